@@ -0,0 +1,235 @@
+#ifndef __TFASYNC_H__
+#define __TFASYNC_H__
+
+/**
+* libtwofish coroutine API
+* ========================================================
+* co_await-able EncryptAsync()/DecryptAsync() on blockEncrypt() and
+* blockDecrypt().  A buffer is ciphered in chunks, each one a separate
+* job on a TwoFishEngine or a task of a user executor, so the awaiting
+* thread (an event loop) never runs crypto.  Header only, and only with
+* C++20 coroutines : the library itself stays C++11, TWOFISH_ASYNC tells
+* whether this is available.
+*
+* (C)2021, Raphael Kim
+**/
+
+#if defined( __has_include ) && ( __cplusplus >= 202002L )
+    #if __has_include( <coroutine> )
+        #define TWOFISH_ASYNC   1
+    #endif
+#endif
+
+#if defined( TWOFISH_ASYNC )
+
+#include <cstdint>
+#include <cstddef>
+#include <coroutine>
+#include <functional>
+
+#include "tfish.h"
+#include "tfengine.h"
+
+#define TWOFISH_ASYNC_CHUNK     ( 64 * 1024 )   /* bytes per job */
+#define TWOFISH_ASYNC_DEPTH     4096            /* jobs in flight, library engine */
+#define TWOFISH_ASYNC_MAXCHUNK  ( 64 * 1024 * 1024 )    /* bits of it fit in int */
+
+/* runs task somewhere, e.g. [&]( auto t ){ asio::post( ioc, t ); } */
+typedef std::function< void( std::function< void() > ) > asyncPost;
+
+typedef struct
+{
+    /* chunks go to this engine and queue ... */
+    TwoFishEngine*  engine;
+    int             queue;
+    /* ... or to this executor when engine is NULL.  With neither,
+       a library engine of a worker per CPU is used.
+    */
+    asyncPost       executor;
+    /* awaiting coroutine resumes there, on the last chunk's thread if
+       empty.
+    */
+    asyncPost       resume;
+    /* bytes per chunk, 0 for TWOFISH_ASYNC_CHUNK, TWOFISH_ASYNC_MAXCHUNK
+       at most */
+    size_t          chunk;
+} asyncOptions;
+
+/* engine of library, for asyncOptions without engine and executor */
+inline TwoFishEngine* TwoFishAsyncEngine( int* queue )
+{
+    static TwoFishEngine engine;
+    static int           q = engine.OpenQueue( TWOFISH_ASYNC_DEPTH );
+
+    *queue = q;
+    return &engine;
+}
+
+/* One EncryptAsync()/DecryptAsync().  co_await gives # of bytes ciphered
+   as int64_t, any buffer size, or error code.  cipher is updated as by one blockEncrypt() call over
+   the whole buffer, and together with key and buffers must stay alive
+   and untouched until then.  Key rules are those of TwoFishEngine.
+*/
+class TwoFishAsyncOp
+{
+    public:
+        TwoFishAsyncOp( const asyncOptions& opt, uint8_t dir, keyInstance* key,
+                        cipherInstance* cipher, const uint8_t* input,
+                        size_t inputLen, uint8_t* outBuffer )
+         : options( opt ), cipher( cipher ), total( inputLen ), done( 0 ),
+           input( input ), outBuffer( outBuffer ), result( 0 )
+        {
+            size_t bytes = ( options.chunk > 0 ) ? options.chunk : TWOFISH_ASYNC_CHUNK;
+
+            if ( bytes > TWOFISH_ASYNC_MAXCHUNK )
+                bytes = TWOFISH_ASYNC_MAXCHUNK;
+
+            chunkLen = ( bytes / ( BLOCK_SIZE/8 ) ) * BLOCK_SIZE;
+            if ( chunkLen == 0 )
+                chunkLen = BLOCK_SIZE;
+
+            if ( ( options.engine == NULL ) && !options.executor )
+                options.engine = TwoFishAsyncEngine( &options.queue );
+
+            job           = engineJob();
+            job.key       = key;
+            job.dir       = dir;
+            job.input     = input;
+            job.outBuffer = outBuffer;
+            job.done      = JobDone;
+            job.user      = this;
+
+            if ( ( cipher == NULL ) || ( key == NULL ) ||
+                 ( ( input == NULL ) && ( inputLen > 0 ) ) ||
+                 ( ( outBuffer == NULL ) && ( inputLen > 0 ) ) )
+                result = BAD_PARAMS;
+            else
+                job.cipher = *cipher;
+        }
+
+        TwoFishAsyncOp( const TwoFishAsyncOp& ) = delete;
+        TwoFishAsyncOp& operator=( const TwoFishAsyncOp& ) = delete;
+
+    public:
+        bool await_ready()
+        {
+            return ( result < 0 ) || ( total == 0 );
+        }
+
+        void await_suspend( std::coroutine_handle<> h )
+        {
+            handle = h;
+            Next();
+        }
+
+        int64_t await_resume()
+        {
+            return ( result < 0 ) ? (int64_t)result : (int64_t)( total / 8 );
+        }
+
+    private:
+        // next chunk, or resume.  Nothing may touch this after resume.
+        void Next()
+        {
+            for (;;)
+            {
+                if ( ( result < 0 ) || ( done == total ) )
+                {
+                    if ( result >= 0 )
+                        *cipher = job.cipher;
+
+                    std::coroutine_handle<> h = handle;
+
+                    if ( options.resume )
+                        options.resume( [h](){ h.resume(); } );
+                    else
+                        h.resume();
+                    return;
+                }
+
+                job.input     = input + done / 8;
+                job.outBuffer = outBuffer + done / 8;
+                job.inputLen  = ( total - done > chunkLen ) ? chunkLen : total - done;
+
+                if ( options.engine == NULL )
+                {
+                    options.executor( [this](){ Cipher(); Chunked(); } );
+                    return;
+                }
+
+                int reti = options.engine->Submit( options.queue, &job );
+
+                if ( reti == TF_SUCCESS )
+                    return;
+
+                if ( reti == ENGINE_BUSY )
+                    Cipher();       /* rings full : this chunk here, rare */
+                else
+                    job.result = reti;
+
+                Account();
+            }
+        }
+
+        void Cipher()
+        {
+            if ( job.dir == DIR_ENCRYPT )
+                job.result = blockEncrypt( &job.cipher, job.key, job.input,
+                                           job.inputLen, job.outBuffer );
+            else
+                job.result = blockDecrypt( &job.cipher, job.key, job.input,
+                                           job.inputLen, job.outBuffer );
+        }
+
+        void Account()
+        {
+            if ( job.result < 0 )
+                result = job.result;
+            else
+                done += job.inputLen;
+        }
+
+        void Chunked()
+        {
+            Account();
+            Next();
+        }
+
+        static void JobDone( engineJob* j )
+        {
+            ( (TwoFishAsyncOp*)j->user )->Chunked();
+        }
+
+    private:
+        asyncOptions            options;
+        cipherInstance*         cipher;
+        size_t                  total;      /* bits */
+        size_t                  done;
+        size_t                  chunkLen;
+        const uint8_t*          input;
+        uint8_t*                outBuffer;
+        int                     result;
+        engineJob               job;
+        std::coroutine_handle<> handle;
+};
+
+/* co_await EncryptAsync( ... ) : inputLen in bits, as blockEncrypt(). */
+inline TwoFishAsyncOp EncryptAsync( keyInstance* key, cipherInstance* cipher,
+                                    const uint8_t* input, size_t inputLen,
+                                    uint8_t* outBuffer,
+                                    const asyncOptions& opt = asyncOptions() )
+{
+    return TwoFishAsyncOp( opt, DIR_ENCRYPT, key, cipher, input, inputLen, outBuffer );
+}
+
+inline TwoFishAsyncOp DecryptAsync( keyInstance* key, cipherInstance* cipher,
+                                    const uint8_t* input, size_t inputLen,
+                                    uint8_t* outBuffer,
+                                    const asyncOptions& opt = asyncOptions() )
+{
+    return TwoFishAsyncOp( opt, DIR_DECRYPT, key, cipher, input, inputLen, outBuffer );
+}
+
+#endif /// of TWOFISH_ASYNC
+
+#endif /// of __TFASYNC_H__
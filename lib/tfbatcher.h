@@ -0,0 +1,60 @@
+#ifndef __TFBATCHER_H__
+#define __TFBATCHER_H__
+
+/**
+* libtwofish micro-batcher
+* ========================================================
+* Collects small jobs, one packet at a time, until maxBlocks blocks are
+* waiting or the oldest has waited maxDelayUs microseconds, then ciphers
+* them together in one lanes call.  Trades latency for throughput, and
+* counts what it costs.
+*
+* (C)2021, Raphael Kim
+**/
+
+#include <cstdint>
+#include <cstddef>
+
+#include "tfish.h"
+#include "tfengine.h"
+
+#define BATCHER_BLOCKS      64      /* default maxBlocks */
+#define BATCHER_DELAY_US    50      /* default maxDelayUs */
+
+typedef struct
+{
+    uint64_t batches;
+    uint64_t jobs;
+    uint64_t blocks;
+    uint64_t fullBatches;   /* flushed by reaching maxBlocks */
+    uint64_t lateBatches;   /* flushed by deadline of oldest job */
+    uint64_t delayUsSum;    /* wait of oldest job, summed over batches */
+    uint64_t delayUsMax;
+} batcherStats;
+
+class TwoFishBatcher
+{
+    public:
+        TwoFishBatcher( size_t maxBlocks = BATCHER_BLOCKS,
+                        uint32_t maxDelayUs = BATCHER_DELAY_US );
+        /* flushes jobs still waiting. */
+        ~TwoFishBatcher();
+
+    public:
+        /* job is given back by its done callback, which must be set.  A
+           job that fills a batch has it ciphered on the calling thread,
+           a deadline flush runs on the batcher thread.  Key rules are
+           those of TwoFishEngine::Submit().
+        */
+        int    Add( engineJob* job );
+        /* cipher waiting jobs now. */
+        void   Flush();
+        size_t GetWaiting();
+        void   GetStats( batcherStats* stats );
+        void   ResetStats();
+
+    public:
+        void* context;
+};
+
+#endif /// of __TFBATCHER_H__
@@ -0,0 +1,93 @@
+#ifndef __TFCHANNEL_H__
+#define __TFCHANNEL_H__
+
+/**
+* libtwofish shared memory channel
+* ========================================================
+* Encrypted frames between two processes of a host, through a ring of
+* slots in POSIX shared memory.  The producer ciphers a frame straight
+* into its slot, or in place after filling the slot itself ; the consumer
+* deciphers in place and reads the frame where it lies.  No copies, the
+* cipher is the cost of a frame.  A side waiting on a full or an empty
+* ring sleeps on a futex, and is woken only if it does.
+*
+* Both sides hold the key, given once to Create() and Attach() : the
+* shared memory has the counter nonce and a key check, never the key.
+* Frame n is CTR from nonce + n x slot blocks, so counters of frames
+* never meet.  No authentication : frames are kept private, not
+* unforged, from those who may map the memory.
+*
+* One producer and one consumer, each a single thread.  Linux only.
+*
+* (C)2021, Raphael Kim
+**/
+
+#include <cstdint>
+#include <cstddef>
+
+#include "tfish.h"
+#include "tfstream.h"
+
+#define CHANNEL_SLOTS       64                  /* default slotCount */
+#define CHANNEL_SLOTSZ      ( 64 * 1024 )       /* default slotSize */
+#define CHANNEL_MAXSLOTSZ   ( 16 * 1024 * 1024 )
+
+#define BAD_CHANNEL         -19     /* not a channel, or its header is damaged */
+#define CHANNEL_TIMEOUT     -20     /* ring still full, or still empty */
+#define CHANNEL_CLOSED      -21     /* other side closed, nothing left */
+
+typedef struct
+{
+    uint64_t frames;        /* sent, or received */
+    uint64_t bytes;
+    uint64_t waits;         /* futex sleeps */
+    uint64_t wakes;         /* futex wakes of the other side */
+} channelStats;
+
+class TwoFishChannel
+{
+    public:
+        TwoFishChannel();
+        ~TwoFishChannel();
+
+    public:
+        /* producer : creates shared memory name, shm_open() style, for a
+           ring of slotCount frames of slotSize bytes at most.  Fails if
+           name is there already.  key is copied.
+        */
+        int  Create( const char* name, keyInstance* key,
+                     size_t slotCount = CHANNEL_SLOTS,
+                     size_t slotSize = CHANNEL_SLOTSZ );
+        /* consumer : maps name.  BAD_KEY_MAT if key isn't the producer's. */
+        int  Attach( const char* name, keyInstance* key );
+        /* tells the other side and unmaps ; the producer removes name. */
+        int  Close();
+
+    public:
+        /* producer : frame ciphered into the next slot.  timeoutMs is how
+           long to wait while the ring is full, -1 for ever.
+        */
+        int  Send( const uint8_t* frame, size_t len, int timeoutMs = -1 );
+        /* producer : next slot's slotSize bytes to fill in plain ... */
+        int  Acquire( uint8_t** buf, int timeoutMs = -1 );
+        /* ... ciphered in place, len bytes of it, and handed over. */
+        int  Publish( size_t len );
+
+    public:
+        /* consumer : next frame deciphered in its slot, valid to Release().
+           timeoutMs is how long to wait while the ring is empty.  Plain
+           frames stay in shared memory until their slot is used again.
+        */
+        int  Receive( const uint8_t** frame, size_t* len, int timeoutMs = -1 );
+        /* consumer : slot of the frame given back to the producer. */
+        int  Release();
+
+    public:
+        size_t GetSlotSize();
+        void   GetStats( channelStats* stats );
+
+    public:
+        void* context;
+};
+
+#endif /// of __TFCHANNEL_H__
@@ -0,0 +1,67 @@
+#ifndef __TFGCM_H__
+#define __TFGCM_H__
+
+/**
+* libtwofish GCM
+* ========================================================
+* Galois/Counter Mode (NIST SP 800-38D) on Twofish : CTR for secrecy,
+* GHASH over additional data and cipher text for a 128 bit tag.  One
+* message at a time per object, streamed through Update() or in one
+* Encrypt()/Decrypt() call.
+*
+* (C)2021, Raphael Kim
+**/
+
+#include <cstdint>
+#include <cstddef>
+
+#include "tfish.h"
+
+#define GCM_IV_SIZE         12      /* recommended IV bytes */
+#define GCM_TAG_SIZE        16
+#define GCM_MIN_TAG_SIZE    12      /* shorter tags are too easy to forge */
+
+#define BAD_GCM_TAG         -16     /* tag doesn't match, message forged */
+
+class TwoFishGCM
+{
+    public:
+        /* key stays the caller's, read only from here on : expanded and
+           turned to DIR_ENCRYPT now.  Objects may share a key.
+        */
+        TwoFishGCM( keyInstance* key );
+        ~TwoFishGCM();
+
+    public:
+        /* new message.  Any ivLen, GCM_IV_SIZE takes no hashing.  An IV
+           must never be used twice with a key.
+        */
+        int  Start( const uint8_t* iv, size_t ivLen,
+                    const uint8_t* aad = NULL, size_t aadLen = 0 );
+        /* dir DIR_ENCRYPT or DIR_DECRYPT, out may be in.  Every call but
+           the last of a message takes whole blocks.
+        */
+        int  Update( uint8_t dir, const uint8_t* in, size_t len, uint8_t* out );
+        /* tag of message, GCM_TAG_SIZE bytes. */
+        int  Finish( uint8_t* tag );
+        /* TF_SUCCESS or BAD_GCM_TAG, first tagLen bytes compared.
+           tagLen GCM_MIN_TAG_SIZE to GCM_TAG_SIZE, else BAD_PARAMS.
+        */
+        int  Verify( const uint8_t* tag, size_t tagLen = GCM_TAG_SIZE );
+
+    public:
+        /* whole message at once. */
+        int  Encrypt( const uint8_t* iv, size_t ivLen,
+                      const uint8_t* aad, size_t aadLen,
+                      const uint8_t* in, size_t len, uint8_t* out, uint8_t* tag );
+        /* out is wiped when tag doesn't match. */
+        int  Decrypt( const uint8_t* iv, size_t ivLen,
+                      const uint8_t* aad, size_t aadLen,
+                      const uint8_t* in, size_t len, uint8_t* out,
+                      const uint8_t* tag, size_t tagLen = GCM_TAG_SIZE );
+
+    public:
+        void* context;
+};
+
+#endif /// of __TFGCM_H__
@@ -0,0 +1,91 @@
+#ifndef __TFJOURNAL_H__
+#define __TFJOURNAL_H__
+
+/**
+* libtwofish append-only journal
+* ========================================================
+* Encrypted record log : records are queued, and a commit encrypts all
+* of them in one CTR pass and one write, with no padding.  The journal
+* is one CTR stream after its header, a record's counter is its offset
+* in it, so any record decrypts on its own.  Offsets of records go to
+* an index file next to the journal ( path + ".idx" ) for replay of any
+* range of records.
+*
+* Records are framed as 4 length bytes and data, both encrypted.  The
+* index shows where records start, their contents stay secret.  No
+* authentication : the journal keeps records private, not unforged.
+*
+* (C)2021, Raphael Kim
+**/
+
+#include <cstdint>
+#include <cstddef>
+
+#include "tfish.h"
+#include "tfstream.h"
+
+#define JOURNAL_HDRSZ       32
+#define JOURNAL_GROUP       ( 256 * 1024 )          /* default groupBytes */
+#define JOURNAL_MAXGROUP    ( 64 * 1024 * 1024 )
+#define JOURNAL_MAXREC      ( 16 * 1024 * 1024 )    /* record data bytes */
+
+/* flags */
+#define JOURNAL_SYNC        0x01    /* fdatasync() on every commit */
+
+#define BAD_JOURNAL         -18     /* not a journal, or its header is damaged */
+
+/* replay : a record in order, return false to stop. */
+typedef bool (*journalRecord)( void* user, uint64_t recNo,
+                               const uint8_t* data, size_t len );
+
+typedef struct
+{
+    uint64_t records;       /* appended */
+    uint64_t bytes;         /* written, framing included */
+    uint64_t commits;       /* CTR passes and writes */
+    uint64_t recovered;     /* records missing in the index, found by Open() */
+    uint64_t dropped;       /* bytes of a torn last record, cut by Open() */
+} journalStats;
+
+class TwoFishJournal
+{
+    public:
+        /* queued records are committed when they reach groupBytes. */
+        TwoFishJournal( size_t groupBytes = JOURNAL_GROUP, uint32_t flags = 0 );
+        ~TwoFishJournal();
+
+    public:
+        /* creates path, or opens it to append : a record cut by a crash
+           is removed, and the journal written again under a new IV, via
+           path + ".tmp".  Records missing from the index are found again.
+           key stays the caller's, expanded and turned to DIR_ENCRYPT.
+        */
+        int  Open( const char* path, keyInstance* key );
+        /* commits what's queued, and closes. */
+        int  Close();
+
+    public:
+        /* record queued, recNo set to its number if not NULL.  Thread
+           safe, records of many threads go in one commit.
+        */
+        int  Append( const uint8_t* data, size_t len, uint64_t* recNo = NULL );
+        /* queued records encrypted and written, durable with JOURNAL_SYNC.
+           Records queued by others meanwhile go along.  After a commit
+           failed, Append() and Commit() fail until Open() again.
+        */
+        int  Commit();
+        /* committed records. */
+        uint64_t GetRecordCount();
+        /* committed records first .. first + cnt - 1, fewer at the end,
+           decrypted a batch at a time and handed to fn in order.  fn is
+           called without the journal lock, so it may Append().
+           BAD_JOURNAL if a record's length doesn't fill its place.
+        */
+        int  Replay( uint64_t first, uint64_t cnt, journalRecord fn, void* user );
+        void GetStats( journalStats* stats );
+
+    public:
+        void* context;
+};
+
+#endif /// of __TFJOURNAL_H__
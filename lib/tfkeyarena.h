@@ -0,0 +1,47 @@
+#ifndef __TFKEYARENA_H__
+#define __TFKEYARENA_H__
+
+/**
+* libtwofish key arena
+* ========================================================
+* Slab allocator of keyInstances.  Keys sit packed in big slabs with
+* 64-byte aligned S-box tables, instead of being spread over the heap.
+* Slabs may be backed by 2 MB huge pages and locked in RAM.
+*
+* (C)2021, Raphael Kim
+**/
+
+#include <cstdint>
+#include <cstddef>
+
+#include "tfish.h"
+
+/* flags of TwoFishKeyArena */
+#define KEYARENA_HUGEPAGE   0x01    /* back slabs by 2 MB pages when we can */
+#define KEYARENA_MLOCK      0x02    /* keep slabs out of swap */
+
+class TwoFishKeyArena
+{
+    public:
+        /* slabsz is bytes per slab, taken from the system as keys run out,
+           and rounded up to hold at least one key (and to 2 MB with
+           KEYARENA_HUGEPAGE).
+        */
+        TwoFishKeyArena( size_t slabsz = 2 * 1024 * 1024, unsigned flags = 0 );
+        ~TwoFishKeyArena();
+
+    public:
+        /* zeroed key, or NULL when out of memory.  O(1) */
+        keyInstance* Alloc();
+        /* wipes key, it must be from Alloc() of this arena.  O(1) */
+        void         Free( keyInstance* key );
+        size_t       GetCount();
+        size_t       GetCapacity();
+        /* flags that took effect, some may be refused by the system */
+        unsigned     GetFlags();
+
+    public:
+        void* context;
+};
+
+#endif /// of __TFKEYARENA_H__
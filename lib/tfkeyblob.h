@@ -0,0 +1,89 @@
+#ifndef __TFKEYBLOB_H__
+#define __TFKEYBLOB_H__
+
+/**
+* libtwofish key blob
+* ========================================================
+* Binary image of fully expanded key schedules (subkeys and sBox8x32),
+* saved once and used in place from an mmap()ed file or a shared memory
+* segment.  A restart, or another process, skips makeKey() entirely.
+*
+* (C)2021, Raphael Kim
+**/
+
+#include <cstdint>
+#include <cstddef>
+
+#include "tfish.h"
+
+#define KEYBLOB_MAGIC       0x424B4654  /* 'TFKB' */
+#define KEYBLOB_VERSION     1
+#define KEYBLOB_HEADSZ      64          /* keys follow at this offset */
+
+#define BAD_KEY_BLOB        -11 /* not a blob of this build, or damaged */
+#define BAD_KEY_FILE        -12 /* blob file can't be read or written */
+
+/* First KEYBLOB_HEADSZ bytes of a blob.  Offsets only, no pointers, so a
+   blob works at any address.  keySize, keyOffset and byteOrder tie it to
+   the keyInstance layout of the build that wrote it.
+*/
+typedef struct
+{
+    uint32_t magic;         /* KEYBLOB_MAGIC */
+    uint32_t version;       /* KEYBLOB_VERSION */
+    uint32_t byteOrder;     /* 0x01020304 as written */
+    uint32_t keySize;       /* sizeof(keyInstance) */
+    uint32_t keyOffset;     /* of keyInstance in its slot */
+    uint32_t slotSize;      /* bytes per key, multiple of 64 */
+    uint64_t keyCount;
+    uint64_t dataSum;       /* checksum of all slots */
+    uint8_t  reserved[16];  /* zero */
+    uint64_t headSum;       /* checksum of bytes above */
+} keyBlobHeader;
+
+class TwoFishKeyBlob
+{
+    public:
+        TwoFishKeyBlob();
+        ~TwoFishKeyBlob();
+
+    public:
+        /* bytes of a blob of keyCnt keys. */
+        static size_t Size( size_t keyCnt );
+        /* build a blob of keys in mem, which has Size( keyCnt ) bytes.
+           Keys must be expanded (not lazy).  TF_SUCCESS or error code.
+        */
+        static int    Write( void* mem, size_t memsz,
+                             const keyInstance* const* keys, size_t keyCnt );
+        /* Write() to a file, through a temporary file made mode 0600,
+           synced to disk, then renamed.
+        */
+        static int    Save( const char* path,
+                            const keyInstance* const* keys, size_t keyCnt );
+
+    public:
+        /* map a blob file copy-on-write : pages are shared by every
+           process that maps it until a key is written to.
+        */
+        int           Open( const char* path, bool verify = true );
+        /* use a blob in place, e.g. a shared memory segment, not owned.
+           verify false skips checksum of keys, header is always checked.
+        */
+        int           Attach( void* mem, size_t memsz, bool verify = true );
+        void          Close();
+        size_t        GetCount();
+        /* key of blob in place, shared with every user of the blob : read
+           only.  Use it in its own direction ( key->direction ), which
+           leaves it as it is, or in either one through the lanes calls.
+           Never pass it to a call of the other direction, that reverses
+           subkeys in place under everyone else.
+        */
+        const keyInstance* GetKey( size_t index );
+        /* key of blob copied to key, the caller's to use either way. */
+        int           CopyKey( size_t index, keyInstance* key );
+
+    public:
+        void* context;
+};
+
+#endif /// of __TFKEYBLOB_H__
@@ -0,0 +1,66 @@
+#ifndef __TFMAPFILE_H__
+#define __TFMAPFILE_H__
+
+/**
+* libtwofish in-place file cipher
+* ========================================================
+* Maps a file and ciphers it where it lies, in CTR or XTS, with chunks
+* spread over the library thread pool.  No copy of the file is made :
+* the page cache reads ahead (madvise() hints) and writes back, flushed
+* a window at a time.  Both modes keep the length of the file, so a file
+* is turned into its cipher text and back in place.
+*
+* (C)2021, Raphael Kim
+**/
+
+#include <cstdint>
+#include <cstddef>
+
+#include "tfish.h"
+#include "tfstream.h"
+
+#define MAPFILE_CHUNK       ( 1024 * 1024 )         /* default chunkSize */
+#define MAPFILE_WINDOW      ( 64 * 1024 * 1024 )    /* default syncBytes */
+#define MAPFILE_UNIT        4096                    /* default XTS data unit */
+
+typedef struct
+{
+    uint64_t bytes;
+    uint64_t chunks;
+    uint64_t windows;   /* msync() batches */
+} mapFileStats;
+
+class TwoFishMapFile
+{
+    public:
+        /* threadCnt 0 : a thread per CPU.  chunkSize : bytes per job,
+           rounded to blocks (to data units for XTS).  syncBytes : bytes
+           ciphered between msync() calls, the read-ahead window too.
+        */
+        TwoFishMapFile( size_t threadCnt = 0, size_t chunkSize = MAPFILE_CHUNK,
+                        size_t syncBytes = MAPFILE_WINDOW );
+        ~TwoFishMapFile();
+
+    public:
+        /* CTR over whole file, both ways.  cipher from cipherInit() with
+           MODE_CTR, updated as one blockEncrypt() call would.  key is
+           expanded and turned to DIR_ENCRYPT.  TF_SUCCESS or error code.
+        */
+        int  CryptCTR( const char* path, keyInstance* key, cipherInstance* cipher );
+        /* XTS (IEEE P1619, with ciphertext stealing) over whole file :
+           data unit n of unitSize bytes has tweak firstUnit + n.  dataKey
+           is turned to dir, tweakKey (another key) to DIR_ENCRYPT.  A
+           last unit of less than a block is BAD_INPUT_LEN, the file is
+           left untouched then.  TF_SUCCESS or error code.
+        */
+        int  CryptXTS( const char* path, uint8_t dir, keyInstance* dataKey,
+                       keyInstance* tweakKey, size_t unitSize = MAPFILE_UNIT,
+                       uint64_t firstUnit = 0 );
+        /* of last call. */
+        void GetStats( mapFileStats* stats );
+
+    public:
+        void* context;
+};
+
+#endif /// of __TFMAPFILE_H__
@@ -0,0 +1,83 @@
+#ifndef __LIBTWOFISH_H__
+#define __LIBTWOFISH_H__
+
+/**
+* libblowfish
+* ========================================================
+* Based on Bruce Schneier's TwoFish..
+* Reference on https://www.schneier.com/academic/twofish/
+* 
+* (C)2021, Raphael Kim
+**/
+
+#include <cstdint>
+#include <cstddef>
+
+/* bytes of inline state of a TwoFish object, checked at build time */
+#define TWOFISH_CONTEXT_SIZE    4864
+
+/* modes of SetMode(), CBC is default */
+#define TWOFISH_MODE_ECB        1
+#define TWOFISH_MODE_CBC        2
+#define TWOFISH_MODE_CTR        4
+
+/* default size from which SetParallel() objects use threads */
+#define TWOFISH_PARALLEL_MINSZ  ( 256 * 1024 )
+
+class TwoFishKeyCache;
+class TwoFishKeyArena;
+class TwoFishKeyHandle;
+
+class TwoFish
+{
+    public:
+        /* iv and ivlen should be skipped for ECB encoding.
+        */
+        TwoFish( uint8_t* key = NULL, size_t keylen = 0, const char* iv = NULL, size_t ivlen = 0 );
+        /* moved from object is left as if newly constructed. */
+        TwoFish( TwoFish&& other );
+        ~TwoFish();
+
+        TwoFish& operator=( TwoFish&& other );
+        /* a copy would share an arena key, move instead. */
+        TwoFish( const TwoFish& ) = delete;
+        TwoFish& operator=( const TwoFish& ) = delete;
+        
+    public:
+        bool   Initialize( uint8_t* key = NULL, size_t keylen = 0, const char* iv = NULL, size_t ivlen = 0 );
+        size_t GetEncodeLength( size_t srclen );
+        size_t GetBlockSize( bool isbit = true );
+        size_t Encode( uint8_t* pInput, uint8_t*& pOutput, size_t inpsz );
+        size_t Decode( uint8_t* pInput, uint8_t*& pOutput, size_t inpsz );
+        /* Encode/Decode take key schedules from cache when set,
+           cache is not owned and may be shared by many objects.
+        */
+        void   SetKeyCache( TwoFishKeyCache* cache = NULL );
+        /* Key schedule goes to a key of arena, NULL takes it back in the
+           object.  Arena is not owned and must outlive the object.
+        */
+        bool   SetKeyArena( TwoFishKeyArena* arena = NULL );
+        /* Encode/Decode use the current key of handle instead of the
+           key of Initialize(), and fail while handle has no key.  Keys
+           rotate under running calls, each call keeps the key it began
+           with.  Handle is not owned.
+        */
+        void   SetKeyHandle( TwoFishKeyHandle* handle = NULL );
+        /* TWOFISH_MODE_*, takes effect from next Encode/Decode.  CTR needs
+           an iv of 16 bytes, the initial counter, or Encode/Decode fail.
+        */
+        bool   SetMode( uint8_t mode );
+        /* Encode/Decode of minsz bytes or more run on threadcnt threads
+           of a pool shared by all objects, 0 means a thread per CPU and
+           1 turns it off (default).  ECB, CTR and CBC decode split, CBC
+           encode always runs serially.  Output is the same either way.
+        */
+        void   SetParallel( size_t threadcnt = 0, size_t minsz = TWOFISH_PARALLEL_MINSZ );
+        
+    public:
+        /* all state is here, no heap is used by the object itself. */
+        alignas( uint64_t ) uint8_t context[ TWOFISH_CONTEXT_SIZE ];
+};
+
+#endif // of __LIBTWOFISH_H__
+
@@ -6,8 +6,16 @@
 #include <cstring>
 #include <cstdint>
 
+#include <atomic>
+#include <thread>
+#include <vector>
+
 #include "twofish.h"
 #include "tfish.h"
+#include "tfkeycache.h"
+#include "tfkeyarena.h"
+#include "tfkeyhandle.h"
+#include "tfthreadpool.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -17,17 +25,36 @@ typedef struct
     keyInstance      keyinst;
     cipherInstance   cipherinst;
     uint8_t          enc_mode;
-    uint8_t*         usr_key;
+    uint8_t          usr_mode;  /* from SetMode(), 0 for default CBC */
+    uint8_t          usr_key[ MAX_KEY_SIZE + 1 ];
     size_t           usr_keylen;
-    char*            usr_iv;
+    char             usr_iv[ MAX_IV_SIZE + 1 ];
     size_t           usr_ivlen;
-    char*            usr_keyref;
-    char*            usr_ivref;
+    char             usr_keyref[ MAX_KEY_SIZE * 2 + 1 ];
+    char             usr_ivref[ MAX_IV_SIZE * 2 + 1 ];
+    TwoFishKeyCache* keycache;
+    TwoFishKeyArena* keyarena;
+    keyInstance*     keyptr;    /* key of keyarena, NULL for keyinst */
+    TwoFishKeyHandle* keyhandle;
+    size_t           par_threads;   /* 0 : serial */
+    size_t           par_minsz;
 }libTwoFishContext;
 
 #define MAX_KEY_BLEN    256
 #define L2FCTX          libTwoFishContext
 #define TOCTX(_x_)      L2FCTX* _x_ = (L2FCTX*)context
+#define CTXKEY(_x_)     ( (_x_)->keyptr != NULL ? (_x_)->keyptr : &(_x_)->keyinst )
+#define CTXIVREF(_x_)   ( (_x_)->usr_ivref[0] != 0 ? (_x_)->usr_ivref : NULL )
+
+static_assert( sizeof( L2FCTX ) <= TWOFISH_CONTEXT_SIZE,
+               "TWOFISH_CONTEXT_SIZE is too small for libTwoFishContext" );
+static_assert( alignof( L2FCTX ) <= alignof( uint64_t ),
+               "TwoFish::context is not aligned enough for libTwoFishContext" );
+static_assert( ( TWOFISH_MODE_ECB == MODE_ECB ) && ( TWOFISH_MODE_CBC == MODE_CBC ) &&
+               ( TWOFISH_MODE_CTR == MODE_CTR ), "TWOFISH_MODE_* differ from MODE_*" );
+
+// bytes per job of parallel Encode/Decode, fits in L2 with its output.
+#define PAR_CHUNK       ( 64 * 1024 )
 
 // default key references -
 static char hexTab[]   = "0123456789ABCDEF";
@@ -37,24 +64,22 @@ static char hexString[]= "0123456789ABCDEFFEDCBA987654321000112233445566778899"
 
 ////////////////////////////////////////////////////////////////////////////////
 
-void str2hex( const uint8_t* p, char*& o )
+void str2hex( const uint8_t* p, char* o, size_t osz )
 {
-    if ( p == NULL )
+    if ( ( p == NULL ) || ( o == NULL ) || ( osz == 0 ) )
         return;
     
     size_t l = strlen( (const char*)p );
 
-    o = new char[ l * 2 + 1 ];
-    
-    if ( o != NULL )
-    {
-        memset( o, 0, l * 2 + 1 );
+    if ( l * 2 + 1 > osz )
+        l = ( osz - 1 ) / 2;
+
+    memset( o, 0, osz );
         
-        for( size_t cnt=0; cnt<l; cnt++ )
-        {
-            snprintf( &o[cnt*2], 3, "%02X", (uint8_t)p[cnt] );
-        }                
-    }
+    for( size_t cnt=0; cnt<l; cnt++ )
+    {
+        snprintf( &o[cnt*2], 3, "%02X", (uint8_t)p[cnt] );
+    }                
 }
 
 void key2hex( const uint8_t* p, size_t l, keyInstance* ki )
@@ -62,28 +87,22 @@ void key2hex( const uint8_t* p, size_t l, keyInstance* ki )
     if ( ( p == NULL ) || ( l == 0 ) || ( ki == NULL ) )
         return;
         
-    //char* sstr = new char[ MAX_KEY_SIZE + 1 ];
-    char* sstr = new char[ l*2 + 1 ];
-    
-    if ( sstr != NULL )
-    {
-        //memset( sstr, 0, MAX_KEY_SIZE + 1 );
-        memset( sstr, 0, l*2 + 1 );
-        
-        for( size_t cnt=0; cnt<l; cnt++ )
-        {
-            snprintf( &sstr[cnt*2], 3, "%02X", (uint8_t) p[cnt] );
-        }
-                
-        for( size_t cnt=0; cnt<(MAX_KEY_BITS/32); cnt++ )
-        {
-            char tmps[16] = {0};
-            snprintf( tmps, 16, "0xFF000000" );
-            memcpy( &tmps[2], &sstr[(cnt*8)%8], 8 );
-            ki->key32[cnt] = (uint32_t)strtoul( tmps, NULL, 0 );
-        }
+    if ( l > MAX_KEY_SIZE )
+        l = MAX_KEY_SIZE;
+
+    char sstr[ MAX_KEY_SIZE*2 + 1 ] = {0};
         
-        delete[] sstr;
+    for( size_t cnt=0; cnt<l; cnt++ )
+    {
+        snprintf( &sstr[cnt*2], 3, "%02X", (uint8_t) p[cnt] );
+    }
+            
+    for( size_t cnt=0; cnt<(MAX_KEY_BITS/32); cnt++ )
+    {
+        char tmps[16] = {0};
+        snprintf( tmps, 16, "0xFF000000" );
+        memcpy( &tmps[2], &sstr[(cnt*8)%8], 8 );
+        ki->key32[cnt] = (uint32_t)strtoul( tmps, NULL, 0 );
     }
 }
 
@@ -92,176 +111,255 @@ void iv2hex( const char* p, size_t l, cipherInstance* ci )
     if ( ( p == NULL ) || ( l == 0 ) )
         return;
         
-    //char* sstr = new char[ MAX_IV_SIZE + 1 ];
-    char* sstr = new char[ l*2 + 1 ];
+    if ( l > MAX_IV_SIZE )
+        l = MAX_IV_SIZE;
+
+    char sstr[ MAX_IV_SIZE*2 + 1 ] = {0};
+        
+    for( size_t cnt=0; cnt<l; cnt++ )
+    {
+        snprintf( &sstr[cnt*2], 3, "%02X", (uint8_t) p[cnt] );
+    }
     
-    if ( sstr != NULL )
+    for( size_t cnt=0; cnt<BLOCK_SIZE/32; cnt++ )
     {
-        //memset( sstr, 0, MAX_IV_SIZE + 1 );
-        memset( sstr, 0, l*2 + 1 );
-        
-        for( size_t cnt=0; cnt<l; cnt++ )
-        {
-            snprintf( &sstr[cnt*2], 3, "%02X", (uint8_t) p[cnt] );
-        }
-        
-        for( size_t cnt=0; cnt<BLOCK_SIZE/32; cnt++ )
+        char tmps[16] = {0};
+        snprintf( tmps, 16, "0xFF000000" );
+        memcpy( &tmps[2], &sstr[(cnt*8)%8], 8 );
+        ci->iv32[cnt] = (uint32_t)strtoul( tmps, NULL, 0 );
+    }
+}
+
+
+// holds a key of handle for one Encode/Decode.
+struct handleGuard
+{
+    TwoFishKeyHandle* handle;
+    keyReader         rd;
+    bool              held;
+
+    handleGuard( TwoFishKeyHandle* h ) : handle( h ), held( false ) {}
+    ~handleGuard()
+    {
+        if ( held == true )
+            handle->Release( &rd );
+    }
+
+    bool Acquire()
+    {
+        held = ( handle->Acquire( &rd ) == TF_SUCCESS );
+        return held;
+    }
+};
+
+// one parallel Encode/Decode, shared by its jobs.
+typedef struct
+{
+    keyInstance*          key;
+    const cipherInstance* cipher;
+    const uint8_t*        input;
+    uint8_t*              output;
+    size_t                size;
+    uint8_t               dir;
+    std::vector< uint32_t > ivs;    // CBC decode : IV of each chunk
+    std::atomic< bool >   failed;
+}parallelJob;
+
+static void parallelChunk( void* arg, size_t job )
+{
+    parallelJob*   pj  = (parallelJob*)arg;
+    size_t         ofs = job * PAR_CHUNK;
+    size_t         len = pj->size - ofs;
+    cipherInstance ci  = *pj->cipher;
+
+    if ( len > PAR_CHUNK )
+        len = PAR_CHUNK;
+
+    if ( ci.mode == MODE_CTR )
+        CounterAdd( &ci, ofs / ( BLOCK_SIZE/8 ) );
+    else
+    if ( ( ci.mode == MODE_CBC ) && ( job > 0 ) )
+        memcpy( ci.iv32, &pj->ivs[ job * ( BLOCK_SIZE/32 ) ], BLOCK_SIZE/8 );
+
+    int reti;
+    if ( pj->dir == DIR_ENCRYPT )
+        reti = blockEncrypt( &ci, pj->key, pj->input + ofs, len * 8, pj->output + ofs );
+    else
+        reti = blockDecrypt( &ci, pj->key, pj->input + ofs, len * 8, pj->output + ofs );
+
+    if ( reti != (int)( len * 8 ) )
+        pj->failed = true;
+}
+
+// returns bytes done, or -1 when this call is for the serial path.
+static int parallelCipher( L2FCTX* tfctx, keyInstance* key, const uint8_t* input,
+                           uint8_t* output, size_t size, uint8_t dir )
+{
+    uint8_t mode = tfctx->cipherinst.mode;
+
+    // a short IV leaves cipher uninitialized (mode 0), serial path only.
+    if ( ( mode != MODE_ECB ) && ( mode != MODE_CBC ) && ( mode != MODE_CTR ) )
+        return -1;
+
+    if ( ( tfctx->par_threads < 2 ) || ( size < tfctx->par_minsz ) ||
+         ( size > (size_t)INT32_MAX / 8 ) || ( size <= PAR_CHUNK ) )
+        return -1;
+
+    // CBC encode chains every block, can't be split.
+    if ( ( mode == MODE_CBC ) && ( dir == DIR_ENCRYPT ) )
+        return -1;
+
+    parallelJob pj;
+    size_t      jobcnt = ( size + PAR_CHUNK - 1 ) / PAR_CHUNK;
+
+    pj.key    = key;
+    pj.cipher = &tfctx->cipherinst;
+    pj.input  = input;
+    pj.output = output;
+    pj.size   = size;
+    pj.dir    = dir;
+    pj.failed = false;
+
+    // jobs share the key : its S-boxes and subkey order must be final.
+    expandKey( pj.key );
+    if ( ( mode != MODE_CTR ) && ( pj.key->direction != dir ) )
+        ReverseRoundSubkeys( pj.key, dir );
+
+    // chunk IVs are ciphertext, taken before any job may overwrite it.
+    if ( mode == MODE_CBC )
+    {
+        pj.ivs.resize( jobcnt * ( BLOCK_SIZE/32 ) );
+        for ( size_t cnt=1; cnt<jobcnt; cnt++ )
         {
-            char tmps[16] = {0};
-            snprintf( tmps, 16, "0xFF000000" );
-            memcpy( &tmps[2], &sstr[(cnt*8)%8], 8 );
-            ci->iv32[cnt] = (uint32_t)strtoul( tmps, NULL, 0 );
+            const uint32_t* prev = (const uint32_t*)( input + cnt * PAR_CHUNK - BLOCK_SIZE/8 );
+            for ( size_t n=0; n<BLOCK_SIZE/32; n++ )
+                pj.ivs[ cnt * ( BLOCK_SIZE/32 ) + n ] = Bswap( prev[n] );
         }
-        
-        delete[] sstr;
     }
-}
 
+    TwoFishThreadPool::Shared().Run( jobcnt, tfctx->par_threads, parallelChunk, &pj );
+
+    if ( pj.failed == true )
+        return 0;
+
+    return (int)size;
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 
 TwoFish::TwoFish( uint8_t* key, size_t keylen, const char* iv, size_t ivlen )
- : context( NULL )
 {
     srand((unsigned) time(NULL));
     
     // it must be rebuild MDS at once.
     BuildMDS();
 
-    L2FCTX* tfcontext = new L2FCTX;
-    if ( tfcontext != NULL )
-    {
-        memset( tfcontext, 0, sizeof( L2FCTX ) );
-        context = (void*)tfcontext;
+    memset( context, 0, sizeof( context ) );
 #ifdef DEBUG_LIBTWOFISH
-        bool retb = Initialize( key, keylen, iv, ivlen );
-        if ( retb == false )
-        {
-            printf( "(warning : Initialize() failure.\n" );
-        }
+    bool retb = Initialize( key, keylen, iv, ivlen );
+    if ( retb == false )
+    {
+        printf( "(warning : Initialize() failure.\n" );
+    }
 #else
-        Initialize( key, keylen, iv, ivlen );
+    Initialize( key, keylen, iv, ivlen );
 #endif
-    }
+}
+
+TwoFish::TwoFish( TwoFish&& other )
+{
+    // whole state is inline, so moving is a copy plus a fresh source.
+    memcpy( context, other.context, sizeof( context ) );
+    memset( other.context, 0, sizeof( other.context ) );
+    other.Initialize();
 }
 
 TwoFish::~TwoFish()
 {
     TOCTX( tfctx );
     
-    if ( tfctx != NULL )
+    if ( tfctx->keyarena != NULL )
+        tfctx->keyarena->Free( tfctx->keyptr );
+
+    // don't leave keys behind.
+    memset( context, 0, sizeof( context ) );
+}
+
+TwoFish& TwoFish::operator=( TwoFish&& other )
+{
+    if ( this != &other )
     {
-        context = NULL;
-        
-        if ( tfctx->usr_key != NULL )
-            delete[] tfctx->usr_key;
-        
-        if ( tfctx->usr_iv != NULL )
-            delete[] tfctx->usr_iv;
-        
-        if ( tfctx->usr_keyref != NULL )
-            delete[] tfctx->usr_keyref;
-        
-        if ( tfctx->usr_ivref != NULL )
-            delete[] tfctx->usr_ivref;
-        
-        delete tfctx;
+        TOCTX( tfctx );
+
+        if ( tfctx->keyarena != NULL )
+            tfctx->keyarena->Free( tfctx->keyptr );
+
+        memcpy( context, other.context, sizeof( context ) );
+        memset( other.context, 0, sizeof( other.context ) );
+        other.Initialize();
     }
+
+    return *this;
 }
 
 bool TwoFish::Initialize( uint8_t* key, size_t keylen, const char* iv, size_t ivlen )
 {
     TOCTX( tfctx );
     
-    if ( tfctx != NULL )
-    {       
-        /// let initailize cipher.
-        int rinit = TF_SUCCESS;
+    /// let initailize cipher.
+    int rinit = TF_SUCCESS;
 
-        // allocate memory for string, zero end for +1.
-        if ( tfctx->usr_key == NULL )
-        {
-            tfctx->usr_key = new uint8_t[ MAX_KEY_SIZE + 1 ];
-        }
+    memset( tfctx->usr_key, 0, MAX_KEY_SIZE + 1 );
+    tfctx->usr_keylen = 0;
+    
+    if ( key != NULL )
+    {
+        // key size cannot be over than (MAX_KEY_BITS/8). 
+        if ( keylen > MAX_KEY_SIZE )
+            keylen = MAX_KEY_SIZE;
         
-        if ( tfctx->usr_iv == NULL )
-        {
-            tfctx->usr_iv  = new char[ MAX_IV_SIZE + 1 ];
-        }
+        // this key is plain text/data.
+        memcpy( tfctx->usr_key, key, keylen );
         
-        if ( tfctx->usr_key != NULL )
-        {
-            memset( tfctx->usr_key, 0, MAX_KEY_SIZE + 1 );
-            tfctx->usr_keylen = 0;
-            
-            if ( key != NULL )
-            {
-                // key size cannot be over than (MAX_KEY_BITS/8). 
-                if ( keylen > MAX_KEY_SIZE )
-                    keylen = MAX_KEY_SIZE;
-                
-                // this key is plain text/data.
-                memcpy( tfctx->usr_key, key, keylen );
-                
-                // key size each 128, or 192, or 256 bits.
-                if ( keylen < MIN_KEY_BITS/8 )
-                    tfctx->usr_keylen = MIN_KEY_BITS/8;
-                else
-                    tfctx->usr_keylen = MAX_KEY_BITS/8;
-            }
-            
-            if ( tfctx->usr_keyref != NULL )
-            {
-                delete[] tfctx->usr_keyref;
-                tfctx->usr_keyref = NULL;
-            }
-            
-            str2hex( tfctx->usr_key, tfctx->usr_keyref );
-            
-            tfctx->enc_mode = MODE_ECB;
-        }
+        // key size each 128, or 192, or 256 bits.
+        if ( keylen < MIN_KEY_BITS/8 )
+            tfctx->usr_keylen = MIN_KEY_BITS/8;
+        else
+            tfctx->usr_keylen = MAX_KEY_BITS/8;
+    }
+    
+    str2hex( tfctx->usr_key, tfctx->usr_keyref, sizeof( tfctx->usr_keyref ) );
+    
+    // then CBC 
+    memset( tfctx->usr_iv, 0, MAX_IV_SIZE + 1 );
+    tfctx->usr_ivlen = 0;
+
+    if ( ( iv != NULL ) && ( ivlen > 0 ) )
+    {
+        if ( ivlen > MAX_IV_SIZE )
+            ivlen = MAX_IV_SIZE;
+
+        memcpy( tfctx->usr_iv, iv, ivlen );
+        tfctx->usr_ivlen = ivlen;
+        // it need to debug.
+        iv2hex( tfctx->usr_iv, tfctx->usr_ivlen, &tfctx->cipherinst );
         
-        // then CBC 
-        if ( tfctx->usr_iv != NULL )
-        {
-            memset( tfctx->usr_iv, 0, MAX_IV_SIZE + 1 );
-            tfctx->usr_ivlen = 0;
-
-            if ( ( iv != NULL ) && ( ivlen > 0 ) )
-            {
-                if ( ivlen > MAX_IV_SIZE )
-                    ivlen = MAX_IV_SIZE;
-
-                memcpy( tfctx->usr_iv, iv, ivlen );
-                tfctx->usr_ivlen = ivlen;
-                // it need to debug.
-                iv2hex( tfctx->usr_iv, tfctx->usr_ivlen, &tfctx->cipherinst );
-                
-                if ( tfctx->usr_ivref != NULL )
-                {
-                    delete[] tfctx->usr_ivref;
-                    tfctx->usr_ivref = NULL;
-                }
-                
-                str2hex( (const uint8_t*)tfctx->usr_iv, tfctx->usr_ivref );
-            }
-            
-            tfctx->enc_mode = MODE_CBC;
-        }
+        str2hex( (const uint8_t*)tfctx->usr_iv, tfctx->usr_ivref, 
+                 sizeof( tfctx->usr_ivref ) );
+    }
+    
+    tfctx->enc_mode = ( tfctx->usr_mode != 0 ) ? tfctx->usr_mode : MODE_CBC;
+    
+    rinit = cipherInit( &tfctx->cipherinst, tfctx->enc_mode, CTXIVREF( tfctx ) );
         
-        rinit = cipherInit( &tfctx->cipherinst, tfctx->enc_mode, tfctx->usr_ivref );
-            
 #ifdef DEBUG_LIBTWOFISH        
-        if ( rinit != TF_SUCCESS )
-        {
-            printf( "cipherInit failure by : %d\n", rinit );
-            return false;
-        }
-#endif /// of DEBUG_LIBTWOFISH        
-        return true;
+    if ( rinit != TF_SUCCESS )
+    {
+        printf( "cipherInit failure by : %d\n", rinit );
+        return false;
     }
-    
-    return false;
+#endif /// of DEBUG_LIBTWOFISH        
+    return true;
 }
 
 size_t TwoFish::GetEncodeLength( size_t srclen )
@@ -284,22 +382,105 @@ size_t TwoFish::GetBlockSize( bool isbit )
     return BLOCK_SIZE/8;
 }
 
-size_t TwoFish::Encode( uint8_t* pInput, uint8_t*& pOutput, size_t inpsz )
+void TwoFish::SetKeyCache( TwoFishKeyCache* cache )
 {
-    if ( context == NULL )
-        return 0;
+    TOCTX( tfctx );
     
+    tfctx->keycache = cache;
+}
+
+bool TwoFish::SetMode( uint8_t mode )
+{
+    TOCTX( tfctx );
+
+    if ( ( mode != MODE_ECB ) && ( mode != MODE_CBC ) && ( mode != MODE_CTR ) )
+        return false;
+
+    tfctx->usr_mode = mode;
+    tfctx->enc_mode = mode;
+
+    return true;
+}
+
+void TwoFish::SetParallel( size_t threadcnt, size_t minsz )
+{
+    TOCTX( tfctx );
+
+    if ( threadcnt == 0 )
+        threadcnt = std::thread::hardware_concurrency();
+
+    tfctx->par_threads = ( threadcnt > 1 ) ? threadcnt : 0;
+    tfctx->par_minsz   = minsz;
+}
+
+void TwoFish::SetKeyHandle( TwoFishKeyHandle* handle )
+{
+    TOCTX( tfctx );
+
+    tfctx->keyhandle = handle;
+}
+
+bool TwoFish::SetKeyArena( TwoFishKeyArena* arena )
+{
+    TOCTX( tfctx );
+
+    if ( arena == tfctx->keyarena )
+        return true;
+
+    keyInstance* key = NULL;
+
+    if ( arena != NULL )
+    {
+        key = arena->Alloc();
+        if ( key == NULL )
+            return false;
+    }
+
+    /* key schedule is remade by each Encode/Decode, nothing to carry */
+    if ( tfctx->keyarena != NULL )
+        tfctx->keyarena->Free( tfctx->keyptr );
+
+    tfctx->keyarena = arena;
+    tfctx->keyptr   = key;
+
+    return true;
+}
+
+size_t TwoFish::Encode( uint8_t* pInput, uint8_t*& pOutput, size_t inpsz )
+{
     if ( pInput == NULL )
         return 0;
     
     TOCTX( tfctx );
 
-    key2hex( tfctx->usr_key, tfctx->usr_keylen, &tfctx->keyinst );
+    int reti = cipherInit( &tfctx->cipherinst, tfctx->enc_mode, CTXIVREF( tfctx ) );
+
+    // CTR without a full block of IV would repeat keystream of others.
+    if ( ( reti != TF_SUCCESS ) && ( tfctx->enc_mode == MODE_CTR ) )
+        return 0;
 
-    cipherInit( &tfctx->cipherinst, tfctx->enc_mode, tfctx->usr_ivref );
+    handleGuard  hg( tfctx->keyhandle );
+    keyInstance* key = CTXKEY( tfctx );
+
+    reti = TF_SUCCESS;
+    
+    if ( hg.handle != NULL )
+    {
+        if ( hg.Acquire() == false )
+            return 0;
+        key = hg.rd.enc;
+    }
+    else
+    {
+        key2hex( tfctx->usr_key, tfctx->usr_keylen, key );
 
-    int reti = makeKey( &tfctx->keyinst, DIR_ENCRYPT, 
-                        tfctx->usr_keylen * 8, hexString );
+        if ( tfctx->keycache != NULL )
+            reti = tfctx->keycache->MakeKey( key, DIR_ENCRYPT, 
+                                             tfctx->usr_keylen * 8, hexString );
+        else
+            reti = makeKey( key, DIR_ENCRYPT, 
+                            tfctx->usr_keylen * 8, hexString );
+    }
     
     if ( reti != TF_SUCCESS )
     {
@@ -323,6 +504,10 @@ size_t TwoFish::Encode( uint8_t* pInput, uint8_t*& pOutput, size_t inpsz )
     memset( pOutput, 0, rsz );
     memcpy( pOutput, pInput, inpsz );
 
+    int retp = parallelCipher( tfctx, key, pOutput, pOutput, rsz, DIR_ENCRYPT );
+    if ( retp >= 0 )
+        return (size_t)retp;
+
     size_t    loops = rsz / ( BLOCK_SIZE/8 );
     size_t    bQ    = 0;
     uint32_t* pBin  = (uint32_t*)pOutput;
@@ -331,7 +516,7 @@ size_t TwoFish::Encode( uint8_t* pInput, uint8_t*& pOutput, size_t inpsz )
     for( size_t cnt=0; cnt<loops; cnt++ )
     {
         int reti = blockEncrypt( &tfctx->cipherinst, 
-                                 &tfctx->keyinst, 
+                                 key, 
                                  (uint8_t*)pBin,
                                  BLOCK_SIZE, 
                                  (uint8_t*)pBout );
@@ -353,21 +538,42 @@ size_t TwoFish::Encode( uint8_t* pInput, uint8_t*& pOutput, size_t inpsz )
 
 size_t TwoFish::Decode( uint8_t* pInput, uint8_t*& pOutput, size_t inpsz )
 {
-    if ( context == NULL )
-        return 0;
-
     if ( pInput == NULL )
         return 0;
 
     TOCTX( tfctx );
 
-    key2hex( tfctx->usr_key, tfctx->usr_keylen, &tfctx->keyinst );
-    
-    cipherInit( &tfctx->cipherinst, tfctx->enc_mode, tfctx->usr_ivref );
+    int reti = cipherInit( &tfctx->cipherinst, tfctx->enc_mode, CTXIVREF( tfctx ) );
+
+    // CTR without a full block of IV would repeat keystream of others.
+    if ( ( reti != TF_SUCCESS ) && ( tfctx->enc_mode == MODE_CTR ) )
+        return 0;
+
+    handleGuard  hg( tfctx->keyhandle );
+    keyInstance* key = CTXKEY( tfctx );
      
-    int reti = makeKey( &tfctx->keyinst, DIR_DECRYPT, 
-                        //tfctx->usr_keylen * 8, tfctx->usr_keyref );
-                        tfctx->usr_keylen * 8, hexString );
+    reti = TF_SUCCESS;
+    // CTR decodes with encrypting key.
+    uint8_t keydir = ( tfctx->enc_mode == MODE_CTR ) ? DIR_ENCRYPT : DIR_DECRYPT;
+    
+    if ( hg.handle != NULL )
+    {
+        if ( hg.Acquire() == false )
+            return 0;
+        key = ( keydir == DIR_ENCRYPT ) ? hg.rd.enc : hg.rd.dec;
+    }
+    else
+    {
+        key2hex( tfctx->usr_key, tfctx->usr_keylen, key );
+
+        if ( tfctx->keycache != NULL )
+            reti = tfctx->keycache->MakeKey( key, keydir, 
+                                             tfctx->usr_keylen * 8, hexString );
+        else
+            reti = makeKey( key, keydir, 
+                            //tfctx->usr_keylen * 8, tfctx->usr_keyref );
+                            tfctx->usr_keylen * 8, hexString );
+    }
      
     if ( reti != TF_SUCCESS )
     {
@@ -385,6 +591,16 @@ size_t TwoFish::Decode( uint8_t* pInput, uint8_t*& pOutput, size_t inpsz )
             return 0;
     }
 
+    size_t blksz = inpsz - inpsz % ( BLOCK_SIZE/8 );
+
+    int retp = parallelCipher( tfctx, key, pInput, pOutput, blksz, DIR_DECRYPT );
+    if ( retp >= 0 )
+    {
+        // as the serial path : nothing but zeros past decoded blocks.
+        memset( pOutput + retp, 0, inpsz - retp );
+        return (size_t)retp;
+    }
+
     memset( pOutput, 0, inpsz );
 
     size_t loops = inpsz / ( BLOCK_SIZE/8 );
@@ -394,7 +610,7 @@ size_t TwoFish::Decode( uint8_t* pInput, uint8_t*& pOutput, size_t inpsz )
     for( size_t cnt=0; cnt<loops; cnt++ )
     {
         int reti = blockDecrypt( &tfctx->cipherinst, 
-                                 &tfctx->keyinst, 
+                                 key, 
                                  (uint8_t*)pBin,
                                  BLOCK_SIZE, 
                                  (uint8_t*)pBout );
@@ -0,0 +1,297 @@
+/***************************************************************************
+    tfbatcher.cpp
+
+  ------------------------------------------------------------------------
+
+    Deadline based micro-batching of small jobs for the lanes kernel.
+
+    (C)2021, Raphael Kim
+
+    Notes:
+        *   Jobs wait in a list under a mutex, a batch is taken out of it
+            as a whole and ciphered outside of the lock, so Add() of the
+            next packets goes on meanwhile.
+        *   One thread per batcher sleeps until the deadline of the
+            oldest waiting job.
+        *   Tab size is set to 4 characters in this file
+
+***************************************************************************/
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include "tfish.h"
+#include "tfbatcher.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+typedef std::chrono::steady_clock   batcherClock;
+
+typedef struct
+{
+    std::mutex                  lock;
+    std::condition_variable     wake;
+    std::thread                 flusher;
+    std::vector< engineJob* >   waiting;
+    size_t                      blocks;     /* of waiting jobs */
+    batcherClock::time_point    oldest;     /* Add() of first waiting job */
+    size_t                      maxBlocks;
+    std::chrono::microseconds   maxDelay;
+    batcherStats                stats;
+    bool                        quit;
+}libTwoFishBatcherContext;
+
+#define L2FBTCTX        libTwoFishBatcherContext
+#define TOBTCTX(_x_)    L2FBTCTX* _x_ = (L2FBTCTX*)context
+
+////////////////////////////////////////////////////////////////////////////////
+
+static size_t jobBlocks( const engineJob* job )
+{
+    return ( job->inputLen + BLOCK_SIZE - 1 ) / BLOCK_SIZE;
+}
+
+// takes waiting jobs into batch, lock held.  reason : counter to step, or NULL.
+static void batcherTake( L2FBTCTX* btctx, std::vector< engineJob* >& batch,
+                         uint64_t* reason )
+{
+    uint64_t delay = std::chrono::duration_cast< std::chrono::microseconds >(
+                         batcherClock::now() - btctx->oldest ).count();
+
+    btctx->stats.batches++;
+    btctx->stats.jobs       += btctx->waiting.size();
+    btctx->stats.blocks     += btctx->blocks;
+    btctx->stats.delayUsSum += delay;
+    if ( delay > btctx->stats.delayUsMax )
+        btctx->stats.delayUsMax = delay;
+    if ( reason != NULL )
+        (*reason)++;
+
+    batch.swap( btctx->waiting );
+    btctx->waiting.clear();
+    btctx->blocks = 0;
+}
+
+// one lanes call per direction, then callbacks.
+static void batcherCipher( std::vector< engineJob* >& batch )
+{
+    std::vector< laneInstance > lanes;
+    std::vector< engineJob* >   lanejobs;
+
+    lanes.reserve( batch.size() );
+    lanejobs.reserve( batch.size() );
+
+    for ( uint8_t dir=DIR_ENCRYPT; dir<=DIR_DECRYPT; dir++ )
+    {
+        lanes.clear();
+        lanejobs.clear();
+
+        for ( size_t n=0; n<batch.size(); n++ )
+        {
+            engineJob* job = batch[n];
+            if ( job->dir != dir )
+                continue;
+
+            laneInstance ln;
+            ln.key       = job->key;
+            ln.cipher    = &job->cipher;
+            ln.input     = job->input;
+            ln.inputLen  = job->inputLen;
+            ln.outBuffer = job->outBuffer;
+            ln.result    = 0;
+            lanes.push_back( ln );
+            lanejobs.push_back( job );
+        }
+
+        if ( lanes.size() == 0 )
+            continue;
+
+        if ( dir == DIR_ENCRYPT )
+            blockEncryptLanes( lanes.data(), lanes.size() );
+        else
+            blockDecryptLanes( lanes.data(), lanes.size() );
+
+        for ( size_t n=0; n<lanes.size(); n++ )
+        {
+            lanejobs[n]->result = lanes[n].result;
+            lanejobs[n]->done( lanejobs[n] );
+        }
+    }
+
+    batch.clear();
+}
+
+static void batcherFlusher( L2FBTCTX* btctx )
+{
+    std::vector< engineJob* >      batch;
+    std::unique_lock< std::mutex > guard( btctx->lock );
+
+    while ( btctx->quit == false )
+    {
+        if ( btctx->waiting.size() == 0 )
+        {
+            btctx->wake.wait( guard );
+            continue;
+        }
+
+        batcherClock::time_point due = btctx->oldest + btctx->maxDelay;
+
+        if ( batcherClock::now() < due )
+        {
+            btctx->wake.wait_until( guard, due );
+            continue;
+        }
+
+        batcherTake( btctx, batch, &btctx->stats.lateBatches );
+        guard.unlock();
+        batcherCipher( batch );
+        guard.lock();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+TwoFishBatcher::TwoFishBatcher( size_t maxBlocks, uint32_t maxDelayUs )
+ : context( NULL )
+{
+    L2FBTCTX* btctx = new L2FBTCTX;
+    if ( btctx == NULL )
+        return;
+
+    btctx->blocks    = 0;
+    btctx->maxBlocks = ( maxBlocks > 0 ) ? maxBlocks : 1;
+    btctx->maxDelay  = std::chrono::microseconds( maxDelayUs );
+    btctx->quit      = false;
+    memset( &btctx->stats, 0, sizeof( batcherStats ) );
+
+    btctx->flusher = std::thread( batcherFlusher, btctx );
+
+    context = (void*)btctx;
+}
+
+TwoFishBatcher::~TwoFishBatcher()
+{
+    TOBTCTX( btctx );
+
+    if ( btctx == NULL )
+        return;
+
+    {
+        std::lock_guard< std::mutex > guard( btctx->lock );
+        btctx->quit = true;
+    }
+    btctx->wake.notify_all();
+    btctx->flusher.join();
+
+    Flush();
+
+    context = NULL;
+    delete btctx;
+}
+
+int TwoFishBatcher::Add( engineJob* job )
+{
+    TOBTCTX( btctx );
+
+    if ( ( btctx == NULL ) || ( job == NULL ) || ( job->done == NULL ) )
+        return BAD_PARAMS;
+
+    if ( ( job->key == NULL ) || ( job->key->keySig != VALID_SIG ) )
+        return BAD_KEY_INSTANCE;
+
+    if ( ( job->dir != DIR_ENCRYPT ) && ( job->dir != DIR_DECRYPT ) )
+        return BAD_KEY_DIR;
+
+    // these modes reverse a decrypting key in place.
+    if ( ( ( job->cipher.mode == MODE_CTR ) || ( job->cipher.mode == MODE_CFB1 ) ) &&
+         ( job->key->direction != DIR_ENCRYPT ) )
+        return BAD_KEY_DIR;
+
+    // jobs of a batch run on whichever thread flushes it, as with the engine.
+    if ( job->key->sboxReady == 0 )
+        return BAD_KEY_INSTANCE;
+
+    job->result = 0;
+
+    std::vector< engineJob* >      batch;
+    std::unique_lock< std::mutex > guard( btctx->lock );
+
+    if ( btctx->waiting.size() == 0 )
+    {
+        btctx->oldest = batcherClock::now();
+        btctx->wake.notify_one();   /* flusher takes new deadline */
+    }
+
+    btctx->waiting.push_back( job );
+    btctx->blocks += jobBlocks( job );
+
+    if ( btctx->blocks >= btctx->maxBlocks )
+    {
+        batcherTake( btctx, batch, &btctx->stats.fullBatches );
+        guard.unlock();
+        batcherCipher( batch );
+    }
+
+    return TF_SUCCESS;
+}
+
+void TwoFishBatcher::Flush()
+{
+    TOBTCTX( btctx );
+
+    if ( btctx == NULL )
+        return;
+
+    std::vector< engineJob* >      batch;
+    std::unique_lock< std::mutex > guard( btctx->lock );
+
+    if ( btctx->waiting.size() == 0 )
+        return;
+
+    batcherTake( btctx, batch, NULL );
+    guard.unlock();
+    batcherCipher( batch );
+}
+
+size_t TwoFishBatcher::GetWaiting()
+{
+    TOBTCTX( btctx );
+
+    if ( btctx == NULL )
+        return 0;
+
+    std::lock_guard< std::mutex > guard( btctx->lock );
+
+    return btctx->waiting.size();
+}
+
+void TwoFishBatcher::GetStats( batcherStats* stats )
+{
+    TOBTCTX( btctx );
+
+    if ( ( btctx == NULL ) || ( stats == NULL ) )
+        return;
+
+    std::lock_guard< std::mutex > guard( btctx->lock );
+
+    *stats = btctx->stats;
+}
+
+void TwoFishBatcher::ResetStats()
+{
+    TOBTCTX( btctx );
+
+    if ( btctx == NULL )
+        return;
+
+    std::lock_guard< std::mutex > guard( btctx->lock );
+
+    memset( &btctx->stats, 0, sizeof( batcherStats ) );
+}
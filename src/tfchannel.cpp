@@ -0,0 +1,664 @@
+/***************************************************************************
+    tfchannel.cpp
+
+  ------------------------------------------------------------------------
+
+    Shared memory channel : CTR frames in a ring, futex wakeups.
+
+    (C)2021, Raphael Kim
+
+    Notes:
+        *   The producer owns head, the consumer tail, each on a cache
+            line of its own.  A side in want of room or of a frame sets
+            its waits flag, looks again, and only then sleeps on the
+            futex word the other side bumps : the other side makes the
+            wake call only if the flag is set.
+        *   Counters come from one cipher instance made at setup, copied
+            and moved on per frame, no IV text to parse.
+        *   Magic is written last, a consumer attaching early sees no
+            channel rather than half of one.
+        *   Needs futex and POSIX shared memory, Linux only.
+        *   Tab size is set to 4 characters in this file
+
+***************************************************************************/
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <climits>
+
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <random>
+#include <string>
+
+#if defined(__linux__)
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <time.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <sys/syscall.h>
+    #include <linux/futex.h>
+#endif
+
+#include "tfish.h"
+#include "tfchannel.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define CH_MAGIC        "TFCH"
+#define CH_VERSION      1
+#define CH_BLOCK        ( BLOCK_SIZE/8 )
+#define CH_SLOTHDR      16                  /* length, sequence */
+#define CH_LINE         64
+#define CH_MAXSLOTS     ( 1024 * 1024 )
+#define CH_ROUND(x,a)   ( ( (x) + (a) - 1 ) / (a) * (a) )
+
+// start of the shared memory, slots after it.
+typedef struct
+{
+    uint8_t                 magic[4];
+    uint8_t                 version;
+    uint8_t                 reserved[3];
+    uint32_t                slotCount;
+    uint32_t                slotSize;
+    uint8_t                 nonce[ CH_BLOCK ];
+    uint8_t                 check[ CH_BLOCK ];      /* E( ~nonce ) */
+
+    /* producer's */
+    alignas( CH_LINE ) std::atomic< uint64_t > head;
+    std::atomic< uint32_t > dataWord;
+    std::atomic< uint32_t > consumerWaits;
+    std::atomic< uint32_t > producerGone;
+
+    /* consumer's */
+    alignas( CH_LINE ) std::atomic< uint64_t > tail;
+    std::atomic< uint32_t > spaceWord;
+    std::atomic< uint32_t > producerWaits;
+    std::atomic< uint32_t > consumerGone;
+}chShared;
+
+typedef struct
+{
+    bool                    producer;
+    bool                    held;       /* slot acquired, or frame received */
+    std::string             name;
+    void*                   map;
+    size_t                  mapsz;
+    chShared*               sh;
+    uint8_t*                slots;
+    size_t                  slotCount;
+    size_t                  slotSize;
+    size_t                  stride;
+    size_t                  slotBlocks;
+    uint64_t                seq;        /* head of producer, tail of consumer */
+    keyInstance             key;
+    cipherInstance          base;       /* counter of frame 0 */
+    channelStats            stats;
+}libTwoFishChannelContext;
+
+#define L2FCHCTX        libTwoFishChannelContext
+#define TOCHCTX(_x_)    L2FCHCTX* _x_ = (L2FCHCTX*)context
+
+////////////////////////////////////////////////////////////////////////////////
+
+#if defined(__linux__)
+static void chFutexWait( std::atomic< uint32_t >* word, uint32_t val, long usec )
+{
+    struct timespec ts;
+
+    ts.tv_sec  = usec / 1000000;
+    ts.tv_nsec = ( usec % 1000000 ) * 1000;
+
+    syscall( SYS_futex, (uint32_t*)word, FUTEX_WAIT, val,
+             ( usec < 0 ) ? NULL : &ts, NULL, 0 );
+}
+
+static void chFutexWake( std::atomic< uint32_t >* word, int cnt )
+{
+    syscall( SYS_futex, (uint32_t*)word, FUTEX_WAKE, cnt, NULL, NULL, 0 );
+}
+
+static uint8_t* chSlot( L2FCHCTX* chctx, uint64_t seq )
+{
+    return chctx->slots + ( seq % chctx->slotCount ) * chctx->stride;
+}
+
+static int chCipher( L2FCHCTX* chctx, uint64_t seq,
+                     const uint8_t* in, size_t len, uint8_t* out )
+{
+    if ( len == 0 )
+        return TF_SUCCESS;
+
+    cipherInstance ci = chctx->base;
+
+    CounterAdd( &ci, seq * chctx->slotBlocks );
+
+    int reti = blockEncrypt( &ci, &chctx->key, in, len * 8, out );
+
+    return ( reti < 0 ) ? reti : TF_SUCCESS;
+}
+
+static bool chReady( L2FCHCTX* chctx )
+{
+    if ( chctx->producer == true )
+        return ( chctx->seq - chctx->sh->tail.load() ) < chctx->slotCount;
+
+    return chctx->sh->head.load() != chctx->seq;
+}
+
+// room for the producer, a frame for the consumer.
+static int chAwait( L2FCHCTX* chctx, int timeoutMs )
+{
+    chShared* sh = chctx->sh;
+    bool      prod = chctx->producer;
+
+    std::atomic< uint32_t >* word  = prod ? &sh->spaceWord : &sh->dataWord;
+    std::atomic< uint32_t >* waits = prod ? &sh->producerWaits : &sh->consumerWaits;
+    std::atomic< uint32_t >* gone  = prod ? &sh->consumerGone : &sh->producerGone;
+
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds( timeoutMs );
+
+    while ( true )
+    {
+        // nobody reads what the producer would send.
+        if ( ( prod == true ) && ( gone->load() != 0 ) )
+            return CHANNEL_CLOSED;
+
+        if ( chReady( chctx ) == true )
+            return TF_SUCCESS;
+
+        if ( gone->load() != 0 )
+            return CHANNEL_CLOSED;
+
+        if ( timeoutMs == 0 )
+            return CHANNEL_TIMEOUT;
+
+        long usec = -1;
+
+        if ( timeoutMs > 0 )
+        {
+            usec = (long)std::chrono::duration_cast< std::chrono::microseconds >(
+                            deadline - std::chrono::steady_clock::now() ).count();
+            if ( usec <= 0 )
+                return CHANNEL_TIMEOUT;
+        }
+
+        uint32_t w = word->load();
+
+        waits->store( 1 );
+
+        if ( ( chReady( chctx ) == false ) && ( gone->load() == 0 ) )
+        {
+            chFutexWait( word, w, usec );
+            chctx->stats.waits++;
+        }
+
+        waits->store( 0 );
+    }
+}
+
+// the other side's word bumped, woken if it sleeps.
+static void chNotify( L2FCHCTX* chctx, int cnt )
+{
+    chShared* sh = chctx->sh;
+
+    std::atomic< uint32_t >* word  = chctx->producer ? &sh->dataWord : &sh->spaceWord;
+    std::atomic< uint32_t >* waits = chctx->producer ? &sh->consumerWaits : &sh->producerWaits;
+
+    word->fetch_add( 1 );
+
+    if ( ( waits->load() != 0 ) || ( cnt > 1 ) )
+    {
+        chFutexWake( word, cnt );
+        chctx->stats.wakes++;
+    }
+}
+
+// slot of seq, ciphered, handed to the consumer.
+static void chPost( L2FCHCTX* chctx, size_t len )
+{
+    uint8_t* slot = chSlot( chctx, chctx->seq );
+    uint32_t l32  = (uint32_t)len;
+
+    memcpy( slot, &l32, 4 );
+    memcpy( slot + 8, &chctx->seq, 8 );
+
+    chctx->seq++;
+    chctx->sh->head.store( chctx->seq );
+
+    chctx->stats.frames++;
+    chctx->stats.bytes += len;
+
+    chNotify( chctx, 1 );
+}
+
+static void chKeyCheck( L2FCHCTX* chctx, const uint8_t* nonce, uint8_t* check )
+{
+    cipherInstance ecb;
+
+    for ( size_t cnt=0; cnt<CH_BLOCK; cnt++ )
+        check[ cnt ] = (uint8_t)~nonce[ cnt ];
+
+    cipherInit( &ecb, MODE_ECB, NULL );
+    blockEncrypt( &ecb, &chctx->key, check, BLOCK_SIZE, check );
+}
+
+// key copied and turned, counter base from the nonce.
+static void chSetup( L2FCHCTX* chctx, keyInstance* key, const uint8_t* nonce )
+{
+    char iv[ CH_BLOCK * 2 + 1 ] = {0};
+
+    chctx->key = *key;
+    expandKey( &chctx->key );
+    if ( chctx->key.direction != DIR_ENCRYPT )
+        ReverseRoundSubkeys( &chctx->key, DIR_ENCRYPT );
+
+    for ( size_t cnt=0; cnt<CH_BLOCK; cnt++ )
+        snprintf( &iv[cnt*2], 3, "%02X", nonce[ cnt ] );
+
+    cipherInit( &chctx->base, MODE_CTR, iv );
+
+    chctx->stride     = CH_ROUND( CH_SLOTHDR + chctx->slotSize, CH_LINE );
+    chctx->slotBlocks = CH_ROUND( chctx->slotSize, CH_BLOCK ) / CH_BLOCK;
+    chctx->slots      = (uint8_t*)chctx->map + CH_ROUND( sizeof( chShared ), CH_LINE );
+    chctx->held       = false;
+    memset( &chctx->stats, 0, sizeof( channelStats ) );
+}
+
+static size_t chMapSize( size_t slotCount, size_t slotSize )
+{
+    return CH_ROUND( sizeof( chShared ), CH_LINE ) +
+           slotCount * CH_ROUND( CH_SLOTHDR + slotSize, CH_LINE );
+}
+#endif /// of __linux__
+
+////////////////////////////////////////////////////////////////////////////////
+
+TwoFishChannel::TwoFishChannel()
+ : context( NULL )
+{
+    L2FCHCTX* chctx = new L2FCHCTX;
+    if ( chctx == NULL )
+        return;
+
+    chctx->producer = false;
+    chctx->held     = false;
+    chctx->map      = NULL;
+    chctx->mapsz    = 0;
+    chctx->sh       = NULL;
+    chctx->slots    = NULL;
+    chctx->slotSize = 0;
+    chctx->seq      = 0;
+    memset( &chctx->stats, 0, sizeof( channelStats ) );
+
+    context = (void*)chctx;
+}
+
+TwoFishChannel::~TwoFishChannel()
+{
+    TOCHCTX( chctx );
+
+    if ( chctx == NULL )
+        return;
+
+    Close();
+
+    context = NULL;
+    delete chctx;
+}
+
+int TwoFishChannel::Create( const char* name, keyInstance* key,
+                            size_t slotCount, size_t slotSize )
+{
+    TOCHCTX( chctx );
+
+    if ( ( chctx == NULL ) || ( name == NULL ) || ( key == NULL ) ||
+         ( slotCount < 2 ) || ( slotCount > CH_MAXSLOTS ) ||
+         ( slotSize == 0 ) || ( slotSize > CHANNEL_MAXSLOTSZ ) )
+        return BAD_PARAMS;
+
+    if ( key->keySig != VALID_SIG )
+        return BAD_KEY_INSTANCE;
+
+#if !defined(__linux__)
+    return STREAM_IO_FAIL;
+#else
+    Close();
+
+    size_t mapsz = chMapSize( slotCount, slotSize );
+
+    int fd = shm_open( name, O_RDWR | O_CREAT | O_EXCL, 0600 );
+    if ( fd < 0 )
+        return STREAM_IO_FAIL;
+
+    void* map = MAP_FAILED;
+
+    if ( ftruncate( fd, (off_t)mapsz ) == 0 )
+        map = mmap( NULL, mapsz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+
+    close( fd );
+
+    if ( map == MAP_FAILED )
+    {
+        shm_unlink( name );
+        return STREAM_IO_FAIL;
+    }
+
+    chShared* sh = new ( map ) chShared;
+
+    std::random_device rnd;
+
+    for ( size_t cnt=0; cnt<CH_BLOCK; cnt+=4 )
+    {
+        uint32_t r = rnd();
+        memcpy( sh->nonce + cnt, &r, 4 );
+    }
+
+    sh->version   = CH_VERSION;
+    sh->slotCount = (uint32_t)slotCount;
+    sh->slotSize  = (uint32_t)slotSize;
+    sh->head.store( 0 );
+    sh->dataWord.store( 0 );
+    sh->consumerWaits.store( 0 );
+    sh->producerGone.store( 0 );
+    sh->tail.store( 0 );
+    sh->spaceWord.store( 0 );
+    sh->producerWaits.store( 0 );
+    sh->consumerGone.store( 0 );
+
+    chctx->producer  = true;
+    chctx->name      = name;
+    chctx->map       = map;
+    chctx->mapsz     = mapsz;
+    chctx->sh        = sh;
+    chctx->slotCount = slotCount;
+    chctx->slotSize  = slotSize;
+    chctx->seq       = 0;
+
+    chSetup( chctx, key, sh->nonce );
+    chKeyCheck( chctx, sh->nonce, sh->check );
+
+    std::atomic_thread_fence( std::memory_order_release );
+    memcpy( sh->magic, CH_MAGIC, 4 );
+
+    return TF_SUCCESS;
+#endif /// of __linux__
+}
+
+int TwoFishChannel::Attach( const char* name, keyInstance* key )
+{
+    TOCHCTX( chctx );
+
+    if ( ( chctx == NULL ) || ( name == NULL ) || ( key == NULL ) )
+        return BAD_PARAMS;
+
+    if ( key->keySig != VALID_SIG )
+        return BAD_KEY_INSTANCE;
+
+#if !defined(__linux__)
+    return STREAM_IO_FAIL;
+#else
+    Close();
+
+    int fd = shm_open( name, O_RDWR, 0 );
+    if ( fd < 0 )
+        return STREAM_IO_FAIL;
+
+    struct stat sb;
+    void*       map = MAP_FAILED;
+
+    if ( fstat( fd, &sb ) == 0 )
+    {
+        if ( (size_t)sb.st_size < chMapSize( 2, 1 ) )
+        {
+            close( fd );
+            return BAD_CHANNEL;
+        }
+
+        map = mmap( NULL, (size_t)sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    }
+
+    close( fd );
+
+    if ( map == MAP_FAILED )
+        return STREAM_IO_FAIL;
+
+    chShared* sh = (chShared*)map;
+
+    if ( ( memcmp( sh->magic, CH_MAGIC, 4 ) != 0 ) || ( sh->version != CH_VERSION ) ||
+         ( sh->slotCount < 2 ) || ( sh->slotCount > CH_MAXSLOTS ) ||
+         ( sh->slotSize == 0 ) || ( sh->slotSize > CHANNEL_MAXSLOTSZ ) ||
+         ( chMapSize( sh->slotCount, sh->slotSize ) != (size_t)sb.st_size ) )
+    {
+        munmap( map, (size_t)sb.st_size );
+        return BAD_CHANNEL;
+    }
+
+    std::atomic_thread_fence( std::memory_order_acquire );
+
+    chctx->map       = map;
+    chctx->mapsz     = (size_t)sb.st_size;
+    chctx->sh        = sh;
+    chctx->slotCount = sh->slotCount;
+    chctx->slotSize  = sh->slotSize;
+
+    chSetup( chctx, key, sh->nonce );
+
+    uint8_t check[ CH_BLOCK ];
+    chKeyCheck( chctx, sh->nonce, check );
+
+    if ( memcmp( check, sh->check, CH_BLOCK ) != 0 )
+    {
+        munmap( map, chctx->mapsz );
+        memset( &chctx->key, 0, sizeof( keyInstance ) );
+        chctx->map = NULL;
+        chctx->sh  = NULL;
+        return BAD_KEY_MAT;
+    }
+
+    chctx->producer = false;
+    chctx->name     = name;
+    chctx->seq      = sh->tail.load();
+
+    return TF_SUCCESS;
+#endif /// of __linux__
+}
+
+int TwoFishChannel::Close()
+{
+    TOCHCTX( chctx );
+
+    if ( chctx == NULL )
+        return BAD_PARAMS;
+
+#if !defined(__linux__)
+    return TF_SUCCESS;
+#else
+    if ( chctx->sh == NULL )
+        return TF_SUCCESS;
+
+    // gone flag, then every sleeper of the other side woken.
+    if ( chctx->producer == true )
+        chctx->sh->producerGone.store( 1 );
+    else
+        chctx->sh->consumerGone.store( 1 );
+
+    chNotify( chctx, INT_MAX );
+
+    if ( chctx->producer == true )
+        shm_unlink( chctx->name.c_str() );
+
+    munmap( chctx->map, chctx->mapsz );
+    memset( &chctx->key, 0, sizeof( keyInstance ) );
+    memset( &chctx->base, 0, sizeof( cipherInstance ) );
+
+    chctx->map   = NULL;
+    chctx->sh    = NULL;
+    chctx->slots = NULL;
+    chctx->held  = false;
+    chctx->name.clear();
+
+    return TF_SUCCESS;
+#endif /// of __linux__
+}
+
+int TwoFishChannel::Send( const uint8_t* frame, size_t len, int timeoutMs )
+{
+    TOCHCTX( chctx );
+
+    if ( ( chctx == NULL ) || ( chctx->sh == NULL ) || ( chctx->producer == false ) ||
+         ( chctx->held == true ) || ( ( frame == NULL ) && ( len > 0 ) ) )
+        return BAD_PARAMS;
+
+    if ( len > chctx->slotSize )
+        return BAD_INPUT_LEN;
+
+#if !defined(__linux__)
+    return STREAM_IO_FAIL;
+#else
+    int reti = chAwait( chctx, timeoutMs );
+    if ( reti != TF_SUCCESS )
+        return reti;
+
+    reti = chCipher( chctx, chctx->seq, frame, len,
+                     chSlot( chctx, chctx->seq ) + CH_SLOTHDR );
+    if ( reti != TF_SUCCESS )
+        return reti;
+
+    chPost( chctx, len );
+
+    return TF_SUCCESS;
+#endif /// of __linux__
+}
+
+int TwoFishChannel::Acquire( uint8_t** buf, int timeoutMs )
+{
+    TOCHCTX( chctx );
+
+    if ( ( chctx == NULL ) || ( chctx->sh == NULL ) || ( chctx->producer == false ) ||
+         ( chctx->held == true ) || ( buf == NULL ) )
+        return BAD_PARAMS;
+
+#if !defined(__linux__)
+    return STREAM_IO_FAIL;
+#else
+    int reti = chAwait( chctx, timeoutMs );
+    if ( reti != TF_SUCCESS )
+        return reti;
+
+    *buf        = chSlot( chctx, chctx->seq ) + CH_SLOTHDR;
+    chctx->held = true;
+
+    return TF_SUCCESS;
+#endif /// of __linux__
+}
+
+int TwoFishChannel::Publish( size_t len )
+{
+    TOCHCTX( chctx );
+
+    if ( ( chctx == NULL ) || ( chctx->sh == NULL ) || ( chctx->producer == false ) ||
+         ( chctx->held == false ) )
+        return BAD_PARAMS;
+
+    if ( len > chctx->slotSize )
+        return BAD_INPUT_LEN;
+
+#if !defined(__linux__)
+    return STREAM_IO_FAIL;
+#else
+    uint8_t* p = chSlot( chctx, chctx->seq ) + CH_SLOTHDR;
+
+    int reti = chCipher( chctx, chctx->seq, p, len, p );
+    if ( reti != TF_SUCCESS )
+        return reti;
+
+    chctx->held = false;
+    chPost( chctx, len );
+
+    return TF_SUCCESS;
+#endif /// of __linux__
+}
+
+int TwoFishChannel::Receive( const uint8_t** frame, size_t* len, int timeoutMs )
+{
+    TOCHCTX( chctx );
+
+    if ( ( chctx == NULL ) || ( chctx->sh == NULL ) || ( chctx->producer == true ) ||
+         ( chctx->held == true ) || ( frame == NULL ) || ( len == NULL ) )
+        return BAD_PARAMS;
+
+#if !defined(__linux__)
+    return STREAM_IO_FAIL;
+#else
+    int reti = chAwait( chctx, timeoutMs );
+    if ( reti != TF_SUCCESS )
+        return reti;
+
+    uint8_t* slot = chSlot( chctx, chctx->seq );
+    uint32_t l32;
+    uint64_t seq;
+
+    memcpy( &l32, slot, 4 );
+    memcpy( &seq, slot + 8, 8 );
+
+    if ( ( l32 > chctx->slotSize ) || ( seq != chctx->seq ) )
+        return BAD_CHANNEL;
+
+    reti = chCipher( chctx, seq, slot + CH_SLOTHDR, l32, slot + CH_SLOTHDR );
+    if ( reti != TF_SUCCESS )
+        return reti;
+
+    *frame      = slot + CH_SLOTHDR;
+    *len        = l32;
+    chctx->held = true;
+
+    chctx->stats.frames++;
+    chctx->stats.bytes += l32;
+
+    return TF_SUCCESS;
+#endif /// of __linux__
+}
+
+int TwoFishChannel::Release()
+{
+    TOCHCTX( chctx );
+
+    if ( ( chctx == NULL ) || ( chctx->sh == NULL ) || ( chctx->producer == true ) ||
+         ( chctx->held == false ) )
+        return BAD_PARAMS;
+
+#if !defined(__linux__)
+    return STREAM_IO_FAIL;
+#else
+    chctx->held = false;
+    chctx->seq++;
+    chctx->sh->tail.store( chctx->seq );
+
+    chNotify( chctx, 1 );
+
+    return TF_SUCCESS;
+#endif /// of __linux__
+}
+
+size_t TwoFishChannel::GetSlotSize()
+{
+    TOCHCTX( chctx );
+
+    return ( ( chctx != NULL ) && ( chctx->sh != NULL ) ) ? chctx->slotSize : 0;
+}
+
+void TwoFishChannel::GetStats( channelStats* stats )
+{
+    TOCHCTX( chctx );
+
+    if ( ( chctx == NULL ) || ( stats == NULL ) )
+        return;
+
+    *stats = chctx->stats;
+}
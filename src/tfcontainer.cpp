@@ -0,0 +1,585 @@
+/***************************************************************************
+    tfcontainer.cpp
+
+  ------------------------------------------------------------------------
+
+    Seekable container of GCM sealed chunks.
+
+    (C)2021, Raphael Kim
+
+    Notes:
+        *   Chunks go through a batch buffer : read in one go, sealed or
+            opened in place as jobs of TwoFishThreadPool, written in one
+            go.  Memory stays at a batch, CT_BATCHMEM at most, whatever
+            the size of the file or of a Read().
+        *   GCM nonce of chunk n is file id ( 16 random bytes ) and n as
+            a 64 bit number, additional data the first 16 header bytes
+            and a last chunk flag.  So a chunk can't be moved to another
+            place, file, or chunk size, and a file can't be cut short at
+            a chunk end unnoticed.
+        *   Seal() reads to the end of a pipe as well, a byte of look
+            ahead tells a full chunk from the last one.
+        *   Header fields are little endian.
+        *   Tab size is set to 4 characters in this file
+
+***************************************************************************/
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "tfish.h"
+#include "tfgcm.h"
+#include "tfstream.h"
+#include "tfthreadpool.h"
+#include "tfcontainer.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define CT_MAGIC        "TFCT"
+#define CT_VERSION      1
+#define CT_IDSZ         16
+#define CT_AADSZ        16                      /* header bytes sealed along */
+#define CT_IVSZ         ( CT_IDSZ + 8 )
+#define CT_BATCHMEM     ( 64 * 1024 * 1024 )    /* batch buffer limit */
+#define CT_NOLAST       UINT64_MAX
+
+/* header offsets */
+#define CT_OFS_VER      4
+#define CT_OFS_FLAGS    5
+#define CT_OFS_CHUNK    8
+#define CT_OFS_LENGTH   16
+#define CT_OFS_ID       24
+
+typedef struct
+{
+    size_t                  threads;
+    keyInstance*            key;
+    FILE*                   fp;         /* Open() */
+    off_t                   base;
+    uint8_t                 hdr[ CONTAINER_HDRSZ ];
+    containerInfo           info;
+    std::vector< uint8_t >  index;      /* tags, CONTAINER_INDEX */
+    std::vector< uint8_t >  buf;        /* one batch */
+    containerStats          stats;
+}libTwoFishContainerContext;
+
+#define L2FCTCTX        libTwoFishContainerContext
+#define TOCTCTX(_x_)    L2FCTCTX* _x_ = (L2FCTCTX*)context
+
+// one batch : chunk first + job at data + job x stride.
+typedef struct
+{
+    keyInstance*        key;
+    const uint8_t*      hdr;
+    uint8_t             dir;
+    uint8_t*            data;
+    size_t              stride;
+    uint8_t*            tags;       /* NULL : tag follows its chunk */
+    size_t              chunksz;
+    uint64_t            first;
+    uint64_t            lastChunk;  /* CT_NOLAST : not in this batch */
+    size_t              lastLen;
+    std::atomic< int >  error;
+}containerJob;
+
+////////////////////////////////////////////////////////////////////////////////
+
+static uint64_t ctLoad( const uint8_t* p, size_t n )
+{
+    uint64_t v = 0;
+
+    for ( size_t cnt=n; cnt-->0; )
+        v = ( v << 8 ) | p[ cnt ];
+
+    return v;
+}
+
+static void ctStore( uint8_t* p, uint64_t v, size_t n )
+{
+    for ( size_t cnt=0; cnt<n; cnt++ )
+    {
+        p[ cnt ] = (uint8_t)v;
+        v >>= 8;
+    }
+}
+
+static size_t ctStride( const containerInfo* info )
+{
+    return info->chunkSize +
+           ( ( info->flags & CONTAINER_INDEX ) ? 0 : GCM_TAG_SIZE );
+}
+
+// chunks per pool run : a few per thread, within CT_BATCHMEM.
+static size_t ctBatch( size_t threads, size_t stride )
+{
+    size_t n = threads * 4;
+
+    if ( n * stride > CT_BATCHMEM )
+        n = CT_BATCHMEM / stride;
+
+    return ( n > 0 ) ? n : 1;
+}
+
+static void ctChunk( void* arg, size_t job )
+{
+    containerJob* cj  = (containerJob*)arg;
+    uint64_t      n   = cj->first + job;
+    bool          end = ( n == cj->lastChunk );
+    size_t        len = end ? cj->lastLen : cj->chunksz;
+    uint8_t*      p   = cj->data + job * cj->stride;
+    uint8_t*      tag = ( cj->tags != NULL ) ? cj->tags + job * GCM_TAG_SIZE
+                                             : p + len;
+    uint8_t       iv[ CT_IVSZ ];
+    uint8_t       aad[ CT_AADSZ + 1 ];
+
+    memcpy( iv, cj->hdr + CT_OFS_ID, CT_IDSZ );
+    for ( size_t cnt=0; cnt<8; cnt++ )
+        iv[ CT_IDSZ + cnt ] = (uint8_t)( n >> ( 56 - cnt * 8 ) );
+
+    memcpy( aad, cj->hdr, CT_AADSZ );
+    aad[ CT_AADSZ ] = end ? 1 : 0;
+
+    TwoFishGCM gcm( cj->key );
+
+    int reti;
+    if ( cj->dir == DIR_ENCRYPT )
+        reti = gcm.Encrypt( iv, CT_IVSZ, aad, sizeof( aad ), p, len, p, tag );
+    else
+        reti = gcm.Decrypt( iv, CT_IVSZ, aad, sizeof( aad ), p, len, p, tag );
+
+    if ( reti != TF_SUCCESS )
+        cj->error = reti;
+}
+
+// chunks first .. first + cnt - 1 of an open container, in place in buf.
+static int ctRun( L2FCTCTX* ctctx, containerJob* cj, uint8_t dir,
+                  uint64_t first, size_t cnt, uint64_t lastChunk, size_t lastLen )
+{
+    cj->key       = ctctx->key;
+    cj->hdr       = ctctx->hdr;
+    cj->dir       = dir;
+    cj->data      = ctctx->buf.data();
+    cj->stride    = ctStride( &ctctx->info );
+    cj->chunksz   = ctctx->info.chunkSize;
+    cj->first     = first;
+    cj->lastChunk = lastChunk;
+    cj->lastLen   = lastLen;
+    cj->error     = TF_SUCCESS;
+    cj->tags      = ( ctctx->info.flags & CONTAINER_INDEX )
+                    ? ctctx->index.data() + first * GCM_TAG_SIZE : NULL;
+
+    TwoFishThreadPool::Shared().Run( cnt, ctctx->threads, ctChunk, cj );
+
+    ctctx->stats.chunks  += cnt;
+    ctctx->stats.batches++;
+
+    return cj->error;
+}
+
+static void ctPrepareKey( keyInstance* key )
+{
+    // read only from here, so jobs can share it.
+    expandKey( key );
+    if ( key->direction != DIR_ENCRYPT )
+        ReverseRoundSubkeys( key, DIR_ENCRYPT );
+}
+
+static size_t ctChunkLen( const containerInfo* info, uint64_t n )
+{
+    if ( n + 1 < info->chunkCount )
+        return info->chunkSize;
+
+    return (size_t)( info->dataLength - n * info->chunkSize );
+}
+
+// opens chunks f .. l, copies what lies in [offset, offset + len) to out.
+static int ctOpenRange( L2FCTCTX* ctctx, uint64_t f, uint64_t l,
+                        uint64_t offset, uint8_t* out, size_t len )
+{
+    const containerInfo* info   = &ctctx->info;
+    size_t               stride = ctStride( info );
+    size_t               batch  = ctBatch( ctctx->threads, stride );
+    containerJob         cj;
+
+    ctctx->buf.resize( batch * stride );
+
+    for ( uint64_t c=f; c<=l; c+=batch )
+    {
+        size_t   cnt  = ( l - c + 1 < batch ) ? (size_t)( l - c + 1 ) : batch;
+        uint64_t e    = c + cnt - 1;
+        size_t   elen = ctChunkLen( info, e );
+        size_t   rlen = ( cnt - 1 ) * stride + elen +
+                        ( ( info->flags & CONTAINER_INDEX ) ? 0 : GCM_TAG_SIZE );
+
+        if ( fseeko( ctctx->fp, ctctx->base + CONTAINER_HDRSZ + (off_t)( c * stride ),
+                     SEEK_SET ) != 0 )
+            return STREAM_IO_FAIL;
+
+        if ( fread( ctctx->buf.data(), 1, rlen, ctctx->fp ) != rlen )
+            return ferror( ctctx->fp ) ? STREAM_IO_FAIL : BAD_CONTAINER;
+
+        int reti = ctRun( ctctx, &cj, DIR_DECRYPT, c, cnt,
+                          info->chunkCount - 1, ctChunkLen( info, info->chunkCount - 1 ) );
+        if ( reti != TF_SUCCESS )
+            return reti;
+
+        for ( uint64_t n=c; n<=e; n++ )
+        {
+            size_t   clen = ctChunkLen( info, n );
+            uint64_t cofs = n * info->chunkSize;
+
+            ctctx->stats.bytes += clen;
+
+            if ( out == NULL )
+                continue;
+
+            uint64_t from = ( offset > cofs ) ? offset : cofs;
+            uint64_t to   = ( offset + len < cofs + clen ) ? offset + len : cofs + clen;
+
+            if ( from < to )
+                memcpy( out + ( from - offset ),
+                        ctctx->buf.data() + ( n - c ) * stride + ( from - cofs ),
+                        (size_t)( to - from ) );
+        }
+    }
+
+    return TF_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+TwoFishContainer::TwoFishContainer( size_t threadCnt )
+ : context( NULL )
+{
+    L2FCTCTX* ctctx = new L2FCTCTX;
+    if ( ctctx == NULL )
+        return;
+
+    if ( threadCnt == 0 )
+        threadCnt = std::thread::hardware_concurrency();
+
+    ctctx->threads = ( threadCnt > 0 ) ? threadCnt : 1;
+    ctctx->key     = NULL;
+    ctctx->fp      = NULL;
+    ctctx->base    = 0;
+    memset( ctctx->hdr, 0, CONTAINER_HDRSZ );
+    memset( &ctctx->info, 0, sizeof( containerInfo ) );
+    memset( &ctctx->stats, 0, sizeof( containerStats ) );
+
+    context = (void*)ctctx;
+}
+
+TwoFishContainer::~TwoFishContainer()
+{
+    TOCTCTX( ctctx );
+
+    if ( ctctx == NULL )
+        return;
+
+    // plain text of last batch.
+    if ( ctctx->buf.empty() == false )
+        memset( ctctx->buf.data(), 0, ctctx->buf.size() );
+
+    context = NULL;
+    delete ctctx;
+}
+
+int TwoFishContainer::Seal( keyInstance* key, FILE* in, FILE* out,
+                            size_t chunkSize, uint32_t flags )
+{
+    TOCTCTX( ctctx );
+
+    if ( ( ctctx == NULL ) || ( key == NULL ) || ( key->keySig != VALID_SIG ) ||
+         ( in == NULL ) || ( out == NULL ) ||
+         ( chunkSize == 0 ) || ( chunkSize > CONTAINER_MAXCHUNK ) ||
+         ( ( flags & ~CONTAINER_INDEX ) != 0 ) )
+        return BAD_PARAMS;
+
+    off_t base = ftello( out );
+    if ( base < 0 )
+        return BAD_PARAMS;
+
+    Close();
+    memset( &ctctx->stats, 0, sizeof( containerStats ) );
+
+    ctPrepareKey( key );
+    ctctx->key = key;
+
+    uint8_t* hdr = ctctx->hdr;
+    std::random_device rnd;
+
+    memset( hdr, 0, CONTAINER_HDRSZ );
+    memcpy( hdr, CT_MAGIC, 4 );
+    hdr[ CT_OFS_VER ]   = CT_VERSION;
+    hdr[ CT_OFS_FLAGS ] = (uint8_t)flags;
+    ctStore( hdr + CT_OFS_CHUNK, chunkSize, 4 );
+    for ( size_t cnt=0; cnt<CT_IDSZ; cnt+=4 )
+        ctStore( hdr + CT_OFS_ID + cnt, rnd(), 4 );
+
+    ctctx->info.chunkSize = (uint32_t)chunkSize;
+    ctctx->info.flags     = flags;
+    ctctx->index.clear();
+
+    if ( fwrite( hdr, 1, CONTAINER_HDRSZ, out ) != CONTAINER_HDRSZ )
+        return STREAM_IO_FAIL;
+
+    size_t       stride = ctStride( &ctctx->info );
+    size_t       batch  = ctBatch( ctctx->threads, stride );
+    uint64_t     done   = 0;
+    uint64_t     total  = 0;
+    bool         eof    = false;
+    containerJob cj;
+
+    ctctx->buf.resize( batch * stride );
+
+    while ( eof == false )
+    {
+        size_t cnt     = 0;
+        size_t lastLen = chunkSize;
+
+        while ( ( cnt < batch ) && ( eof == false ) )
+        {
+            uint8_t* p = ctctx->buf.data() + cnt * stride;
+            size_t   r = fread( p, 1, chunkSize, in );
+
+            if ( ( r < chunkSize ) && ( ferror( in ) != 0 ) )
+                return STREAM_IO_FAIL;
+
+            total += r;
+            cnt++;
+
+            // a full chunk is the last when nothing follows.
+            if ( r == chunkSize )
+            {
+                int c = fgetc( in );
+                if ( c == EOF )
+                {
+                    if ( ferror( in ) != 0 )
+                        return STREAM_IO_FAIL;
+                    eof = true;
+                }
+                else
+                    ungetc( c, in );
+            }
+            else
+            {
+                eof     = true;
+                lastLen = r;
+            }
+        }
+
+        if ( ctctx->info.flags & CONTAINER_INDEX )
+            ctctx->index.resize( ( done + cnt ) * GCM_TAG_SIZE );
+
+        uint64_t lastChunk = eof ? done + cnt - 1 : CT_NOLAST;
+
+        int reti = ctRun( ctctx, &cj, DIR_ENCRYPT, done, cnt, lastChunk, lastLen );
+        if ( reti != TF_SUCCESS )
+            return reti;
+
+        size_t wlen = ( cnt - 1 ) * stride + lastLen +
+                      ( ( flags & CONTAINER_INDEX ) ? 0 : GCM_TAG_SIZE );
+
+        if ( fwrite( ctctx->buf.data(), 1, wlen, out ) != wlen )
+            return STREAM_IO_FAIL;
+
+        done += cnt;
+    }
+
+    ctctx->stats.bytes = total;
+
+    if ( ( flags & CONTAINER_INDEX ) &&
+         ( fwrite( ctctx->index.data(), 1, ctctx->index.size(), out ) != ctctx->index.size() ) )
+        return STREAM_IO_FAIL;
+
+    // length goes in last, then out is left after the container.
+    off_t end = ftello( out );
+
+    ctStore( hdr + CT_OFS_LENGTH, total, 8 );
+
+    if ( ( end < 0 ) ||
+         ( fseeko( out, base + CT_OFS_LENGTH, SEEK_SET ) != 0 ) ||
+         ( fwrite( hdr + CT_OFS_LENGTH, 1, 8, out ) != 8 ) ||
+         ( fseeko( out, end, SEEK_SET ) != 0 ) ||
+         ( fflush( out ) != 0 ) )
+        return STREAM_IO_FAIL;
+
+    memset( ctctx->buf.data(), 0, ctctx->buf.size() );
+    ctctx->key = NULL;
+
+    return TF_SUCCESS;
+}
+
+int TwoFishContainer::Open( keyInstance* key, FILE* fp )
+{
+    TOCTCTX( ctctx );
+
+    if ( ( ctctx == NULL ) || ( key == NULL ) || ( key->keySig != VALID_SIG ) ||
+         ( fp == NULL ) )
+        return BAD_PARAMS;
+
+    Close();
+
+    off_t    base = ftello( fp );
+    uint8_t* hdr  = ctctx->hdr;
+
+    if ( base < 0 )
+        return BAD_PARAMS;
+
+    if ( fread( hdr, 1, CONTAINER_HDRSZ, fp ) != CONTAINER_HDRSZ )
+        return ferror( fp ) ? STREAM_IO_FAIL : BAD_CONTAINER;
+
+    containerInfo* info = &ctctx->info;
+
+    info->chunkSize  = (uint32_t)ctLoad( hdr + CT_OFS_CHUNK, 4 );
+    info->flags      = hdr[ CT_OFS_FLAGS ];
+    info->dataLength = ctLoad( hdr + CT_OFS_LENGTH, 8 );
+
+    if ( ( memcmp( hdr, CT_MAGIC, 4 ) != 0 ) || ( hdr[ CT_OFS_VER ] != CT_VERSION ) ||
+         ( ( info->flags & ~CONTAINER_INDEX ) != 0 ) ||
+         ( info->chunkSize == 0 ) || ( info->chunkSize > CONTAINER_MAXCHUNK ) ||
+         ( info->dataLength > ( UINT64_MAX >> 1 ) ) )
+    {
+        memset( info, 0, sizeof( containerInfo ) );
+        return BAD_CONTAINER;
+    }
+
+    info->chunkCount = ( info->dataLength == 0 ) ? 1 :
+                       ( info->dataLength + info->chunkSize - 1 ) / info->chunkSize;
+
+    // header fields aren't authenticated : what they ask for must be in
+    // the file before anything is allocated for it.
+    off_t fend = -1;
+
+    if ( fseeko( fp, 0, SEEK_END ) == 0 )
+        fend = ftello( fp );
+
+    if ( ( fend < 0 ) ||
+         ( fseeko( fp, base + CONTAINER_HDRSZ, SEEK_SET ) != 0 ) )
+    {
+        memset( info, 0, sizeof( containerInfo ) );
+        return STREAM_IO_FAIL;
+    }
+
+    if ( ( info->chunkCount > ( UINT64_MAX >> 6 ) ) ||
+         ( (uint64_t)( fend - base ) <
+           CONTAINER_HDRSZ + info->dataLength + info->chunkCount * GCM_TAG_SIZE ) ||
+         ( info->chunkCount * GCM_TAG_SIZE > SIZE_MAX ) )
+    {
+        memset( info, 0, sizeof( containerInfo ) );
+        return BAD_CONTAINER;
+    }
+
+    if ( info->flags & CONTAINER_INDEX )
+    {
+        size_t isz = (size_t)( info->chunkCount * GCM_TAG_SIZE );
+
+        ctctx->index.resize( isz );
+
+        if ( ( fseeko( fp, base + CONTAINER_HDRSZ + (off_t)info->dataLength,
+                       SEEK_SET ) != 0 ) ||
+             ( fread( ctctx->index.data(), 1, isz, fp ) != isz ) )
+        {
+            memset( info, 0, sizeof( containerInfo ) );
+            ctctx->index.clear();
+            return ferror( fp ) ? STREAM_IO_FAIL : BAD_CONTAINER;
+        }
+    }
+
+    ctPrepareKey( key );
+
+    ctctx->key  = key;
+    ctctx->fp   = fp;
+    ctctx->base = base;
+
+    return TF_SUCCESS;
+}
+
+int TwoFishContainer::GetInfo( containerInfo* info )
+{
+    TOCTCTX( ctctx );
+
+    if ( ( ctctx == NULL ) || ( info == NULL ) || ( ctctx->fp == NULL ) )
+        return BAD_PARAMS;
+
+    *info = ctctx->info;
+
+    return TF_SUCCESS;
+}
+
+long TwoFishContainer::Read( uint64_t offset, uint8_t* out, size_t len )
+{
+    TOCTCTX( ctctx );
+
+    if ( ( ctctx == NULL ) || ( ctctx->fp == NULL ) ||
+         ( ( out == NULL ) && ( len > 0 ) ) )
+        return BAD_PARAMS;
+
+    memset( &ctctx->stats, 0, sizeof( containerStats ) );
+
+    const containerInfo* info = &ctctx->info;
+
+    if ( ( offset >= info->dataLength ) || ( len == 0 ) )
+        return 0;
+
+    if ( len > info->dataLength - offset )
+        len = (size_t)( info->dataLength - offset );
+
+    int reti = ctOpenRange( ctctx, offset / info->chunkSize,
+                            ( offset + len - 1 ) / info->chunkSize,
+                            offset, out, len );
+    if ( reti != TF_SUCCESS )
+    {
+        memset( out, 0, len );
+        return reti;
+    }
+
+    return (long)len;
+}
+
+int TwoFishContainer::Verify()
+{
+    TOCTCTX( ctctx );
+
+    if ( ( ctctx == NULL ) || ( ctctx->fp == NULL ) )
+        return BAD_PARAMS;
+
+    memset( &ctctx->stats, 0, sizeof( containerStats ) );
+
+    return ctOpenRange( ctctx, 0, ctctx->info.chunkCount - 1, 0, NULL, 0 );
+}
+
+void TwoFishContainer::Close()
+{
+    TOCTCTX( ctctx );
+
+    if ( ctctx == NULL )
+        return;
+
+    if ( ctctx->buf.empty() == false )
+        memset( ctctx->buf.data(), 0, ctctx->buf.size() );
+
+    ctctx->fp  = NULL;
+    ctctx->key = NULL;
+    ctctx->index.clear();
+    memset( &ctctx->info, 0, sizeof( containerInfo ) );
+}
+
+void TwoFishContainer::GetStats( containerStats* stats )
+{
+    TOCTCTX( ctctx );
+
+    if ( ( ctctx == NULL ) || ( stats == NULL ) )
+        return;
+
+    *stats = ctctx->stats;
+}
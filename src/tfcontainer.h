@@ -0,0 +1,90 @@
+#ifndef __TFCONTAINER_H__
+#define __TFCONTAINER_H__
+
+/**
+* libtwofish seekable container
+* ========================================================
+* File format of fixed size chunks, each sealed on its own with GCM :
+* nonce from a random file id and the chunk index, tag per chunk.  Any
+* byte range is read by decrypting only the chunks under it, and chunks
+* are sealed or checked in parallel on the library thread pool.
+*
+* Layout, offsets from where the container starts in its file :
+*   header    CONTAINER_HDRSZ bytes, magic, chunk size, length, file id
+*   chunks    chunk n at header + n x ( chunkSize + tag ), tag inline,
+*             or at header + n x chunkSize with CONTAINER_INDEX
+*   index     CONTAINER_INDEX only : tags of all chunks after the data
+* The last chunk is sealed as last, a cut or grown file fails its tag.
+*
+* (C)2021, Raphael Kim
+**/
+
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+
+#include "tfish.h"
+#include "tfgcm.h"
+
+#define CONTAINER_CHUNK     ( 64 * 1024 )   /* default chunkSize */
+#define CONTAINER_HDRSZ     64
+#define CONTAINER_MAXCHUNK  ( 64 * 1024 * 1024 )
+
+/* flags */
+#define CONTAINER_INDEX     0x01    /* tags in an index, chunks at plain offsets */
+
+#define BAD_CONTAINER       -17     /* not a container, or its header is damaged */
+
+typedef struct
+{
+    uint64_t dataLength;    /* plain bytes */
+    uint64_t chunkCount;    /* an empty container has one, empty */
+    uint32_t chunkSize;
+    uint32_t flags;
+} containerInfo;
+
+typedef struct
+{
+    uint64_t bytes;         /* plain bytes sealed or opened */
+    uint64_t chunks;
+    uint64_t batches;       /* thread pool runs */
+} containerStats;
+
+class TwoFishContainer
+{
+    public:
+        /* threadCnt 0 : a thread per CPU. */
+        TwoFishContainer( size_t threadCnt = 0 );
+        ~TwoFishContainer();
+
+    public:
+        /* in read to its end and written to out as a container, from the
+           position of out, which must be seekable : header is completed
+           last.  key is expanded and turned to DIR_ENCRYPT, one key may
+           seal many containers.  TF_SUCCESS or error code.
+        */
+        int  Seal( keyInstance* key, FILE* in, FILE* out,
+                   size_t chunkSize = CONTAINER_CHUNK, uint32_t flags = 0 );
+
+    public:
+        /* container at position of fp, which stays the caller's until
+           Close().  Reads the header, and the index if any.
+        */
+        int  Open( keyInstance* key, FILE* fp );
+        int  GetInfo( containerInfo* info );
+        /* plain bytes from offset, clipped to the end of data : # bytes
+           or error code.  Only the chunks under the range are read and
+           checked, out is wiped on BAD_GCM_TAG.
+        */
+        long Read( uint64_t offset, uint8_t* out, size_t len );
+        /* every chunk checked, nothing written.  TF_SUCCESS or BAD_GCM_TAG. */
+        int  Verify();
+        void Close();
+        /* of last Seal(), Read() or Verify(). */
+        void GetStats( containerStats* stats );
+
+    public:
+        void* context;
+};
+
+#endif /// of __TFCONTAINER_H__
@@ -0,0 +1,288 @@
+/***************************************************************************
+    tfdatagram.cpp
+
+  ------------------------------------------------------------------------
+
+    CTR over mmsghdr batches, one ECB call for the key stream of many.
+
+    (C)2021, Raphael Kim
+
+    Notes:
+        *   Datagrams are taken in groups whose counter blocks fill the
+            key stream buffer, DG_KSBLOCKS at most : a batch of small
+            datagrams is one ECB call, a batch of big ones a few.
+        *   Header and payload may lie over any number of iovecs, bytes
+            are walked iovec by iovec, never gathered.
+        *   Needs struct mmsghdr, Linux only.
+        *   Tab size is set to 4 characters in this file
+
+***************************************************************************/
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include <vector>
+
+#if defined(__linux__)
+    #include <sys/types.h>
+    #include <sys/socket.h>
+    #include <sys/uio.h>
+#endif
+
+#include "tfish.h"
+#include "tfdatagram.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define DG_BLOCK        ( BLOCK_SIZE/8 )
+#define DG_KSBLOCKS     16384               /* key stream blocks per ECB call */
+
+typedef struct
+{
+    size_t                  msg;        /* index in batch */
+    size_t                  len;        /* payload bytes */
+    size_t                  ks;         /* first key stream block */
+}dgramPending;
+
+typedef struct
+{
+    keyInstance*            key;
+    size_t                  hdrLen;
+    size_t                  nonceOfs;
+    cipherInstance          ecb;
+    std::vector< uint8_t >  ks;
+    std::vector< dgramPending > pend;
+    dgramStats              stats;
+}libTwoFishDatagramContext;
+
+#define L2FDGCTX        libTwoFishDatagramContext
+#define TODGCTX(_x_)    L2FDGCTX* _x_ = (L2FDGCTX*)context
+
+////////////////////////////////////////////////////////////////////////////////
+
+#if defined(__linux__)
+// bytes ofs .. ofs + len - 1 of a datagram copied out of its iovecs.
+static void dgCopy( const struct msghdr* h, size_t ofs, uint8_t* dst, size_t len )
+{
+    for ( size_t n=0; ( n < h->msg_iovlen ) && ( len > 0 ); n++ )
+    {
+        size_t ilen = h->msg_iov[n].iov_len;
+
+        if ( ofs >= ilen )
+        {
+            ofs -= ilen;
+            continue;
+        }
+
+        size_t take = ( ilen - ofs < len ) ? ilen - ofs : len;
+
+        memcpy( dst, (const uint8_t*)h->msg_iov[n].iov_base + ofs, take );
+        dst += take;
+        len -= take;
+        ofs  = 0;
+    }
+}
+
+// key stream ks over bytes ofs .. ofs + len - 1, in their iovecs.
+static void dgXor( struct msghdr* h, size_t ofs, const uint8_t* ks, size_t len )
+{
+    for ( size_t n=0; ( n < h->msg_iovlen ) && ( len > 0 ); n++ )
+    {
+        size_t ilen = h->msg_iov[n].iov_len;
+
+        if ( ofs >= ilen )
+        {
+            ofs -= ilen;
+            continue;
+        }
+
+        uint8_t* p    = (uint8_t*)h->msg_iov[n].iov_base + ofs;
+        size_t   take = ( ilen - ofs < len ) ? ilen - ofs : len;
+
+        for ( size_t cnt=0; cnt<take; cnt++ )
+            p[ cnt ] ^= ks[ cnt ];
+
+        ks  += take;
+        len -= take;
+        ofs  = 0;
+    }
+}
+
+// key stream of pending datagrams in one ECB call, then applied.
+static int dgFlush( L2FDGCTX* dgctx, struct mmsghdr* msgs, size_t blocks )
+{
+    if ( blocks == 0 )
+        return TF_SUCCESS;
+
+    int reti = blockEncrypt( &dgctx->ecb, dgctx->key, dgctx->ks.data(),
+                             blocks * BLOCK_SIZE, dgctx->ks.data() );
+    if ( reti < 0 )
+        return reti;
+
+    for ( size_t n=0; n<dgctx->pend.size(); n++ )
+    {
+        dgramPending* dp = &dgctx->pend[n];
+
+        dgXor( &msgs[ dp->msg ].msg_hdr, dgctx->hdrLen,
+               dgctx->ks.data() + dp->ks * DG_BLOCK, dp->len );
+
+        dgctx->stats.datagrams++;
+        dgctx->stats.bytes += dp->len;
+    }
+
+    dgctx->stats.batches++;
+    dgctx->pend.clear();
+
+    return TF_SUCCESS;
+}
+
+static int dgCrypt( L2FDGCTX* dgctx, struct mmsghdr* msgs, size_t cnt,
+                    int* results, bool received )
+{
+    int    ret    = TF_SUCCESS;
+    size_t blocks = 0;
+
+    dgctx->pend.clear();
+
+    for ( size_t n=0; n<cnt; n++ )
+    {
+        struct msghdr* h   = &msgs[n].msg_hdr;
+        size_t         len = 0;
+
+        if ( received == true )
+            len = msgs[n].msg_len;
+        else
+            for ( size_t v=0; v<h->msg_iovlen; v++ )
+                len += h->msg_iov[v].iov_len;
+
+        if ( ( len < dgctx->hdrLen ) || ( len > DGRAM_MAXLEN ) ||
+             ( ( received == true ) && ( ( h->msg_flags & MSG_TRUNC ) != 0 ) ) )
+        {
+            if ( results != NULL )
+                results[n] = BAD_INPUT_LEN;
+            if ( ret == TF_SUCCESS )
+                ret = BAD_INPUT_LEN;
+
+            dgctx->stats.rejected++;
+            continue;
+        }
+
+        if ( results != NULL )
+            results[n] = TF_SUCCESS;
+
+        len -= dgctx->hdrLen;
+
+        size_t nb = ( len + DG_BLOCK - 1 ) / DG_BLOCK;
+
+        if ( blocks + nb > DG_KSBLOCKS )
+        {
+            int reti = dgFlush( dgctx, msgs, blocks );
+            if ( reti != TF_SUCCESS )
+                return reti;
+            blocks = 0;
+        }
+
+        // counter blocks : nonce, then block number big endian.
+        uint8_t  nonce[ DGRAM_NONCESZ ];
+        uint8_t* cb = dgctx->ks.data() + blocks * DG_BLOCK;
+
+        dgCopy( h, dgctx->nonceOfs, nonce, DGRAM_NONCESZ );
+
+        for ( size_t b=0; b<nb; b++, cb+=DG_BLOCK )
+        {
+            memcpy( cb, nonce, DGRAM_NONCESZ );
+            for ( size_t cnt=0; cnt<8; cnt++ )
+                cb[ DGRAM_NONCESZ + cnt ] = (uint8_t)( (uint64_t)b >> ( ( 7 - cnt ) * 8 ) );
+        }
+
+        dgramPending dp = { n, len, blocks };
+
+        dgctx->pend.push_back( dp );
+        blocks += nb;
+    }
+
+    int reti = dgFlush( dgctx, msgs, blocks );
+
+    return ( reti != TF_SUCCESS ) ? reti : ret;
+}
+#endif /// of __linux__
+
+////////////////////////////////////////////////////////////////////////////////
+
+TwoFishDatagram::TwoFishDatagram( keyInstance* key, size_t hdrLen, size_t nonceOfs )
+ : context( NULL )
+{
+    if ( ( key == NULL ) || ( key->keySig != VALID_SIG ) ||
+         ( nonceOfs + DGRAM_NONCESZ > hdrLen ) || ( hdrLen > DGRAM_MAXLEN ) )
+        return;
+
+    L2FDGCTX* dgctx = new L2FDGCTX;
+    if ( dgctx == NULL )
+        return;
+
+    expandKey( key );
+    if ( key->direction != DIR_ENCRYPT )
+        ReverseRoundSubkeys( key, DIR_ENCRYPT );
+
+    dgctx->key      = key;
+    dgctx->hdrLen   = hdrLen;
+    dgctx->nonceOfs = nonceOfs;
+    dgctx->ks.resize( DG_KSBLOCKS * DG_BLOCK );
+    cipherInit( &dgctx->ecb, MODE_ECB, NULL );
+    memset( &dgctx->stats, 0, sizeof( dgramStats ) );
+
+    context = (void*)dgctx;
+}
+
+TwoFishDatagram::~TwoFishDatagram()
+{
+    TODGCTX( dgctx );
+
+    if ( dgctx == NULL )
+        return;
+
+    memset( dgctx->ks.data(), 0, dgctx->ks.size() );
+
+    context = NULL;
+    delete dgctx;
+}
+
+int TwoFishDatagram::Encrypt( struct mmsghdr* msgs, size_t cnt, int* results )
+{
+    TODGCTX( dgctx );
+
+    if ( ( dgctx == NULL ) || ( ( msgs == NULL ) && ( cnt > 0 ) ) )
+        return BAD_PARAMS;
+
+#if !defined(__linux__)
+    return BAD_PARAMS;
+#else
+    return dgCrypt( dgctx, msgs, cnt, results, false );
+#endif /// of __linux__
+}
+
+int TwoFishDatagram::Decrypt( struct mmsghdr* msgs, size_t cnt, int* results )
+{
+    TODGCTX( dgctx );
+
+    if ( ( dgctx == NULL ) || ( ( msgs == NULL ) && ( cnt > 0 ) ) )
+        return BAD_PARAMS;
+
+#if !defined(__linux__)
+    return BAD_PARAMS;
+#else
+    return dgCrypt( dgctx, msgs, cnt, results, true );
+#endif /// of __linux__
+}
+
+void TwoFishDatagram::GetStats( dgramStats* stats )
+{
+    TODGCTX( dgctx );
+
+    if ( ( dgctx == NULL ) || ( stats == NULL ) )
+        return;
+
+    *stats = dgctx->stats;
+}
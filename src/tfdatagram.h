@@ -0,0 +1,72 @@
+#ifndef __TFDATAGRAM_H__
+#define __TFDATAGRAM_H__
+
+/**
+* libtwofish datagram batches
+* ========================================================
+* CTR over whole batches of datagrams, as recvmmsg() fills and sendmmsg()
+* takes them : struct mmsghdr arrays, ciphered in place in their iovecs.
+* Counter blocks of every datagram of a batch are made first and go
+* through one ECB call, then each datagram takes its part of the key
+* stream.  A datagram per call was the packet rate ceiling.
+*
+* A datagram is a plain header of hdrLen bytes, then the payload that is
+* ciphered.  The header has the datagram's 8 byte nonce at nonceOfs :
+* block n of the payload is ciphered by counter nonce || n, n 64 bit big
+* endian.  The sender sets nonces, and must never use one twice with a
+* key.  No authentication : datagrams are kept private, not unforged.
+*
+* (C)2021, Raphael Kim
+**/
+
+#include <cstdint>
+#include <cstddef>
+
+#include "tfish.h"
+
+#define DGRAM_HDRSZ         16              /* default hdrLen */
+#define DGRAM_NONCEOFS      8               /* default nonceOfs */
+#define DGRAM_NONCESZ       8
+#define DGRAM_MAXLEN        65536           /* datagram bytes */
+
+struct mmsghdr;
+
+typedef struct
+{
+    uint64_t datagrams;     /* ciphered */
+    uint64_t bytes;         /* payload bytes ciphered */
+    uint64_t batches;       /* ECB calls */
+    uint64_t rejected;      /* short or truncated */
+} dgramStats;
+
+class TwoFishDatagram
+{
+    public:
+        /* key stays the caller's, read only from here on : expanded and
+           turned to DIR_ENCRYPT now.  nonceOfs + DGRAM_NONCESZ must fit
+           in hdrLen.  An object per thread, objects may share a key.
+        */
+        TwoFishDatagram( keyInstance* key, size_t hdrLen = DGRAM_HDRSZ,
+                         size_t nonceOfs = DGRAM_NONCEOFS );
+        ~TwoFishDatagram();
+
+    public:
+        /* payloads of cnt datagrams to send ciphered in place, a datagram
+           being all bytes of its msg_iov.  results, if not NULL, gets
+           TF_SUCCESS or BAD_INPUT_LEN for each ; the first error is
+           returned, other datagrams are ciphered still.
+        */
+        int  Encrypt( struct mmsghdr* msgs, size_t cnt, int* results = NULL );
+        /* payloads of cnt datagrams recvmmsg() returned deciphered in
+           place, a datagram being its msg_len bytes.  One cut short
+           ( MSG_TRUNC ) or shorter than a header is left as it is,
+           BAD_INPUT_LEN.
+        */
+        int  Decrypt( struct mmsghdr* msgs, size_t cnt, int* results = NULL );
+        void GetStats( dgramStats* stats );
+
+    public:
+        void* context;
+};
+
+#endif /// of __TFDATAGRAM_H__
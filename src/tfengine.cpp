@@ -0,0 +1,894 @@
+/***************************************************************************
+    tfengine.cpp
+
+  ------------------------------------------------------------------------
+
+    Crypto job engine, work-stealing workers over lock-free rings.
+
+    (C)2021, Raphael Kim
+
+    Notes:
+        *   Rings are bounded MPMC queues of job pointers, every cell has
+            a sequence number telling whether it is free for the push of
+            a lap or filled for its pop.  No locks on submit, take, or
+            poll.
+        *   Submit() spreads jobs over worker rings round-robin, a worker
+            with an empty ring steals from the next ones.  A queue never
+            has more jobs pending than its completion ring holds, so a
+            worker can always post a completion.
+        *   Idle workers nap on a condition variable.  A wakeup lost to
+            the race with Submit() only costs up to EG_NAP of latency.
+        *   ENGINE_NUMA reads node CPU lists from sysfs and asks the kernel
+            for the node of an input page (get_mempolicy), without libnuma.
+        *   With ENGINE_NUMA every worker keeps copies of the keys it
+            ciphers with, EG_WORKER_KEYS at most, in a key arena it makes
+            once pinned : first touched on its node, and touched by no
+            other thread, so no locks.  A key is looked up once a batch,
+            the least recently used copy is wiped to make room, and
+            ReleaseKey() has every worker wipe its copy.
+        *   Tab size is set to 4 characters in this file
+
+***************************************************************************/
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#if defined(__linux__)
+    #include <sched.h>
+    #include <pthread.h>
+    #include <unistd.h>
+    #include <sys/syscall.h>
+#endif
+
+#include "tfish.h"
+#include "tfkeyarena.h"
+#include "tfengine.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define EG_LINE         64                          /* padding between hot counters */
+#define EG_SPINS        64                          /* empty takes before napping */
+#define EG_NAP          std::chrono::milliseconds( 2 )
+#define EG_MAX_NODES    64                          /* node ids looked up */
+#define EG_WORKER_KEYS  32                          /* key copies per worker */
+/* one slab holds them all : a slot is a key, its head and alignment */
+#define EG_ARENA_SZ     ( EG_WORKER_KEYS * ( sizeof( keyInstance ) + 3 * EG_LINE ) )
+
+#ifndef MPOL_F_NODE
+    #define MPOL_F_NODE     ( 1 << 0 )
+    #define MPOL_F_ADDR     ( 1 << 1 )
+#endif
+
+typedef struct
+{
+    std::atomic< size_t >   seq;
+    engineJob*              job;
+}engineCell;
+
+typedef struct
+{
+    engineCell*             cells;
+    size_t                  mask;
+    uint8_t                 pad0[ EG_LINE ];
+    std::atomic< size_t >   head;       /* next to pop */
+    uint8_t                 pad1[ EG_LINE ];
+    std::atomic< size_t >   tail;       /* next to push */
+    uint8_t                 pad2[ EG_LINE ];
+}engineRing;
+
+typedef struct
+{
+    engineRing              done;
+    size_t                  depth;
+    std::atomic< size_t >   pending;    /* submitted, not polled */
+}engineQueue;
+
+typedef struct
+{
+    std::vector< size_t >       rings;      /* of workers on node */
+    std::atomic< size_t >       next;
+}engineNode;
+
+typedef struct
+{
+    const keyInstance*          orig;       /* NULL : unused */
+    keyInstance*                copy;
+    uint64_t                    used;       /* batch last used in */
+}engineKeyCopy;
+
+typedef struct
+{
+    TwoFishKeyArena*            arena;      /* made by the worker, pinned */
+    engineKeyCopy               keys[ EG_WORKER_KEYS ];
+    uint64_t                    batches;
+    std::atomic< uint64_t >     seen;       /* release epoch done */
+    uint8_t                     pad[ EG_LINE ];
+}engineWorkerKeys;
+
+typedef struct
+{
+    std::vector< std::thread >  workers;
+    std::vector< int >          workerCpu;  /* -1 : not pinned */
+    std::vector< size_t >       workerNode;
+    std::vector< std::vector< size_t > > stealOrder;    /* same node first */
+    engineNode*                 nodes;
+    engineWorkerKeys*           wkeys;      /* one per worker, its own */
+    size_t                      nodeCnt;
+    int                         nodeIndex[ EG_MAX_NODES ];  /* node id -> nodes[] */
+    unsigned                    flags;
+    engineRing*                 rings;      /* one per worker */
+    size_t                      ringCnt;
+    engineQueue*                queues[ ENGINE_MAX_QUEUES ];
+    std::atomic< int >          queueCnt;
+    std::mutex                  qlock;      /* OpenQueue() */
+    std::atomic< size_t >       nextRing;
+    std::atomic< size_t >       inflight;   /* in worker rings */
+    std::atomic< size_t >       sleepers;
+    std::atomic< bool >         quit;
+    std::mutex                  rlock;      /* ReleaseKey() */
+    std::atomic< const keyInstance* > releasing;
+    std::atomic< uint64_t >     epoch;      /* ReleaseKey() calls */
+    std::mutex                  lock;
+    std::condition_variable     wake;
+}libTwoFishEngineContext;
+
+#define L2FEGCTX        libTwoFishEngineContext
+#define TOEGCTX(_x_)    L2FEGCTX* _x_ = (L2FEGCTX*)context
+
+////////////////////////////////////////////////////////////////////////////////
+
+static bool ringInit( engineRing* r, size_t depth )
+{
+    size_t cnt = 2;
+
+    while ( cnt < depth )
+        cnt <<= 1;
+
+    r->cells = new engineCell[ cnt ];
+    if ( r->cells == NULL )
+        return false;
+
+    for ( size_t n=0; n<cnt; n++ )
+    {
+        r->cells[n].seq = n;
+        r->cells[n].job = NULL;
+    }
+
+    r->mask = cnt - 1;
+    r->head = 0;
+    r->tail = 0;
+
+    return true;
+}
+
+static void ringFree( engineRing* r )
+{
+    delete[] r->cells;
+    r->cells = NULL;
+}
+
+static bool ringPush( engineRing* r, engineJob* job )
+{
+    size_t      pos = r->tail.load( std::memory_order_relaxed );
+    engineCell* cell;
+
+    for (;;)
+    {
+        cell = &r->cells[ pos & r->mask ];
+
+        size_t   seq = cell->seq.load( std::memory_order_acquire );
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+
+        if ( dif == 0 )
+        {
+            if ( r->tail.compare_exchange_weak( pos, pos + 1,
+                                                std::memory_order_relaxed ) )
+                break;
+        }
+        else
+        if ( dif < 0 )
+            return false;   /* full */
+        else
+            pos = r->tail.load( std::memory_order_relaxed );
+    }
+
+    cell->job = job;
+    cell->seq.store( pos + 1, std::memory_order_release );
+
+    return true;
+}
+
+static engineJob* ringPop( engineRing* r )
+{
+    size_t      pos = r->head.load( std::memory_order_relaxed );
+    engineCell* cell;
+
+    for (;;)
+    {
+        cell = &r->cells[ pos & r->mask ];
+
+        size_t   seq = cell->seq.load( std::memory_order_acquire );
+        intptr_t dif = (intptr_t)seq - (intptr_t)( pos + 1 );
+
+        if ( dif == 0 )
+        {
+            if ( r->head.compare_exchange_weak( pos, pos + 1,
+                                                std::memory_order_relaxed ) )
+                break;
+        }
+        else
+        if ( dif < 0 )
+            return NULL;    /* empty */
+        else
+            pos = r->head.load( std::memory_order_relaxed );
+    }
+
+    engineJob* job = cell->job;
+    cell->seq.store( pos + r->mask + 1, std::memory_order_release );
+
+    return job;
+}
+
+// CPUs of every NUMA node, by sysfs.  Returns # of nodes, 0 if unknown.
+static size_t engineTopology( std::vector< std::vector< int > >& nodeCpus,
+                              std::vector< int >& nodeIds )
+{
+#if defined(__linux__)
+    for ( int node=0; node<EG_MAX_NODES; node++ )
+    {
+        char path[64];
+        snprintf( path, sizeof( path ),
+                  "/sys/devices/system/node/node%d/cpulist", node );
+
+        FILE* fp = fopen( path, "r" );
+        if ( fp == NULL )
+            continue;
+
+        std::vector< int > cpus;
+        int first, last;
+        char sep;
+
+        // "0-3,8-11"
+        while ( fscanf( fp, "%d", &first ) == 1 )
+        {
+            last = first;
+            if ( ( fscanf( fp, "%c", &sep ) == 1 ) && ( sep == '-' ) )
+            {
+                if ( fscanf( fp, "%d", &last ) != 1 )
+                    break;
+                if ( fscanf( fp, "%c", &sep ) != 1 )
+                    sep = 0;
+            }
+            for ( int cpu=first; cpu<=last; cpu++ )
+                cpus.push_back( cpu );
+            if ( sep != ',' )
+                break;
+        }
+        fclose( fp );
+
+        if ( cpus.size() > 0 )
+        {
+            nodeCpus.push_back( cpus );
+            nodeIds.push_back( node );
+        }
+    }
+#endif
+    return nodeCpus.size();
+}
+
+// node index of page holding p, -1 if unknown.
+static int engineNodeOf( L2FEGCTX* egctx, const void* p )
+{
+#if defined(__linux__) && defined(SYS_get_mempolicy)
+    int node = -1;
+
+    if ( syscall( SYS_get_mempolicy, &node, NULL, 0, p,
+                  MPOL_F_NODE | MPOL_F_ADDR ) != 0 )
+        return -1;
+
+    if ( ( node < 0 ) || ( node >= EG_MAX_NODES ) )
+        return -1;
+
+    return egctx->nodeIndex[ node ];
+#else
+    return -1;
+#endif
+}
+
+static void enginePin( int cpu )
+{
+#if defined(__linux__)
+    if ( cpu < 0 )
+        return;
+
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    CPU_SET( cpu, &set );
+    pthread_setaffinity_np( pthread_self(), sizeof( set ), &set );
+#endif
+}
+
+// wipes copies of key a worker has, all of them if key is NULL.
+static void engineDropKeys( engineWorkerKeys* wk, const keyInstance* key )
+{
+    for ( size_t n=0; n<EG_WORKER_KEYS; n++ )
+    {
+        engineKeyCopy* kc = &wk->keys[n];
+
+        if ( ( kc->orig == NULL ) || ( ( key != NULL ) && ( kc->orig != key ) ) )
+            continue;
+
+        wk->arena->Free( kc->copy );
+        kc->orig = NULL;
+        kc->copy = NULL;
+    }
+}
+
+// a ReleaseKey() not seen yet : copies of its key wiped, then told.
+static void engineCheckRelease( L2FEGCTX* egctx, size_t idx )
+{
+    engineWorkerKeys* wk    = &egctx->wkeys[ idx ];
+    uint64_t          epoch = egctx->epoch.load( std::memory_order_acquire );
+
+    if ( wk->seen.load( std::memory_order_relaxed ) == epoch )
+        return;
+
+    engineDropKeys( wk, egctx->releasing.load( std::memory_order_relaxed ) );
+    wk->seen.store( epoch, std::memory_order_release );
+}
+
+// worker's own copy of key, made on first use.  No locks, no other
+// thread touches the worker's copies.
+static keyInstance* engineLocalKey( L2FEGCTX* egctx, size_t idx, keyInstance* key )
+{
+    engineWorkerKeys* wk  = &egctx->wkeys[ idx ];
+    engineKeyCopy*    hit = NULL;
+    engineKeyCopy*    old = &wk->keys[0];
+
+    for ( size_t n=0; n<EG_WORKER_KEYS; n++ )
+    {
+        engineKeyCopy* kc = &wk->keys[n];
+
+        if ( kc->orig == key )
+        {
+            hit = kc;
+            break;
+        }
+
+        // an unused one, else the least recently used.
+        if ( ( old->orig != NULL ) &&
+             ( ( kc->orig == NULL ) || ( kc->used < old->used ) ) )
+            old = kc;
+    }
+
+    if ( hit != NULL )
+    {
+        hit->used = wk->batches;
+
+        // still the same key ?  jobs of old contents can't be in flight.
+        if ( ( hit->copy->direction != key->direction ) ||
+             ( hit->copy->keyLen != key->keyLen ) ||
+             ( hit->copy->sboxReady != key->sboxReady ) ||
+             ( memcmp( hit->copy->key32, key->key32, sizeof( key->key32 ) ) != 0 ) )
+            memcpy( hit->copy, key, sizeof( keyInstance ) );
+
+        return hit->copy;
+    }
+
+    if ( wk->arena == NULL )
+        wk->arena = new TwoFishKeyArena( EG_ARENA_SZ );
+
+    if ( old->orig != NULL )
+    {
+        wk->arena->Free( old->copy );
+        old->orig = NULL;
+        old->copy = NULL;
+    }
+
+    keyInstance* copy = wk->arena->Alloc();
+    if ( copy == NULL )
+        return key;
+
+    memcpy( copy, key, sizeof( keyInstance ) );
+
+    old->orig = key;
+    old->copy = copy;
+    old->used = wk->batches;
+
+    return copy;
+}
+
+// own ring first, then steal half a batch from the others.
+static size_t engineTake( L2FEGCTX* egctx, size_t idx, engineJob** batch )
+{
+    size_t cnt = 0;
+
+    while ( cnt < ENGINE_BATCH )
+    {
+        engineJob* job = ringPop( &egctx->rings[ idx ] );
+        if ( job == NULL )
+            break;
+        batch[ cnt++ ] = job;
+    }
+
+    const std::vector< size_t >& order = egctx->stealOrder[ idx ];
+
+    for ( size_t n=0; ( cnt == 0 ) && ( n<order.size() ); n++ )
+    {
+        engineRing* r = &egctx->rings[ order[n] ];
+
+        while ( cnt < ENGINE_BATCH/2 )
+        {
+            engineJob* job = ringPop( r );
+            if ( job == NULL )
+                break;
+            batch[ cnt++ ] = job;
+        }
+    }
+
+    if ( cnt > 0 )
+        egctx->inflight -= cnt;
+
+    return cnt;
+}
+
+static void engineComplete( L2FEGCTX* egctx, engineJob* job )
+{
+    engineQueue* q = egctx->queues[ job->queue ];
+
+    if ( job->done != NULL )
+    {
+        // job may be gone after its callback.
+        job->done( job );
+        q->pending--;
+    }
+    else
+        ringPush( &q->done, job );  /* has room, see Submit() */
+}
+
+// one lanes call per direction over a batch.
+static void engineCipher( L2FEGCTX* egctx, size_t idx, engineJob** batch, size_t cnt )
+{
+    laneInstance lanes[ ENGINE_BATCH ];
+    engineJob*   lanejobs[ ENGINE_BATCH ];
+    keyInstance* origs[ ENGINE_BATCH ];     /* keys looked up this batch */
+    keyInstance* copies[ ENGINE_BATCH ];
+    size_t       kcnt = 0;
+    bool         local = ( ( egctx->flags & ENGINE_NUMA ) != 0 );
+
+    egctx->wkeys[ idx ].batches++;
+
+    for ( uint8_t dir=DIR_ENCRYPT; dir<=DIR_DECRYPT; dir++ )
+    {
+        size_t lcnt = 0;
+
+        for ( size_t n=0; n<cnt; n++ )
+        {
+            engineJob* job = batch[n];
+            if ( job->dir != dir )
+                continue;
+
+            keyInstance* key = job->key;
+
+            if ( local == true )
+            {
+                size_t k = 0;
+
+                while ( ( k < kcnt ) && ( origs[k] != key ) )
+                    k++;
+
+                if ( k == kcnt )
+                {
+                    origs[ kcnt ]    = key;
+                    copies[ kcnt++ ] = engineLocalKey( egctx, idx, key );
+                }
+
+                key = copies[k];
+            }
+
+            lanes[ lcnt ].key       = key;
+            lanes[ lcnt ].cipher    = &job->cipher;
+            lanes[ lcnt ].input     = job->input;
+            lanes[ lcnt ].inputLen  = job->inputLen;
+            lanes[ lcnt ].outBuffer = job->outBuffer;
+            lanes[ lcnt ].result    = 0;
+            lanejobs[ lcnt++ ]      = job;
+        }
+
+        if ( lcnt == 0 )
+            continue;
+
+        if ( dir == DIR_ENCRYPT )
+            blockEncryptLanes( lanes, lcnt );
+        else
+            blockDecryptLanes( lanes, lcnt );
+
+        for ( size_t n=0; n<lcnt; n++ )
+        {
+            lanejobs[n]->result = lanes[n].result;
+            engineComplete( egctx, lanejobs[n] );
+        }
+    }
+}
+
+static void engineWorker( L2FEGCTX* egctx, size_t idx )
+{
+    engineJob* batch[ ENGINE_BATCH ];
+    size_t     idle = 0;
+
+    enginePin( egctx->workerCpu[ idx ] );
+
+    for (;;)
+    {
+        engineCheckRelease( egctx, idx );
+
+        size_t cnt = engineTake( egctx, idx, batch );
+
+        if ( cnt > 0 )
+        {
+            engineCipher( egctx, idx, batch, cnt );
+            idle = 0;
+            continue;
+        }
+
+        if ( ( egctx->quit == true ) && ( egctx->inflight == 0 ) )
+        {
+            delete egctx->wkeys[ idx ].arena;   /* wipes key copies */
+            egctx->wkeys[ idx ].arena = NULL;
+            return;
+        }
+
+        if ( ++idle < EG_SPINS )
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::unique_lock< std::mutex > guard( egctx->lock );
+        egctx->sleepers++;
+        egctx->wake.wait_for( guard, EG_NAP,
+                              [&]{ return ( egctx->quit == true ) ||
+                                          ( egctx->inflight > 0 ) ||
+                                          ( egctx->epoch != egctx->wkeys[ idx ].seen ); } );
+        egctx->sleepers--;
+        idle = 0;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+TwoFishEngine::TwoFishEngine( size_t threadCnt, size_t ringDepth, unsigned flags )
+ : context( NULL )
+{
+    if ( threadCnt == 0 )
+        threadCnt = std::thread::hardware_concurrency();
+    if ( threadCnt == 0 )
+        threadCnt = 1;
+
+    L2FEGCTX* egctx = new L2FEGCTX;
+    if ( egctx == NULL )
+        return;
+
+    egctx->rings    = new engineRing[ threadCnt ];
+    egctx->ringCnt  = threadCnt;
+    egctx->queueCnt = 0;
+    egctx->nextRing = 0;
+    egctx->inflight = 0;
+    egctx->sleepers = 0;
+    egctx->quit     = false;
+    egctx->flags    = flags;
+    egctx->releasing = NULL;
+    egctx->epoch    = 0;
+
+    for ( size_t cnt=0; cnt<ENGINE_MAX_QUEUES; cnt++ )
+        egctx->queues[ cnt ] = NULL;
+
+    for ( size_t cnt=0; cnt<EG_MAX_NODES; cnt++ )
+        egctx->nodeIndex[ cnt ] = -1;
+
+    for ( size_t cnt=0; cnt<threadCnt; cnt++ )
+        ringInit( &egctx->rings[ cnt ], ringDepth );
+
+    // place workers : CPUs taken from every node in turn.
+    std::vector< std::vector< int > > nodeCpus;
+    std::vector< int >                nodeIds;
+
+    if ( ( flags & ENGINE_NUMA ) != 0 )
+        engineTopology( nodeCpus, nodeIds );
+
+    if ( nodeCpus.size() == 0 )
+    {
+        nodeCpus.push_back( std::vector< int >() );
+        nodeIds.push_back( 0 );
+    }
+
+    egctx->nodeCnt = nodeCpus.size();
+    egctx->nodes   = new engineNode[ egctx->nodeCnt ];
+
+    for ( size_t cnt=0; cnt<egctx->nodeCnt; cnt++ )
+    {
+        egctx->nodes[ cnt ].next  = 0;
+        if ( nodeIds[ cnt ] < EG_MAX_NODES )
+            egctx->nodeIndex[ nodeIds[ cnt ] ] = (int)cnt;
+    }
+
+    for ( size_t cnt=0; cnt<threadCnt; cnt++ )
+    {
+        size_t node = cnt % egctx->nodeCnt;
+        size_t pick = cnt / egctx->nodeCnt;
+        int    cpu  = -1;
+
+        if ( nodeCpus[ node ].size() > 0 )
+            cpu = nodeCpus[ node ][ pick % nodeCpus[ node ].size() ];
+
+        egctx->workerCpu.push_back( cpu );
+        egctx->workerNode.push_back( node );
+        egctx->nodes[ node ].rings.push_back( cnt );
+    }
+
+    egctx->wkeys = new engineWorkerKeys[ threadCnt ];
+
+    for ( size_t cnt=0; cnt<threadCnt; cnt++ )
+    {
+        engineWorkerKeys* wk = &egctx->wkeys[ cnt ];
+
+        wk->arena   = NULL;
+        wk->batches = 0;
+        wk->seen    = 0;
+        for ( size_t n=0; n<EG_WORKER_KEYS; n++ )
+        {
+            wk->keys[n].orig = NULL;
+            wk->keys[n].copy = NULL;
+            wk->keys[n].used = 0;
+        }
+    }
+
+    // steal from workers of same node before going remote.
+    egctx->stealOrder.resize( threadCnt );
+    for ( size_t cnt=0; cnt<threadCnt; cnt++ )
+    {
+        for ( size_t pass=0; pass<2; pass++ )
+        for ( size_t n=1; n<threadCnt; n++ )
+        {
+            size_t other = ( cnt + n ) % threadCnt;
+            bool   local = ( egctx->workerNode[ other ] == egctx->workerNode[ cnt ] );
+
+            if ( local == ( pass == 0 ) )
+                egctx->stealOrder[ cnt ].push_back( other );
+        }
+    }
+
+    for ( size_t cnt=0; cnt<threadCnt; cnt++ )
+        egctx->workers.push_back( std::thread( engineWorker, egctx, cnt ) );
+
+    context = (void*)egctx;
+}
+
+TwoFishEngine::~TwoFishEngine()
+{
+    TOEGCTX( egctx );
+
+    if ( egctx == NULL )
+        return;
+
+    {
+        std::lock_guard< std::mutex > guard( egctx->lock );
+        egctx->quit = true;
+    }
+    egctx->wake.notify_all();
+
+    for ( size_t cnt=0; cnt<egctx->workers.size(); cnt++ )
+        egctx->workers[ cnt ].join();
+
+    for ( size_t cnt=0; cnt<egctx->ringCnt; cnt++ )
+        ringFree( &egctx->rings[ cnt ] );
+    delete[] egctx->rings;
+
+    delete[] egctx->wkeys;                  /* copies wiped by workers */
+    delete[] egctx->nodes;
+
+    for ( int cnt=0; cnt<egctx->queueCnt; cnt++ )
+    {
+        ringFree( &egctx->queues[ cnt ]->done );
+        delete egctx->queues[ cnt ];
+    }
+
+    context = NULL;
+    delete egctx;
+}
+
+int TwoFishEngine::OpenQueue( size_t depth )
+{
+    TOEGCTX( egctx );
+
+    if ( ( egctx == NULL ) || ( depth == 0 ) )
+        return BAD_PARAMS;
+
+    std::lock_guard< std::mutex > guard( egctx->qlock );
+
+    int qcnt = egctx->queueCnt;
+    if ( qcnt >= ENGINE_MAX_QUEUES )
+        return BAD_PARAMS;
+
+    engineQueue* q = new engineQueue;
+    if ( ( q == NULL ) || ( ringInit( &q->done, depth ) == false ) )
+    {
+        delete q;
+        return BAD_PARAMS;
+    }
+
+    q->depth   = depth;
+    q->pending = 0;
+
+    egctx->queues[ qcnt ] = q;
+    egctx->queueCnt = qcnt + 1;
+
+    return qcnt;
+}
+
+int TwoFishEngine::Submit( int queue, engineJob* job )
+{
+    TOEGCTX( egctx );
+
+    if ( ( egctx == NULL ) || ( job == NULL ) ||
+         ( queue < 0 ) || ( queue >= egctx->queueCnt ) )
+        return BAD_PARAMS;
+
+    if ( ( job->key == NULL ) || ( job->key->keySig != VALID_SIG ) )
+        return BAD_KEY_INSTANCE;
+
+    if ( ( job->dir != DIR_ENCRYPT ) && ( job->dir != DIR_DECRYPT ) )
+        return BAD_KEY_DIR;
+
+    // these modes reverse a decrypting key in place.
+    if ( ( ( job->cipher.mode == MODE_CTR ) || ( job->cipher.mode == MODE_CFB1 ) ) &&
+         ( job->key->direction != DIR_ENCRYPT ) )
+        return BAD_KEY_DIR;
+
+    // workers share the key, so it can't be expanded by a first use.
+    if ( job->key->sboxReady == 0 )
+        return BAD_KEY_INSTANCE;
+
+    engineQueue* q = egctx->queues[ queue ];
+
+    if ( q->pending.fetch_add( 1 ) >= q->depth )
+    {
+        q->pending--;
+        return ENGINE_BUSY;
+    }
+
+    job->queue  = queue;
+    job->result = 0;
+
+    egctx->inflight++;
+
+    bool pushed = false;
+
+    // workers of node holding the data, if there is a choice of nodes.
+    if ( egctx->nodeCnt > 1 )
+    {
+        int node = engineNodeOf( egctx, job->input );
+
+        if ( node >= 0 )
+        {
+            engineNode* nd    = &egctx->nodes[ node ];
+            size_t      first = nd->next.fetch_add( 1 );
+
+            for ( size_t cnt=0; ( pushed == false ) && ( cnt<nd->rings.size() ); cnt++ )
+                pushed = ringPush( &egctx->rings[ nd->rings[ ( first + cnt ) % nd->rings.size() ] ],
+                                   job );
+        }
+    }
+
+    if ( pushed == false )
+    {
+        size_t first = egctx->nextRing.fetch_add( 1 );
+
+        for ( size_t cnt=0; ( pushed == false ) && ( cnt<egctx->ringCnt ); cnt++ )
+            pushed = ringPush( &egctx->rings[ ( first + cnt ) % egctx->ringCnt ], job );
+    }
+
+    if ( pushed == false )
+    {
+        egctx->inflight--;
+        q->pending--;
+        return ENGINE_BUSY;
+    }
+
+    if ( egctx->sleepers > 0 )
+        egctx->wake.notify_one();
+
+    return TF_SUCCESS;
+}
+
+int TwoFishEngine::ReleaseKey( const keyInstance* key )
+{
+    TOEGCTX( egctx );
+
+    if ( ( egctx == NULL ) || ( key == NULL ) )
+        return BAD_PARAMS;
+
+    if ( ( egctx->flags & ENGINE_NUMA ) == 0 )
+        return TF_SUCCESS;  /* no copies */
+
+    std::lock_guard< std::mutex > guard( egctx->rlock );
+
+    egctx->releasing.store( key, std::memory_order_relaxed );
+
+    uint64_t epoch = egctx->epoch.fetch_add( 1, std::memory_order_release ) + 1;
+
+    // napping workers are either waiting, or see the new epoch.
+    {
+        std::lock_guard< std::mutex > nap( egctx->lock );
+    }
+    egctx->wake.notify_all();
+
+    for ( size_t cnt=0; cnt<egctx->ringCnt; cnt++ )
+        while ( egctx->wkeys[ cnt ].seen.load( std::memory_order_acquire ) != epoch )
+            std::this_thread::yield();
+
+    return TF_SUCCESS;
+}
+
+size_t TwoFishEngine::Poll( int queue, engineJob** jobs, size_t maxCnt )
+{
+    TOEGCTX( egctx );
+
+    if ( ( egctx == NULL ) || ( jobs == NULL ) ||
+         ( queue < 0 ) || ( queue >= egctx->queueCnt ) )
+        return 0;
+
+    engineQueue* q   = egctx->queues[ queue ];
+    size_t       cnt = 0;
+
+    while ( cnt < maxCnt )
+    {
+        engineJob* job = ringPop( &q->done );
+        if ( job == NULL )
+            break;
+        jobs[ cnt++ ] = job;
+    }
+
+    if ( cnt > 0 )
+        q->pending -= cnt;
+
+    return cnt;
+}
+
+size_t TwoFishEngine::GetPending( int queue )
+{
+    TOEGCTX( egctx );
+
+    if ( ( egctx == NULL ) || ( queue < 0 ) || ( queue >= egctx->queueCnt ) )
+        return 0;
+
+    return egctx->queues[ queue ]->pending;
+}
+
+size_t TwoFishEngine::GetThreadCount()
+{
+    TOEGCTX( egctx );
+
+    if ( egctx == NULL )
+        return 0;
+
+    return egctx->workers.size();
+}
+
+size_t TwoFishEngine::GetNodeCount()
+{
+    TOEGCTX( egctx );
+
+    if ( egctx == NULL )
+        return 0;
+
+    return egctx->nodeCnt;
+}
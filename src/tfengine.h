@@ -0,0 +1,105 @@
+#ifndef __TFENGINE_H__
+#define __TFENGINE_H__
+
+/**
+* libtwofish crypto job engine
+* ========================================================
+* Asynchronous blockEncrypt()/blockDecrypt() for threads that must not
+* block on crypto.  Producers submit jobs to lock-free rings and collect
+* them later from a completion ring of their own, or get a callback.
+* Workers take jobs in batches from their own ring, steal from the
+* others when it runs dry, and cipher each batch with the multi-key
+* lanes kernel (blockEncryptLanes()/blockDecryptLanes()).
+*
+* (C)2021, Raphael Kim
+**/
+
+#include <cstdint>
+#include <cstddef>
+
+#include "tfish.h"
+
+#define ENGINE_MAX_QUEUES   64      /* producer queues per engine */
+#define ENGINE_BATCH        16      /* jobs a worker takes at once */
+
+#define ENGINE_BUSY         -13     /* rings full, Poll() and submit again */
+
+/* flags of TwoFishEngine */
+#define ENGINE_NUMA         0x01    /* pin workers, node local keys and jobs */
+
+struct engineJob;
+
+/* called on a worker thread when a job is done, instead of completion */
+typedef void (*engineDone)( engineJob* job );
+
+/* One encrypt or decrypt call.  Owned by the producer, must stay alive
+   and untouched from Submit() until it comes back from Poll() or its
+   done callback.
+*/
+typedef struct engineJob
+{
+    /* read only while in flight, see TwoFishEngine::Submit() */
+    keyInstance*    key;
+    /* initialized by cipherInit(), updated the way blockEncrypt() does */
+    cipherInstance  cipher;
+    /* DIR_ENCRYPT or DIR_DECRYPT */
+    uint8_t         dir;
+    const uint8_t*  input;
+    /* # bits, as for blockEncrypt() */
+    size_t          inputLen;
+    uint8_t*        outBuffer;
+    /* # bits ciphered, or error code, set when done */
+    int             result;
+    /* NULL : job goes to completion ring of its queue */
+    engineDone      done;
+    void*           user;
+    /* used by engine */
+    int             queue;
+} engineJob;
+
+class TwoFishEngine
+{
+    public:
+        /* threadCnt 0 : a worker per CPU.
+           ringDepth : jobs per worker ring, rounded up to power of 2.
+           ENGINE_NUMA (Linux) pins workers to CPUs spread over NUMA
+           nodes, gives every worker its own node local copy of the keys
+           it ciphers with, and sends a job to workers of the node
+           holding its input buffer.  Without NUMA nodes only pinning and
+           copies remain.  Copies are wiped when the least recently used,
+           by ReleaseKey(), or with the engine.
+        */
+        TwoFishEngine( size_t threadCnt = 0, size_t ringDepth = 1024,
+                       unsigned flags = 0 );
+        /* waits for jobs in flight, then stops workers. */
+        ~TwoFishEngine();
+
+    public:
+        /* queue for one producer thread, up to depth jobs in flight.
+           Returns queue number, or error code.
+        */
+        int    OpenQueue( size_t depth = 256 );
+        /* never blocks.  TF_SUCCESS, ENGINE_BUSY, or error code.  Keys
+           are shared between workers : a lazy key must be expandKey()'d
+           first (else BAD_KEY_INSTANCE), and CTR and CFB1 jobs need a key
+           made for DIR_ENCRYPT.
+        */
+        int    Submit( int queue, engineJob* job );
+        /* every worker's copy of key wiped, before the caller wipes or
+           frees it.  No job with key may be in flight.  Blocks until all
+           workers are done, a few ms at most if they nap.
+        */
+        int    ReleaseKey( const keyInstance* key );
+        /* done jobs of queue, up to maxCnt, returns how many. */
+        size_t Poll( int queue, engineJob** jobs, size_t maxCnt );
+        /* jobs of queue submitted, not polled yet. */
+        size_t GetPending( int queue );
+        size_t GetThreadCount();
+        /* NUMA nodes workers are spread on, 1 without ENGINE_NUMA. */
+        size_t GetNodeCount();
+
+    public:
+        void* context;
+};
+
+#endif /// of __TFENGINE_H__
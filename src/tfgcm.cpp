@@ -0,0 +1,404 @@
+/***************************************************************************
+    tfgcm.cpp
+
+  ------------------------------------------------------------------------
+
+    Galois/Counter Mode on Twofish.
+
+    (C)2021, Raphael Kim
+
+    Notes:
+        *   GHASH multiplies by H with 4 bit tables (Shoup's method), 16
+            table lookups and shifts per block instead of 128 bit steps.
+        *   The counter part is blockEncrypt() in MODE_CTR over whole
+            Update() calls.  GCM steps only the low 32 bits of the counter,
+            so a call crossing their wrap is split there ; with a 12 byte
+            IV that never happens within the length limit.  It is also
+            split every GCM_MAXCALL bytes : blockEncrypt() returns bits
+            as an int.
+        *   Tab size is set to 4 characters in this file
+
+***************************************************************************/
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include "tfish.h"
+#include "tfgcm.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define GCM_BLOCK       ( BLOCK_SIZE/8 )
+#define GCM_MAXTEXT     ( ( (uint64_t)1 << 36 ) - 32 )  /* bytes per message */
+#define GCM_MAXCALL     ( 64 * 1024 * 1024 )            /* bits of it fit in int */
+
+typedef struct
+{
+    keyInstance*    key;
+    uint64_t        HL[16];     /* multiples of H, low and high halves */
+    uint64_t        HH[16];
+    uint8_t         J0[ GCM_BLOCK ];
+    uint8_t         X[ GCM_BLOCK ];     /* GHASH so far */
+    cipherInstance  ctr;
+    uint64_t        aadLen;
+    uint64_t        textLen;
+    bool            started;
+}libTwoFishGCMContext;
+
+#define L2FGCMCTX       libTwoFishGCMContext
+#define TOGCMCTX(_x_)   L2FGCMCTX* _x_ = (L2FGCMCTX*)context
+
+// reduction of the 4 bits shifted out, times x^128 + x^7 + x^2 + x + 1.
+static const uint64_t gcmLast4[16] =
+{
+    0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+    0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+static uint64_t gcmLoad64( const uint8_t* p )
+{
+    uint64_t v = 0;
+
+    for ( size_t cnt=0; cnt<8; cnt++ )
+        v = ( v << 8 ) | p[ cnt ];
+
+    return v;
+}
+
+static void gcmStore64( uint8_t* p, uint64_t v )
+{
+    for ( size_t cnt=8; cnt-->0; )
+    {
+        p[ cnt ] = (uint8_t)v;
+        v >>= 8;
+    }
+}
+
+static void gcmTable( L2FGCMCTX* gcctx, const uint8_t* h )
+{
+    uint64_t vh = gcmLoad64( h );
+    uint64_t vl = gcmLoad64( h + 8 );
+
+    gcctx->HL[8] = vl;
+    gcctx->HH[8] = vh;
+    gcctx->HL[0] = 0;
+    gcctx->HH[0] = 0;
+
+    for ( size_t i=4; i>0; i>>=1 )
+    {
+        uint64_t t = ( vl & 1 ) * 0xe1000000U;
+        vl = ( vh << 63 ) | ( vl >> 1 );
+        vh = ( vh >> 1 ) ^ ( t << 32 );
+        gcctx->HL[i] = vl;
+        gcctx->HH[i] = vh;
+    }
+
+    for ( size_t i=2; i<=8; i*=2 )
+    {
+        for ( size_t j=1; j<i; j++ )
+        {
+            gcctx->HH[i+j] = gcctx->HH[i] ^ gcctx->HH[j];
+            gcctx->HL[i+j] = gcctx->HL[i] ^ gcctx->HL[j];
+        }
+    }
+}
+
+// X = X * H
+static void gcmMult( L2FGCMCTX* gcctx )
+{
+    uint8_t* x  = gcctx->X;
+    uint8_t  lo = x[15] & 0x0F;
+    uint64_t zh = gcctx->HH[ lo ];
+    uint64_t zl = gcctx->HL[ lo ];
+
+    for ( int i=15; i>=0; i-- )
+    {
+        uint8_t  hi = x[i] >> 4;
+        uint64_t rem;
+
+        lo = x[i] & 0x0F;
+
+        if ( i != 15 )
+        {
+            rem = zl & 0x0F;
+            zl  = ( zh << 60 ) | ( zl >> 4 );
+            zh  = ( zh >> 4 ) ^ ( gcmLast4[ rem ] << 48 );
+            zh ^= gcctx->HH[ lo ];
+            zl ^= gcctx->HL[ lo ];
+        }
+
+        rem = zl & 0x0F;
+        zl  = ( zh << 60 ) | ( zl >> 4 );
+        zh  = ( zh >> 4 ) ^ ( gcmLast4[ rem ] << 48 );
+        zh ^= gcctx->HH[ hi ];
+        zl ^= gcctx->HL[ hi ];
+    }
+
+    gcmStore64( x, zh );
+    gcmStore64( x + 8, zl );
+}
+
+// GHASH over data, a partial last block taken zero padded.
+static void gcmHash( L2FGCMCTX* gcctx, const uint8_t* p, size_t len )
+{
+    while ( len > 0 )
+    {
+        size_t n = ( len < GCM_BLOCK ) ? len : GCM_BLOCK;
+
+        for ( size_t cnt=0; cnt<n; cnt++ )
+            gcctx->X[ cnt ] ^= p[ cnt ];
+        gcmMult( gcctx );
+
+        p   += n;
+        len -= n;
+    }
+}
+
+static void gcmLengths( L2FGCMCTX* gcctx, uint64_t aBits, uint64_t cBits )
+{
+    uint8_t b[ GCM_BLOCK ];
+
+    gcmStore64( b, aBits );
+    gcmStore64( b + 8, cBits );
+    gcmHash( gcctx, b, GCM_BLOCK );
+}
+
+static int gcmECB( keyInstance* key, const uint8_t* in, uint8_t* out )
+{
+    cipherInstance ecb;
+
+    cipherInit( &ecb, MODE_ECB, NULL );
+    return blockEncrypt( &ecb, key, in, BLOCK_SIZE, out );
+}
+
+// CTR over len bytes, counter wrapping in its low 32 bits only.
+static int gcmCTR( L2FGCMCTX* gcctx, const uint8_t* in, size_t len, uint8_t* out )
+{
+    cipherInstance* ci = &gcctx->ctr;
+
+    while ( len > 0 )
+    {
+        uint64_t low  = gcmLoad64( ci->IV + 8 ) & 0xFFFFFFFFU;
+        uint64_t room = ( (uint64_t)1 << 32 ) - low;    /* blocks to wrap */
+        size_t   n    = len;
+
+        if ( n > GCM_MAXCALL )
+            n = GCM_MAXCALL;
+        if ( ( n + GCM_BLOCK - 1 ) / GCM_BLOCK > room )
+            n = (size_t)( room * GCM_BLOCK );
+
+        uint8_t top[ GCM_BLOCK - 4 ];
+        memcpy( top, ci->IV, sizeof( top ) );
+
+        int reti = blockEncrypt( ci, gcctx->key, in, n * 8, out );
+        if ( reti < 0 )
+            return reti;
+
+        // no carry out of the low 32 bits.
+        memcpy( ci->IV, top, sizeof( top ) );
+        CounterAdd( ci, 0 );
+
+        in  += n;
+        out += n;
+        len -= n;
+    }
+
+    return TF_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+TwoFishGCM::TwoFishGCM( keyInstance* key )
+ : context( NULL )
+{
+    if ( ( key == NULL ) || ( key->keySig != VALID_SIG ) )
+        return;
+
+    L2FGCMCTX* gcctx = new L2FGCMCTX;
+    if ( gcctx == NULL )
+        return;
+
+    memset( gcctx, 0, sizeof( L2FGCMCTX ) );
+
+    expandKey( key );
+    if ( key->direction != DIR_ENCRYPT )
+        ReverseRoundSubkeys( key, DIR_ENCRYPT );
+
+    uint8_t h[ GCM_BLOCK ] = {0};
+
+    gcctx->key = key;
+    gcmECB( key, h, h );
+    gcmTable( gcctx, h );
+    memset( h, 0, sizeof( h ) );
+
+    context = (void*)gcctx;
+}
+
+TwoFishGCM::~TwoFishGCM()
+{
+    TOGCMCTX( gcctx );
+
+    if ( gcctx == NULL )
+        return;
+
+    /* H tables are key material */
+    memset( gcctx, 0, sizeof( L2FGCMCTX ) );
+
+    context = NULL;
+    delete gcctx;
+}
+
+int TwoFishGCM::Start( const uint8_t* iv, size_t ivLen,
+                       const uint8_t* aad, size_t aadLen )
+{
+    TOGCMCTX( gcctx );
+
+    if ( ( gcctx == NULL ) || ( iv == NULL ) || ( ivLen == 0 ) ||
+         ( ( aad == NULL ) && ( aadLen > 0 ) ) )
+        return BAD_PARAMS;
+
+    memset( gcctx->X, 0, GCM_BLOCK );
+
+    if ( ivLen == GCM_IV_SIZE )
+    {
+        memcpy( gcctx->J0, iv, GCM_IV_SIZE );
+        memset( gcctx->J0 + GCM_IV_SIZE, 0, GCM_BLOCK - GCM_IV_SIZE );
+        gcctx->J0[ GCM_BLOCK - 1 ] = 1;
+    }
+    else
+    {
+        gcmHash( gcctx, iv, ivLen );
+        gcmLengths( gcctx, 0, (uint64_t)ivLen * 8 );
+        memcpy( gcctx->J0, gcctx->X, GCM_BLOCK );
+        memset( gcctx->X, 0, GCM_BLOCK );
+    }
+
+    gcmHash( gcctx, aad, aadLen );
+
+    cipherInit( &gcctx->ctr, MODE_CTR, NULL );
+    memcpy( gcctx->ctr.IV, gcctx->J0, GCM_BLOCK );
+
+    // first block of text takes inc32( J0 ).
+    uint8_t top[ GCM_BLOCK - 4 ];
+    memcpy( top, gcctx->ctr.IV, sizeof( top ) );
+    CounterAdd( &gcctx->ctr, 1 );
+    memcpy( gcctx->ctr.IV, top, sizeof( top ) );
+    CounterAdd( &gcctx->ctr, 0 );
+
+    gcctx->aadLen  = aadLen;
+    gcctx->textLen = 0;
+    gcctx->started = true;
+
+    return TF_SUCCESS;
+}
+
+int TwoFishGCM::Update( uint8_t dir, const uint8_t* in, size_t len, uint8_t* out )
+{
+    TOGCMCTX( gcctx );
+
+    if ( ( gcctx == NULL ) || ( gcctx->started == false ) ||
+         ( ( ( in == NULL ) || ( out == NULL ) ) && ( len > 0 ) ) )
+        return BAD_PARAMS;
+
+    if ( ( dir != DIR_ENCRYPT ) && ( dir != DIR_DECRYPT ) )
+        return BAD_KEY_DIR;
+
+    // a partial block was the last one.
+    if ( ( gcctx->textLen % GCM_BLOCK != 0 ) && ( len > 0 ) )
+        return BAD_PARAMS;
+
+    if ( len > GCM_MAXTEXT - gcctx->textLen )
+        return BAD_INPUT_LEN;
+
+    if ( dir == DIR_DECRYPT )
+        gcmHash( gcctx, in, len );
+
+    int reti = gcmCTR( gcctx, in, len, out );
+    if ( reti < 0 )
+        return reti;
+
+    if ( dir == DIR_ENCRYPT )
+        gcmHash( gcctx, out, len );
+
+    gcctx->textLen += len;
+
+    return TF_SUCCESS;
+}
+
+int TwoFishGCM::Finish( uint8_t* tag )
+{
+    TOGCMCTX( gcctx );
+
+    if ( ( gcctx == NULL ) || ( gcctx->started == false ) || ( tag == NULL ) )
+        return BAD_PARAMS;
+
+    gcmLengths( gcctx, gcctx->aadLen * 8, gcctx->textLen * 8 );
+
+    uint8_t ek[ GCM_BLOCK ];
+
+    int reti = gcmECB( gcctx->key, gcctx->J0, ek );
+    if ( reti < 0 )
+        return reti;
+
+    for ( size_t cnt=0; cnt<GCM_BLOCK; cnt++ )
+        tag[ cnt ] = gcctx->X[ cnt ] ^ ek[ cnt ];
+
+    gcctx->started = false;
+
+    return TF_SUCCESS;
+}
+
+int TwoFishGCM::Verify( const uint8_t* tag, size_t tagLen )
+{
+    if ( ( tag == NULL ) || ( tagLen < GCM_MIN_TAG_SIZE ) ||
+         ( tagLen > GCM_TAG_SIZE ) )
+        return BAD_PARAMS;
+
+    uint8_t mine[ GCM_TAG_SIZE ];
+
+    int reti = Finish( mine );
+    if ( reti != TF_SUCCESS )
+        return reti;
+
+    // all bytes compared, time doesn't tell where they differ.
+    uint8_t diff = 0;
+    for ( size_t cnt=0; cnt<tagLen; cnt++ )
+        diff |= mine[ cnt ] ^ tag[ cnt ];
+
+    return ( diff == 0 ) ? TF_SUCCESS : BAD_GCM_TAG;
+}
+
+int TwoFishGCM::Encrypt( const uint8_t* iv, size_t ivLen,
+                         const uint8_t* aad, size_t aadLen,
+                         const uint8_t* in, size_t len, uint8_t* out, uint8_t* tag )
+{
+    int reti = Start( iv, ivLen, aad, aadLen );
+
+    if ( reti == TF_SUCCESS )
+        reti = Update( DIR_ENCRYPT, in, len, out );
+    if ( reti == TF_SUCCESS )
+        reti = Finish( tag );
+
+    return reti;
+}
+
+int TwoFishGCM::Decrypt( const uint8_t* iv, size_t ivLen,
+                         const uint8_t* aad, size_t aadLen,
+                         const uint8_t* in, size_t len, uint8_t* out,
+                         const uint8_t* tag, size_t tagLen )
+{
+    int reti = Start( iv, ivLen, aad, aadLen );
+
+    if ( reti == TF_SUCCESS )
+        reti = Update( DIR_DECRYPT, in, len, out );
+    if ( reti == TF_SUCCESS )
+        reti = Verify( tag, tagLen );
+
+    if ( ( reti != TF_SUCCESS ) && ( out != NULL ) )
+        memset( out, 0, len );
+
+    return reti;
+}
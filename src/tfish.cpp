@@ -33,9 +33,20 @@
 #include <cstdint>
 #include <cstring>
 
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+
 #include "tfish.h"
 #include "tftables.h"
 
+#if X86_SIMD
+    #include <immintrin.h>
+    /* rotate 8 dwords */
+    #define ROLV(v,n)   _mm256_or_si256(_mm256_slli_epi32(v,n),_mm256_srli_epi32(v,32-(n)))
+#endif
+
 #if   defined(min_key)  && !defined(MIN_KEY)
     /* toupper() */
     #define MIN_KEY     1
@@ -58,12 +69,22 @@
 
 static fullSbox MDStab;        /* not actually const.  Initialized ONE time */
 static bool     needToBuildMDS = true;       /* is MDStab initialized yet? */
+#if X86_SIMD
+static uint32_t P8x8w[2][256];  /* P8x8 as dwords, for vector gathers */
+static uint64_t gfMatX = 0;     /* Mul_X, Mul_Y as GF(2) matrices for GFNI */
+static uint64_t gfMatY = 0;
+static uint8_t  vecIota[64];    /* 0,1,2,...,63 */
+static uint8_t  vecSpread[64];  /* 0,0,0,0,1,1,1,1,... byte to dword */
+#endif
 
+/* nonzero --> big table in use from start, else see BigTabOp() */
 #define     BIG_TAB     0
 
-#if BIG_TAB
-uint8_t     bigTab[4][256][256];    /* pre-computed S-box */
-#endif
+/* pre-computed S-box, q0[q1[k]^j] of the last two stages per column.
+   256 KB, only touched when switched on. */
+static uint8_t          bigTab[4][256][256];
+static std::once_flag   bigTabBuilt;
+static std::atomic<int> bigTabUse( BIG_TAB );
 
 /* number of rounds for various key sizes:  128, 192, 256 */
 /* (ignored for now in optimized code!) */
@@ -77,25 +98,27 @@ const int   numRounds[4]= {0,ROUNDS_128,ROUNDS_192,ROUNDS_256};
 #endif
 #define _sBox8_(N) (((uint8_t *) _sBox_) + (N)*256)
 
-/*------- see what level of S-box precomputation we need to do -----*/
-#if   defined(ZERO_KEY)
-    #define MOD_STRING  "(Zero S-box keying)"
-    #define Fe32_128(x,R)   \
+/* S-box + MDS lookup on-the-fly from SKEY[] (local copy of sboxKeys),
+   for ZERO_KEY and for lazy keys of FULL_KEY that aren't expanded yet */
+#define Fe32_128(x,R)   \
         (   MDStab[0][p8(01)[p8(02)[_b(x,R  )]^b0(SKEY[1])]^b0(SKEY[0])] ^  \
             MDStab[1][p8(11)[p8(12)[_b(x,R+1)]^b1(SKEY[1])]^b1(SKEY[0])] ^  \
             MDStab[2][p8(21)[p8(22)[_b(x,R+2)]^b2(SKEY[1])]^b2(SKEY[0])] ^  \
             MDStab[3][p8(31)[p8(32)[_b(x,R+3)]^b3(SKEY[1])]^b3(SKEY[0])] )
-    #define Fe32_192(x,R)   \
+#define Fe32_192(x,R)   \
         (   MDStab[0][p8(01)[p8(02)[p8(03)[_b(x,R  )]^b0(SKEY[2])]^b0(SKEY[1])]^b0(SKEY[0])] ^ \
             MDStab[1][p8(11)[p8(12)[p8(13)[_b(x,R+1)]^b1(SKEY[2])]^b1(SKEY[1])]^b1(SKEY[0])] ^ \
             MDStab[2][p8(21)[p8(22)[p8(23)[_b(x,R+2)]^b2(SKEY[2])]^b2(SKEY[1])]^b2(SKEY[0])] ^ \
             MDStab[3][p8(31)[p8(32)[p8(33)[_b(x,R+3)]^b3(SKEY[2])]^b3(SKEY[1])]^b3(SKEY[0])] )
-    #define Fe32_256(x,R)   \
+#define Fe32_256(x,R)   \
         (   MDStab[0][p8(01)[p8(02)[p8(03)[p8(04)[_b(x,R  )]^b0(SKEY[3])]^b0(SKEY[2])]^b0(SKEY[1])]^b0(SKEY[0])] ^ \
             MDStab[1][p8(11)[p8(12)[p8(13)[p8(14)[_b(x,R+1)]^b1(SKEY[3])]^b1(SKEY[2])]^b1(SKEY[1])]^b1(SKEY[0])] ^ \
             MDStab[2][p8(21)[p8(22)[p8(23)[p8(24)[_b(x,R+2)]^b2(SKEY[3])]^b2(SKEY[2])]^b2(SKEY[1])]^b2(SKEY[0])] ^ \
             MDStab[3][p8(31)[p8(32)[p8(33)[p8(34)[_b(x,R+3)]^b3(SKEY[3])]^b3(SKEY[2])]^b3(SKEY[1])]^b3(SKEY[0])] )
 
+/*------- see what level of S-box precomputation we need to do -----*/
+#if   defined(ZERO_KEY)
+    #define MOD_STRING  "(Zero S-box keying)"
     #define GetSboxKey  uint32_t SKEY[4];   /* local copy */ \
                         memcpy(SKEY,key->sboxKeys,sizeof(SKEY));
     /*----------------------------------------------------------------*/
@@ -138,18 +161,24 @@ const int   numRounds[4]= {0,ROUNDS_128,ROUNDS_192,ROUNDS_256};
     #define Fe32_(x,R) \
             (_sBox_[0][2*_b(x,R  )] ^ _sBox_[0][2*_b(x,R+1)+1] ^ \
              _sBox_[2][2*_b(x,R+2)] ^ _sBox_[2][2*_b(x,R+3)+1])
-    /* set a single S-box value, given the input byte */
-    /* FixMe : g++ 10.2 warning this preprocessor iteration 64 invokes
-     *         undefined behavior at sbSet() */
+    /* set a single S-box value, given the input byte.
+       _sBox_[N&2] and _sBox_[(N&2)+1] make one interleaved 512 dword row,
+       so index from the start of the whole table. */
     #define sbSet(N,i,J,v) \
-            { size_t y=2*i+(N&1)+2*J;\
-              if ((y<=256)&&(v<=256)) _sBox_[N&2][y] = MDStab[N][v]; }
+            { (&_sBox_[0][0])[256*(N&2)+2*(i)+(N&1)+2*(J)] = MDStab[N][v]; }
     #define GetSboxKey
 #endif
 
 const       char moduleDescription[] = "Optimized C ";
 const       char modeString[]        = MOD_STRING;
 
+/* CFB1 takes any # of bits, CTR whole bytes, others whole blocks */
+#define     BadInputLen(mode,len)   ( ((mode) == MODE_CFB1) ? 0 :                 \
+                                      ((mode) == MODE_CTR)  ? ((len) & 7) :       \
+                                                              ((len) % BLOCK_SIZE) )
+/* # of counter blocks encrypted per pass in CTR mode */
+#define     CTR_BLOCKS      16
+
 
 /* macro(s) for debugging help */
 /* nonzero --> compare against "slow" table */
@@ -205,6 +234,183 @@ int TableOp(int op)
     return TF_SUCCESS;
 }
 
+/*
++*****************************************************************************
+*
+* Function Name:    SimdOp
+*
+* Function:         Check or switch use of vector kernels
+*
+* Arguments:        op  =   what to do  (see SIMD_* defns in tfish.h)
+*
+* Return:           TF_SUCCESS --> vector kernels are in use
+*                   TF_FAILURE --> portable code is in use
+*
+* Notes: Vector kernels are used by default when the CPU has AVX2.
+*        Key setup also uses AVX-512 VBMI and GFNI when they are there.
+*        SIMD_DISABLE forces the portable code, mostly for testing that
+*        both produce same result.
+*
+-****************************************************************************/
+#define SIMD_LEVEL_AVX2     1
+#define SIMD_LEVEL_VBMI     2
+
+static std::once_flag   simdProbed;
+static std::atomic<int> simdHave( 0 );  /* SIMD_LEVEL_* once probed */
+static std::atomic<int> simdUse( 1 );
+
+static void ProbeSimd()
+{
+#if X86_SIMD
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports("avx2") )
+    {
+        simdHave = SIMD_LEVEL_AVX2;
+        if ( __builtin_cpu_supports("avx512f") &&
+             __builtin_cpu_supports("avx512bw") &&
+             __builtin_cpu_supports("avx512vbmi") &&
+             __builtin_cpu_supports("gfni") )
+            simdHave = SIMD_LEVEL_VBMI;
+    }
+#endif
+}
+
+int SimdOp(int op)
+{
+    std::call_once( simdProbed, ProbeSimd );
+
+    switch (op)
+    {
+        case SIMD_DISABLE:
+            simdUse = 0;
+            break;
+        case SIMD_ENABLE:
+            simdUse = 1;
+            break;
+    }
+
+    if ( ( simdHave > 0 ) && ( simdUse > 0 ) )
+        return TF_SUCCESS;
+
+    return TF_FAILURE;
+}
+
+/* best vector level in use, 0 for portable code */
+static int SimdLevel()
+{
+    if ( SimdOp(SIMD_QUERY) == TF_SUCCESS )
+        return simdHave;
+
+    return 0;
+}
+
+/*
++*****************************************************************************
+*
+* Function Name:    BuildBigTab, BigTabOp
+*
+* Function:         Check or switch use of the big keying table in reKey()
+*
+* Arguments:        op  =   what to do  (see BIGTAB_* defns in tfish.h)
+*
+* Return:           TF_SUCCESS --> big table is in use
+*                   TF_FAILURE --> chained q lookups are in use
+*
+* Notes: Table is built on first BIGTAB_ENABLE.  With it, each S-box byte
+*        costs one lookup instead of two (three for 256-bit keys), but
+*        the 256 KB table competes with the caller's data for the cache,
+*        and with vector key setup the S-boxes need no lookups at all.
+*        So it is off by default; see the -b option of test for where it
+*        pays off.
+*
+-****************************************************************************/
+static void BuildBigTab()
+{
+    for ( size_t cnt=0; cnt<4; cnt++ )
+    {
+        const uint8_t* q0 = NULL;
+        const uint8_t* q1 = NULL;
+
+        switch (cnt)
+        {
+            case 0: q0 = p8(01); q1 = p8(02);   break;
+            case 1: q0 = p8(11); q1 = p8(12);   break;
+            case 2: q0 = p8(21); q1 = p8(22);   break;
+            case 3: q0 = p8(31); q1 = p8(32);   break;
+        }
+        
+        for ( size_t cntj=0; cntj<256; cntj++ )
+            for ( size_t cntk=0; cntk<256; cntk++)
+                bigTab[cnt][cntj][cntk]=q0[q1[cntk]^cntj];
+    }
+}
+
+int BigTabOp(int op)
+{
+#if BIG_TAB
+    std::call_once( bigTabBuilt, BuildBigTab );
+#endif
+
+    switch (op)
+    {
+        case BIGTAB_DISABLE:
+            bigTabUse = 0;
+            break;
+        case BIGTAB_ENABLE:
+            std::call_once( bigTabBuilt, BuildBigTab );
+            bigTabUse = 1;
+            break;
+    }
+
+    if ( bigTabUse > 0 )
+        return TF_SUCCESS;
+
+    return TF_FAILURE;
+}
+
+/*
++*****************************************************************************
+*
+* Function Name:    LazyOp
+*
+* Function:         Check or switch lazy S-box expansion
+*
+* Arguments:        op  =   what to do  (see LAZY_* defns in tfish.h)
+*
+* Return:           TF_SUCCESS --> keys made from now on are lazy
+*                   TF_FAILURE --> reKey() expands S-boxes right away
+*
+* Notes: A lazy key has subkeys and sboxKeys only.  Calls of up to
+*        LAZY_BLOCKS blocks do the S-box lookups on-the-fly from sboxKeys,
+*        the first bigger call expands sBox8x32 into the key.  Saves the
+*        4 KB expansion for keys used on a header or two and dropped.
+*        A lazy key is written by its first bulk call, so don't share it
+*        between threads before that (same as with direction changes).
+*        Only FULL_KEY builds have S-boxes worth deferring.
+*
+-****************************************************************************/
+static std::atomic<int> lazyUse( 0 );
+
+int LazyOp(int op)
+{
+#if defined(FULL_KEY)
+    switch (op)
+    {
+        case LAZY_DISABLE:
+            lazyUse = 0;
+            break;
+        case LAZY_ENABLE:
+            lazyUse = 1;
+            break;
+    }
+#endif
+
+    if ( lazyUse > 0 )
+        return TF_SUCCESS;
+
+    return TF_FAILURE;
+}
+
 
 /*
 +*****************************************************************************
@@ -442,23 +648,31 @@ void BuildMDS(void)
 #define Mul_X   Mx_X
 #define Mul_Y   Mx_Y
     
-#if BIG_TAB
-    for ( size_t cnt=0; cnt<4; cnt++ )
+
+#if X86_SIMD
+    for ( size_t cnt=0; cnt<256; cnt++ )
     {
-        const uint8_t* q0 = NULL;
-        const uint8_t* q1 = NULL;
+        P8x8w[0][cnt] = P8x8[0][cnt];
+        P8x8w[1][cnt] = P8x8[1][cnt];
+    }
 
-        switch (cnt)
+    /* GFNI row of output bit i is byte 7-i, one bit per input bit */
+    for ( size_t cnt=0; cnt<8; cnt++ )
+    {
+        uint32_t cx = Mx_X(1u << cnt);
+        uint32_t cy = Mx_Y(1u << cnt);
+
+        for ( size_t cnti=0; cnti<8; cnti++ )
         {
-            case 0: q0 = p8(01); q1 = p8(02);   break;
-            case 1: q0 = p8(11); q1 = p8(12);   break;
-            case 2: q0 = p8(21); q1 = p8(22);   break;
-            case 3: q0 = p8(31); q1 = p8(32);   break;
+            gfMatX |= (uint64_t)( (cx >> cnti) & 1 ) << ( 8*(7-cnti) + cnt );
+            gfMatY |= (uint64_t)( (cy >> cnti) & 1 ) << ( 8*(7-cnti) + cnt );
         }
-        
-        for ( size_t cntj=0; cntj<256; cntj++ )
-            for ( size_t cntk=0; cntk<256; cntk++)
-                bigTab[cnt][cntj][cntk]=q0[q1[cntk]^cntj];
+    }
+
+    for ( size_t cnt=0; cnt<64; cnt++ )
+    {
+        vecIota[cnt]   = (uint8_t) cnt;
+        vecSpread[cnt] = (uint8_t)(cnt >> 2);
     }
 #endif
 
@@ -536,6 +750,308 @@ void ReverseRoundSubkeys( keyInstance* key, uint8_t newDir )
         { Xor32(dst,src,i  ); Xor32(dst,src,i+1); Xor32(dst,src,i+2); Xor32(dst,src,i+3); } \
     }
 
+#if X86_SIMD && defined(FULL_KEY)
+/*
++*****************************************************************************
+*
+* Function Name:    F32V, SubkeysAVX2, SboxVBMI
+*
+* Function:         Vector key schedule
+*
+* Arguments:        key     =   ptr to keyInstance being initialized
+*                   k32e    =   even key dwords
+*                   k32o    =   odd  key dwords
+*                   sKey    =   S-box key dwords (reverse order)
+*
+* Return:           None.
+*
+* Notes:
+*   F32V() is the F32() macro of reKey, with each byte lane gathered from
+*   P8x8w[] and MDStab[].  Key dwords come as vectors, so the same code
+*   serves 8 inputs of one key (subkeys here) as well as 8 keys at once.
+*
+*   Gathers don't beat scalar loads for the 1024 S-box entries, so
+*   SboxVBMI() does them as byte permutes instead: a 256 byte q table
+*   lives in 4 zmm registers, vpermi2b looks up 64 bytes at once, and
+*   the MDS multiply is done with GFNI affine ops in place of MDStab[].
+*   Output layout is the same as sbSet().
+*
+-****************************************************************************/
+#define ByteV(v,n)  _mm256_and_si256(_mm256_srli_epi32(v,8*(n)),_mm256_set1_epi32(0xFF))
+#define Q8V(P,v)    _mm256_i32gather_epi32((const int*)P8x8w[P],v,4)
+#define MDSV(N,v)   _mm256_i32gather_epi32((const int*)MDStab[N],v,4)
+#define QK8V(P,v,k) _mm256_xor_si256(Q8V(P,v),k)
+
+TARGET_AVX2
+static __m256i F32V( __m256i x, const __m256i* k32, size_t k64Cnt )
+{
+    __m256i b0 = ByteV(x,0);
+    __m256i b1 = ByteV(x,1);
+    __m256i b2 = ByteV(x,2);
+    __m256i b3 = ByteV(x,3);
+
+    switch (k64Cnt & 3)
+    {
+        case 0:  /* same as 4 */
+            b0 = QK8V(P_04,b0,ByteV(k32[3],0));
+            b1 = QK8V(P_14,b1,ByteV(k32[3],1));
+            b2 = QK8V(P_24,b2,ByteV(k32[3],2));
+            b3 = QK8V(P_34,b3,ByteV(k32[3],3));
+            /* fall thru */
+        case 3:
+            b0 = QK8V(P_03,b0,ByteV(k32[2],0));
+            b1 = QK8V(P_13,b1,ByteV(k32[2],1));
+            b2 = QK8V(P_23,b2,ByteV(k32[2],2));
+            b3 = QK8V(P_33,b3,ByteV(k32[2],3));
+            /* fall thru */
+        case 2:
+            b0 = QK8V(P_01,QK8V(P_02,b0,ByteV(k32[1],0)),ByteV(k32[0],0));
+            b1 = QK8V(P_11,QK8V(P_12,b1,ByteV(k32[1],1)),ByteV(k32[0],1));
+            b2 = QK8V(P_21,QK8V(P_22,b2,ByteV(k32[1],2)),ByteV(k32[0],2));
+            b3 = QK8V(P_31,QK8V(P_32,b3,ByteV(k32[1],3)),ByteV(k32[0],3));
+    }
+
+    return _mm256_xor_si256( _mm256_xor_si256( MDSV(0,b0), MDSV(1,b1) ),
+                             _mm256_xor_si256( MDSV(2,b2), MDSV(3,b3) ) );
+}
+
+/* store a[0],b[0],a[1],b[1],... to 16 dwords at p */
+#define StoreInterleaveV(p,a,b)                                             \
+    {   __m256i lo_ = _mm256_unpacklo_epi32(a,b);                           \
+        __m256i hi_ = _mm256_unpackhi_epi32(a,b);                           \
+        _mm256_storeu_si256((__m256i*)(p),  _mm256_permute2x128_si256(lo_,hi_,0x20)); \
+        _mm256_storeu_si256((__m256i*)(p)+1,_mm256_permute2x128_si256(lo_,hi_,0x31)); }
+
+TARGET_AVX2
+static void SubkeysAVX2( keyInstance* key, const uint32_t* k32e, const uint32_t* k32o )
+{
+    size_t   k64Cnt    = (key->keyLen+63)/64;
+    size_t   subkeyCnt = ROUND_SUBKEYS + 2*key->numRounds;
+    uint32_t sk[TOTAL_SUBKEYS+16];
+    __m256i  ke[MAX_KEY_BITS/64];
+    __m256i  ko[MAX_KEY_BITS/64];
+
+    for ( size_t cnt=0; cnt<MAX_KEY_BITS/64; cnt++ )
+    {
+        ke[cnt] = _mm256_set1_epi32(k32e[cnt]);
+        ko[cnt] = _mm256_set1_epi32(k32o[cnt]);
+    }
+
+    /* round subkeys for PHT, 8 pairs at once */
+    __m256i q = _mm256_mullo_epi32( _mm256_setr_epi32(0,1,2,3,4,5,6,7),
+                                    _mm256_set1_epi32(SK_STEP) );
+
+    for ( size_t cnt=0; cnt<subkeyCnt/2; cnt+=8 )
+    {
+        __m256i A = F32V( q, ke, k64Cnt );
+        __m256i B = F32V( _mm256_add_epi32(q,_mm256_set1_epi32(SK_BUMP)), ko, k64Cnt );
+
+        B = ROLV(B,8);
+        __m256i s0 = _mm256_add_epi32(A,B);
+        __m256i s1 = _mm256_add_epi32(A,_mm256_slli_epi32(B,1));
+        s1 = ROLV(s1,SK_ROTL);
+        StoreInterleaveV( &sk[2*cnt], s0, s1 );
+
+        q = _mm256_add_epi32(q,_mm256_set1_epi32(8*SK_STEP));
+    }
+
+    memcpy( key->subKeys, sk, sizeof(uint32_t)*subkeyCnt );
+}
+
+/* permutation index for stage 0..4 of S-box column N */
+static const int sbP[5][4] =
+{
+    { P_00, P_10, P_20, P_30 },
+    { P_01, P_11, P_21, P_31 },
+    { P_02, P_12, P_22, P_32 },
+    { P_03, P_13, P_23, P_33 },
+    { P_04, P_14, P_24, P_34 }
+};
+
+/* which bytes of MDStab[N] dwords are Mul_X and Mul_Y (rest is Mul_1),
+   one bit per byte, repeated for 16 dwords of a zmm */
+#define MdsMask(b0,b1,b2,b3)    ( 0x1111111111111111ull * ((b0)|((b1)<<1)|((b2)<<2)|((b3)<<3)) )
+static const uint64_t sbMaskX[4] =
+{
+    MdsMask(0,1,0,0), MdsMask(0,0,1,0), MdsMask(1,0,0,0), MdsMask(1,0,0,1)
+};
+static const uint64_t sbMaskY[4] =
+{
+    MdsMask(0,0,1,1), MdsMask(1,1,0,0), MdsMask(0,1,0,1), MdsMask(0,0,1,0)
+};
+
+/* 256 byte lookup in table T[4], bit 7 of x picks the upper half */
+#define Q8Z(T,x)    _mm512_mask_blend_epi8( _mm512_movepi8_mask(x),             \
+                        _mm512_permutex2var_epi8((T)[0],x,(T)[1]),              \
+                        _mm512_permutex2var_epi8((T)[2],x,(T)[3]) )
+#define QK8Z(T,x,k) _mm512_xor_si512(Q8Z(T,x),_mm512_set1_epi8((char)(k)))
+
+TARGET_VBMI
+static void SboxVBMI( keyInstance* key, const uint32_t* sKey )
+{
+    size_t    k64Cnt = (key->keyLen+63)/64;
+    uint32_t* sb     = &key->sBox8x32[0][0];
+    __m512i   qt[2][4];
+
+    for ( size_t cnt=0; cnt<4; cnt++ )
+    {
+        qt[0][cnt] = _mm512_loadu_si512( (const void*)&P8x8[0][64*cnt] );
+        qt[1][cnt] = _mm512_loadu_si512( (const void*)&P8x8[1][64*cnt] );
+    }
+
+    const __m512i gfX    = _mm512_set1_epi64( (long long)gfMatX );
+    const __m512i gfY    = _mm512_set1_epi64( (long long)gfMatY );
+    const __m512i iota   = _mm512_loadu_si512( (const void*)vecIota );
+    const __m512i spread = _mm512_loadu_si512( (const void*)vecSpread );
+    const __m512i il0    = _mm512_setr_epi32( 0,16, 1,17, 2,18, 3,19,
+                                              4,20, 5,21, 6,22, 7,23 );
+    const __m512i il1    = _mm512_setr_epi32( 8,24, 9,25,10,26,11,27,
+                                             12,28,13,29,14,30,15,31 );
+
+    /* columns 0,1 and 2,3 share interleaved rows, 64 entries per pass */
+    for ( size_t N=0; N<4; N+=2 )
+    for ( size_t cnt=0; cnt<256; cnt+=64 )
+    {
+        __m512i d[2][4];
+
+        for ( size_t h=0; h<2; h++ )
+        {
+            size_t  col = N + h;
+            __m512i v   = _mm512_add_epi8( iota, _mm512_set1_epi8((char)cnt) );
+
+            switch (k64Cnt)
+            {
+                case 4:
+                    v = QK8Z( qt[sbP[4][col]], v, sKey[3] >> 8*col );
+                    /* fall thru */
+                case 3:
+                    v = QK8Z( qt[sbP[3][col]], v, sKey[2] >> 8*col );
+                    /* fall thru */
+                default:
+                    v = QK8Z( qt[sbP[2][col]], v, sKey[1] >> 8*col );
+                    v = QK8Z( qt[sbP[1][col]], v, sKey[0] >> 8*col );
+            }
+
+            /* MDStab[col][v] : q of MDS input, then the GF(256) multiples */
+            __m512i u = Q8Z( qt[sbP[0][col]], v );
+            __m512i x = _mm512_gf2p8affine_epi64_epi8( u, gfX, 0 );
+            __m512i y = _mm512_gf2p8affine_epi64_epi8( u, gfY, 0 );
+
+            for ( size_t g=0; g<4; g++ )
+            {
+                __m512i idx = _mm512_add_epi8( spread, _mm512_set1_epi8((char)(16*g)) );
+                __m512i r   = _mm512_permutexvar_epi8( idx, u );
+
+                r = _mm512_mask_blend_epi8( sbMaskX[col], r, _mm512_permutexvar_epi8( idx, x ) );
+                r = _mm512_mask_blend_epi8( sbMaskY[col], r, _mm512_permutexvar_epi8( idx, y ) );
+                d[h][g] = r;
+            }
+        }
+
+        for ( size_t g=0; g<4; g++ )
+        {
+            uint32_t* p = sb + 256*N + 2*(cnt + 16*g);
+
+            _mm512_storeu_si512( (void*)p,        _mm512_permutex2var_epi32( d[0][g], il0, d[1][g] ) );
+            _mm512_storeu_si512( (void*)(p + 16), _mm512_permutex2var_epi32( d[0][g], il1, d[1][g] ) );
+        }
+    }
+}
+/* RS_rem() on 8 dwords */
+#define RS_remV(x)                                                              \
+    {   __m256i b_  = _mm256_srli_epi32(x,24);                                  \
+        __m256i h_  = _mm256_cmpeq_epi32(_mm256_and_si256(b_,_mm256_set1_epi32(0x80)), \
+                                         _mm256_set1_epi32(0x80));             \
+        __m256i l_  = _mm256_cmpeq_epi32(_mm256_and_si256(b_,_mm256_set1_epi32(1)),    \
+                                         _mm256_set1_epi32(1));                \
+        __m256i g2_ = _mm256_and_si256(_mm256_xor_si256(_mm256_slli_epi32(b_,1),       \
+                          _mm256_and_si256(h_,_mm256_set1_epi32(RS_GF_FDBK))),          \
+                          _mm256_set1_epi32(0xFF));                             \
+        __m256i g3_ = _mm256_xor_si256(_mm256_xor_si256(_mm256_srli_epi32(b_,1),        \
+                          _mm256_and_si256(l_,_mm256_set1_epi32(RS_GF_FDBK >> 1))), g2_); \
+        x = _mm256_xor_si256(_mm256_xor_si256(_mm256_slli_epi32(x,8),_mm256_slli_epi32(g3_,24)), \
+            _mm256_xor_si256(_mm256_xor_si256(_mm256_slli_epi32(g2_,16),_mm256_slli_epi32(g3_,8)),b_)); }
+
+/*
++*****************************************************************************
+*
+* Function Name:    ReKeyLanesAVX2
+*
+* Function:         S-box keys and round subkeys of LANE_KEYS keys at once
+*
+* Arguments:        kp      =   ptrs to LANE_KEYS keyInstances, all with same
+*                               keyLen and numRounds and key32 set
+*
+* Return:           None.
+*
+* Notes:
+*   Each vector lane is one key, so RS_MDS_Encode() and F32() run for 8
+*   keys per instruction.  Subkeys are left in natural order, like reKey()
+*   has them before ReverseRoundSubkeys().  Same ptr may be given in more
+*   than one lane to fill a short group.
+*
+-****************************************************************************/
+#define LANE_KEYS   8
+
+TARGET_AVX2
+static void ReKeyLanesAVX2( keyInstance* const* kp )
+{
+    size_t   k64Cnt    = (kp[0]->keyLen+63)/64;
+    size_t   subkeyCnt = ROUND_SUBKEYS + 2*kp[0]->numRounds;
+    uint32_t sk[TOTAL_SUBKEYS][LANE_KEYS];
+    uint32_t sb[LANE_KEYS];
+    __m256i  ke[MAX_KEY_BITS/64];
+    __m256i  ko[MAX_KEY_BITS/64];
+
+#define LaneKeyV(n)     _mm256_setr_epi32( kp[0]->key32[n], kp[1]->key32[n], \
+                                           kp[2]->key32[n], kp[3]->key32[n], \
+                                           kp[4]->key32[n], kp[5]->key32[n], \
+                                           kp[6]->key32[n], kp[7]->key32[n] )
+
+    for ( size_t cnt=0; cnt<MAX_KEY_BITS/64; cnt++ )
+    {
+        ke[cnt] = _mm256_setzero_si256();
+        ko[cnt] = _mm256_setzero_si256();
+    }
+
+    for ( size_t cnt=0; cnt<k64Cnt; cnt++ )
+    {
+        ke[cnt] = LaneKeyV(2*cnt);
+        ko[cnt] = LaneKeyV(2*cnt+1);
+
+        /* RS_MDS_Encode(), S-box keys in reverse order */
+        __m256i r = ko[cnt];
+        RS_remV(r); RS_remV(r); RS_remV(r); RS_remV(r);
+        r = _mm256_xor_si256(r,ke[cnt]);
+        RS_remV(r); RS_remV(r); RS_remV(r); RS_remV(r);
+
+        _mm256_storeu_si256( (__m256i*)sb, r );
+        for ( size_t cntl=0; cntl<LANE_KEYS; cntl++ )
+            kp[cntl]->sboxKeys[k64Cnt-1-cnt] = sb[cntl];
+    }
+
+    for ( size_t cnt=0; cnt<subkeyCnt/2; cnt++ )
+    {
+        __m256i A = F32V( _mm256_set1_epi32(cnt*SK_STEP), ke, k64Cnt );
+        __m256i B = F32V( _mm256_set1_epi32(cnt*SK_STEP+SK_BUMP), ko, k64Cnt );
+
+        B = ROLV(B,8);
+        _mm256_storeu_si256( (__m256i*)sk[2*cnt], _mm256_add_epi32(A,B) );
+        B = _mm256_add_epi32(A,_mm256_slli_epi32(B,1));
+        _mm256_storeu_si256( (__m256i*)sk[2*cnt+1], ROLV(B,SK_ROTL) );
+    }
+
+    for ( size_t cntl=0; cntl<LANE_KEYS; cntl++ )
+    {
+        for ( size_t cnt=0; cnt<subkeyCnt; cnt++ )
+            kp[cntl]->subKeys[cnt] = sk[cnt][cntl];
+        kp[cntl]->sboxReady = 0;    /* new sboxKeys, S-boxes are stale */
+    }
+
+#undef LaneKeyV
+}
+#endif /// of X86_SIMD && FULL_KEY
+
 /*
 +*****************************************************************************
 *
@@ -552,8 +1068,28 @@ void ReverseRoundSubkeys( keyInstance* key, uint8_t newDir )
 *   required.  For example, on a smartcard, the round subkeys can 
 *   be generated on-the-fly using f32()
 *
+*   ReKeyStep() does only the REKEY_* steps asked for.  makeKeys() does
+*   sboxKeys and subKeys of several keys at once and leaves the rest here,
+*   lazy keys (see LazyOp) get their S-boxes on first bulk call.
+*
 -****************************************************************************/
+#define REKEY_SUBKEYS   1   /* sboxKeys and subKeys from key32 */
+#define REKEY_SBOXES    2   /* expand sBox8x32 from sboxKeys */
+#define REKEY_REVERSE   4   /* fit subKeys, in natural order, to direction */
+
+static int ReKeyStep( keyInstance* key, int steps );
+
 int reKey( keyInstance* key )
+{
+    int steps = REKEY_SUBKEYS | REKEY_REVERSE;
+
+    if ( LazyOp(LAZY_QUERY) != TF_SUCCESS )
+        steps |= REKEY_SBOXES;
+
+    return ReKeyStep( key, steps );
+}
+
+static int ReKeyStep( keyInstance* key, int steps )
 {
     if ( key == NULL )
         return TF_FAILURE;
@@ -571,6 +1107,10 @@ int reKey( keyInstance* key )
     /* small local 8-bit permutations */
     uint8_t L0[256] = {0};
     uint8_t L1[256] = {0};
+    /* set when vector code did subkeys or S-boxes */
+    bool    subkeyDone = ( ( steps & REKEY_SUBKEYS ) == 0 );
+    bool    sboxDone   = ( ( steps & REKEY_SBOXES ) == 0 );
+    bool    useBig     = ( BigTabOp(BIGTAB_QUERY) == TF_SUCCESS );
 
 #if VALIDATE_PARMS
     #if ALIGN32
@@ -620,9 +1160,29 @@ int reKey( keyInstance* key )
         k32e[i]=key->key32[2*i  ];
         k32o[i]=key->key32[2*i+1];
         /* compute S-box keys using (12,8) Reed-Solomon code over GF(256) */
-        sKey[j]=key->sboxKeys[j]=RS_MDS_Encode(k32e[i],k32o[i]);    /* reverse order */
+        if ( subkeyDone == false )
+            key->sboxKeys[j]=RS_MDS_Encode(k32e[i],k32o[i]);    /* reverse order */
+        sKey[j]=key->sboxKeys[j];
+    }
+
+#if X86_SIMD && defined(FULL_KEY)
+    switch ( SimdLevel() )
+    {
+        case SIMD_LEVEL_VBMI:
+            if ( ( useBig == false ) && ( sboxDone == false ) )
+            {
+                SboxVBMI( key, sKey );
+                sboxDone = true;
+            }
+            /* fall thru */
+        case SIMD_LEVEL_AVX2:
+            if ( subkeyDone == false )
+                SubkeysAVX2( key, k32e, k32o );
+            subkeyDone = true;
     }
+#endif
 
+    if ( subkeyDone == false )
     for (i=q=0;i<subkeyCnt/2;i++,q+=SK_STEP)    
     {                           /* compute round subkeys for PHT */
         F32(A,q        ,k32e);      /* A uses even key dwords */
@@ -634,25 +1194,23 @@ int reKey( keyInstance* key )
     }
     
 #if !defined(ZERO_KEY)
+    if ( sboxDone == false )
     switch (keyLen) /* case out key length for speed in generating S-boxes */
     {
         case 128:
         #if defined(FULL_KEY) || defined(PART_KEY)
-#if BIG_TAB
-            #define one128(N,J) sbSet(N,i,J,L0[i+J])
-            #define sb128(N) {                      \
-                uint8_t* qq=bigTab[N][b##N(sKey[1])];   \
-                Xor256(L0,qq,b##N(sKey[0]));        \
-                for (size_t cnti=0; cnti<256; cnti+=2) \
-                { one128(N,0); one128(N,1); } }
-#else
-            #define one128(N,J) sbSet(N,i,J,p8(N##1)[L0[i+J]]^k0)
+            #define oneBig128(N,J) sbSet(N,cnti,J,L0[cnti+J])
+            #define one128(N,J) sbSet(N,cnti,J,p8(N##1)[L0[cnti+J]]^k0)
             #define sb128(N) {                  \
-                Xor256(L0,p8(N##2),b##N(sKey[1]));  \
+              if ( useBig == true )             \
+              { Xor256(L0,bigTab[N][b##N(sKey[1])],b##N(sKey[0]));  \
+                for (size_t cnti=0; cnti<256; cnti+=2) \
+                { oneBig128(N,0); oneBig128(N,1); } }  \
+              else                              \
+              { Xor256(L0,p8(N##2),b##N(sKey[1]));  \
                 { register uint32_t k0=b##N(sKey[0]);   \
                   for (size_t cnti=0; cnti<256; cnti+=2) \
-                  { one128(N,0); one128(N,1); } } }
-#endif
+                  { one128(N,0); one128(N,1); } } } }
         #elif defined(MIN_KEY)
             #define sb128(N) Xor256(_sBox8_(N),p8(N##2),b##N(sKey[1]))
         #endif
@@ -661,15 +1219,21 @@ int reKey( keyInstance* key )
             
         case 192:
         #if defined(FULL_KEY) || defined(PART_KEY)
-            #define one192(N,J) sbSet(N,i,J,p8(N##1)[p8(N##2)[L0[i+J]]^k1]^k0)
+            #define oneBig192(N,J) sbSet(N,cnti,J,qq[L0[cnti+J]]^k0)
+            #define one192(N,J) sbSet(N,cnti,J,p8(N##1)[p8(N##2)[L0[cnti+J]]^k1]^k0)
             #define sb192(N) {                      \
                 Xor256(L0,p8(N##3),b##N(sKey[2]));  \
                 { register uint32_t k0=b##N(sKey[0]);   \
                   register uint32_t k1=b##N(sKey[1]);   \
+                  const uint8_t* qq=bigTab[N][k1];      \
+                  if ( useBig == true )                 \
+                  for (size_t cnti=0; cnti<256; cnti+=2) \
+                  { oneBig192(N,0); oneBig192(N,1); }   \
+                  else                                  \
                   for (size_t cnti=0; cnti<256; cnti+=2) \
                   { one192(N,0); one192(N,1); } } }
         #elif defined(MIN_KEY)
-            #define one192(N,J) sbSet(N,i,J,p8(N##2)[L0[i+J]]^k1)
+            #define one192(N,J) sbSet(N,cnti,J,p8(N##2)[L0[cnti+J]]^k1)
             #define sb192(N) {                      \
                 Xor256(L0,p8(N##3),b##N(sKey[2]));  \
                 { register uint32_t k1=b##N(sKey[1]);   \
@@ -681,7 +1245,8 @@ int reKey( keyInstance* key )
             
         case 256:
         #if defined(FULL_KEY) || defined(PART_KEY)
-            #define one256(N,J) sbSet(N,i,J,p8(N##1)[p8(N##2)[L0[i+J]]^k1]^k0)
+            #define oneBig256(N,J) sbSet(N,cnti,J,qq[L0[cnti+J]]^k0)
+            #define one256(N,J) sbSet(N,cnti,J,p8(N##1)[p8(N##2)[L0[cnti+J]]^k1]^k0)
             #define sb256(N) {                                      \
                 Xor256(L1,p8(N##4),b##N(sKey[3]));                  \
                 for (size_t cnti=0; cnti<256; cnti+=2)              \
@@ -690,10 +1255,15 @@ int reKey( keyInstance* key )
                 Xor256(L0,L0,b##N(sKey[2]));                        \
                 { register uint32_t k0=b##N(sKey[0]);               \
                   register uint32_t k1=b##N(sKey[1]);               \
+                  const uint8_t* qq=bigTab[N][k1];                  \
+                  if ( useBig == true )                             \
+                  for ( size_t cnti=0; cnti<256; cnti+=2)           \
+                  { oneBig256(N,0); oneBig256(N,1); }               \
+                  else                                              \
                   for ( size_t cnti=0; cnti<256; cnti+=2)           \
                   { one256(N,0); one256(N,1); } } }
         #elif defined(MIN_KEY)
-            #define one256(N,J) sbSet(N,i,J,p8(N##2)[L0[i+J]]^k1)
+            #define one256(N,J) sbSet(N,cnti,J,p8(N##2)[L0[cnti+J]]^k1)
             #define sb256(N) {                                      \
                 Xor256(L1,p8(N##4),b##N(sKey[3]));                  \
                 for (size_t cnti=0; cnti<256; cnti+=2)              \
@@ -721,24 +1291,47 @@ int reKey( keyInstance* key )
         assert(key->subKeys[2*cnt+1] == ROL(A+2*B,SK_ROTL));
     }
   #if !defined(ZERO_KEY)            /* any S-boxes to check? */
+    if ( steps & REKEY_SBOXES )
     for ( size_t cnt=q=0; cnt<256; cnt++, q+=0x01010101 )
         assert(f32(q,key->sboxKeys,keyLen) == Fe32_(q,0));
   #endif
 #endif /* CHECK_TABLE */
 
+    if ( steps & REKEY_SBOXES )
+        key->sboxReady = 1;
+    else if ( steps & REKEY_SUBKEYS )
+        key->sboxReady = 0;
+
     DebugDumpKey(key);
 
-    if (key->direction == DIR_ENCRYPT)  
+    if ((steps & REKEY_REVERSE) && (key->direction == DIR_ENCRYPT))
         ReverseRoundSubkeys(key,DIR_ENCRYPT);   /* reverse the round subkey order */
 
     return TF_SUCCESS;
 }
 
-/*
-+*****************************************************************************
-*
-* Function Name:    makeKey
-*
+/* build S-boxes of a lazy key */
+static void ExpandSboxes( keyInstance* key )
+{
+    if ( key->sboxReady == 0 )
+        ReKeyStep( key, REKEY_SBOXES );
+}
+
+int expandKey( keyInstance* key )
+{
+    if ((key == NULL) || (key->keySig != VALID_SIG))
+        return BAD_KEY_INSTANCE;
+
+    ExpandSboxes( key );
+
+    return TF_SUCCESS;
+}
+
+/*
++*****************************************************************************
+*
+* Function Name:    makeKey
+*
 * Function:         Initialize the Twofish key schedule
 *
 * Arguments:        key         =   ptr to keyInstance to be initialized
@@ -752,7 +1345,20 @@ int reKey( keyInstance* key )
 * Notes:    This parses the key bits from keyMaterial.  Zeroes out unused key bits
 *
 -****************************************************************************/
+static int SetupKey( keyInstance* key, uint8_t direction, size_t keyLen, const char* keyMaterial );
+
 int makeKey( keyInstance* key, uint8_t direction, size_t keyLen, const char* keyMaterial )
+{
+    int reti = SetupKey( key, direction, keyLen, keyMaterial );
+
+    if ( ( reti != TF_SUCCESS ) || (keyMaterial == NULL) || (keyMaterial[0]==0) )
+        return reti;
+
+    return reKey(key);          /* generate round subkeys */
+}
+
+/* all of makeKey() but the key schedule */
+static int SetupKey( keyInstance* key, uint8_t direction, size_t keyLen, const char* keyMaterial )
 {
     /* first, sanity check on parameters */
 #if VALIDATE_PARMS
@@ -788,7 +1394,168 @@ int makeKey( keyInstance* key, uint8_t direction, size_t keyLen, const char* key
     if ( ParseHexDword(keyLen,keyMaterial,key->key32,key->keyMaterial) )
         return BAD_KEY_MAT;
     
-    return reKey(key);          /* generate round subkeys */
+    return TF_SUCCESS;
+}
+
+/*
++*****************************************************************************
+*
+* Function Name:    makeKeys
+*
+* Function:         Initialize key schedules of many keys at once
+*
+* Arguments:        keys        =   array of keyCnt keyInstances to initialize
+*                   keyCnt      =   # of keys
+*                   direction   =   DIR_ENCRYPT or DIR_DECRYPT, for all keys
+*                   keyLen      =   # bits of key text, for all keys
+*                   keyMaterial =   array of keyCnt ptrs to hex ASCII keys
+*                   threadCnt   =   # of threads to use, 0 --> decide by keyCnt
+*
+* Return:           TF_SUCCESS when all keys are made
+*                   else error code of first key that failed
+*
+* Notes:
+*   Same result as makeKey() on each key.  Keys that fail don't stop the
+*   others.  With vector kernels, RS_MDS_Encode() and subkeys are done
+*   LANE_KEYS keys per instruction, and only the S-boxes are per key.
+*   Big batches are split in contiguous ranges over threads; with
+*   threadCnt 0 a thread is used per MAKEKEYS_PER_THREAD keys, up to the
+*   number of CPUs.
+*
+-****************************************************************************/
+#define MAKEKEYS_PER_THREAD     2048
+
+/* keeps error of the lowest numbered key that failed */
+static void MakeKeysError( int* reti, size_t* retIdx, size_t idx, int err )
+{
+    if ( ( err != TF_SUCCESS ) &&
+         ( ( *reti == TF_SUCCESS ) || ( idx < *retIdx ) ) )
+    {
+        *reti   = err;
+        *retIdx = idx;
+    }
+}
+
+static int MakeKeysRange( keyInstance* keys, size_t keyCnt, uint8_t direction,
+                          size_t keyLen, const char* const* keyMaterial )
+{
+    int          reti   = TF_SUCCESS;
+    size_t       retIdx = 0;
+#if X86_SIMD && defined(FULL_KEY)
+    bool         useVec = ( SimdLevel() > 0 );
+    keyInstance* kp[LANE_KEYS];
+    size_t       kpCnt  = 0;
+    int          steps  = REKEY_REVERSE;
+
+    if ( LazyOp(LAZY_QUERY) != TF_SUCCESS )
+        steps |= REKEY_SBOXES;
+#endif
+
+    for ( size_t cnt=0; cnt<keyCnt; cnt++ )
+    {
+        int retk = SetupKey( &keys[cnt], direction, keyLen, keyMaterial[cnt] );
+
+        if ( retk != TF_SUCCESS )
+        {
+            MakeKeysError( &reti, &retIdx, cnt, retk );
+            continue;
+        }
+
+        if ( (keyMaterial[cnt] == NULL) || (keyMaterial[cnt][0]==0) )
+            continue;
+
+#if X86_SIMD && defined(FULL_KEY)
+        if ( useVec == true )
+        {
+            kp[kpCnt++] = &keys[cnt];
+            if ( kpCnt == LANE_KEYS )
+            {
+                ReKeyLanesAVX2( kp );
+                for ( size_t cntl=0; cntl<kpCnt; cntl++ )
+                    MakeKeysError( &reti, &retIdx, (size_t)( kp[cntl] - keys ),
+                                   ReKeyStep( kp[cntl], steps ) );
+                kpCnt = 0;
+            }
+            continue;
+        }
+#endif
+        MakeKeysError( &reti, &retIdx, cnt, reKey( &keys[cnt] ) );
+    }
+
+#if X86_SIMD && defined(FULL_KEY)
+    if ( kpCnt > 0 )
+    {
+        /* short group : repeat last key in unused lanes */
+        for ( size_t cntl=kpCnt; cntl<LANE_KEYS; cntl++ )
+            kp[cntl] = kp[kpCnt-1];
+
+        ReKeyLanesAVX2( kp );
+        for ( size_t cntl=0; cntl<kpCnt; cntl++ )
+            MakeKeysError( &reti, &retIdx, (size_t)( kp[cntl] - keys ),
+                           ReKeyStep( kp[cntl], steps ) );
+    }
+#endif
+
+    return reti;
+}
+
+int makeKeys( keyInstance* keys, size_t keyCnt, uint8_t direction, size_t keyLen,
+              const char* const* keyMaterial, size_t threadCnt )
+{
+    if ( ( keys == NULL ) || ( keyMaterial == NULL ) )
+        return BAD_PARAMS;
+
+    if ( keyCnt == 0 )
+        return TF_SUCCESS;
+
+    /* tables are shared by threads, build them before any starts */
+    if ( needToBuildMDS == true )
+        BuildMDS();
+
+    SimdOp(SIMD_QUERY);
+
+    if ( threadCnt == 0 )
+    {
+        size_t cpuCnt = std::thread::hardware_concurrency();
+
+        threadCnt = keyCnt / MAKEKEYS_PER_THREAD;
+        if ( threadCnt > cpuCnt )
+            threadCnt = cpuCnt;
+    }
+
+    if ( threadCnt > keyCnt )
+        threadCnt = keyCnt;
+
+    if ( threadCnt <= 1 )
+        return MakeKeysRange( keys, keyCnt, direction, keyLen, keyMaterial );
+
+    std::vector< std::thread > thrs;
+    std::vector< int >         rets( threadCnt, TF_SUCCESS );
+    size_t                     per = keyCnt / threadCnt;
+
+    /* calling thread does the first range */
+    for ( size_t cnt=1; cnt<threadCnt; cnt++ )
+    {
+        size_t first = cnt * per;
+        size_t cntk  = ( cnt+1 == threadCnt ) ? ( keyCnt - first ) : per;
+
+        thrs.push_back( std::thread( [=,&rets]()
+        {
+            rets[cnt] = MakeKeysRange( keys + first, cntk, direction, keyLen,
+                                       keyMaterial + first );
+        } ) );
+    }
+
+    rets[0] = MakeKeysRange( keys, per, direction, keyLen, keyMaterial );
+
+    for ( size_t cnt=0; cnt<thrs.size(); cnt++ )
+        thrs[cnt].join();
+
+    for ( size_t cnt=0; cnt<threadCnt; cnt++ )
+        if ( rets[cnt] != TF_SUCCESS )
+            return rets[cnt];
+
+    return TF_SUCCESS;
 }
 
 /*
@@ -799,8 +1566,9 @@ int makeKey( keyInstance* key, uint8_t direction, size_t keyLen, const char* key
 * Function:         Initialize the Twofish cipher in a given mode
 *
 * Arguments:        cipher      =   ptr to cipherInstance to be initialized
-*                   mode        =   MODE_ECB, MODE_CBC, or MODE_CFB1
+*                   mode        =   MODE_ECB, MODE_CBC, MODE_CFB1 or MODE_CTR
 *                   IV          =   ptr to hex ASCII test representing IV bytes
+*                                   (initial counter block for MODE_CTR)
 *
 * Return:           TF_SUCCESS on success
 *                   else error code (e.g., BAD_CIPHER_MODE)
@@ -815,7 +1583,8 @@ int cipherInit( cipherInstance* cipher, uint8_t mode, const char* IV )
         return BAD_PARAMS;
     
     /* must have valid cipher mode */
-    if ((mode != MODE_ECB) && (mode != MODE_CBC) && (mode != MODE_CFB1))
+    if ((mode != MODE_ECB) && (mode != MODE_CBC) && (mode != MODE_CFB1) &&
+        (mode != MODE_CTR))
         return BAD_CIPHER_MODE;
     
     cipher->cipherSig   =   VALID_SIG;
@@ -836,6 +1605,43 @@ int cipherInit( cipherInstance* cipher, uint8_t mode, const char* IV )
     return TF_SUCCESS;
 }
 
+/*
++*****************************************************************************
+*
+* Function Name:    CounterAdd
+*
+* Function:         Step the counter block of a MODE_CTR cipher
+*
+* Arguments:        cipher      =   ptr to already initialized cipherInstance
+*                   blockCnt    =   # of blocks to step over
+*
+* Return:           None.
+*
+* Notes: The counter is the IV taken as one big-endian 128-bit number,
+*   wrapping around.  Gives the cipher for data blockCnt blocks further,
+*   so a stream can be ciphered in pieces, in any order.
+*
+-****************************************************************************/
+void CounterAdd( cipherInstance* cipher, uint64_t blockCnt )
+{
+    if ( cipher == NULL )
+        return;
+
+    uint32_t carry = 0;
+
+    for ( size_t cnt=BLOCK_SIZE/8; ( cnt-->0 ) && ( ( blockCnt | carry ) != 0 ); )
+    {
+        carry += cipher->IV[cnt] + (uint32_t)( blockCnt & 0xFF );
+        cipher->IV[cnt] = (uint8_t)carry;
+        carry  >>= 8;
+        blockCnt >>= 8;
+    }
+
+    /* keep dword copy as cipherInit() makes it */
+    for ( size_t cnt=0; cnt<BLOCK_SIZE/32; cnt++ )
+        cipher->iv32[cnt] = Bswap(((uint32_t *)cipher->IV)[cnt]);
+}
+
 /*
 +*****************************************************************************
 *
@@ -868,8 +1674,12 @@ int cipherInit( cipherInstance* cipher, uint8_t mode, const char* IV )
             x[K^2] = ROR(x[K^2],1);                         \
             DebugDump(x,"",rounds-(R),0,0,1,0);
 #define     Encrypt2(R,id)  { EncryptRound(0,R+1,id); EncryptRound(2,R,id); }
-int blockEncrypt( cipherInstance* cipher, keyInstance* key, 
-                  const uint8_t* input, size_t inputLen, uint8_t* outBuffer )
+#define     EncryptAll(id)  { Encrypt2(14,id); Encrypt2(12,id); Encrypt2(10,id); Encrypt2( 8,id); \
+                              Encrypt2( 6,id); Encrypt2( 4,id); Encrypt2( 2,id); Encrypt2( 0,id); }
+/* expand false keeps a lazy key lazy for calls of any size */
+static int EncryptBlocks( cipherInstance* cipher, keyInstance* key,
+                          const uint8_t* input, size_t inputLen, uint8_t* outBuffer,
+                          bool expand )
 {
     /* block being encrypted */
     uint32_t x[BLOCK_SIZE/32] = {0};
@@ -895,18 +1705,64 @@ int blockEncrypt( cipherInstance* cipher, keyInstance* key,
     if ((rounds < 2) || (rounds > MAX_ROUNDS) || (rounds&1))
         return BAD_KEY_INSTANCE;
     
-    if ((mode != MODE_CFB1) && (inputLen % BLOCK_SIZE))
+    if (BadInputLen(mode,inputLen))
         return BAD_INPUT_LEN;
 
 #endif /// of VALIDATE_PARMS
 
+#if defined(FULL_KEY)
+    /* lazy key : expand S-boxes for a bulk call, else look up on-the-fly */
+    bool     lazy = false;
+    uint32_t SKEY[MAX_KEY_BITS/64];
+
+    if ( key->sboxReady == 0 )
+    {
+        if ( ( expand == true ) &&
+             ( ( (mode == MODE_CFB1) ? inputLen : inputLen/BLOCK_SIZE ) > LAZY_BLOCKS ) )
+            ExpandSboxes( key );
+        else
+        {
+            lazy = true;
+            memcpy( SKEY, key->sboxKeys, sizeof(SKEY) );
+        }
+    }
+#endif
+
+    if ( mode == MODE_CTR )
+    {   /* encrypt counter blocks in ECB, CTR_BLOCKS at a time, for keystream */
+        uint32_t ks[CTR_BLOCKS*BLOCK_SIZE/32];
+        size_t   byteCnt = inputLen/8;
+
+        cipher->mode = MODE_ECB;
+
+        for ( size_t n=0; n<byteCnt; n+=sizeof(ks) )
+        {
+            size_t len = ( byteCnt-n < sizeof(ks) ) ? byteCnt-n : sizeof(ks);
+            size_t blk = ( len + BLOCK_SIZE/8 - 1 ) / (BLOCK_SIZE/8);
+
+            for ( size_t cnt=0; cnt<blk; cnt++ )
+            {
+                memcpy( (uint8_t*)ks + cnt*BLOCK_SIZE/8, cipher->IV, BLOCK_SIZE/8 );
+                CounterAdd( cipher, 1 );
+            }
+
+            EncryptBlocks( cipher, key, (uint8_t*)ks, blk*BLOCK_SIZE, (uint8_t*)ks, expand );
+
+            for ( size_t cnt=0; cnt<len; cnt++ )
+                outBuffer[n+cnt] = input[n+cnt] ^ ((uint8_t*)ks)[cnt];
+        }
+
+        cipher->mode = MODE_CTR;    /* restore mode for next time */
+        return inputLen;
+    }
+
     if ( mode == MODE_CFB1 )
     {   /* use recursion here to handle CFB, one block at a time */
         cipher->mode = MODE_ECB;    /* do encryption in ECB */
         
         for ( size_t n=0; n<inputLen; n++ )
         {
-            blockEncrypt(cipher,key,cipher->IV,BLOCK_SIZE,(uint8_t*)x);
+            EncryptBlocks(cipher,key,cipher->IV,BLOCK_SIZE,(uint8_t*)x,expand);
             bit0  = 0x80 >> (n & 7);/* which bit position in byte */
             ctBit = (input[n/8] & bit0) ^ ((((uint8_t *) x)[0] & 0x80) >> (n&7));
             outBuffer[n/8] = (outBuffer[n/8] & ~ bit0) | ctBit;
@@ -972,6 +1828,19 @@ int blockEncrypt( cipherInstance* cipher, keyInstance* key,
                 break;
         }
 #else
+  #if defined(FULL_KEY)
+        if ( lazy == true )
+        {
+            switch (key->keyLen)
+            {
+                case 128:   EncryptAll(_128);    break;
+                case 192:   EncryptAll(_192);    break;
+                default:    EncryptAll(_256);    break;
+            }
+        }
+        else
+  #endif
+        {
         Encrypt2(14,_);
         Encrypt2(12,_);
         Encrypt2(10,_);
@@ -980,6 +1849,7 @@ int blockEncrypt( cipherInstance* cipher, keyInstance* key,
         Encrypt2( 4,_);
         Encrypt2( 2,_);
         Encrypt2( 0,_);
+        }
 #endif
 
         /* need to do (or undo, depending on your point of view) final swap */
@@ -1012,6 +1882,12 @@ int blockEncrypt( cipherInstance* cipher, keyInstance* key,
     return (int)inputLen;
 }
 
+int blockEncrypt( cipherInstance* cipher, keyInstance* key,
+                  const uint8_t* input, size_t inputLen, uint8_t* outBuffer )
+{
+    return EncryptBlocks( cipher, key, input, inputLen, outBuffer, true );
+}
+
 /*
 +*****************************************************************************
 *
@@ -1044,8 +1920,11 @@ int blockEncrypt( cipherInstance* cipher, keyInstance* key,
             x[K^3] = ROR (x[K^3],1);                        \
 
 #define     Decrypt2(R,id)  { DecryptRound(2,R+1,id); DecryptRound(0,R,id); }
-int blockDecrypt( cipherInstance* cipher, keyInstance* key, 
-                  const uint8_t* input, size_t inputLen, uint8_t* outBuffer )
+#define     DecryptAll(id)  { Decrypt2(14,id); Decrypt2(12,id); Decrypt2(10,id); Decrypt2( 8,id); \
+                              Decrypt2( 6,id); Decrypt2( 4,id); Decrypt2( 2,id); Decrypt2( 0,id); }
+static int DecryptBlocks( cipherInstance* cipher, keyInstance* key,
+                          const uint8_t* input, size_t inputLen, uint8_t* outBuffer,
+                          bool expand )
 {
     /* block being encrypted */
     uint32_t x[BLOCK_SIZE/32] = {0};         
@@ -1071,17 +1950,39 @@ int blockDecrypt( cipherInstance* cipher, keyInstance* key,
     if ((rounds < 2) || (rounds > MAX_ROUNDS) || (rounds&1))
         return BAD_KEY_INSTANCE;
     
-    if ((cipher->mode != MODE_CFB1) && (inputLen % BLOCK_SIZE))
+    if (BadInputLen(cipher->mode,inputLen))
         return BAD_INPUT_LEN;
 #endif
 
+    /* CTR is the same both ways */
+    if (cipher->mode == MODE_CTR)
+        return EncryptBlocks(cipher,key,input,inputLen,outBuffer,expand);
+
+#if defined(FULL_KEY)
+    /* lazy key : expand S-boxes for a bulk call, else look up on-the-fly */
+    bool     lazy = false;
+    uint32_t SKEY[MAX_KEY_BITS/64];
+
+    if ( key->sboxReady == 0 )
+    {
+        if ( ( expand == true ) &&
+             ( ( (mode == MODE_CFB1) ? inputLen : inputLen/BLOCK_SIZE ) > LAZY_BLOCKS ) )
+            ExpandSboxes( key );
+        else
+        {
+            lazy = true;
+            memcpy( SKEY, key->sboxKeys, sizeof(SKEY) );
+        }
+    }
+#endif
+
     if (cipher->mode == MODE_CFB1)
     {   /* use blockEncrypt here to handle CFB, one block at a time */
         cipher->mode = MODE_ECB;    /* do encryption in ECB */
         
         for ( size_t n=0; n<inputLen; n++ )
         {
-            blockEncrypt(cipher,key,cipher->IV,BLOCK_SIZE,(uint8_t *)x);
+            EncryptBlocks(cipher,key,cipher->IV,BLOCK_SIZE,(uint8_t *)x,expand);
             bit0  = 0x80 >> (n & 7);
             ctBit = input[n/8] & bit0;
             outBuffer[n/8] = (outBuffer[n/8] & ~ bit0) |
@@ -1146,6 +2047,19 @@ int blockDecrypt( cipherInstance* cipher, keyInstance* key,
                 break;
         }
 #else
+  #if defined(FULL_KEY)
+        if ( lazy == true )
+        {
+            switch (key->keyLen)
+            {
+                case 128:   DecryptAll(_128);    break;
+                case 192:   DecryptAll(_192);    break;
+                default:    DecryptAll(_256);    break;
+            }
+        }
+        else
+  #endif
+        {
         Decrypt2(14,_);
         Decrypt2(12,_);
         Decrypt2(10,_);
@@ -1154,6 +2068,7 @@ int blockDecrypt( cipherInstance* cipher, keyInstance* key,
         Decrypt2( 4,_);
         Decrypt2( 2,_);
         Decrypt2( 0,_);
+        }
 #endif
         DebugDump(x,"",0,0,0,0,0);
         
@@ -1187,6 +2102,684 @@ int blockDecrypt( cipherInstance* cipher, keyInstance* key,
     return inputLen;
 }
 
+int blockDecrypt( cipherInstance* cipher, keyInstance* key,
+                  const uint8_t* input, size_t inputLen, uint8_t* outBuffer )
+{
+    return DecryptBlocks( cipher, key, input, inputLen, outBuffer, true );
+}
+
+/*
++*****************************************************************************
+*           Compact keys
+-****************************************************************************/
+
+/* compact key fields of a keyInstance, both ways */
+static void KeyToCompact( compactKey* ckey, const keyInstance* key )
+{
+    ckey->direction = key->direction;
+    ckey->keyLen    = key->keyLen;
+    ckey->keySig    = key->keySig;
+    ckey->numRounds = key->numRounds;
+    memcpy( ckey->key32,    key->key32,    sizeof(ckey->key32) );
+    memcpy( ckey->sboxKeys, key->sboxKeys, sizeof(ckey->sboxKeys) );
+    memcpy( ckey->subKeys,  key->subKeys,  sizeof(ckey->subKeys) );
+}
+
+static void CompactToKey( keyInstance* key, const compactKey* ckey )
+{
+    key->direction = ckey->direction;
+    key->keyLen    = ckey->keyLen;
+    key->keySig    = ckey->keySig;
+    key->numRounds = ckey->numRounds;
+    key->sboxReady = 0;
+    memcpy( key->key32,    ckey->key32,    sizeof(key->key32) );
+    memcpy( key->sboxKeys, ckey->sboxKeys, sizeof(key->sboxKeys) );
+    memcpy( key->subKeys,  ckey->subKeys,  sizeof(key->subKeys) );
+}
+
+/*
++*****************************************************************************
+*
+* Function Name:    makeCompactKey
+*
+* Function:         Initialize a compact key : key schedule without S-boxes
+*
+* Arguments:        ckey        =   ptr to compactKey to be initialized
+*                   direction   =   DIR_ENCRYPT or DIR_DECRYPT
+*                   keyLen      =   # bits of key text at *keyMaterial
+*                   keyMaterial =   ptr to hex ASCII chars representing key bits
+*
+* Return:           TF_SUCCESS on success
+*                   else error code (e.g., BAD_KEY_DIR)
+*
+* Notes:    Same parameters as makeKey().  No keyMaterial gives the schedule
+*   of an all zero key.  The key takes sizeof(compactKey) bytes instead of
+*   sizeof(keyInstance), blockEncryptCompact()/blockDecryptCompact() look
+*   S-boxes up from MDStab on-the-fly, and promoteKey() makes a full key.
+*
+-****************************************************************************/
+int makeCompactKey( compactKey* ckey, uint8_t direction, size_t keyLen, const char* keyMaterial )
+{
+    keyInstance key;    /* sBox8x32 of it is never touched */
+
+    if ( ckey == NULL )
+        return BAD_KEY_INSTANCE;
+
+    int reti = SetupKey( &key, direction, keyLen, keyMaterial );
+    if ( reti != TF_SUCCESS )
+        return reti;
+
+    /* sboxKeys past keyLen aren't set by ReKeyStep() */
+    memset( key.sboxKeys, 0, sizeof(key.sboxKeys) );
+
+    reti = ReKeyStep( &key, REKEY_SUBKEYS | REKEY_REVERSE );
+    if ( reti != TF_SUCCESS )
+        return reti;
+
+    KeyToCompact( ckey, &key );
+
+    return TF_SUCCESS;
+}
+
+/*
++*****************************************************************************
+*
+* Function Name:    blockEncryptCompact, blockDecryptCompact
+*
+* Function:         Encrypt or decrypt block(s) of data with a compact key
+*
+* Arguments:        cipher      =   ptr to already initialized cipherInstance
+*                   ckey        =   ptr to compactKey from makeCompactKey()
+*                   input       =   ptr to data blocks to be ciphered
+*                   inputLen    =   # bits to cipher (multiple of blockSize)
+*                   outBuffer   =   ptr to where to put ciphered blocks
+*
+* Return:           # bits ciphered (>= 0)
+*                   else error code (e.g., BAD_CIPHER_STATE, BAD_KEY_INSTANCE)
+*
+* Notes: Same output as blockEncrypt()/blockDecrypt() with a full key.
+*   The compact key is read only, so threads may share it.  Every round
+*   does 8 or more table lookups per byte instead of one, so a key that
+*   gets busy is better promoted with promoteKey().
+*
+-****************************************************************************/
+static int CipherCompact( cipherInstance* cipher, const compactKey* ckey,
+                          const uint8_t* input, size_t inputLen, uint8_t* outBuffer,
+                          uint8_t dir )
+{
+    keyInstance key;    /* a lazy copy, direction is fixed up on it */
+
+#if VALIDATE_PARMS
+    if ((ckey == NULL) || (ckey->keySig != VALID_SIG))
+        return BAD_KEY_INSTANCE;
+#endif
+
+    CompactToKey( &key, ckey );
+
+#if !defined(FULL_KEY) && !defined(ZERO_KEY)
+    /* partial S-boxes of MIN_KEY/PART_KEY can't be skipped */
+    ReKeyStep( &key, REKEY_SBOXES );
+#endif
+
+    if ( dir == DIR_ENCRYPT )
+        return EncryptBlocks( cipher, &key, input, inputLen, outBuffer, false );
+
+    return DecryptBlocks( cipher, &key, input, inputLen, outBuffer, false );
+}
+
+int blockEncryptCompact( cipherInstance* cipher, const compactKey* ckey,
+                         const uint8_t* input, size_t inputLen, uint8_t* outBuffer )
+{
+    return CipherCompact( cipher, ckey, input, inputLen, outBuffer, DIR_ENCRYPT );
+}
+
+int blockDecryptCompact( cipherInstance* cipher, const compactKey* ckey,
+                         const uint8_t* input, size_t inputLen, uint8_t* outBuffer )
+{
+    return CipherCompact( cipher, ckey, input, inputLen, outBuffer, DIR_DECRYPT );
+}
+
+/*
++*****************************************************************************
+*
+* Function Name:    promoteKey, demoteKey
+*
+* Function:         Turn a compact key into a full key, or back
+*
+* Arguments:        key         =   ptr to keyInstance
+*                   ckey        =   ptr to compactKey
+*
+* Return:           TF_SUCCESS on success
+*                   else BAD_KEY_INSTANCE
+*
+* Notes: promoteKey() builds the S-boxes (or leaves them to the first bulk
+*   call when LazyOp() is on) and the ASCII keyMaterial, so the key is the
+*   same as one from makeKey().  demoteKey() keeps only the compact part.
+*
+-****************************************************************************/
+int promoteKey( keyInstance* key, const compactKey* ckey )
+{
+    static const char hexTab[] = "0123456789ABCDEF";
+
+    if ((key == NULL) || (ckey == NULL) || (ckey->keySig != VALID_SIG))
+        return BAD_KEY_INSTANCE;
+
+    CompactToKey( key, ckey );
+
+    /* same nibble order as ParseHexDword() */
+    for ( size_t cnt=0; cnt*4<key->keyLen; cnt++ )
+        key->keyMaterial[cnt] = hexTab[ ( key->key32[cnt/8] >> (4*((cnt^1)&7)) ) & 0xF ];
+    key->keyMaterial[key->keyLen/4] = 0;
+    key->keyMaterial[MAX_KEY_SIZE]  = 0;
+
+    if ( LazyOp( LAZY_QUERY ) != TF_SUCCESS )
+        ReKeyStep( key, REKEY_SBOXES );
+
+    return TF_SUCCESS;
+}
+
+int demoteKey( compactKey* ckey, const keyInstance* key )
+{
+    if ((key == NULL) || (ckey == NULL) || (key->keySig != VALID_SIG))
+        return BAD_KEY_INSTANCE;
+
+    KeyToCompact( ckey, key );
+
+    return TF_SUCCESS;
+}
+
+/*
++*****************************************************************************
+*           Multi-key lanes
+-****************************************************************************/
+
+/* # of blocks ciphered side by side, one AVX2 register of dwords */
+#define     LANE_CNT        8
+
+/* one slot of the lane scheduler, serves one laneInstance at a time */
+typedef struct
+{
+    /* lane being served, NULL when slot is idle */
+    laneInstance*      lane;
+    const keyInstance* key;
+    const uint8_t*     input;
+    uint8_t*           outBuffer;
+    /* # blocks left for this lane */
+    size_t             blkLeft;
+    uint8_t            mode;
+    /* CBC chaining value, and ciphertext of block in flight for decrypt */
+    uint32_t           IV[BLOCK_SIZE/32];
+    uint32_t           nextIV[BLOCK_SIZE/32];
+    /* subkeys of this slot in the order of requested direction */
+    uint32_t           sk[TOTAL_SUBKEYS];
+} laneSlot;
+
+/* per call working set, x[] and skT[] are transposed for vector loads */
+typedef struct
+{
+    laneSlot           slot[LANE_CNT];
+    uint32_t           x[BLOCK_SIZE/32][LANE_CNT];
+    uint32_t           skT[TOTAL_SUBKEYS][LANE_CNT];
+} laneState;
+
+/*
++*****************************************************************************
+*
+* Function Name:    LoadLaneSubkeys
+*
+* Function:         Copy subkeys of a key into a lane slot
+*
+* Arguments:        ls      =   lane working set
+*                   l       =   slot index
+*                   key     =   key to copy from
+*                   dir     =   DIR_ENCRYPT or DIR_DECRYPT
+*
+* Return:           None.
+*
+* Notes:
+*   Unlike blockEncrypt() which calls ReverseRoundSubkeys() on the key
+*   itself, the round subkey order is fixed up in the copy.  So keys are
+*   never written here, and one key may be shared by many lanes.
+*
+-****************************************************************************/
+static void LoadLaneSubkeys( laneState* ls, size_t l, const keyInstance* key, uint8_t dir )
+{
+    uint32_t* sk     = ls->slot[l].sk;
+    size_t    rounds = key->numRounds;
+
+    memcpy( sk, key->subKeys, sizeof(uint32_t)*ROUND_SUBKEYS );
+
+    if ( key->direction == dir )
+    {
+        memcpy( sk + ROUND_SUBKEYS, key->subKeys + ROUND_SUBKEYS,
+                sizeof(uint32_t)*2*rounds );
+    }
+    else
+    {
+        /* swap the order, but keep relative order within pairs */
+        for ( size_t cnt=0; cnt<rounds; cnt++ )
+        {
+            sk[ROUND_SUBKEYS+2*cnt  ] = key->subKeys[ROUND_SUBKEYS+2*(rounds-1-cnt)  ];
+            sk[ROUND_SUBKEYS+2*cnt+1] = key->subKeys[ROUND_SUBKEYS+2*(rounds-1-cnt)+1];
+        }
+    }
+
+    for ( size_t cnt=0; cnt<TOTAL_SUBKEYS; cnt++ )
+        ls->skT[cnt][l] = sk[cnt];
+}
+
+/*
++*****************************************************************************
+*
+* Function Name:    CipherLanesC
+*
+* Function:         Run 16 rounds over the blocks of all busy slots
+*
+* Arguments:        ls      =   lane working set, whitened blocks in ls->x
+*                   dir     =   DIR_ENCRYPT or DIR_DECRYPT
+*
+* Return:           None.
+*
+* Notes: Portable version, same round macros as blockEncrypt/blockDecrypt.
+*
+-****************************************************************************/
+static void CipherLanesC( laneState* ls, uint8_t dir )
+{
+    for ( size_t l=0; l<LANE_CNT; l++ )
+    {
+        const keyInstance* key = ls->slot[l].key;
+
+        if ( ls->slot[l].lane == NULL )
+            continue;
+
+        GetSboxKey;
+
+        const uint32_t* sk = ls->slot[l].sk;
+        uint32_t x[BLOCK_SIZE/32];
+        uint32_t t0 = 0;
+        uint32_t t1 = 0;
+#ifdef DEBUG
+        size_t   rounds = key->numRounds;
+#endif
+
+        for ( size_t n=0; n<BLOCK_SIZE/32; n++ )
+            x[n] = ls->x[n][l];
+
+        if ( dir == DIR_ENCRYPT )
+        {
+            Encrypt2(14,_);
+            Encrypt2(12,_);
+            Encrypt2(10,_);
+            Encrypt2( 8,_);
+            Encrypt2( 6,_);
+            Encrypt2( 4,_);
+            Encrypt2( 2,_);
+            Encrypt2( 0,_);
+        }
+        else
+        {
+            Decrypt2(14,_);
+            Decrypt2(12,_);
+            Decrypt2(10,_);
+            Decrypt2( 8,_);
+            Decrypt2( 6,_);
+            Decrypt2( 4,_);
+            Decrypt2( 2,_);
+            Decrypt2( 0,_);
+        }
+
+        for ( size_t n=0; n<BLOCK_SIZE/32; n++ )
+            ls->x[n][l] = x[n];
+    }
+}
+
+#if X86_SIMD && defined(FULL_KEY)
+/*
++*****************************************************************************
+*
+* Function Name:    CipherLanesAVX2
+*
+* Function:         Run 16 rounds over 8 blocks, each with its own S-box
+*
+* Arguments:        ls      =   lane working set, whitened blocks in ls->x
+*                   dir     =   DIR_ENCRYPT or DIR_DECRYPT
+*
+* Return:           false if S-boxes are too far apart for 32-bit gathers,
+*                   then caller must use CipherLanesC().
+*
+* Notes:
+*   Each lane gathers from its own sBox8x32, addressed as a 32-bit byte
+*   offset from the S-box of the first busy slot.  Fe32_(x,3) is same as
+*   Fe32_(ROL(x,8),0), so only one vector Fe32 is needed.
+*
+-****************************************************************************/
+#define ByteIdxV(v,s,o) \
+        _mm256_add_epi32(o,_mm256_and_si256(s,_mm256_set1_epi32(0x7F8)))
+#define Fe32V(v)    \
+        _mm256_xor_si256(                                                        \
+          _mm256_xor_si256(                                                      \
+            _mm256_i32gather_epi32(sbBase,ByteIdxV(v,_mm256_slli_epi32(v, 3),sb0),1), \
+            _mm256_i32gather_epi32(sbBase,ByteIdxV(v,_mm256_srli_epi32(v, 5),sb1),1)),\
+          _mm256_xor_si256(                                                      \
+            _mm256_i32gather_epi32(sbBase,ByteIdxV(v,_mm256_srli_epi32(v,13),sb2),1), \
+            _mm256_i32gather_epi32(sbBase,ByteIdxV(v,_mm256_srli_epi32(v,21),sb3),1)))
+#define SubkeyV(n)  _mm256_loadu_si256((const __m256i*)ls->skT[n])
+#define EncryptRoundV(K,R)                                                  \
+            t0     = Fe32V(x[K]);                                           \
+            t1     = Fe32V(ROLV(x[K^1],8));                                 \
+            x[K^3] = ROLV(x[K^3],1);                                        \
+            x[K^2] = _mm256_xor_si256(x[K^2], _mm256_add_epi32(             \
+                     _mm256_add_epi32(t0,t1), SubkeyV(ROUND_SUBKEYS+2*(R))));   \
+            x[K^3] = _mm256_xor_si256(x[K^3], _mm256_add_epi32(             \
+                     _mm256_add_epi32(t0,_mm256_slli_epi32(t1,1)),          \
+                     SubkeyV(ROUND_SUBKEYS+2*(R)+1)));                      \
+            x[K^2] = ROLV(x[K^2],31);
+#define DecryptRoundV(K,R)                                                  \
+            t0     = Fe32V(x[K]);                                           \
+            t1     = Fe32V(ROLV(x[K^1],8));                                 \
+            x[K^2] = ROLV(x[K^2],1);                                        \
+            x[K^2] = _mm256_xor_si256(x[K^2], _mm256_add_epi32(             \
+                     _mm256_add_epi32(t0,t1), SubkeyV(ROUND_SUBKEYS+2*(R))));   \
+            x[K^3] = _mm256_xor_si256(x[K^3], _mm256_add_epi32(             \
+                     _mm256_add_epi32(t0,_mm256_slli_epi32(t1,1)),          \
+                     SubkeyV(ROUND_SUBKEYS+2*(R)+1)));                      \
+            x[K^3] = ROLV(x[K^3],31);
+
+TARGET_AVX2
+static bool CipherLanesAVX2( laneState* ls, uint8_t dir )
+{
+    const int* sbBase = NULL;
+    int32_t    sbOff[LANE_CNT] = {0};
+
+    for ( size_t l=0; l<LANE_CNT; l++ )
+    {
+        if ( ls->slot[l].lane != NULL )
+        {
+            sbBase = (const int*)ls->slot[l].key->sBox8x32;
+            break;
+        }
+    }
+
+    if ( sbBase == NULL )
+        return true;
+
+    for ( size_t l=0; l<LANE_CNT; l++ )
+    {
+        /* idle slots just read the first S-box */
+        if ( ls->slot[l].lane == NULL )
+            continue;
+
+        ptrdiff_t d = (const uint8_t*)ls->slot[l].key->sBox8x32 -
+                      (const uint8_t*)sbBase;
+
+        if ( ( d < INT32_MIN ) || ( d > INT32_MAX - (ptrdiff_t)sizeof(fullSbox) ) )
+            return false;
+
+        sbOff[l] = (int32_t)d;
+    }
+
+    /* byte offsets of _sBox_[0][2*b], [0][2*b+1], [2][2*b], [2][2*b+1] */
+    __m256i sb0 = _mm256_loadu_si256((const __m256i*)sbOff);
+    __m256i sb1 = _mm256_add_epi32(sb0,_mm256_set1_epi32(4));
+    __m256i sb2 = _mm256_add_epi32(sb0,_mm256_set1_epi32(2*256*4));
+    __m256i sb3 = _mm256_add_epi32(sb0,_mm256_set1_epi32(2*256*4+4));
+    __m256i x[BLOCK_SIZE/32];
+    __m256i t0,t1;
+
+    for ( size_t n=0; n<BLOCK_SIZE/32; n++ )
+        x[n] = _mm256_loadu_si256((const __m256i*)ls->x[n]);
+
+    if ( dir == DIR_ENCRYPT )
+    {
+        for ( int R=MAX_ROUNDS-2; R>=0; R-=2 )
+        {
+            EncryptRoundV(0,R+1);
+            EncryptRoundV(2,R);
+        }
+    }
+    else
+    {
+        for ( int R=MAX_ROUNDS-2; R>=0; R-=2 )
+        {
+            DecryptRoundV(2,R+1);
+            DecryptRoundV(0,R);
+        }
+    }
+
+    for ( size_t n=0; n<BLOCK_SIZE/32; n++ )
+        _mm256_storeu_si256((__m256i*)ls->x[n],x[n]);
+
+    return true;
+}
+#endif /// of X86_SIMD && FULL_KEY
+
+/*
++*****************************************************************************
+*
+* Function Name:    CipherLanes
+*
+* Function:         Encrypt or decrypt many lanes, each with its own key
+*
+* Arguments:        lanes   =   ptr to lane descriptors
+*                   laneCnt =   # of lanes
+*                   dir     =   DIR_ENCRYPT or DIR_DECRYPT
+*
+* Return:           TF_SUCCESS if all lanes are done,
+*                   else error code of the first failed lane
+*
+* Notes:
+*   Up to LANE_CNT lanes are busy at a time.  Each step takes the next
+*   block of every busy slot, and a slot whose lane is finished is handed
+*   the next waiting lane, so lanes of different length keep slots full.
+*   CFB1 lanes are passed to blockEncrypt/blockDecrypt as they are.
+*
+-****************************************************************************/
+static int CipherLanes( laneInstance* lanes, size_t laneCnt, uint8_t dir )
+{
+    if ( ( lanes == NULL ) && ( laneCnt > 0 ) )
+        return BAD_PARAMS;
+
+    laneState ls;
+    size_t    next = 0;
+    int       ret  = TF_SUCCESS;
+#if X86_SIMD && defined(FULL_KEY)
+    bool      useVec = ( SimdOp(SIMD_QUERY) == TF_SUCCESS );
+#endif
+
+    memset( &ls, 0, sizeof(ls) );
+
+    for (;;)
+    {
+        size_t busy = 0;
+
+        /* hand idle slots to waiting lanes */
+        for ( size_t l=0; l<LANE_CNT; l++ )
+        {
+            laneSlot* s = &ls.slot[l];
+
+            while ( ( s->lane == NULL ) && ( next < laneCnt ) )
+            {
+                laneInstance* ln   = &lanes[next++];
+                uint8_t       mode = ( ln->cipher != NULL ) ? ln->cipher->mode : MODE_ECB;
+
+#if VALIDATE_PARMS
+                if ( ( ln->cipher != NULL ) && ( ln->cipher->cipherSig != VALID_SIG ) )
+                    ln->result = BAD_CIPHER_STATE;
+                else
+                if ( ( ln->key == NULL ) || ( ln->key->keySig != VALID_SIG ) ||
+                     ( ln->key->numRounds != MAX_ROUNDS ) )
+                    ln->result = BAD_KEY_INSTANCE;
+                else
+                if ( BadInputLen( mode, ln->inputLen ) )
+                    ln->result = BAD_INPUT_LEN;
+                else
+#endif
+                if ( ln->inputLen == 0 )
+                {
+                    ln->result = 0;
+                }
+                else
+                if ( ( mode == MODE_CFB1 ) || ( mode == MODE_CTR ) )
+                {
+                    if ( dir == DIR_ENCRYPT )
+                        ln->result = blockEncrypt( ln->cipher, ln->key, ln->input,
+                                                   ln->inputLen, ln->outBuffer );
+                    else
+                        ln->result = blockDecrypt( ln->cipher, ln->key, ln->input,
+                                                   ln->inputLen, ln->outBuffer );
+                }
+                else
+                {
+#if defined(FULL_KEY)
+                    ExpandSboxes( ln->key );    /* lanes only use full tables */
+#endif
+                    s->lane      = ln;
+                    s->key       = ln->key;
+                    s->input     = ln->input;
+                    s->outBuffer = ln->outBuffer;
+                    s->blkLeft   = ln->inputLen / BLOCK_SIZE;
+                    s->mode      = mode;
+
+                    if ( mode == MODE_CBC )
+                        BlockCopy(s->IV,ln->cipher->iv32)
+                    else
+                        s->IV[0]=s->IV[1]=s->IV[2]=s->IV[3]=0;
+
+                    LoadLaneSubkeys( &ls, l, ln->key, dir );
+                    break;
+                }
+
+                if ( ( ln->result < 0 ) && ( ret == TF_SUCCESS ) )
+                    ret = ln->result;
+            }
+
+            if ( s->lane == NULL )
+                continue;
+
+            busy++;
+
+            /* load next block with input whitening */
+            const uint32_t* sk = s->sk;
+            const uint32_t* in = (const uint32_t*)s->input;
+
+            for ( size_t n=0; n<BLOCK_SIZE/32; n++ )
+            {
+                if ( dir == DIR_ENCRYPT )
+                {
+                    ls.x[n][l] = Bswap(in[n]) ^ sk[INPUT_WHITEN+n] ^ s->IV[n];
+                }
+                else
+                {
+                    s->nextIV[n]   = Bswap(in[n]);
+                    ls.x[n^2][l]   = s->nextIV[n] ^ sk[OUTPUT_WHITEN+n];
+                }
+            }
+        }
+
+        if ( busy == 0 )
+            break;
+
+#if X86_SIMD && defined(FULL_KEY)
+        if ( ( useVec == false ) || ( CipherLanesAVX2( &ls, dir ) == false ) )
+#endif
+            CipherLanesC( &ls, dir );
+
+        /* store with output whitening, then step every busy slot */
+        for ( size_t l=0; l<LANE_CNT; l++ )
+        {
+            laneSlot* s = &ls.slot[l];
+
+            if ( s->lane == NULL )
+                continue;
+
+            const uint32_t* sk  = s->sk;
+            uint32_t*       out = (uint32_t*)s->outBuffer;
+
+            for ( size_t n=0; n<BLOCK_SIZE/32; n++ )
+            {
+                if ( dir == DIR_ENCRYPT )
+                {
+                    uint32_t t = ls.x[n^2][l] ^ sk[OUTPUT_WHITEN+n];
+                    out[n] = Bswap(t);
+
+                    if ( s->mode == MODE_CBC )
+                        s->IV[n] = t;
+                }
+                else
+                {
+                    uint32_t t = ls.x[n][l] ^ sk[INPUT_WHITEN+n] ^ s->IV[n];
+                    out[n] = Bswap(t);
+
+                    if ( s->mode == MODE_CBC )
+                        s->IV[n] = s->nextIV[n];
+                }
+            }
+
+            s->input     += BLOCK_SIZE/8;
+            s->outBuffer += BLOCK_SIZE/8;
+
+            if ( --s->blkLeft == 0 )
+            {
+                if ( s->mode == MODE_CBC )
+                    BlockCopy(s->lane->cipher->iv32,s->IV)
+
+                s->lane->result = (int)s->lane->inputLen;
+                s->lane = NULL;
+                s->key  = NULL;
+            }
+        }
+    }
+
+    return ret;
+}
+
+/*
++*****************************************************************************
+*
+* Function Name:    blockEncryptLanes
+*
+* Function:         Encrypt many lanes of blocks, each with its own key
+*
+* Arguments:        lanes   =   ptr to lane descriptors
+*                   laneCnt =   # of lanes
+*
+* Return:           TF_SUCCESS if all lanes are done,
+*                   else error code of the first failed lane.
+*                   lanes[].result gets # bits ciphered or error code.
+*
+* Notes: Each lane gives same output as blockEncrypt() with its own
+*        cipher and key, and CBC lanes update their cipher->iv32 the same
+*        way.  Keys are not modified for ECB and CBC lanes.
+*
+-****************************************************************************/
+int blockEncryptLanes( laneInstance* lanes, size_t laneCnt )
+{
+    return CipherLanes( lanes, laneCnt, DIR_ENCRYPT );
+}
+
+/*
++*****************************************************************************
+*
+* Function Name:    blockDecryptLanes
+*
+* Function:         Decrypt many lanes of blocks, each with its own key
+*
+* Arguments:        lanes   =   ptr to lane descriptors
+*                   laneCnt =   # of lanes
+*
+* Return:           TF_SUCCESS if all lanes are done,
+*                   else error code of the first failed lane.
+*                   lanes[].result gets # bits ciphered or error code.
+*
+* Notes: Each lane gives same output as blockDecrypt() with its own
+*        cipher and key.
+*
+-****************************************************************************/
+int blockDecryptLanes( laneInstance* lanes, size_t laneCnt )
+{
+    return CipherLanes( lanes, laneCnt, DIR_DECRYPT );
+}
+
 #ifdef GetCodeSize
 uint32_t TwofishCodeSize(void)
 {
@@ -31,6 +31,7 @@ INCLUDE IMPLEMENTATION SPECIFIC INFORMATION.
 #define     MODE_ECB            1  /* Are we ciphering in ECB mode? */
 #define     MODE_CBC            2  /* Are we ciphering in CBC mode? */
 #define     MODE_CFB1           3  /* Are we ciphering in 1-bit CFB mode? */
+#define     MODE_CTR            4  /* Are we ciphering in counter mode? */
 
 #define     TF_SUCCESS           1
 #define     TF_FAILURE           0
@@ -94,22 +95,48 @@ typedef struct
     uint32_t sboxKeys[MAX_KEY_BITS/64];
     /* round subkeys, input/output whitening bits */
     uint32_t subKeys[TOTAL_SUBKEYS];
+    /* nonzero when sBox8x32 is built, zero for a lazy key (see LazyOp) */
+    uint32_t sboxReady;
 #if REENTRANT
 /* fully expanded S-box */
     fullSbox sBox8x32;
 #endif /// of REENTRANT
 } keyInstance;
 
+/* Compact form of a key : the key schedule without expanded S-boxes, for
+   holding many keys.  Ciphered with on-the-fly S-box lookups. */
+typedef struct
+{
+    /* direction of subKeys, as in keyInstance */
+    uint8_t  direction;
+#if ALIGN32
+    /* keep 32-bit alignment with direction */
+    uint8_t  dummyAlign[3];
+#endif
+    /* Length of the key */
+    uint32_t keyLen;
+    /* set to VALID_SIG by makeCompactKey() */
+    uint32_t keySig;
+    /* number of rounds in cipher */
+    uint32_t numRounds;
+    /* actual key bits, in dwords */
+    uint32_t key32[MAX_KEY_BITS/32];
+    /* key bits used for S-boxes */
+    uint32_t sboxKeys[MAX_KEY_BITS/64];
+    /* round subkeys, input/output whitening bits */
+    uint32_t subKeys[TOTAL_SUBKEYS];
+} compactKey;
+
 /* The structure for cipher information */
 typedef struct
 {
-    /* MODE_ECB, MODE_CBC, or MODE_CFB1 */
+    /* MODE_ECB, MODE_CBC, MODE_CFB1 or MODE_CTR */
     uint8_t  mode;
 #if ALIGN32
     /* keep 32-bit alignment */
     uint8_t  dummyAlign[3];
 #endif
-    /* CFB1 iv bytes  (CBC uses iv32) */
+    /* CFB1 iv bytes, CTR counter  (CBC uses iv32) */
     uint8_t  IV[MAX_IV_SIZE];
 
     /* Twofish-specific parameters: */
@@ -127,6 +154,24 @@ int    cipherInit( cipherInstance* cipher, uint8_t mode, const char* IV );
 int    blockEncrypt( cipherInstance* cipher, keyInstance* key, const uint8_t* input, size_t inputLen, uint8_t* outBuffer );
 int    blockDecrypt( cipherInstance* cipher, keyInstance* key, const uint8_t* input, size_t inputLen, uint8_t* outBuffer );
 
+/* makeKey() on keyCnt keys, vector lanes across keys, threads for big batches */
+int    makeKeys( keyInstance* keys, size_t keyCnt, uint8_t direction, size_t keyLen,
+                 const char* const* keyMaterial, size_t threadCnt = 0 );
+
+/* compact keys, about 1/20 of a keyInstance, see makeCompactKey() */
+int    makeCompactKey( compactKey* ckey, uint8_t direction, size_t keyLen, const char* keyMaterial );
+int    blockEncryptCompact( cipherInstance* cipher, const compactKey* ckey, const uint8_t* input, size_t inputLen, uint8_t* outBuffer );
+int    blockDecryptCompact( cipherInstance* cipher, const compactKey* ckey, const uint8_t* input, size_t inputLen, uint8_t* outBuffer );
+int    promoteKey( keyInstance* key, const compactKey* ckey );
+int    demoteKey( compactKey* ckey, const keyInstance* key );
+
+/* helpers of makeKey(), for code building keys outside of it */
+int    ParseHexDword( int bits, const char* srcTxt, uint32_t* d, char* dstTxt );
+void   ReverseRoundSubkeys( keyInstance* key, uint8_t newDir );
+
+/* step MODE_CTR counter over blockCnt blocks, to cipher a stream in pieces */
+void   CounterAdd( cipherInstance* cipher, uint64_t blockCnt );
+
 /* API to check table usage, for use in ECB_TBL KAT */
 #define     TAB_DISABLE         0
 #define     TAB_ENABLE          1
@@ -136,6 +181,52 @@ int    blockDecrypt( cipherInstance* cipher, keyInstance* key, const uint8_t* in
 
 int TableOp(int op);
 
+/* API to check/switch vector kernel usage (AVX2 when CPU has it) */
+#define     SIMD_DISABLE        0
+#define     SIMD_ENABLE         1
+#define     SIMD_QUERY          3
+
+int SimdOp(int op);
+
+/* API to check/switch big keying table of reKey() (256 KB, built on enable) */
+#define     BIGTAB_DISABLE      0
+#define     BIGTAB_ENABLE       1
+#define     BIGTAB_QUERY        3
+
+int BigTabOp(int op);
+
+/* API to check/switch lazy S-box expansion of keys made from now on */
+#define     LAZY_DISABLE        0
+#define     LAZY_ENABLE         1
+#define     LAZY_QUERY          3
+#define     LAZY_BLOCKS         4   /* bigger calls expand a lazy key */
+
+int LazyOp(int op);
+/* build S-boxes of a lazy key now, e.g. before threads share it */
+int expandKey( keyInstance* key );
+
+/* Multi-key lane descriptor for blockEncryptLanes()/blockDecryptLanes().
+   Every lane carries its own key, so packets of different sessions can be
+   ciphered in one call. */
+typedef struct
+{
+    /* key of this lane, used read only (a lazy key gets its S-boxes) */
+    keyInstance*    key;
+    /* MODE_ECB, MODE_CBC, MODE_CFB1 or MODE_CTR, NULL cipher means ECB */
+    cipherInstance* cipher;
+    /* data blocks to be ciphered */
+    const uint8_t*  input;
+    /* # bits to cipher (multiple of BLOCK_SIZE) */
+    size_t          inputLen;
+    /* where to put ciphered blocks */
+    uint8_t*        outBuffer;
+    /* # bits ciphered, or error code, set by call */
+    int             result;
+} laneInstance;
+
+int    blockEncryptLanes( laneInstance* lanes, size_t laneCnt );
+int    blockDecryptLanes( laneInstance* lanes, size_t laneCnt );
+
 /* optimize block copies */
 #if (BLOCK_SIZE == 128)
     #define     Copy1(d,s,N)    ((uint32_t*)(d))[N] = ((uint32_t*)(s))[N]
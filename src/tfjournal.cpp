@@ -0,0 +1,759 @@
+/***************************************************************************
+    tfjournal.cpp
+
+  ------------------------------------------------------------------------
+
+    Append-only journal, one CTR stream over its records.
+
+    (C)2021, Raphael Kim
+
+    Notes:
+        *   Counter of byte n of the stream is header IV + n / 16.  A
+            commit starts inside a block as often as not : the group
+            buffer begins at that block, the bytes before the stream end
+            are ciphered along and not written.
+        *   Data goes first, its index entries after.  A crash between
+            leaves records the index doesn't know, Open() finds them from
+            their length fields ; a record cut short is cut off.
+        *   Counters of the stream are never used twice.  A record cut off
+            by Open() was on disk already, so the journal is written again
+            under a new IV rather than appended to at the cut.  A commit
+            that fails leaves the journal failed until opened again : what
+            of it reached the disk is unknown.
+        *   Needs POSIX file calls, not on Windows.
+        *   Tab size is set to 4 characters in this file
+
+***************************************************************************/
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32)
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <sys/stat.h>
+#endif
+
+#include "tfish.h"
+#include "tfjournal.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define JR_MAGIC        "TFJL"
+#define JR_VERSION      1
+#define JR_OFS_IV       16
+#define JR_BLOCK        ( BLOCK_SIZE/8 )
+#define JR_LENSZ        4                   /* record length field */
+#define JR_IDXSZ        8                   /* index entry */
+#define JR_REPLAYBUF    ( 1024 * 1024 )     /* bytes decrypted per batch */
+
+typedef struct
+{
+    size_t                  groupsz;
+    uint32_t                flags;
+    std::mutex              lock;
+    int                     fd;
+    int                     idxfd;
+    keyInstance*            key;
+    cipherInstance          base;       /* counter of stream byte 0 */
+    uint64_t                end;        /* stream bytes committed */
+    bool                    failed;     /* a commit failed, no appends */
+    std::vector< uint64_t > index;      /* committed record offsets */
+    /* group being queued, from block of stream end */
+    std::vector< uint8_t >  group;
+    std::vector< uint64_t > groupIdx;
+    std::vector< uint8_t >  replay;
+    journalStats            stats;
+}libTwoFishJournalContext;
+
+#define L2FJRCTX        libTwoFishJournalContext
+#define TOJRCTX(_x_)    L2FJRCTX* _x_ = (L2FJRCTX*)context
+
+////////////////////////////////////////////////////////////////////////////////
+
+#if !defined(_WIN32)
+static bool jrWriteAt( int fd, const uint8_t* p, size_t len, uint64_t ofs )
+{
+    while ( len > 0 )
+    {
+        ssize_t r = pwrite( fd, p, len, (off_t)ofs );
+        if ( r <= 0 )
+            return false;
+
+        p   += r;
+        len -= (size_t)r;
+        ofs += (uint64_t)r;
+    }
+
+    return true;
+}
+
+static bool jrReadAt( int fd, uint8_t* p, size_t len, uint64_t ofs )
+{
+    while ( len > 0 )
+    {
+        ssize_t r = pread( fd, p, len, (off_t)ofs );
+        if ( r <= 0 )
+            return false;
+
+        p   += r;
+        len -= (size_t)r;
+        ofs += (uint64_t)r;
+    }
+
+    return true;
+}
+
+// stream bytes [ofs, ofs + len) decrypted to buf, which takes the block
+// before them too : data at buf + ofs % 16.
+static int jrDecrypt( L2FJRCTX* jrctx, uint64_t ofs, size_t len, uint8_t* buf )
+{
+    uint64_t from = ofs / JR_BLOCK * JR_BLOCK;
+    size_t   n    = (size_t)( ofs + len - from );
+
+    if ( jrReadAt( jrctx->fd, buf, n, JOURNAL_HDRSZ + from ) == false )
+        return STREAM_IO_FAIL;
+
+    cipherInstance ci = jrctx->base;
+    CounterAdd( &ci, from / JR_BLOCK );
+
+    int reti = blockEncrypt( &ci, jrctx->key, buf, n * 8, buf );
+
+    return ( reti < 0 ) ? reti : TF_SUCCESS;
+}
+
+// little-endian record length field.
+static uint32_t jrGet32( const uint8_t* p )
+{
+    return (uint32_t)p[0] | ( (uint32_t)p[1] << 8 ) |
+           ( (uint32_t)p[2] << 16 ) | ( (uint32_t)p[3] << 24 );
+}
+
+// record length at stream offset ofs.
+static int jrLength( L2FJRCTX* jrctx, uint64_t ofs, uint32_t* len )
+{
+    uint8_t b[ JR_BLOCK * 2 ];
+
+    int reti = jrDecrypt( jrctx, ofs, JR_LENSZ, b );
+    if ( reti != TF_SUCCESS )
+        return reti;
+
+    *len = jrGet32( b + ofs % JR_BLOCK );
+
+    return TF_SUCCESS;
+}
+
+// counter of stream byte 0, from the IV of a header.
+static void jrBase( cipherInstance* ci, const uint8_t* hdr )
+{
+    char iv[ JR_BLOCK * 2 + 1 ] = {0};
+
+    for ( size_t cnt=0; cnt<JR_BLOCK; cnt++ )
+        snprintf( &iv[cnt*2], 3, "%02X", hdr[ JR_OFS_IV + cnt ] );
+
+    cipherInit( ci, MODE_CTR, iv );
+}
+
+static void jrNewIV( uint8_t* hdr )
+{
+    std::random_device rnd;
+
+    for ( size_t cnt=JR_OFS_IV; cnt<JOURNAL_HDRSZ; cnt+=4 )
+    {
+        uint32_t r = rnd();
+        memcpy( hdr + cnt, &r, 4 );
+    }
+}
+
+// directory of path synced, so a rename in it survives a crash.
+static int jrSyncDir( const char* path )
+{
+    std::string dir( path );
+    size_t      sep = dir.rfind( '/' );
+
+    dir = ( sep == std::string::npos ) ? std::string( "." ) :
+          ( sep == 0 ) ? std::string( "/" ) : dir.substr( 0, sep );
+
+    int fd = open( dir.c_str(), O_RDONLY );
+    if ( fd < 0 )
+        return STREAM_IO_FAIL;
+
+    int reti = ( fsync( fd ) == 0 ) ? TF_SUCCESS : STREAM_IO_FAIL;
+
+    close( fd );
+
+    return reti;
+}
+
+// stream bytes [0, len) of path written again under a new IV, to
+// path + ".tmp" renamed over path : counters past len were used.
+static int jrRotate( L2FJRCTX* jrctx, const char* path, uint64_t len )
+{
+    std::string tmp = std::string( path ) + ".tmp";
+    uint8_t     hdr[ JOURNAL_HDRSZ ];
+
+    if ( jrReadAt( jrctx->fd, hdr, JOURNAL_HDRSZ, 0 ) == false )
+        return STREAM_IO_FAIL;
+
+    int fd = open( tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600 );
+    if ( fd < 0 )
+        return STREAM_IO_FAIL;
+
+    cipherInstance base;
+    int            reti = TF_SUCCESS;
+
+    jrNewIV( hdr );
+    jrBase( &base, hdr );
+
+    if ( jrWriteAt( fd, hdr, JOURNAL_HDRSZ, 0 ) == false )
+        reti = STREAM_IO_FAIL;
+
+    jrctx->replay.resize( JR_REPLAYBUF + JR_BLOCK );
+
+    for ( uint64_t ofs=0; ( reti == TF_SUCCESS ) && ( ofs < len ); ofs+=JR_REPLAYBUF )
+    {
+        size_t   n = ( len - ofs < JR_REPLAYBUF ) ? (size_t)( len - ofs ) : JR_REPLAYBUF;
+        uint8_t* p = jrctx->replay.data();
+
+        reti = jrDecrypt( jrctx, ofs, n, p );
+        if ( reti != TF_SUCCESS )
+            break;
+
+        cipherInstance ci = base;
+        CounterAdd( &ci, ofs / JR_BLOCK );
+
+        if ( blockEncrypt( &ci, jrctx->key, p, n * 8, p ) < 0 )
+            reti = BAD_PARAMS;
+        else
+        if ( jrWriteAt( fd, p, n, JOURNAL_HDRSZ + ofs ) == false )
+            reti = STREAM_IO_FAIL;
+    }
+
+    memset( jrctx->replay.data(), 0, jrctx->replay.size() );
+
+    if ( ( reti == TF_SUCCESS ) &&
+         ( ( fdatasync( fd ) != 0 ) || ( rename( tmp.c_str(), path ) != 0 ) ) )
+        reti = STREAM_IO_FAIL;
+
+    if ( reti != TF_SUCCESS )
+    {
+        close( fd );
+        unlink( tmp.c_str() );
+        return reti;
+    }
+
+    close( jrctx->fd );
+    jrctx->fd   = fd;
+    jrctx->base = base;
+
+    return jrSyncDir( path );
+}
+
+// index and data of a journal opened : both made to agree.
+static int jrRecover( L2FJRCTX* jrctx, const char* path, uint64_t streamLen )
+{
+    struct stat sb;
+
+    if ( fstat( jrctx->idxfd, &sb ) != 0 )
+        return STREAM_IO_FAIL;
+
+    size_t cnt = (size_t)sb.st_size / JR_IDXSZ;
+    std::vector< uint8_t > raw( cnt * JR_IDXSZ );
+
+    if ( ( cnt > 0 ) &&
+         ( jrReadAt( jrctx->idxfd, raw.data(), raw.size(), 0 ) == false ) )
+        return STREAM_IO_FAIL;
+
+    jrctx->index.clear();
+
+    // entries must climb and lie in the data.
+    for ( size_t n=0; n<cnt; n++ )
+    {
+        uint64_t ofs = 0;
+        for ( size_t b=JR_IDXSZ; b-->0; )
+            ofs = ( ofs << 8 ) | raw[ n * JR_IDXSZ + b ];
+
+        if ( ( ofs + JR_LENSZ > streamLen ) ||
+             ( ( jrctx->index.empty() == false ) && ( ofs <= jrctx->index.back() ) ) )
+            break;
+
+        jrctx->index.push_back( ofs );
+    }
+
+    size_t   known = jrctx->index.size();
+    uint64_t pos   = ( known > 0 ) ? jrctx->index.back() : 0;
+
+    if ( known > 0 )
+        jrctx->index.pop_back();
+
+    // walk records from the last known one.
+    while ( pos + JR_LENSZ <= streamLen )
+    {
+        uint32_t len;
+
+        int reti = jrLength( jrctx, pos, &len );
+        if ( reti != TF_SUCCESS )
+            return reti;
+
+        if ( ( len > JOURNAL_MAXREC ) || ( pos + JR_LENSZ + len > streamLen ) )
+            break;
+
+        jrctx->index.push_back( pos );
+        pos += JR_LENSZ + len;
+    }
+
+    jrctx->end = pos;
+
+    if ( jrctx->index.size() > known )
+        jrctx->stats.recovered = jrctx->index.size() - known;
+
+    // a torn record goes, with the IV its counters were used under ; the
+    // index is written again from the first change.
+    if ( pos < streamLen )
+    {
+        jrctx->stats.dropped = streamLen - pos;
+
+        int reti = jrRotate( jrctx, path, pos );
+        if ( reti != TF_SUCCESS )
+            return reti;
+    }
+
+    size_t keep = ( known > 0 ) ? known - 1 : 0;
+    if ( keep > jrctx->index.size() )
+        keep = jrctx->index.size();
+
+    std::vector< uint8_t > out( ( jrctx->index.size() - keep ) * JR_IDXSZ );
+
+    for ( size_t n=keep; n<jrctx->index.size(); n++ )
+        for ( size_t b=0; b<JR_IDXSZ; b++ )
+            out[ ( n - keep ) * JR_IDXSZ + b ] = (uint8_t)( jrctx->index[n] >> ( b * 8 ) );
+
+    if ( ( ftruncate( jrctx->idxfd, (off_t)( keep * JR_IDXSZ ) ) != 0 ) ||
+         ( jrWriteAt( jrctx->idxfd, out.data(), out.size(), keep * JR_IDXSZ ) == false ) )
+        return STREAM_IO_FAIL;
+
+    return TF_SUCCESS;
+}
+
+// stream offset after record n.
+static uint64_t jrEnd( L2FJRCTX* jrctx, uint64_t n )
+{
+    return ( n + 1 < jrctx->index.size() ) ? jrctx->index[ n + 1 ] : jrctx->end;
+}
+
+static int jrWrite( L2FJRCTX* jrctx )
+{
+    size_t   lead = (size_t)( jrctx->end % JR_BLOCK );
+    size_t   len  = jrctx->group.size() - lead;
+    uint8_t* p    = jrctx->group.data();
+
+    cipherInstance ci = jrctx->base;
+    CounterAdd( &ci, jrctx->end / JR_BLOCK );
+
+    int reti = blockEncrypt( &ci, jrctx->key, p, jrctx->group.size() * 8, p );
+    if ( reti < 0 )
+        return reti;
+
+    // from here on some of the group may be on disk.
+    jrctx->failed = true;
+
+    if ( jrWriteAt( jrctx->fd, p + lead, len, JOURNAL_HDRSZ + jrctx->end ) == false )
+        return STREAM_IO_FAIL;
+
+    size_t                 cnt = jrctx->groupIdx.size();
+    std::vector< uint8_t > ent( cnt * JR_IDXSZ );
+
+    for ( size_t n=0; n<cnt; n++ )
+        for ( size_t b=0; b<JR_IDXSZ; b++ )
+            ent[ n * JR_IDXSZ + b ] = (uint8_t)( jrctx->groupIdx[n] >> ( b * 8 ) );
+
+    if ( jrWriteAt( jrctx->idxfd, ent.data(), ent.size(),
+                    jrctx->index.size() * JR_IDXSZ ) == false )
+        return STREAM_IO_FAIL;
+
+    if ( ( jrctx->flags & JOURNAL_SYNC ) && ( fdatasync( jrctx->fd ) != 0 ) )
+        return STREAM_IO_FAIL;
+
+    jrctx->index.insert( jrctx->index.end(),
+                         jrctx->groupIdx.begin(), jrctx->groupIdx.end() );
+    jrctx->end   += len;
+    jrctx->failed = false;
+
+    jrctx->stats.bytes += len;
+    jrctx->stats.commits++;
+
+    return TF_SUCCESS;
+}
+
+// lock held.  A group that failed is dropped, and the journal stays
+// failed : counters at its end may be on disk already.
+static int jrCommit( L2FJRCTX* jrctx )
+{
+    if ( jrctx->groupIdx.empty() == true )
+        return TF_SUCCESS;
+
+    if ( jrctx->failed == true )
+    {
+        memset( jrctx->group.data(), 0, jrctx->group.size() );
+        jrctx->group.clear();
+        jrctx->groupIdx.clear();
+        return STREAM_IO_FAIL;
+    }
+
+    int reti = jrWrite( jrctx );
+
+    memset( jrctx->group.data(), 0, jrctx->group.size() );
+    jrctx->group.clear();
+    jrctx->groupIdx.clear();
+
+    return reti;
+}
+#endif /// of !_WIN32
+
+////////////////////////////////////////////////////////////////////////////////
+
+TwoFishJournal::TwoFishJournal( size_t groupBytes, uint32_t flags )
+ : context( NULL )
+{
+    L2FJRCTX* jrctx = new L2FJRCTX;
+    if ( jrctx == NULL )
+        return;
+
+    if ( groupBytes == 0 )
+        groupBytes = JOURNAL_GROUP;
+    if ( groupBytes > JOURNAL_MAXGROUP )
+        groupBytes = JOURNAL_MAXGROUP;
+
+    jrctx->groupsz = groupBytes;
+    jrctx->flags   = flags;
+    jrctx->fd      = -1;
+    jrctx->idxfd   = -1;
+    jrctx->key     = NULL;
+    jrctx->end     = 0;
+    jrctx->failed  = false;
+    memset( &jrctx->stats, 0, sizeof( journalStats ) );
+
+    context = (void*)jrctx;
+}
+
+TwoFishJournal::~TwoFishJournal()
+{
+    TOJRCTX( jrctx );
+
+    if ( jrctx == NULL )
+        return;
+
+    Close();
+
+    context = NULL;
+    delete jrctx;
+}
+
+int TwoFishJournal::Open( const char* path, keyInstance* key )
+{
+    TOJRCTX( jrctx );
+
+    if ( ( jrctx == NULL ) || ( path == NULL ) ||
+         ( key == NULL ) || ( key->keySig != VALID_SIG ) )
+        return BAD_PARAMS;
+
+#if defined(_WIN32)
+    return STREAM_IO_FAIL;
+#else
+    Close();
+
+    std::lock_guard< std::mutex > guard( jrctx->lock );
+    std::string idxPath = std::string( path ) + ".idx";
+
+    jrctx->fd    = open( path, O_RDWR | O_CREAT, 0600 );
+    jrctx->idxfd = open( idxPath.c_str(), O_RDWR | O_CREAT, 0600 );
+
+    struct stat sb;
+    int         reti = TF_SUCCESS;
+    uint8_t     hdr[ JOURNAL_HDRSZ ] = {0};
+
+    if ( ( jrctx->fd < 0 ) || ( jrctx->idxfd < 0 ) || ( fstat( jrctx->fd, &sb ) != 0 ) )
+        reti = STREAM_IO_FAIL;
+    else
+    if ( sb.st_size == 0 )
+    {
+        memcpy( hdr, JR_MAGIC, 4 );
+        hdr[4] = JR_VERSION;
+        jrNewIV( hdr );
+
+        if ( ( jrWriteAt( jrctx->fd, hdr, JOURNAL_HDRSZ, 0 ) == false ) ||
+             ( ftruncate( jrctx->idxfd, 0 ) != 0 ) )
+            reti = STREAM_IO_FAIL;
+    }
+    else
+    if ( ( sb.st_size < JOURNAL_HDRSZ ) ||
+         ( jrReadAt( jrctx->fd, hdr, JOURNAL_HDRSZ, 0 ) == false ) ||
+         ( memcmp( hdr, JR_MAGIC, 4 ) != 0 ) || ( hdr[4] != JR_VERSION ) )
+        reti = BAD_JOURNAL;
+
+    if ( reti == TF_SUCCESS )
+    {
+        expandKey( key );
+        if ( key->direction != DIR_ENCRYPT )
+            ReverseRoundSubkeys( key, DIR_ENCRYPT );
+
+        jrBase( &jrctx->base, hdr );
+
+        memset( &jrctx->stats, 0, sizeof( journalStats ) );
+        jrctx->key = key;
+        jrctx->group.clear();
+        jrctx->groupIdx.clear();
+        jrctx->failed = false;
+
+        uint64_t streamLen = ( sb.st_size > 0 ) ? (uint64_t)sb.st_size - JOURNAL_HDRSZ : 0;
+
+        reti = jrRecover( jrctx, path, streamLen );
+    }
+
+    if ( reti != TF_SUCCESS )
+    {
+        if ( jrctx->fd >= 0 )
+            close( jrctx->fd );
+        if ( jrctx->idxfd >= 0 )
+            close( jrctx->idxfd );
+
+        jrctx->fd    = -1;
+        jrctx->idxfd = -1;
+        jrctx->key   = NULL;
+        jrctx->index.clear();
+    }
+
+    return reti;
+#endif /// of _WIN32
+}
+
+int TwoFishJournal::Close()
+{
+    TOJRCTX( jrctx );
+
+    if ( jrctx == NULL )
+        return BAD_PARAMS;
+
+#if defined(_WIN32)
+    return TF_SUCCESS;
+#else
+    std::lock_guard< std::mutex > guard( jrctx->lock );
+
+    if ( jrctx->fd < 0 )
+        return TF_SUCCESS;
+
+    int reti = jrCommit( jrctx );
+
+    if ( ( reti == TF_SUCCESS ) && ( jrctx->flags & JOURNAL_SYNC ) &&
+         ( fdatasync( jrctx->idxfd ) != 0 ) )
+        reti = STREAM_IO_FAIL;
+
+    close( jrctx->fd );
+    close( jrctx->idxfd );
+
+    jrctx->fd    = -1;
+    jrctx->idxfd = -1;
+    jrctx->key   = NULL;
+    jrctx->end   = 0;
+    jrctx->index.clear();
+
+    // plain text of queued and replayed records.
+    if ( jrctx->group.empty() == false )
+        memset( jrctx->group.data(), 0, jrctx->group.size() );
+    if ( jrctx->replay.empty() == false )
+        memset( jrctx->replay.data(), 0, jrctx->replay.size() );
+    jrctx->group.clear();
+    jrctx->groupIdx.clear();
+
+    return reti;
+#endif /// of _WIN32
+}
+
+int TwoFishJournal::Append( const uint8_t* data, size_t len, uint64_t* recNo )
+{
+    TOJRCTX( jrctx );
+
+    if ( ( jrctx == NULL ) || ( ( data == NULL ) && ( len > 0 ) ) )
+        return BAD_PARAMS;
+
+    if ( len > JOURNAL_MAXREC )
+        return BAD_INPUT_LEN;
+
+#if defined(_WIN32)
+    return STREAM_IO_FAIL;
+#else
+    std::lock_guard< std::mutex > guard( jrctx->lock );
+
+    if ( jrctx->fd < 0 )
+        return BAD_PARAMS;
+
+    if ( jrctx->failed == true )
+        return STREAM_IO_FAIL;
+
+    // a new group starts at the block of the stream end.
+    if ( jrctx->groupIdx.empty() == true )
+        jrctx->group.assign( (size_t)( jrctx->end % JR_BLOCK ), 0 );
+
+    size_t   lead = (size_t)( jrctx->end % JR_BLOCK );
+    uint64_t ofs  = jrctx->end + ( jrctx->group.size() - lead );
+    uint8_t  lb[ JR_LENSZ ];
+
+    for ( size_t cnt=0; cnt<JR_LENSZ; cnt++ )
+        lb[ cnt ] = (uint8_t)( len >> ( cnt * 8 ) );
+
+    jrctx->group.insert( jrctx->group.end(), lb, lb + JR_LENSZ );
+    jrctx->group.insert( jrctx->group.end(), data, data + len );
+    jrctx->groupIdx.push_back( ofs );
+
+    if ( recNo != NULL )
+        *recNo = jrctx->index.size() + jrctx->groupIdx.size() - 1;
+
+    jrctx->stats.records++;
+
+    if ( jrctx->group.size() >= jrctx->groupsz )
+        return jrCommit( jrctx );
+
+    return TF_SUCCESS;
+#endif /// of _WIN32
+}
+
+int TwoFishJournal::Commit()
+{
+    TOJRCTX( jrctx );
+
+    if ( jrctx == NULL )
+        return BAD_PARAMS;
+
+#if defined(_WIN32)
+    return STREAM_IO_FAIL;
+#else
+    std::lock_guard< std::mutex > guard( jrctx->lock );
+
+    if ( jrctx->fd < 0 )
+        return BAD_PARAMS;
+
+    return jrCommit( jrctx );
+#endif /// of _WIN32
+}
+
+uint64_t TwoFishJournal::GetRecordCount()
+{
+    TOJRCTX( jrctx );
+
+    if ( jrctx == NULL )
+        return 0;
+
+    std::lock_guard< std::mutex > guard( jrctx->lock );
+
+    return jrctx->index.size();
+}
+
+int TwoFishJournal::Replay( uint64_t first, uint64_t cnt, journalRecord fn, void* user )
+{
+    TOJRCTX( jrctx );
+
+    if ( ( jrctx == NULL ) || ( fn == NULL ) )
+        return BAD_PARAMS;
+
+#if defined(_WIN32)
+    return STREAM_IO_FAIL;
+#else
+    std::unique_lock< std::mutex > guard( jrctx->lock );
+
+    if ( jrctx->fd < 0 )
+        return BAD_PARAMS;
+
+    std::vector< uint64_t >& idx = jrctx->index;
+
+    if ( first >= idx.size() )
+        return TF_SUCCESS;
+
+    uint64_t n = first;
+    uint64_t e = ( cnt < idx.size() - first ) ? first + cnt : idx.size();
+
+    // fn runs unlocked and may Append() or Commit(), or Replay() itself :
+    // a batch goes to a buffer of this call, not jrctx->replay.
+    std::vector< uint8_t > buf;
+    int                    reti = TF_SUCCESS;
+    bool                   more = true;
+
+    // records n .. m - 1 a batch, whole, at least one.
+    while ( ( n < e ) && more )
+    {
+        if ( ( jrctx->fd < 0 ) || ( e > idx.size() ) )    /* closed, or opened again, by fn */
+        {
+            reti = BAD_PARAMS;
+            break;
+        }
+
+        uint64_t from = idx[n];
+        uint64_t m    = n + 1;
+
+        while ( ( m < e ) && ( jrEnd( jrctx, m ) - from <= JR_REPLAYBUF ) )
+            m++;
+
+        size_t len = (size_t)( jrEnd( jrctx, m - 1 ) - from );
+
+        buf.resize( len + JR_BLOCK );
+
+        reti = jrDecrypt( jrctx, from, len, buf.data() );
+        if ( reti != TF_SUCCESS )
+            break;
+
+        const uint8_t* p = buf.data() + from % JR_BLOCK;
+
+        // length is of decrypted, not authenticated bytes : it must fill
+        // the record the index shows.  All of a batch checked under lock.
+        for ( uint64_t r=n; ( r<m ) && ( reti == TF_SUCCESS ); r++ )
+        {
+            uint32_t rlen = jrGet32( p );
+
+            if ( (uint64_t)JR_LENSZ + rlen != jrEnd( jrctx, r ) - idx[r] )
+                reti = BAD_JOURNAL;
+
+            p += JR_LENSZ + rlen;
+        }
+
+        if ( reti != TF_SUCCESS )
+            break;
+
+        p = buf.data() + from % JR_BLOCK;
+
+        guard.unlock();
+
+        for ( ; ( n<m ) && more; n++ )
+        {
+            uint32_t rlen = jrGet32( p );
+
+            more = fn( user, n, p + JR_LENSZ, rlen );
+            p   += JR_LENSZ + rlen;
+        }
+
+        guard.lock();
+    }
+
+    if ( buf.empty() == false )
+        memset( buf.data(), 0, buf.size() );
+
+    return reti;
+#endif /// of _WIN32
+}
+
+void TwoFishJournal::GetStats( journalStats* stats )
+{
+    TOJRCTX( jrctx );
+
+    if ( ( jrctx == NULL ) || ( stats == NULL ) )
+        return;
+
+    std::lock_guard< std::mutex > guard( jrctx->lock );
+
+    *stats = jrctx->stats;
+}
@@ -0,0 +1,327 @@
+/***************************************************************************
+    tfkeyarena.cpp
+
+  ------------------------------------------------------------------------
+
+    Slab allocator of Twofish keyInstances.
+
+    (C)2021, Raphael Kim
+
+    Notes:
+        *   A slab is cut in slots of whole cache lines.  Each key is put
+            in its slot so that sBox8x32 starts on a 64-byte boundary,
+            the head of the slot links free slots together.
+        *   On Linux, KEYARENA_HUGEPAGE asks for hugetlbfs pages first,
+            then for transparent huge pages on a 2 MB aligned mapping.
+            Slabs are kept out of core dumps there too.
+        *   Tab size is set to 4 characters in this file
+
+***************************************************************************/
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include <mutex>
+#include <vector>
+
+#if !defined(_WIN32)
+    #include <sys/mman.h>
+#endif
+
+#include "tfish.h"
+#include "tfkeyarena.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define KA_LINE         64
+#define KA_HUGE_PAGE    ( 2 * 1024 * 1024 )
+#define KA_ROUND(x,a)   ( ( (x) + (a) - 1 ) / (a) * (a) )
+
+typedef struct
+{
+    uint8_t*    base;       /* KA_LINE aligned start of slots */
+    void*       mem;        /* what to give back to the system */
+    size_t      memsz;
+    bool        mapped;
+}keyArenaSlab;
+
+typedef struct
+{
+    std::mutex                  lock;
+    std::vector< keyArenaSlab > slabs;
+    void*                       freelist;   /* slot heads, linked */
+    size_t                      slabsz;
+    size_t                      slotsz;
+    size_t                      keyofs;     /* keyInstance offset in slot */
+    size_t                      count;
+    size_t                      capacity;
+    unsigned                    flags;      /* asked for */
+    unsigned                    gotflags;   /* had on every slab */
+}libTwoFishKeyArenaContext;
+
+#define L2FKACTX        libTwoFishKeyArenaContext
+#define TOKACTX(_x_)    L2FKACTX* _x_ = (L2FKACTX*)context
+
+////////////////////////////////////////////////////////////////////////////////
+
+static bool arenaMap( L2FKACTX* kactx, keyArenaSlab* slab )
+{
+    size_t   sz  = kactx->slabsz;
+    unsigned got = 0;
+
+    slab->mapped = false;
+    slab->mem    = NULL;
+
+#if defined(__linux__)
+    if ( kactx->flags & KEYARENA_HUGEPAGE )
+    {
+        void* p = mmap( NULL, sz, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+        if ( p != MAP_FAILED )
+        {
+            slab->mem = p;
+            got |= KEYARENA_HUGEPAGE;
+        }
+        else
+        {
+            /* no hugetlbfs pages reserved : map 2 MB aligned, ask for THP */
+            p = mmap( NULL, sz + KA_HUGE_PAGE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+            if ( p != MAP_FAILED )
+            {
+                uint8_t* b    = (uint8_t*)p;
+                uint8_t* a    = (uint8_t*)KA_ROUND( (uintptr_t)b, KA_HUGE_PAGE );
+                size_t   head = a - b;
+
+                if ( head > 0 )
+                    munmap( b, head );
+                munmap( a + sz, KA_HUGE_PAGE - head );
+
+                slab->mem = a;
+                if ( madvise( a, sz, MADV_HUGEPAGE ) == 0 )
+                    got |= KEYARENA_HUGEPAGE;
+            }
+        }
+    }
+
+    if ( slab->mem != NULL )
+        slab->mapped = true;
+#endif /// of __linux__
+
+#if !defined(_WIN32)
+    if ( slab->mem == NULL )
+    {
+        void* p = mmap( NULL, sz, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+        if ( p != MAP_FAILED )
+        {
+            slab->mem    = p;
+            slab->mapped = true;
+        }
+    }
+
+    if ( slab->mem != NULL )
+    {
+  #if defined(__linux__)
+        madvise( slab->mem, sz, MADV_DONTDUMP );
+  #endif
+        if ( ( kactx->flags & KEYARENA_MLOCK ) && ( mlock( slab->mem, sz ) == 0 ) )
+            got |= KEYARENA_MLOCK;
+    }
+#endif /// of !_WIN32
+
+    if ( slab->mem == NULL )
+    {
+        /* no mmap() : heap, aligned by hand */
+        sz += KA_LINE;
+        slab->mem = malloc( sz );
+        if ( slab->mem == NULL )
+            return false;
+    }
+
+    slab->memsz = sz;
+    slab->base  = (uint8_t*)KA_ROUND( (uintptr_t)slab->mem, KA_LINE );
+
+    if ( kactx->slabs.empty() == true )
+        kactx->gotflags = got;
+    else
+        kactx->gotflags &= got;
+
+    return true;
+}
+
+static void arenaUnmap( keyArenaSlab* slab )
+{
+    /* don't leave key schedules behind in freed memory */
+    memset( slab->mem, 0, slab->memsz );
+
+#if !defined(_WIN32)
+    if ( slab->mapped == true )
+    {
+        munlock( slab->mem, slab->memsz );
+        munmap( slab->mem, slab->memsz );
+        return;
+    }
+#endif
+    free( slab->mem );
+}
+
+/* one more slab, all of its slots to free list */
+static bool arenaGrow( L2FKACTX* kactx )
+{
+    keyArenaSlab slab;
+
+    if ( arenaMap( kactx, &slab ) == false )
+        return false;
+
+    size_t slots = kactx->slabsz / kactx->slotsz;
+
+    for ( size_t cnt=slots; cnt-->0; )
+    {
+        void** head = (void**)( slab.base + cnt * kactx->slotsz );
+        *head = kactx->freelist;
+        kactx->freelist = (void*)head;
+    }
+
+    kactx->slabs.push_back( slab );
+    kactx->capacity += slots;
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+TwoFishKeyArena::TwoFishKeyArena( size_t slabsz, unsigned flags )
+ : context( NULL )
+{
+    L2FKACTX* kactx = new L2FKACTX;
+    if ( kactx != NULL )
+    {
+        kactx->freelist = NULL;
+        kactx->count    = 0;
+        kactx->capacity = 0;
+        kactx->flags    = flags & ( KEYARENA_HUGEPAGE | KEYARENA_MLOCK );
+        kactx->gotflags = 0;
+
+#if REENTRANT
+        size_t sbofs = offsetof( keyInstance, sBox8x32 ) % KA_LINE;
+        kactx->keyofs = ( sbofs > 0 ) ? KA_LINE - sbofs : 0;
+#else
+        kactx->keyofs = 0;
+#endif
+        /* a free slot links by its head, so a key can't start there */
+        if ( kactx->keyofs < sizeof( void* ) )
+            kactx->keyofs += KA_LINE;
+        kactx->slotsz = KA_ROUND( kactx->keyofs + sizeof( keyInstance ), KA_LINE );
+
+        if ( slabsz < kactx->slotsz )
+            slabsz = kactx->slotsz;
+        if ( kactx->flags & KEYARENA_HUGEPAGE )
+            slabsz = KA_ROUND( slabsz, KA_HUGE_PAGE );
+        kactx->slabsz = slabsz;
+
+        arenaGrow( kactx );
+
+        context = (void*)kactx;
+    }
+}
+
+TwoFishKeyArena::~TwoFishKeyArena()
+{
+    TOKACTX( kactx );
+
+    if ( kactx != NULL )
+    {
+        context = NULL;
+
+        for ( size_t cnt=0; cnt<kactx->slabs.size(); cnt++ )
+            arenaUnmap( &kactx->slabs[cnt] );
+
+        delete kactx;
+    }
+}
+
+keyInstance* TwoFishKeyArena::Alloc()
+{
+    TOKACTX( kactx );
+
+    if ( kactx == NULL )
+        return NULL;
+
+    void* head = NULL;
+
+    kactx->lock.lock();
+
+    if ( ( kactx->freelist != NULL ) || ( arenaGrow( kactx ) == true ) )
+    {
+        head = kactx->freelist;
+        kactx->freelist = *(void**)head;
+        kactx->count++;
+    }
+
+    kactx->lock.unlock();
+
+    if ( head == NULL )
+        return NULL;
+
+    keyInstance* key = (keyInstance*)( (uint8_t*)head + kactx->keyofs );
+    memset( key, 0, sizeof( keyInstance ) );
+
+    return key;
+}
+
+void TwoFishKeyArena::Free( keyInstance* key )
+{
+    TOKACTX( kactx );
+
+    if ( ( kactx == NULL ) || ( key == NULL ) )
+        return;
+
+    memset( key, 0, sizeof( keyInstance ) );
+
+    void* head = (void*)( (uint8_t*)key - kactx->keyofs );
+
+    std::lock_guard< std::mutex > guard( kactx->lock );
+
+    *(void**)head = kactx->freelist;
+    kactx->freelist = head;
+    kactx->count--;
+}
+
+size_t TwoFishKeyArena::GetCount()
+{
+    TOKACTX( kactx );
+
+    if ( kactx == NULL )
+        return 0;
+
+    std::lock_guard< std::mutex > guard( kactx->lock );
+
+    return kactx->count;
+}
+
+size_t TwoFishKeyArena::GetCapacity()
+{
+    TOKACTX( kactx );
+
+    if ( kactx == NULL )
+        return 0;
+
+    std::lock_guard< std::mutex > guard( kactx->lock );
+
+    return kactx->capacity;
+}
+
+unsigned TwoFishKeyArena::GetFlags()
+{
+    TOKACTX( kactx );
+
+    if ( kactx == NULL )
+        return 0;
+
+    std::lock_guard< std::mutex > guard( kactx->lock );
+
+    return kactx->gotflags;
+}
@@ -0,0 +1,457 @@
+/***************************************************************************
+    tfkeyblob.cpp
+
+  ------------------------------------------------------------------------
+
+    Saved images of expanded Twofish key schedules.
+
+    (C)2021, Raphael Kim
+
+    Notes:
+        *   Key slots are laid out as in TwoFishKeyArena : whole cache
+            lines, sBox8x32 on a 64-byte boundary of the blob.
+        *   Checksum is 4 lanes of 64-bit multiply-rotate over words, fast
+            enough to check a blob in a fraction of its makeKey() time.
+            It catches damage, not tampering : protect blob files as you
+            would protect the keys themselves.
+        *   Tab size is set to 4 characters in this file
+
+***************************************************************************/
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cerrno>
+
+#include <string>
+
+#if !defined(_WIN32)
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+#include "tfish.h"
+#include "tfkeyblob.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define KB_LINE         64
+#define KB_ROUND(x,a)   ( ( (x) + (a) - 1 ) / (a) * (a) )
+#define KB_BYTEORDER    0x01020304
+
+static_assert( sizeof( keyBlobHeader ) == KEYBLOB_HEADSZ,
+               "keyBlobHeader must be KEYBLOB_HEADSZ bytes" );
+
+typedef struct
+{
+    uint8_t*    base;
+    size_t      size;
+    size_t      keyofs;
+    size_t      slotsz;
+    size_t      count;
+    bool        mapped;     /* by Open(), else not ours or malloc()ed */
+    bool        owned;
+}libTwoFishKeyBlobContext;
+
+#define L2FKBCTX        libTwoFishKeyBlobContext
+#define TOKBCTX(_x_)    L2FKBCTX* _x_ = (L2FKBCTX*)context
+
+////////////////////////////////////////////////////////////////////////////////
+
+static size_t blobKeyOffset()
+{
+#if REENTRANT
+    size_t sbofs = offsetof( keyInstance, sBox8x32 ) % KB_LINE;
+    return ( sbofs > 0 ) ? KB_LINE - sbofs : 0;
+#else
+    return 0;
+#endif
+}
+
+static size_t blobSlotSize()
+{
+    return KB_ROUND( blobKeyOffset() + sizeof( keyInstance ), KB_LINE );
+}
+
+#define RotL64(x,n)     ( ( (x) << (n) ) | ( (x) >> ( 64 - (n) ) ) )
+#define SumLane(h,w)    { h ^= (w); h *= 0x9E3779B97F4A7C15ull; h = RotL64(h,31); }
+
+static uint64_t blobSum( const uint8_t* p, size_t n )
+{
+    uint64_t h[4] = { 0x243F6A8885A308D3ull, 0x13198A2E03707344ull,
+                      0xA4093822299F31D0ull, 0x082EFA98EC4E6C89ull };
+    uint64_t w[4];
+    size_t   cnt  = 0;
+
+    for ( ; cnt+32<=n; cnt+=32 )
+    {
+        memcpy( w, p + cnt, 32 );
+        SumLane( h[0], w[0] );
+        SumLane( h[1], w[1] );
+        SumLane( h[2], w[2] );
+        SumLane( h[3], w[3] );
+    }
+
+    for ( ; cnt<n; cnt++ )
+        SumLane( h[cnt&3], p[cnt] );
+
+    uint64_t r = (uint64_t)n;
+    for ( size_t l=0; l<4; l++ )
+        SumLane( r, h[l] );
+
+    return r ^ ( r >> 29 );
+}
+
+/* header fits this build, and blob is big enough for its keys */
+static int blobCheckHead( const keyBlobHeader* hd, size_t memsz )
+{
+    if ( memsz < KEYBLOB_HEADSZ )
+        return BAD_KEY_BLOB;
+
+    if ( ( hd->magic != KEYBLOB_MAGIC ) || ( hd->version != KEYBLOB_VERSION ) ||
+         ( hd->byteOrder != KB_BYTEORDER ) ||
+         ( hd->keySize != sizeof( keyInstance ) ) ||
+         ( hd->keyOffset != blobKeyOffset() ) ||
+         ( hd->slotSize != blobSlotSize() ) )
+        return BAD_KEY_BLOB;
+
+    if ( hd->headSum != blobSum( (const uint8_t*)hd, offsetof( keyBlobHeader, headSum ) ) )
+        return BAD_KEY_BLOB;
+
+    if ( hd->keyCount > ( memsz - KEYBLOB_HEADSZ ) / hd->slotSize )
+        return BAD_KEY_BLOB;
+
+    return TF_SUCCESS;
+}
+
+static int blobCheckKeys( const uint8_t* base, const keyBlobHeader* hd )
+{
+    size_t datasz = (size_t)hd->keyCount * hd->slotSize;
+
+    if ( hd->dataSum != blobSum( base + KEYBLOB_HEADSZ, datasz ) )
+        return BAD_KEY_BLOB;
+
+    for ( size_t cnt=0; cnt<hd->keyCount; cnt++ )
+    {
+        const keyInstance* key = (const keyInstance*)
+            ( base + KEYBLOB_HEADSZ + cnt * hd->slotSize + hd->keyOffset );
+
+        if ( ( key->keySig != VALID_SIG ) || ( key->sboxReady == 0 ) )
+            return BAD_KEY_BLOB;
+    }
+
+    return TF_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+size_t TwoFishKeyBlob::Size( size_t keyCnt )
+{
+    return KEYBLOB_HEADSZ + keyCnt * blobSlotSize();
+}
+
+int TwoFishKeyBlob::Write( void* mem, size_t memsz,
+                           const keyInstance* const* keys, size_t keyCnt )
+{
+    if ( ( mem == NULL ) || ( ( keys == NULL ) && ( keyCnt > 0 ) ) )
+        return BAD_PARAMS;
+
+    if ( memsz < Size( keyCnt ) )
+        return BAD_PARAMS;
+
+    size_t   keyofs = blobKeyOffset();
+    size_t   slotsz = blobSlotSize();
+    uint8_t* base   = (uint8_t*)mem;
+
+    for ( size_t cnt=0; cnt<keyCnt; cnt++ )
+    {
+        if ( ( keys[cnt] == NULL ) || ( keys[cnt]->keySig != VALID_SIG ) ||
+             ( keys[cnt]->sboxReady == 0 ) )
+            return BAD_KEY_INSTANCE;
+    }
+
+    memset( base, 0, Size( keyCnt ) );
+
+    for ( size_t cnt=0; cnt<keyCnt; cnt++ )
+        memcpy( base + KEYBLOB_HEADSZ + cnt * slotsz + keyofs,
+                keys[cnt], sizeof( keyInstance ) );
+
+    keyBlobHeader* hd = (keyBlobHeader*)base;
+
+    hd->magic     = KEYBLOB_MAGIC;
+    hd->version   = KEYBLOB_VERSION;
+    hd->byteOrder = KB_BYTEORDER;
+    hd->keySize   = sizeof( keyInstance );
+    hd->keyOffset = keyofs;
+    hd->slotSize  = slotsz;
+    hd->keyCount  = keyCnt;
+    hd->dataSum   = blobSum( base + KEYBLOB_HEADSZ, keyCnt * slotsz );
+    hd->headSum   = blobSum( base, offsetof( keyBlobHeader, headSum ) );
+
+    return TF_SUCCESS;
+}
+
+int TwoFishKeyBlob::Save( const char* path,
+                          const keyInstance* const* keys, size_t keyCnt )
+{
+    if ( path == NULL )
+        return BAD_PARAMS;
+
+    size_t   sz  = Size( keyCnt );
+    uint8_t* mem = (uint8_t*)malloc( sz );
+
+    if ( mem == NULL )
+        return BAD_KEY_FILE;
+
+    int reti = Write( mem, sz, keys, keyCnt );
+
+    if ( reti == TF_SUCCESS )
+    {
+        /* readers never see a half written blob */
+        std::string tmppath = std::string( path ) + ".tmp";
+
+        reti = BAD_KEY_FILE;
+
+#if !defined(_WIN32)
+        // key material : owner only from the start, on disk before rename.
+        int fd = open( tmppath.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0600 );
+
+        if ( ( fd < 0 ) && ( errno == EEXIST ) )
+        {
+            unlink( tmppath.c_str() );  /* left by a crash */
+            fd = open( tmppath.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0600 );
+        }
+
+        if ( fd >= 0 )
+        {
+            size_t done = 0;
+
+            while ( done < sz )
+            {
+                ssize_t w = write( fd, mem + done, sz - done );
+
+                if ( ( w < 0 ) && ( errno == EINTR ) )
+                    continue;
+                if ( w <= 0 )
+                    break;
+                done += (size_t)w;
+            }
+
+            bool wrote = ( done == sz ) && ( fsync( fd ) == 0 );
+
+            if ( ( close( fd ) == 0 ) && ( wrote == true ) &&
+                 ( rename( tmppath.c_str(), path ) == 0 ) )
+                reti = TF_SUCCESS;
+            else
+                unlink( tmppath.c_str() );
+        }
+#else
+        FILE* fp = fopen( tmppath.c_str(), "wb" );
+
+        if ( fp != NULL )
+        {
+            bool wrote = ( fwrite( mem, 1, sz, fp ) == sz );
+
+            if ( ( fclose( fp ) == 0 ) && ( wrote == true ) &&
+                 ( rename( tmppath.c_str(), path ) == 0 ) )
+                reti = TF_SUCCESS;
+            else
+                remove( tmppath.c_str() );
+        }
+#endif
+    }
+
+    memset( mem, 0, sz );
+    free( mem );
+
+    return reti;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+TwoFishKeyBlob::TwoFishKeyBlob()
+ : context( NULL )
+{
+    L2FKBCTX* kbctx = new L2FKBCTX;
+    if ( kbctx != NULL )
+    {
+        memset( kbctx, 0, sizeof( L2FKBCTX ) );
+        context = (void*)kbctx;
+    }
+}
+
+TwoFishKeyBlob::~TwoFishKeyBlob()
+{
+    TOKBCTX( kbctx );
+
+    if ( kbctx != NULL )
+    {
+        Close();
+        context = NULL;
+        delete kbctx;
+    }
+}
+
+int TwoFishKeyBlob::Open( const char* path, bool verify )
+{
+    TOKBCTX( kbctx );
+
+    if ( ( kbctx == NULL ) || ( path == NULL ) )
+        return BAD_PARAMS;
+
+    Close();
+
+    uint8_t* base   = NULL;
+    size_t   size   = 0;
+    bool     mapped = false;
+
+#if !defined(_WIN32)
+    int fd = open( path, O_RDONLY );
+    if ( fd < 0 )
+        return BAD_KEY_FILE;
+
+    struct stat st;
+    if ( ( fstat( fd, &st ) == 0 ) && ( st.st_size > 0 ) )
+    {
+        size = (size_t)st.st_size;
+        /* private : a key written to gets its own copy of the page */
+        void* p = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+        if ( p != MAP_FAILED )
+        {
+            base   = (uint8_t*)p;
+            mapped = true;
+        }
+    }
+    close( fd );
+#else
+    FILE* fp = fopen( path, "rb" );
+    if ( fp == NULL )
+        return BAD_KEY_FILE;
+
+    if ( ( fseek( fp, 0, SEEK_END ) == 0 ) && ( ftell( fp ) > 0 ) )
+    {
+        size = (size_t)ftell( fp );
+        base = (uint8_t*)malloc( size );
+        rewind( fp );
+        if ( ( base != NULL ) && ( fread( base, 1, size, fp ) != size ) )
+        {
+            free( base );
+            base = NULL;
+        }
+    }
+    fclose( fp );
+#endif
+
+    if ( base == NULL )
+        return BAD_KEY_FILE;
+
+    int reti = Attach( base, size, verify );
+
+    if ( reti != TF_SUCCESS )
+    {
+#if !defined(_WIN32)
+        munmap( base, size );
+#else
+        free( base );
+#endif
+        return reti;
+    }
+
+    kbctx->mapped = mapped;
+    kbctx->owned  = true;
+
+    return TF_SUCCESS;
+}
+
+int TwoFishKeyBlob::Attach( void* mem, size_t memsz, bool verify )
+{
+    TOKBCTX( kbctx );
+
+    if ( ( kbctx == NULL ) || ( mem == NULL ) || ( (uintptr_t)mem & 7 ) )
+        return BAD_PARAMS;
+
+    if ( mem != kbctx->base )
+        Close();
+
+    const keyBlobHeader* hd = (const keyBlobHeader*)mem;
+
+    int reti = blobCheckHead( hd, memsz );
+    if ( reti != TF_SUCCESS )
+        return reti;
+
+    if ( verify == true )
+    {
+        reti = blobCheckKeys( (const uint8_t*)mem, hd );
+        if ( reti != TF_SUCCESS )
+            return reti;
+    }
+
+    kbctx->base   = (uint8_t*)mem;
+    kbctx->size   = memsz;
+    kbctx->keyofs = hd->keyOffset;
+    kbctx->slotsz = hd->slotSize;
+    kbctx->count  = (size_t)hd->keyCount;
+    kbctx->mapped = false;
+    kbctx->owned  = false;
+
+    return TF_SUCCESS;
+}
+
+void TwoFishKeyBlob::Close()
+{
+    TOKBCTX( kbctx );
+
+    if ( ( kbctx == NULL ) || ( kbctx->base == NULL ) )
+        return;
+
+    if ( kbctx->owned == true )
+    {
+#if !defined(_WIN32)
+        if ( kbctx->mapped == true )
+            munmap( kbctx->base, kbctx->size );
+        else
+#endif
+        {
+            memset( kbctx->base, 0, kbctx->size );
+            free( kbctx->base );
+        }
+    }
+
+    memset( kbctx, 0, sizeof( L2FKBCTX ) );
+}
+
+size_t TwoFishKeyBlob::GetCount()
+{
+    TOKBCTX( kbctx );
+
+    if ( kbctx == NULL )
+        return 0;
+
+    return kbctx->count;
+}
+
+const keyInstance* TwoFishKeyBlob::GetKey( size_t index )
+{
+    TOKBCTX( kbctx );
+
+    if ( ( kbctx == NULL ) || ( index >= kbctx->count ) )
+        return NULL;
+
+    return (const keyInstance*)( kbctx->base + KEYBLOB_HEADSZ +
+                                 index * kbctx->slotsz + kbctx->keyofs );
+}
+
+int TwoFishKeyBlob::CopyKey( size_t index, keyInstance* key )
+{
+    const keyInstance* kb = GetKey( index );
+
+    if ( ( kb == NULL ) || ( key == NULL ) )
+        return BAD_PARAMS;
+
+    memcpy( key, kb, sizeof( keyInstance ) );
+
+    return TF_SUCCESS;
+}
@@ -0,0 +1,304 @@
+/***************************************************************************
+    tfkeycache.cpp
+
+  ------------------------------------------------------------------------
+
+    LRU cache of expanded Twofish key schedules.
+
+    (C)2021, Raphael Kim
+
+    Notes:
+        *   Keys are looked up by a SipHash-2-4 fingerprint of the raw key
+            bits, with a random hash key per cache.  So fingerprints can't
+            be predicted from outside, and raw key bits are compared on a
+            fingerprint match anyway.
+        *   Tab size is set to 4 characters in this file
+
+***************************************************************************/
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <random>
+#include <unordered_map>
+
+#include "tfish.h"
+#include "tfkeycache.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct
+{
+    uint64_t        fprint;
+    keyInstance     key;
+}keyCacheEntry;
+
+typedef std::list< keyCacheEntry >                          keyCacheList;
+typedef std::unordered_map< uint64_t, keyCacheList::iterator > keyCacheMap;
+
+typedef struct
+{
+    std::mutex              lock;
+    keyCacheList            lru;        /* most recently used at front */
+    keyCacheMap             map;
+    size_t                  capacity;
+    uint64_t                sipKey[2];
+    std::atomic< uint64_t > hits;
+    std::atomic< uint64_t > misses;
+    std::atomic< uint64_t > evictions;
+}libTwoFishKeyCacheContext;
+
+#define L2FKCCTX        libTwoFishKeyCacheContext
+#define TOKCCTX(_x_)    L2FKCCTX* _x_ = (L2FKCCTX*)context
+
+/* list and hash nodes, roughly, for sizing by memory budget */
+#define KC_NODE_OVERHEAD    ( 8 * sizeof(void*) )
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define SipRound(v0,v1,v2,v3)                                   \
+    {   v0 += v1; v1 = (v1 << 13) | (v1 >> 51); v1 ^= v0;       \
+        v0  = (v0 << 32) | (v0 >> 32);                          \
+        v2 += v3; v3 = (v3 << 16) | (v3 >> 48); v3 ^= v2;       \
+        v0 += v3; v3 = (v3 << 21) | (v3 >> 43); v3 ^= v0;       \
+        v2 += v1; v1 = (v1 << 17) | (v1 >> 47); v1 ^= v2;       \
+        v2  = (v2 << 32) | (v2 >> 32); }
+
+/* SipHash-2-4 over whole 64-bit words */
+static uint64_t sipHash( const uint64_t* k, const uint64_t* m, size_t cnt )
+{
+    uint64_t v0 = k[0] ^ 0x736f6d6570736575ull;
+    uint64_t v1 = k[1] ^ 0x646f72616e646f6dull;
+    uint64_t v2 = k[0] ^ 0x6c7967656e657261ull;
+    uint64_t v3 = k[1] ^ 0x7465646279746573ull;
+
+    for ( size_t cnt_m=0; cnt_m<cnt; cnt_m++ )
+    {
+        v3 ^= m[cnt_m];
+        SipRound(v0,v1,v2,v3);
+        SipRound(v0,v1,v2,v3);
+        v0 ^= m[cnt_m];
+    }
+
+    /* length block */
+    uint64_t b = ( (uint64_t)( cnt * 8 ) ) << 56;
+    v3 ^= b;
+    SipRound(v0,v1,v2,v3);
+    SipRound(v0,v1,v2,v3);
+    v0 ^= b;
+
+    v2 ^= 0xFF;
+    for ( size_t cnt_r=0; cnt_r<4; cnt_r++ )
+        SipRound(v0,v1,v2,v3);
+
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+static uint64_t keyFingerprint( L2FKCCTX* kcctx, const uint32_t* k32, size_t keyLen )
+{
+    uint64_t m[MAX_KEY_BITS/64 + 1] = {0};
+
+    memcpy( m, k32, MAX_KEY_BITS/8 );
+    m[MAX_KEY_BITS/64] = (uint64_t)keyLen;
+
+    return sipHash( kcctx->sipKey, m, MAX_KEY_BITS/64 + 1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+TwoFishKeyCache::TwoFishKeyCache( size_t memsz )
+ : context( NULL )
+{
+    L2FKCCTX* kcctx = new L2FKCCTX;
+    if ( kcctx != NULL )
+    {
+        std::random_device rd;
+
+        kcctx->capacity  = memsz / ( sizeof( keyCacheEntry ) + KC_NODE_OVERHEAD );
+        if ( kcctx->capacity == 0 )
+            kcctx->capacity = 1;
+
+        kcctx->sipKey[0] = ( (uint64_t)rd() << 32 ) ^ rd();
+        kcctx->sipKey[1] = ( (uint64_t)rd() << 32 ) ^ rd();
+        kcctx->hits      = 0;
+        kcctx->misses    = 0;
+        kcctx->evictions = 0;
+        kcctx->map.reserve( kcctx->capacity );
+
+        context = (void*)kcctx;
+    }
+}
+
+TwoFishKeyCache::~TwoFishKeyCache()
+{
+    TOKCCTX( kcctx );
+
+    if ( kcctx != NULL )
+    {
+        context = NULL;
+
+        Clear();
+        delete kcctx;
+    }
+}
+
+int TwoFishKeyCache::MakeKey( keyInstance* key, uint8_t direction,
+                              size_t keyLen, const char* keyMaterial )
+{
+    TOKCCTX( kcctx );
+
+    if ( kcctx == NULL )
+        return makeKey( key, direction, keyLen, keyMaterial );
+
+    /* let makeKey() handle bad parameters and "dummy" setups */
+    if ( ( key == NULL ) || ( keyMaterial == NULL ) || ( keyMaterial[0] == 0 ) ||
+         ( ( direction != DIR_ENCRYPT ) && ( direction != DIR_DECRYPT ) ) ||
+         ( keyLen > MAX_KEY_BITS ) || ( keyLen < 8 ) || ( keyLen & 0x3F ) )
+        return makeKey( key, direction, keyLen, keyMaterial );
+
+    uint32_t k32[MAX_KEY_BITS/32] = {0};
+
+    if ( ParseHexDword( keyLen, keyMaterial, k32, NULL ) )
+        return BAD_KEY_MAT;
+
+    uint64_t fp   = keyFingerprint( kcctx, k32, keyLen );
+    bool     hit  = false;
+
+    kcctx->lock.lock();
+
+    keyCacheMap::iterator it = kcctx->map.find( fp );
+    if ( it != kcctx->map.end() )
+    {
+        keyInstance* ck = &it->second->key;
+
+        if ( ( ck->keyLen == ( ( keyLen + 63 ) & ~63 ) ) &&
+             ( memcmp( ck->key32, k32, sizeof( k32 ) ) == 0 ) )
+        {
+            memcpy( key, ck, sizeof( keyInstance ) );
+            kcctx->lru.splice( kcctx->lru.begin(), kcctx->lru, it->second );
+            hit = true;
+        }
+    }
+
+    kcctx->lock.unlock();
+
+    if ( hit == true )
+    {
+        kcctx->hits++;
+
+        /* keep ASCII copy of caller, then fit cached subkeys to direction */
+        ParseHexDword( keyLen, keyMaterial, key->key32, key->keyMaterial );
+
+        if ( key->direction != direction )
+            ReverseRoundSubkeys( key, direction );
+
+        return TF_SUCCESS;
+    }
+
+    kcctx->misses++;
+
+    int reti = makeKey( key, direction, keyLen, keyMaterial );
+    if ( reti != TF_SUCCESS )
+        return reti;
+
+    kcctx->lock.lock();
+
+    it = kcctx->map.find( fp );
+    if ( it != kcctx->map.end() )
+    {
+        /* other thread did same key, or fingerprint collision : replace */
+        memcpy( &it->second->key, key, sizeof( keyInstance ) );
+        kcctx->lru.splice( kcctx->lru.begin(), kcctx->lru, it->second );
+    }
+    else
+    {
+        if ( kcctx->map.size() >= kcctx->capacity )
+        {
+            kcctx->map.erase( kcctx->lru.back().fprint );
+            memset( &kcctx->lru.back().key, 0, sizeof( keyInstance ) );
+            kcctx->lru.pop_back();
+            kcctx->evictions++;
+        }
+
+        kcctx->lru.push_front( keyCacheEntry() );
+        kcctx->lru.front().fprint = fp;
+        memcpy( &kcctx->lru.front().key, key, sizeof( keyInstance ) );
+        kcctx->map[ fp ] = kcctx->lru.begin();
+    }
+
+    kcctx->lock.unlock();
+
+    return TF_SUCCESS;
+}
+
+void TwoFishKeyCache::Clear()
+{
+    TOKCCTX( kcctx );
+
+    if ( kcctx == NULL )
+        return;
+
+    std::lock_guard< std::mutex > guard( kcctx->lock );
+
+    /* don't leave key schedules behind in freed memory */
+    for ( keyCacheList::iterator it=kcctx->lru.begin(); it!=kcctx->lru.end(); ++it )
+        memset( &it->key, 0, sizeof( keyInstance ) );
+
+    kcctx->lru.clear();
+    kcctx->map.clear();
+}
+
+size_t TwoFishKeyCache::GetCapacity()
+{
+    TOKCCTX( kcctx );
+
+    if ( kcctx == NULL )
+        return 0;
+
+    return kcctx->capacity;
+}
+
+size_t TwoFishKeyCache::GetCount()
+{
+    TOKCCTX( kcctx );
+
+    if ( kcctx == NULL )
+        return 0;
+
+    std::lock_guard< std::mutex > guard( kcctx->lock );
+
+    return kcctx->map.size();
+}
+
+uint64_t TwoFishKeyCache::GetHits()
+{
+    TOKCCTX( kcctx );
+
+    if ( kcctx == NULL )
+        return 0;
+
+    return kcctx->hits;
+}
+
+uint64_t TwoFishKeyCache::GetMisses()
+{
+    TOKCCTX( kcctx );
+
+    if ( kcctx == NULL )
+        return 0;
+
+    return kcctx->misses;
+}
+
+uint64_t TwoFishKeyCache::GetEvictions()
+{
+    TOKCCTX( kcctx );
+
+    if ( kcctx == NULL )
+        return 0;
+
+    return kcctx->evictions;
+}
@@ -0,0 +1,42 @@
+#ifndef __TFKEYCACHE_H__
+#define __TFKEYCACHE_H__
+
+/**
+* libtwofish key cache
+* ========================================================
+* Bounded LRU cache of expanded key schedules, placed in front of
+* makeKey().  Keys coming back skip reKey() and only pay a copy.
+*
+* (C)2021, Raphael Kim
+**/
+
+#include <cstdint>
+#include <cstddef>
+
+#include "tfish.h"
+
+class TwoFishKeyCache
+{
+    public:
+        /* memsz is memory budget in bytes for cached key schedules,
+           at least one key is always kept.
+        */
+        TwoFishKeyCache( size_t memsz = 1024 * 1024 );
+        ~TwoFishKeyCache();
+
+    public:
+        /* same arguments and return values as makeKey(). */
+        int      MakeKey( keyInstance* key, uint8_t direction,
+                          size_t keyLen, const char* keyMaterial );
+        void     Clear();
+        size_t   GetCapacity();
+        size_t   GetCount();
+        uint64_t GetHits();
+        uint64_t GetMisses();
+        uint64_t GetEvictions();
+
+    public:
+        void* context;
+};
+
+#endif /// of __TFKEYCACHE_H__
@@ -0,0 +1,349 @@
+/***************************************************************************
+    tfkeyhandle.cpp
+
+  ------------------------------------------------------------------------
+
+    RCU style key handle : lock-free readers, epoch based reclamation.
+
+    (C)2021, Raphael Kim
+
+    Notes:
+        *   A reader puts the global epoch in a free slot, then loads the
+            current key.  Rotate() swaps the key pointer, then steps the
+            epoch, so a reader with the new epoch can only see the new
+            key.  A retired key is freed when every busy slot holds a
+            later epoch than the one it was retired in.
+        *   All of it is sequentially consistent atomics.  Taking a key is
+            a compare-exchange and two loads, giving it back one store.
+        *   Tab size is set to 4 characters in this file
+
+***************************************************************************/
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <string>
+#include <vector>
+
+#include "tfish.h"
+#include "tfkeyhandle.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define KH_LINE         64
+
+typedef struct
+{
+    keyInstance     enc;
+    keyInstance     dec;
+    uint64_t        version;
+    uint64_t        retired;    /* epoch it was retired in */
+    int             result;     /* of makeKey() in Prepare() */
+}keyHandleEntry;
+
+typedef struct
+{
+    std::atomic< uint64_t > epoch;  /* 0 : free */
+    uint8_t                 pad[ KH_LINE - sizeof( std::atomic< uint64_t > ) ];
+}keyHandleSlot;
+
+typedef struct
+{
+    keyHandleSlot                   slots[ KEYHANDLE_READERS ];
+    std::atomic< keyHandleEntry* >  current;
+    std::atomic< uint64_t >         epoch;
+    std::atomic< size_t >           nextSlot;
+    std::mutex                      lock;       /* writers */
+    std::vector< keyHandleEntry* >  retired;
+    keyHandleEntry*                 prepared;
+    std::thread                     preparer;
+    std::atomic< bool >             preparedDone;
+    uint64_t                        version;
+}libTwoFishKeyHandleContext;
+
+#define L2FKHCTX        libTwoFishKeyHandleContext
+#define TOKHCTX(_x_)    L2FKHCTX* _x_ = (L2FKHCTX*)context
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void entryFree( keyHandleEntry* ent )
+{
+    if ( ent == NULL )
+        return;
+
+    memset( ent, 0, sizeof( keyHandleEntry ) );   /* no key left in heap */
+    delete ent;
+}
+
+static void entryMake( keyHandleEntry* ent, size_t keyLen, const char* keyMaterial )
+{
+    ent->result = makeKey( &ent->enc, DIR_ENCRYPT, keyLen, keyMaterial );
+    if ( ent->result == TF_SUCCESS )
+        ent->result = makeKey( &ent->dec, DIR_DECRYPT, keyLen, keyMaterial );
+    if ( ent->result == TF_SUCCESS )
+    {
+        expandKey( &ent->enc );
+        expandKey( &ent->dec );
+    }
+}
+
+// lock held.
+static void preparedWait( L2FKHCTX* khctx )
+{
+    if ( khctx->preparer.joinable() )
+        khctx->preparer.join();
+}
+
+// lock held.
+static size_t retiredFree( L2FKHCTX* khctx )
+{
+    uint64_t oldest = UINT64_MAX;
+
+    for ( size_t cnt=0; cnt<KEYHANDLE_READERS; cnt++ )
+    {
+        uint64_t e = khctx->slots[ cnt ].epoch;
+        if ( ( e != 0 ) && ( e < oldest ) )
+            oldest = e;
+    }
+
+    size_t keep = 0;
+
+    for ( size_t cnt=0; cnt<khctx->retired.size(); cnt++ )
+    {
+        keyHandleEntry* ent = khctx->retired[ cnt ];
+
+        if ( ent->retired < oldest )
+            entryFree( ent );
+        else
+            khctx->retired[ keep++ ] = ent;
+    }
+
+    khctx->retired.resize( keep );
+
+    return keep;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+TwoFishKeyHandle::TwoFishKeyHandle()
+ : context( NULL )
+{
+    L2FKHCTX* khctx = new L2FKHCTX;
+    if ( khctx == NULL )
+        return;
+
+    for ( size_t cnt=0; cnt<KEYHANDLE_READERS; cnt++ )
+        khctx->slots[ cnt ].epoch = 0;
+
+    khctx->current  = NULL;
+    khctx->epoch    = 1;
+    khctx->nextSlot = 0;
+    khctx->prepared = NULL;
+    khctx->version  = 0;
+    khctx->preparedDone = false;
+
+    context = (void*)khctx;
+}
+
+TwoFishKeyHandle::~TwoFishKeyHandle()
+{
+    TOKHCTX( khctx );
+
+    if ( khctx == NULL )
+        return;
+
+    {
+        std::lock_guard< std::mutex > guard( khctx->lock );
+
+        preparedWait( khctx );
+        entryFree( khctx->prepared );
+        entryFree( khctx->current );
+
+        for ( size_t cnt=0; cnt<khctx->retired.size(); cnt++ )
+            entryFree( khctx->retired[ cnt ] );
+    }
+
+    context = NULL;
+    delete khctx;
+}
+
+int TwoFishKeyHandle::Acquire( keyReader* rd )
+{
+    TOKHCTX( khctx );
+
+    if ( ( khctx == NULL ) || ( rd == NULL ) )
+        return BAD_PARAMS;
+
+    // a free slot, from a moving start so readers spread out.
+    size_t slot = khctx->nextSlot.fetch_add( 1 ) % KEYHANDLE_READERS;
+
+    for (;;)
+    {
+        uint64_t idle = 0;
+        uint64_t e    = khctx->epoch;
+
+        if ( khctx->slots[ slot ].epoch.compare_exchange_strong( idle, e ) )
+            break;
+
+        if ( ++slot == KEYHANDLE_READERS )
+        {
+            slot = 0;
+            std::this_thread::yield();  /* all busy, rare */
+        }
+    }
+
+    keyHandleEntry* ent = khctx->current;
+
+    if ( ent == NULL )
+    {
+        khctx->slots[ slot ].epoch = 0;
+        return KEY_NOT_READY;
+    }
+
+    rd->enc     = &ent->enc;
+    rd->dec     = &ent->dec;
+    rd->version = ent->version;
+    rd->slot    = slot;
+
+    return TF_SUCCESS;
+}
+
+void TwoFishKeyHandle::Release( keyReader* rd )
+{
+    TOKHCTX( khctx );
+
+    if ( ( khctx == NULL ) || ( rd == NULL ) || ( rd->slot >= KEYHANDLE_READERS ) )
+        return;
+
+    khctx->slots[ rd->slot ].epoch = 0;
+
+    rd->enc  = NULL;
+    rd->dec  = NULL;
+    rd->slot = KEYHANDLE_READERS;
+}
+
+int TwoFishKeyHandle::Prepare( size_t keyLen, const char* keyMaterial )
+{
+    TOKHCTX( khctx );
+
+    if ( ( khctx == NULL ) || ( keyMaterial == NULL ) )
+        return BAD_PARAMS;
+
+    // material may not outlive this call.
+    std::string material( keyMaterial );
+
+    std::lock_guard< std::mutex > guard( khctx->lock );
+
+    preparedWait( khctx );
+    entryFree( khctx->prepared );
+
+    keyHandleEntry* ent = new keyHandleEntry;
+    if ( ent == NULL )
+        return BAD_PARAMS;
+
+    memset( ent, 0, sizeof( keyHandleEntry ) );
+    ent->result = KEY_NOT_READY;
+    khctx->prepared     = ent;
+    khctx->preparedDone = false;
+
+    khctx->preparer = std::thread( [khctx, ent, keyLen, material]()
+                                   {
+                                       entryMake( ent, keyLen, material.c_str() );
+                                       khctx->preparedDone = true;
+                                   } );
+
+    return TF_SUCCESS;
+}
+
+bool TwoFishKeyHandle::IsPrepared()
+{
+    TOKHCTX( khctx );
+
+    if ( khctx == NULL )
+        return false;
+
+    std::lock_guard< std::mutex > guard( khctx->lock );
+
+    if ( ( khctx->prepared == NULL ) || ( khctx->preparedDone == false ) )
+        return false;
+
+    return ( khctx->prepared->result == TF_SUCCESS );
+}
+
+int TwoFishKeyHandle::Rotate()
+{
+    TOKHCTX( khctx );
+
+    if ( khctx == NULL )
+        return BAD_PARAMS;
+
+    std::lock_guard< std::mutex > guard( khctx->lock );
+
+    if ( khctx->prepared == NULL )
+        return KEY_NOT_READY;
+
+    preparedWait( khctx );
+
+    keyHandleEntry* ent = khctx->prepared;
+    khctx->prepared = NULL;
+
+    if ( ent->result != TF_SUCCESS )
+    {
+        int reti = ent->result;
+        entryFree( ent );
+        return reti;
+    }
+
+    ent->version = ++khctx->version;
+
+    // swap, then step epoch : readers of the new epoch see new key.
+    keyHandleEntry* old = khctx->current.exchange( ent );
+    uint64_t        e   = khctx->epoch.fetch_add( 1 );
+
+    if ( old != NULL )
+    {
+        old->retired = e;
+        khctx->retired.push_back( old );
+    }
+
+    retiredFree( khctx );
+
+    return TF_SUCCESS;
+}
+
+int TwoFishKeyHandle::Publish( size_t keyLen, const char* keyMaterial )
+{
+    int reti = Prepare( keyLen, keyMaterial );
+    if ( reti != TF_SUCCESS )
+        return reti;
+
+    return Rotate();
+}
+
+size_t TwoFishKeyHandle::Reclaim()
+{
+    TOKHCTX( khctx );
+
+    if ( khctx == NULL )
+        return 0;
+
+    std::lock_guard< std::mutex > guard( khctx->lock );
+
+    return retiredFree( khctx );
+}
+
+uint64_t TwoFishKeyHandle::GetVersion()
+{
+    TOKHCTX( khctx );
+
+    if ( khctx == NULL )
+        return 0;
+
+    std::lock_guard< std::mutex > guard( khctx->lock );
+
+    return khctx->version;
+}
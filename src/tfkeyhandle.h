@@ -0,0 +1,70 @@
+#ifndef __TFKEYHANDLE_H__
+#define __TFKEYHANDLE_H__
+
+/**
+* libtwofish key handle
+* ========================================================
+* Hot key rotation.  Readers take the current key without locks and
+* keep it until they release it, a rotation publishes the next key with
+* one pointer swap and frees the old one once no reader started before
+* the swap is left (epoch based reclamation).  The next key is expanded
+* on a background thread ahead of the switch.
+*
+* (C)2021, Raphael Kim
+**/
+
+#include <cstdint>
+#include <cstddef>
+
+#include "tfish.h"
+
+#define KEYHANDLE_READERS   256     /* readers holding a key at once */
+
+#define KEY_NOT_READY       -14     /* no key published, or none prepared */
+
+/* What Acquire() gives a reader.  Both keys are fully expanded and must
+   be used read only : enc for DIR_ENCRYPT (and CTR/CFB1 either way), dec
+   for DIR_DECRYPT, so no call reverses subkeys in place.
+*/
+typedef struct
+{
+    keyInstance*    enc;
+    keyInstance*    dec;
+    uint64_t        version;    /* 1 for first key, +1 per rotation */
+    size_t          slot;       /* used by handle */
+} keyReader;
+
+class TwoFishKeyHandle
+{
+    public:
+        TwoFishKeyHandle();
+        /* readers must have released their keys. */
+        ~TwoFishKeyHandle();
+
+    public:
+        /* reader side, lock-free.  TF_SUCCESS or KEY_NOT_READY. */
+        int      Acquire( keyReader* rd );
+        void     Release( keyReader* rd );
+
+    public:
+        /* expand next key in the background, as makeKey() takes it. */
+        int      Prepare( size_t keyLen, const char* keyMaterial );
+        /* true when prepared key is expanded, Rotate() won't wait. */
+        bool     IsPrepared();
+        /* publish prepared key.  Waits for its expansion if still going.
+           TF_SUCCESS, KEY_NOT_READY, or error code of makeKey().
+        */
+        int      Rotate();
+        /* Prepare() and Rotate() at once. */
+        int      Publish( size_t keyLen, const char* keyMaterial );
+        /* free keys no reader can hold any more, returns how many are
+           still waiting.  Rotate() does this too.
+        */
+        size_t   Reclaim();
+        uint64_t GetVersion();
+
+    public:
+        void* context;
+};
+
+#endif /// of __TFKEYHANDLE_H__
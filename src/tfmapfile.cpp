@@ -0,0 +1,344 @@
+/***************************************************************************
+    tfmapfile.cpp
+
+  ------------------------------------------------------------------------
+
+    In-place CTR / XTS over a memory mapped file.
+
+    (C)2021, Raphael Kim
+
+    Notes:
+        *   The file is mapped shared and walked a window at a time :
+            madvise( WILLNEED ) on the next window, the chunks of this one
+            on TwoFishThreadPool, then msync( MS_ASYNC ) so write back
+            starts while the next window is ciphered.  One msync( MS_SYNC )
+            at the end.
+        *   Needs mmap(), not on Windows.
+        *   Tab size is set to 4 characters in this file
+
+***************************************************************************/
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include <atomic>
+#include <thread>
+
+#if !defined(_WIN32)
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+#include "tfish.h"
+#include "tfthreadpool.h"
+#include "tfxts.h"
+#include "tfmapfile.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define MF_ROUND(x,a)   ( ( (x) + (a) - 1 ) / (a) * (a) )
+#define MF_BLOCK        ( BLOCK_SIZE/8 )
+#define MF_MAXCHUNK     ( 64 * 1024 * 1024 )    /* bits of it fit in int */
+
+typedef struct
+{
+    size_t          threads;
+    size_t          chunksz;
+    size_t          syncsz;
+    mapFileStats    stats;
+}libTwoFishMapFileContext;
+
+#define L2FMFCTX        libTwoFishMapFileContext
+#define TOMFCTX(_x_)    L2FMFCTX* _x_ = (L2FMFCTX*)context
+
+// one CryptCTR() / CryptXTS().
+typedef struct
+{
+    uint8_t*            base;
+    uint64_t            ofs;        /* window */
+    uint64_t            len;
+    size_t              chunksz;
+    bool                xts;
+    uint8_t             dir;
+    keyInstance*        key;
+    keyInstance*        tweakKey;
+    cipherInstance      start;      /* CTR */
+    size_t              unit;       /* XTS */
+    uint64_t            firstUnit;
+    std::atomic< int >  error;
+}mapFileJob;
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void mapFileChunk( void* arg, size_t job )
+{
+    mapFileJob* mj  = (mapFileJob*)arg;
+    uint64_t    ofs = mj->ofs + job * mj->chunksz;
+    uint64_t    end = mj->ofs + mj->len;
+    size_t      len = ( end - ofs < mj->chunksz ) ? (size_t)( end - ofs ) : mj->chunksz;
+    uint8_t*    p   = mj->base + ofs;
+    int         reti = TF_SUCCESS;
+
+    if ( mj->xts == false )
+    {
+        cipherInstance ci = mj->start;
+
+        CounterAdd( &ci, ofs / MF_BLOCK );
+        reti = blockEncrypt( &ci, mj->key, p, len * 8, p );
+    }
+    else
+    {
+        // chunks hold whole units, only the last unit of file is short.
+        for ( size_t n=0; ( n<len ) && ( reti >= 0 ); n+=mj->unit )
+        {
+            size_t ulen = ( len - n < mj->unit ) ? len - n : mj->unit;
+            uint64_t unitNo = mj->firstUnit + ( ofs + n ) / mj->unit;
+            uint8_t  tweak[ MF_BLOCK ] = {0};
+
+            for ( size_t cnt=0; cnt<sizeof( unitNo ); cnt++ )
+                tweak[ cnt ] = (uint8_t)( unitNo >> ( cnt * 8 ) );
+
+            reti = xtsCrypt( mj->key, mj->tweakKey, mj->dir, p + n, ulen, tweak );
+        }
+    }
+
+    if ( reti < 0 )
+        mj->error = reti;
+}
+
+#if !defined(_WIN32)
+// page aligned madvise() / msync() over [ofs, ofs+len) of mapping.
+static void* mapFilePage( uint8_t* base, uint64_t ofs, uint64_t* len )
+{
+    static uint64_t page = (uint64_t)sysconf( _SC_PAGESIZE );
+    uint64_t        pofs = ofs / page * page;
+
+    *len += ofs - pofs;
+    return base + pofs;
+}
+#endif
+
+static int mapFileRun( L2FMFCTX* mfctx, const char* path, mapFileJob* mj,
+                       uint64_t* fileLen )
+{
+#if defined(_WIN32)
+    return STREAM_IO_FAIL;
+#else
+    int fd = open( path, O_RDWR );
+    if ( fd < 0 )
+        return STREAM_IO_FAIL;
+
+    struct stat st;
+    if ( fstat( fd, &st ) != 0 )
+    {
+        close( fd );
+        return STREAM_IO_FAIL;
+    }
+
+    uint64_t len = (uint64_t)st.st_size;
+    *fileLen = len;
+
+    // a unit short of a block can't be stolen into, checked before touching.
+    if ( ( mj->xts == true ) && ( len % mj->unit != 0 ) && ( len % mj->unit < MF_BLOCK ) )
+    {
+        close( fd );
+        return BAD_INPUT_LEN;
+    }
+
+    if ( len == 0 )
+    {
+        close( fd );
+        return TF_SUCCESS;
+    }
+
+    void* mem = mmap( NULL, (size_t)len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    if ( mem == MAP_FAILED )
+    {
+        close( fd );
+        return STREAM_IO_FAIL;
+    }
+
+    uint8_t* base   = (uint8_t*)mem;
+    uint64_t window = MF_ROUND( mfctx->syncsz, mj->chunksz );
+
+    madvise( base, (size_t)len, MADV_SEQUENTIAL );
+
+    mj->base  = base;
+    mj->error = TF_SUCCESS;
+
+    for ( uint64_t ofs=0; ( ofs<len ) && ( mj->error == TF_SUCCESS ); ofs+=window )
+    {
+        uint64_t wlen = ( len - ofs < window ) ? len - ofs : window;
+        uint64_t nofs = ofs + wlen;
+
+        // next window comes in while this one is ciphered.
+        if ( nofs < len )
+        {
+            uint64_t nlen = ( len - nofs < window ) ? len - nofs : window;
+            void*    np   = mapFilePage( base, nofs, &nlen );
+            madvise( np, (size_t)nlen, MADV_WILLNEED );
+        }
+
+        mj->ofs = ofs;
+        mj->len = wlen;
+
+        size_t jobs = (size_t)( ( wlen + mj->chunksz - 1 ) / mj->chunksz );
+
+        TwoFishThreadPool::Shared().Run( jobs, mfctx->threads, mapFileChunk, mj );
+
+        uint64_t slen = wlen;
+        void*    sp   = mapFilePage( base, ofs, &slen );
+        msync( sp, (size_t)slen, MS_ASYNC );
+
+        mfctx->stats.bytes   += wlen;
+        mfctx->stats.chunks  += jobs;
+        mfctx->stats.windows++;
+    }
+
+    int reti = mj->error;
+
+    if ( ( msync( base, (size_t)len, MS_SYNC ) != 0 ) && ( reti == TF_SUCCESS ) )
+        reti = STREAM_IO_FAIL;
+
+    munmap( mem, (size_t)len );
+
+    if ( ( close( fd ) != 0 ) && ( reti == TF_SUCCESS ) )
+        reti = STREAM_IO_FAIL;
+
+    return reti;
+#endif /// of _WIN32
+}
+
+// shared by chunk jobs : S-boxes and subkey order must be final.
+static void mapFileKey( keyInstance* key, uint8_t dir )
+{
+    expandKey( key );
+    if ( key->direction != dir )
+        ReverseRoundSubkeys( key, dir );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+TwoFishMapFile::TwoFishMapFile( size_t threadCnt, size_t chunkSize, size_t syncBytes )
+ : context( NULL )
+{
+    L2FMFCTX* mfctx = new L2FMFCTX;
+    if ( mfctx == NULL )
+        return;
+
+    if ( threadCnt == 0 )
+        threadCnt = std::thread::hardware_concurrency();
+    if ( chunkSize == 0 )
+        chunkSize = MAPFILE_CHUNK;
+    if ( chunkSize > MF_MAXCHUNK )
+        chunkSize = MF_MAXCHUNK;
+    if ( syncBytes == 0 )
+        syncBytes = MAPFILE_WINDOW;
+
+    mfctx->threads = ( threadCnt > 0 ) ? threadCnt : 1;
+    mfctx->chunksz = MF_ROUND( chunkSize, MF_BLOCK );
+    mfctx->syncsz  = syncBytes;
+
+    memset( &mfctx->stats, 0, sizeof( mapFileStats ) );
+
+    context = (void*)mfctx;
+}
+
+TwoFishMapFile::~TwoFishMapFile()
+{
+    TOMFCTX( mfctx );
+
+    if ( mfctx == NULL )
+        return;
+
+    context = NULL;
+    delete mfctx;
+}
+
+int TwoFishMapFile::CryptCTR( const char* path, keyInstance* key, cipherInstance* cipher )
+{
+    TOMFCTX( mfctx );
+
+    if ( ( mfctx == NULL ) || ( path == NULL ) || ( key == NULL ) || ( cipher == NULL ) )
+        return BAD_PARAMS;
+
+    if ( key->keySig != VALID_SIG )
+        return BAD_KEY_INSTANCE;
+
+    if ( cipher->mode != MODE_CTR )
+        return BAD_CIPHER_MODE;
+
+    memset( &mfctx->stats, 0, sizeof( mapFileStats ) );
+    mapFileKey( key, DIR_ENCRYPT );
+
+    mapFileJob mj;
+    uint64_t   len = 0;
+
+    mj.xts      = false;
+    mj.dir      = DIR_ENCRYPT;
+    mj.key      = key;
+    mj.tweakKey = NULL;
+    mj.start    = *cipher;
+    mj.chunksz  = mfctx->chunksz;
+
+    int reti = mapFileRun( mfctx, path, &mj, &len );
+
+    if ( reti == TF_SUCCESS )
+        CounterAdd( cipher, ( len + MF_BLOCK - 1 ) / MF_BLOCK );
+
+    return reti;
+}
+
+int TwoFishMapFile::CryptXTS( const char* path, uint8_t dir, keyInstance* dataKey,
+                              keyInstance* tweakKey, size_t unitSize,
+                              uint64_t firstUnit )
+{
+    TOMFCTX( mfctx );
+
+    if ( ( mfctx == NULL ) || ( path == NULL ) || ( dataKey == NULL ) ||
+         ( tweakKey == NULL ) || ( dataKey == tweakKey ) )
+        return BAD_PARAMS;
+
+    if ( ( dataKey->keySig != VALID_SIG ) || ( tweakKey->keySig != VALID_SIG ) )
+        return BAD_KEY_INSTANCE;
+
+    if ( ( dir != DIR_ENCRYPT ) && ( dir != DIR_DECRYPT ) )
+        return BAD_KEY_DIR;
+
+    if ( ( unitSize < MF_BLOCK ) || ( unitSize % MF_BLOCK != 0 ) ||
+         ( unitSize > MF_MAXCHUNK ) )
+        return BAD_PARAMS;
+
+    memset( &mfctx->stats, 0, sizeof( mapFileStats ) );
+    mapFileKey( dataKey, dir );
+    mapFileKey( tweakKey, DIR_ENCRYPT );
+
+    mapFileJob mj;
+    uint64_t   len = 0;
+
+    mj.xts       = true;
+    mj.dir       = dir;
+    mj.key       = dataKey;
+    mj.tweakKey  = tweakKey;
+    mj.unit      = unitSize;
+    mj.firstUnit = firstUnit;
+    mj.chunksz   = MF_ROUND( mfctx->chunksz, unitSize );
+    if ( mj.chunksz > MF_MAXCHUNK )
+        mj.chunksz = unitSize;
+
+    return mapFileRun( mfctx, path, &mj, &len );
+}
+
+void TwoFishMapFile::GetStats( mapFileStats* stats )
+{
+    TOMFCTX( mfctx );
+
+    if ( ( mfctx == NULL ) || ( stats == NULL ) )
+        return;
+
+    *stats = mfctx->stats;
+}
@@ -0,0 +1,806 @@
+/***************************************************************************
+    tfpagecache.cpp
+
+  ------------------------------------------------------------------------
+
+    Encrypted page cache : XTS pages on disk, LRU of plain pages.
+
+    (C)2021, Raphael Kim
+
+    Notes:
+        *   Frames of the cache are a doubly linked LRU list by index,
+            most recent at head.  A frame needed while the cache is full
+            comes from the tail ; a dirty tail first writes back a batch
+            of the dirty pages nearest the tail, not only itself.
+        *   Write back ciphers into a staging buffer, the cached page stays
+            plain and hot.  Pages of a batch are sorted, runs of pages
+            next to each other go in one pwrite().  A page's version goes
+            up as it is encrypted : a write back that failed and is tried
+            again never uses an XTS tweak twice.
+        *   A page overwritten whole while not cached is not read, only
+            its version, for the next one.
+        *   Cipher keys are the object's own copies, one data key turned
+            each way, so misses and write backs don't turn keys of jobs.
+        *   Needs POSIX file calls, not on Windows.
+        *   Tab size is set to 4 characters in this file
+
+***************************************************************************/
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <unordered_map>
+
+#if !defined(_WIN32)
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <sys/stat.h>
+#endif
+
+#include "tfish.h"
+#include "tfthreadpool.h"
+#include "tfxts.h"
+#include "tfpagecache.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define PC_ALIGN        4096
+#define PC_ROUND(x,a)   ( ( (x) + (a) - 1 ) / (a) * (a) )
+#define PC_NIL          SIZE_MAX
+
+typedef struct
+{
+    uint64_t    pageNo;
+    uint64_t    version;    /* on disk */
+    bool        used;
+    bool        dirty;
+    size_t      prev;       /* toward head, most recent */
+    size_t      next;
+}pageFrame;
+
+typedef struct
+{
+    size_t                          pagesz;
+    size_t                          capacity;
+    size_t                          threads;
+    std::mutex                      lock;
+    int                             fd;
+    keyInstance                     encKey;
+    keyInstance                     decKey;
+    keyInstance                     tweakKey;
+    uint8_t*                        mem;
+    uint8_t*                        pages;      /* frame n at n x pagesz */
+    std::vector< pageFrame >        frames;
+    std::unordered_map< uint64_t, size_t > map;
+    std::vector< size_t >           freeFrames;
+    size_t                          head;
+    size_t                          tail;
+    uint64_t                        pageCount;
+    std::vector< uint8_t >          stage;      /* slots of one batch */
+    pageCacheStats                  stats;
+}libTwoFishPageCacheContext;
+
+#define L2FPCCTX        libTwoFishPageCacheContext
+#define TOPCCTX(_x_)    L2FPCCTX* _x_ = (L2FPCCTX*)context
+
+// one pool run : frame n of job n, slot n of stage.
+typedef struct
+{
+    L2FPCCTX*               pcctx;
+    const size_t*           frame;
+    std::atomic< int >      error;
+}pageJob;
+
+////////////////////////////////////////////////////////////////////////////////
+
+#if !defined(_WIN32)
+static size_t pcSlot( L2FPCCTX* pcctx )
+{
+    return PAGECACHE_HDRSZ + pcctx->pagesz;
+}
+
+static uint8_t* pcPage( L2FPCCTX* pcctx, size_t f )
+{
+    return pcctx->pages + f * pcctx->pagesz;
+}
+
+static void pcTweak( uint8_t* t, uint64_t pageNo, uint64_t version )
+{
+    for ( size_t cnt=0; cnt<8; cnt++ )
+    {
+        t[ cnt ]     = (uint8_t)( pageNo >> ( cnt * 8 ) );
+        t[ cnt + 8 ] = (uint8_t)( version >> ( cnt * 8 ) );
+    }
+}
+
+static void pcUnlink( L2FPCCTX* pcctx, size_t f )
+{
+    pageFrame* pf = &pcctx->frames[f];
+
+    if ( pf->prev != PC_NIL )
+        pcctx->frames[ pf->prev ].next = pf->next;
+    else
+        pcctx->head = pf->next;
+
+    if ( pf->next != PC_NIL )
+        pcctx->frames[ pf->next ].prev = pf->prev;
+    else
+        pcctx->tail = pf->prev;
+
+    pf->prev = PC_NIL;
+    pf->next = PC_NIL;
+}
+
+static void pcPushHead( L2FPCCTX* pcctx, size_t f )
+{
+    pageFrame* pf = &pcctx->frames[f];
+
+    pf->prev = PC_NIL;
+    pf->next = pcctx->head;
+
+    if ( pcctx->head != PC_NIL )
+        pcctx->frames[ pcctx->head ].prev = f;
+    else
+        pcctx->tail = f;
+
+    pcctx->head = f;
+}
+
+static bool pcWriteAt( int fd, const uint8_t* p, size_t len, uint64_t ofs )
+{
+    while ( len > 0 )
+    {
+        ssize_t r = pwrite( fd, p, len, (off_t)ofs );
+        if ( r <= 0 )
+            return false;
+
+        p   += r;
+        len -= (size_t)r;
+        ofs += (uint64_t)r;
+    }
+
+    return true;
+}
+
+// reads what's there, rest of p zeros : past the end is never written.
+static bool pcReadAt( int fd, uint8_t* p, size_t len, uint64_t ofs )
+{
+    while ( len > 0 )
+    {
+        ssize_t r = pread( fd, p, len, (off_t)ofs );
+        if ( r < 0 )
+            return false;
+        if ( r == 0 )
+        {
+            memset( p, 0, len );
+            break;
+        }
+
+        p   += r;
+        len -= (size_t)r;
+        ofs += (uint64_t)r;
+    }
+
+    return true;
+}
+
+static uint64_t pcVersion( const uint8_t* slot )
+{
+    uint64_t v = 0;
+
+    for ( size_t cnt=8; cnt-->0; )
+        v = ( v << 8 ) | slot[ cnt ];
+
+    return v;
+}
+
+static void pcEncryptJob( void* arg, size_t job )
+{
+    pageJob*   pj    = (pageJob*)arg;
+    L2FPCCTX*  pcctx = pj->pcctx;
+    pageFrame* pf    = &pcctx->frames[ pj->frame[ job ] ];
+    uint8_t*   slot  = pcctx->stage.data() + job * pcSlot( pcctx );
+    uint64_t   ver   = ++pf->version;   /* even if the write fails */
+    uint8_t    t[ PAGECACHE_HDRSZ ];
+
+    memset( slot, 0, PAGECACHE_HDRSZ );
+    for ( size_t cnt=0; cnt<8; cnt++ )
+        slot[ cnt ] = (uint8_t)( ver >> ( cnt * 8 ) );
+
+    memcpy( slot + PAGECACHE_HDRSZ, pcPage( pcctx, pj->frame[ job ] ), pcctx->pagesz );
+    pcTweak( t, pf->pageNo, ver );
+
+    int reti = xtsCrypt( &pcctx->encKey, &pcctx->tweakKey, DIR_ENCRYPT,
+                         slot + PAGECACHE_HDRSZ, pcctx->pagesz, t );
+    if ( reti < 0 )
+        pj->error = reti;
+}
+
+static void pcDecryptJob( void* arg, size_t job )
+{
+    pageJob*   pj    = (pageJob*)arg;
+    L2FPCCTX*  pcctx = pj->pcctx;
+    pageFrame* pf    = &pcctx->frames[ pj->frame[ job ] ];
+    uint8_t*   slot  = pcctx->stage.data() + job * pcSlot( pcctx );
+    uint8_t*   page  = pcPage( pcctx, pj->frame[ job ] );
+    uint8_t    t[ PAGECACHE_HDRSZ ];
+
+    pf->version = pcVersion( slot );
+
+    if ( pf->version == 0 )
+    {
+        memset( page, 0, pcctx->pagesz );
+        return;
+    }
+
+    memcpy( page, slot + PAGECACHE_HDRSZ, pcctx->pagesz );
+    pcTweak( t, pf->pageNo, pf->version );
+
+    int reti = xtsCrypt( &pcctx->decKey, &pcctx->tweakKey, DIR_DECRYPT,
+                         page, pcctx->pagesz, t );
+    if ( reti < 0 )
+        pj->error = reti;
+}
+
+static bool pcByPage( L2FPCCTX* pcctx, size_t a, size_t b )
+{
+    return pcctx->frames[a].pageNo < pcctx->frames[b].pageNo;
+}
+
+// dirty frames of fr, at most PAGECACHE_BATCH, encrypted and written.
+static int pcWriteBack( L2FPCCTX* pcctx, std::vector< size_t >& fr )
+{
+    if ( fr.empty() == true )
+        return TF_SUCCESS;
+
+    std::sort( fr.begin(), fr.end(),
+               [pcctx]( size_t a, size_t b ) { return pcByPage( pcctx, a, b ); } );
+
+    size_t  slot = pcSlot( pcctx );
+    pageJob pj;
+
+    pj.pcctx = pcctx;
+    pj.frame = fr.data();
+    pj.error = TF_SUCCESS;
+
+    TwoFishThreadPool::Shared().Run( fr.size(), pcctx->threads, pcEncryptJob, &pj );
+
+    if ( pj.error != TF_SUCCESS )
+        return pj.error;
+
+    pcctx->stats.batches++;
+
+    // runs of pages next to each other, one write each.
+    for ( size_t n=0; n<fr.size(); )
+    {
+        size_t m = n + 1;
+
+        while ( ( m < fr.size() ) &&
+                ( pcctx->frames[ fr[m] ].pageNo == pcctx->frames[ fr[m-1] ].pageNo + 1 ) )
+            m++;
+
+        uint64_t pageNo = pcctx->frames[ fr[n] ].pageNo;
+
+        if ( pcWriteAt( pcctx->fd, pcctx->stage.data() + n * slot, ( m - n ) * slot,
+                        pageNo * slot ) == false )
+            return STREAM_IO_FAIL;
+
+        pcctx->stats.writes++;
+        n = m;
+    }
+
+    for ( size_t n=0; n<fr.size(); n++ )
+    {
+        pageFrame* pf = &pcctx->frames[ fr[n] ];
+
+        pf->dirty = false;
+
+        if ( pf->pageNo >= pcctx->pageCount )
+            pcctx->pageCount = pf->pageNo + 1;
+    }
+
+    pcctx->stats.writebacks += fr.size();
+
+    return TF_SUCCESS;
+}
+
+// a frame off the LRU list and out of the map, written back if dirty.
+static int pcFreeFrame( L2FPCCTX* pcctx, size_t* f )
+{
+    if ( pcctx->freeFrames.empty() == false )
+    {
+        *f = pcctx->freeFrames.back();
+        pcctx->freeFrames.pop_back();
+        return TF_SUCCESS;
+    }
+
+    size_t victim = pcctx->tail;
+
+    if ( pcctx->frames[ victim ].dirty == true )
+    {
+        std::vector< size_t > fr;
+
+        for ( size_t n=victim; ( n != PC_NIL ) && ( fr.size() < PAGECACHE_BATCH );
+              n=pcctx->frames[n].prev )
+            if ( pcctx->frames[n].dirty == true )
+                fr.push_back( n );
+
+        int reti = pcWriteBack( pcctx, fr );
+        if ( reti != TF_SUCCESS )
+            return reti;
+    }
+
+    pcUnlink( pcctx, victim );
+    pcctx->map.erase( pcctx->frames[ victim ].pageNo );
+    pcctx->frames[ victim ].used = false;
+    pcctx->stats.evictions++;
+
+    *f = victim;
+
+    return TF_SUCCESS;
+}
+
+// frame for pageNo, newest in the LRU list ; *found false : not loaded.
+static int pcFrame( L2FPCCTX* pcctx, uint64_t pageNo, size_t* f, bool* found )
+{
+    std::unordered_map< uint64_t, size_t >::iterator it = pcctx->map.find( pageNo );
+
+    if ( it != pcctx->map.end() )
+    {
+        *f     = it->second;
+        *found = true;
+        pcUnlink( pcctx, *f );
+        pcPushHead( pcctx, *f );
+        pcctx->stats.hits++;
+        return TF_SUCCESS;
+    }
+
+    int reti = pcFreeFrame( pcctx, f );
+    if ( reti != TF_SUCCESS )
+        return reti;
+
+    pageFrame* pf = &pcctx->frames[ *f ];
+
+    pf->pageNo  = pageNo;
+    pf->version = 0;
+    pf->used    = true;
+    pf->dirty   = false;
+
+    pcctx->map[ pageNo ] = *f;
+    pcPushHead( pcctx, *f );
+    *found = false;
+
+    return TF_SUCCESS;
+}
+
+// frames fr, of pages first .. first + cnt - 1, read and decrypted.
+static int pcLoad( L2FPCCTX* pcctx, uint64_t first, size_t cnt, const size_t* fr )
+{
+    size_t slot = pcSlot( pcctx );
+
+    if ( pcReadAt( pcctx->fd, pcctx->stage.data(), cnt * slot, first * slot ) == false )
+        return STREAM_IO_FAIL;
+
+    pageJob pj;
+
+    pj.pcctx = pcctx;
+    pj.frame = fr;
+    pj.error = TF_SUCCESS;
+
+    TwoFishThreadPool::Shared().Run( cnt, pcctx->threads, pcDecryptJob, &pj );
+
+    pcctx->stats.misses += cnt;
+
+    return pj.error;
+}
+
+// frames of a failed load are given back.
+static void pcDrop( L2FPCCTX* pcctx, const size_t* fr, size_t cnt )
+{
+    for ( size_t n=0; n<cnt; n++ )
+    {
+        pcUnlink( pcctx, fr[n] );
+        pcctx->map.erase( pcctx->frames[ fr[n] ].pageNo );
+        pcctx->frames[ fr[n] ].used = false;
+        pcctx->freeFrames.push_back( fr[n] );
+    }
+}
+
+static int pcFlush( L2FPCCTX* pcctx )
+{
+    std::vector< size_t > fr;
+
+    for ( size_t n=pcctx->tail; n != PC_NIL; n=pcctx->frames[n].prev )
+    {
+        if ( pcctx->frames[n].dirty == false )
+            continue;
+
+        fr.push_back( n );
+
+        if ( fr.size() == PAGECACHE_BATCH )
+        {
+            int reti = pcWriteBack( pcctx, fr );
+            if ( reti != TF_SUCCESS )
+                return reti;
+            fr.clear();
+        }
+    }
+
+    return pcWriteBack( pcctx, fr );
+}
+#endif /// of !_WIN32
+
+////////////////////////////////////////////////////////////////////////////////
+
+TwoFishPageCache::TwoFishPageCache( size_t pageSize, size_t cachePages, size_t threadCnt )
+ : context( NULL )
+{
+    L2FPCCTX* pcctx = new L2FPCCTX;
+    if ( pcctx == NULL )
+        return;
+
+    if ( threadCnt == 0 )
+        threadCnt = std::thread::hardware_concurrency();
+    if ( cachePages < 2 )
+        cachePages = 2;
+
+    pcctx->pagesz    = pageSize;
+    pcctx->capacity  = cachePages;
+    pcctx->threads   = ( threadCnt > 0 ) ? threadCnt : 1;
+    pcctx->fd        = -1;
+    pcctx->head      = PC_NIL;
+    pcctx->tail      = PC_NIL;
+    pcctx->pageCount = 0;
+    pcctx->mem       = NULL;
+    pcctx->pages     = NULL;
+    memset( &pcctx->stats, 0, sizeof( pageCacheStats ) );
+
+    context = (void*)pcctx;
+}
+
+TwoFishPageCache::~TwoFishPageCache()
+{
+    TOPCCTX( pcctx );
+
+    if ( pcctx == NULL )
+        return;
+
+    Close();
+
+    context = NULL;
+    delete pcctx;
+}
+
+int TwoFishPageCache::Open( const char* path, keyInstance* dataKey, keyInstance* tweakKey )
+{
+    TOPCCTX( pcctx );
+
+    if ( ( pcctx == NULL ) || ( path == NULL ) ||
+         ( dataKey == NULL ) || ( tweakKey == NULL ) || ( dataKey == tweakKey ) )
+        return BAD_PARAMS;
+
+    if ( ( dataKey->keySig != VALID_SIG ) || ( tweakKey->keySig != VALID_SIG ) )
+        return BAD_KEY_INSTANCE;
+
+    if ( ( pcctx->pagesz != 4096 ) && ( pcctx->pagesz != 8192 ) &&
+         ( pcctx->pagesz != 16384 ) )
+        return BAD_PARAMS;
+
+#if defined(_WIN32)
+    return STREAM_IO_FAIL;
+#else
+    Close();
+
+    std::lock_guard< std::mutex > guard( pcctx->lock );
+
+    pcctx->fd = open( path, O_RDWR | O_CREAT, 0600 );
+    if ( pcctx->fd < 0 )
+        return STREAM_IO_FAIL;
+
+    struct stat sb;
+    if ( fstat( pcctx->fd, &sb ) != 0 )
+    {
+        close( pcctx->fd );
+        pcctx->fd = -1;
+        return STREAM_IO_FAIL;
+    }
+
+    pcctx->pageCount = (uint64_t)sb.st_size / pcSlot( pcctx );
+
+    pcctx->encKey   = *dataKey;
+    pcctx->tweakKey = *tweakKey;
+
+    expandKey( &pcctx->encKey );
+    expandKey( &pcctx->tweakKey );
+    if ( pcctx->encKey.direction != DIR_ENCRYPT )
+        ReverseRoundSubkeys( &pcctx->encKey, DIR_ENCRYPT );
+    if ( pcctx->tweakKey.direction != DIR_ENCRYPT )
+        ReverseRoundSubkeys( &pcctx->tweakKey, DIR_ENCRYPT );
+
+    pcctx->decKey = pcctx->encKey;
+    ReverseRoundSubkeys( &pcctx->decKey, DIR_DECRYPT );
+
+    size_t memsz = pcctx->capacity * pcctx->pagesz;
+
+    pcctx->mem = (uint8_t*)malloc( memsz + PC_ALIGN );
+    if ( pcctx->mem == NULL )
+    {
+        close( pcctx->fd );
+        pcctx->fd = -1;
+        return BAD_PARAMS;
+    }
+
+    pcctx->pages = (uint8_t*)PC_ROUND( (uintptr_t)pcctx->mem, PC_ALIGN );
+    pcctx->frames.assign( pcctx->capacity, pageFrame() );
+    pcctx->stage.resize( PAGECACHE_BATCH * pcSlot( pcctx ) );
+    pcctx->map.clear();
+    pcctx->freeFrames.clear();
+    pcctx->head = PC_NIL;
+    pcctx->tail = PC_NIL;
+
+    for ( size_t n=pcctx->capacity; n-->0; )
+    {
+        pcctx->frames[n].used = false;
+        pcctx->frames[n].prev = PC_NIL;
+        pcctx->frames[n].next = PC_NIL;
+        pcctx->freeFrames.push_back( n );
+    }
+
+    memset( &pcctx->stats, 0, sizeof( pageCacheStats ) );
+
+    return TF_SUCCESS;
+#endif /// of _WIN32
+}
+
+int TwoFishPageCache::Close()
+{
+    TOPCCTX( pcctx );
+
+    if ( pcctx == NULL )
+        return BAD_PARAMS;
+
+#if defined(_WIN32)
+    return TF_SUCCESS;
+#else
+    std::lock_guard< std::mutex > guard( pcctx->lock );
+
+    if ( pcctx->fd < 0 )
+        return TF_SUCCESS;
+
+    int reti = pcFlush( pcctx );
+
+    close( pcctx->fd );
+    pcctx->fd = -1;
+
+    // plain pages and keys.
+    if ( pcctx->mem != NULL )
+    {
+        memset( pcctx->pages, 0, pcctx->capacity * pcctx->pagesz );
+        free( pcctx->mem );
+    }
+    memset( pcctx->stage.data(), 0, pcctx->stage.size() );
+    memset( &pcctx->encKey, 0, sizeof( keyInstance ) );
+    memset( &pcctx->decKey, 0, sizeof( keyInstance ) );
+    memset( &pcctx->tweakKey, 0, sizeof( keyInstance ) );
+
+    pcctx->mem   = NULL;
+    pcctx->pages = NULL;
+    pcctx->map.clear();
+    pcctx->frames.clear();
+    pcctx->freeFrames.clear();
+
+    return reti;
+#endif /// of _WIN32
+}
+
+int TwoFishPageCache::Read( uint64_t pageNo, uint8_t* out )
+{
+    TOPCCTX( pcctx );
+
+    if ( ( pcctx == NULL ) || ( out == NULL ) )
+        return BAD_PARAMS;
+
+#if defined(_WIN32)
+    return STREAM_IO_FAIL;
+#else
+    std::lock_guard< std::mutex > guard( pcctx->lock );
+
+    if ( pcctx->fd < 0 )
+        return BAD_PARAMS;
+
+    size_t f;
+    bool   found;
+
+    int reti = pcFrame( pcctx, pageNo, &f, &found );
+    if ( reti != TF_SUCCESS )
+        return reti;
+
+    if ( found == false )
+    {
+        reti = pcLoad( pcctx, pageNo, 1, &f );
+        if ( reti != TF_SUCCESS )
+        {
+            pcDrop( pcctx, &f, 1 );
+            return reti;
+        }
+    }
+
+    memcpy( out, pcPage( pcctx, f ), pcctx->pagesz );
+
+    return TF_SUCCESS;
+#endif /// of _WIN32
+}
+
+int TwoFishPageCache::Write( uint64_t pageNo, const uint8_t* in )
+{
+    TOPCCTX( pcctx );
+
+    if ( ( pcctx == NULL ) || ( in == NULL ) )
+        return BAD_PARAMS;
+
+#if defined(_WIN32)
+    return STREAM_IO_FAIL;
+#else
+    std::lock_guard< std::mutex > guard( pcctx->lock );
+
+    if ( pcctx->fd < 0 )
+        return BAD_PARAMS;
+
+    size_t f;
+    bool   found;
+
+    int reti = pcFrame( pcctx, pageNo, &f, &found );
+    if ( reti != TF_SUCCESS )
+        return reti;
+
+    if ( found == false )
+    {
+        uint8_t hdr[ PAGECACHE_HDRSZ ];
+
+        if ( pcReadAt( pcctx->fd, hdr, PAGECACHE_HDRSZ, pageNo * pcSlot( pcctx ) ) == false )
+        {
+            pcDrop( pcctx, &f, 1 );
+            return STREAM_IO_FAIL;
+        }
+
+        pcctx->frames[f].version = pcVersion( hdr );
+    }
+
+    memcpy( pcPage( pcctx, f ), in, pcctx->pagesz );
+    pcctx->frames[f].dirty = true;
+
+    return TF_SUCCESS;
+#endif /// of _WIN32
+}
+
+int TwoFishPageCache::Prefetch( uint64_t first, size_t cnt )
+{
+    TOPCCTX( pcctx );
+
+    if ( pcctx == NULL )
+        return BAD_PARAMS;
+
+#if defined(_WIN32)
+    return STREAM_IO_FAIL;
+#else
+    std::lock_guard< std::mutex > guard( pcctx->lock );
+
+    if ( pcctx->fd < 0 )
+        return BAD_PARAMS;
+
+    if ( cnt > pcctx->capacity / 2 )
+        cnt = pcctx->capacity / 2;
+
+    std::vector< size_t > fr;
+
+    // runs of pages not cached, a batch at most each.
+    for ( uint64_t n=first; n<first+cnt; )
+    {
+        if ( pcctx->map.find( n ) != pcctx->map.end() )
+        {
+            n++;
+            continue;
+        }
+
+        uint64_t m = n;
+        fr.clear();
+
+        while ( ( m < first + cnt ) && ( fr.size() < PAGECACHE_BATCH ) &&
+                ( pcctx->map.find( m ) == pcctx->map.end() ) )
+        {
+            size_t f;
+            bool   found;
+
+            int reti = pcFrame( pcctx, m, &f, &found );
+            if ( reti != TF_SUCCESS )
+            {
+                pcDrop( pcctx, fr.data(), fr.size() );
+                return reti;
+            }
+
+            fr.push_back( f );
+            m++;
+        }
+
+        int reti = pcLoad( pcctx, n, fr.size(), fr.data() );
+        if ( reti != TF_SUCCESS )
+        {
+            pcDrop( pcctx, fr.data(), fr.size() );
+            return reti;
+        }
+
+        n = m;
+    }
+
+    return TF_SUCCESS;
+#endif /// of _WIN32
+}
+
+int TwoFishPageCache::Flush( bool durable )
+{
+    TOPCCTX( pcctx );
+
+    if ( pcctx == NULL )
+        return BAD_PARAMS;
+
+#if defined(_WIN32)
+    return STREAM_IO_FAIL;
+#else
+    std::lock_guard< std::mutex > guard( pcctx->lock );
+
+    if ( pcctx->fd < 0 )
+        return BAD_PARAMS;
+
+    int reti = pcFlush( pcctx );
+
+    if ( ( reti == TF_SUCCESS ) && ( durable == true ) && ( fdatasync( pcctx->fd ) != 0 ) )
+        reti = STREAM_IO_FAIL;
+
+    return reti;
+#endif /// of _WIN32
+}
+
+uint64_t TwoFishPageCache::GetPageCount()
+{
+    TOPCCTX( pcctx );
+
+    if ( pcctx == NULL )
+        return 0;
+
+    std::lock_guard< std::mutex > guard( pcctx->lock );
+
+    uint64_t cnt = pcctx->pageCount;
+
+    // dirty pages past the end are pages of the file too.
+    for ( size_t n=pcctx->head; n != PC_NIL; n=pcctx->frames[n].next )
+        if ( ( pcctx->frames[n].dirty == true ) && ( pcctx->frames[n].pageNo >= cnt ) )
+            cnt = pcctx->frames[n].pageNo + 1;
+
+    return cnt;
+}
+
+size_t TwoFishPageCache::GetPageSize()
+{
+    TOPCCTX( pcctx );
+
+    return ( pcctx != NULL ) ? pcctx->pagesz : 0;
+}
+
+void TwoFishPageCache::GetStats( pageCacheStats* stats )
+{
+    TOPCCTX( pcctx );
+
+    if ( ( pcctx == NULL ) || ( stats == NULL ) )
+        return;
+
+    std::lock_guard< std::mutex > guard( pcctx->lock );
+
+    *stats = pcctx->stats;
+}
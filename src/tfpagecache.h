@@ -0,0 +1,79 @@
+#ifndef __TFPAGECACHE_H__
+#define __TFPAGECACHE_H__
+
+/**
+* libtwofish encrypted page cache
+* ========================================================
+* Fixed size pages of a file kept encrypted on disk and plain in an LRU
+* cache, for a database storage engine or a VFS shim.  Pages are XTS
+* ciphered under a tweak of page number and version : every write back
+* of a page takes a new version, so old and new cipher text of a page
+* don't compare.  Dirty pages are written back in batches, ciphered in
+* parallel on the library thread pool, contiguous pages in one write.
+*
+* On disk page n is a slot at n x ( PAGECACHE_HDRSZ + pageSize ) : the
+* version, then the cipher text.  Version 0 is a page never written,
+* read as zeros.
+*
+* (C)2021, Raphael Kim
+**/
+
+#include <cstdint>
+#include <cstddef>
+
+#include "tfish.h"
+#include "tfstream.h"
+
+#define PAGECACHE_PAGES     1024    /* default cachePages */
+#define PAGECACHE_HDRSZ     16      /* slot header : version */
+#define PAGECACHE_BATCH     64      /* pages written back per pool run */
+
+typedef struct
+{
+    uint64_t hits;
+    uint64_t misses;        /* pages read and decrypted */
+    uint64_t evictions;
+    uint64_t writebacks;    /* pages encrypted and written */
+    uint64_t batches;       /* write back pool runs */
+    uint64_t writes;        /* pwrite() calls */
+} pageCacheStats;
+
+class TwoFishPageCache
+{
+    public:
+        /* pageSize 4096, 8192 or 16384.  threadCnt 0 : a thread per CPU. */
+        TwoFishPageCache( size_t pageSize = 4096,
+                          size_t cachePages = PAGECACHE_PAGES,
+                          size_t threadCnt = 0 );
+        ~TwoFishPageCache();
+
+    public:
+        /* creates path or opens it.  Keys are copied, so the caller's
+           stay as they were ; tweakKey must be another key.
+        */
+        int  Open( const char* path, keyInstance* dataKey, keyInstance* tweakKey );
+        /* writes back dirty pages, and closes. */
+        int  Close();
+
+    public:
+        /* pageSize bytes of page to out, zeros for a page never written. */
+        int  Read( uint64_t pageNo, uint8_t* out );
+        /* page replaced, on disk at the latest by Flush() or Close(). */
+        int  Write( uint64_t pageNo, const uint8_t* in );
+        /* pages first .. first + cnt - 1 read into cache : one read per
+           run of missing pages, decrypted in parallel.  cnt is cut to
+           half the cache.
+        */
+        int  Prefetch( uint64_t first, size_t cnt );
+        /* dirty pages written back, fdatasync() too if durable. */
+        int  Flush( bool durable = false );
+        /* pages in file, or written since. */
+        uint64_t GetPageCount();
+        size_t   GetPageSize();
+        void     GetStats( pageCacheStats* stats );
+
+    public:
+        void* context;
+};
+
+#endif /// of __TFPAGECACHE_H__
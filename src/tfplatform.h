@@ -83,6 +83,20 @@
 /* Do alignment for 4bytes, modern C++ compilers may 4 bytes alignment */
 #define     ALIGN32             1
 
+/* x86 vector kernels are built with per-function target attributes and
+   picked at run time, so the library itself needs no -mavx2 switch and
+   stays buildable as an universal binary. */
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+    #define X86_SIMD            1
+    #define TARGET_AVX2         __attribute__((target("avx2")))
+    #define TARGET_VBMI         __attribute__((target("avx2,avx512f,avx512bw,avx512vbmi,gfni")))
+#else
+    #define X86_SIMD            0
+    #define TARGET_AVX2
+    #define TARGET_VBMI
+#endif
+
 #if LittleEndian
     /* NOP for little-endian machines */
     #define     Bswap(x)        (x)
@@ -0,0 +1,553 @@
+/***************************************************************************
+    tfstream.cpp
+
+  ------------------------------------------------------------------------
+
+    Read / cipher / write pipeline over a ring of buffers.
+
+    (C)2021, Raphael Kim
+
+    Notes:
+        *   Three stages walk the ring in order, each a count of buffers
+            it's done with : the reader may run up to bufferCnt buffers
+            ahead of the writer, the cipher only behind the reader and the
+            writer only behind the cipher.  One mutex and condition
+            variable for all, taken once per buffer, not per byte.
+        *   Reader and writer are threads of a Run(), the cipher is the
+            calling thread, so cipher state needs no locking.
+        *   A buffer shorter than bufferSize ends the stream, an empty one
+            too when the input ended right on a buffer.
+        *   Tab size is set to 4 characters in this file
+
+***************************************************************************/
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include "tfish.h"
+#include "tfthreadpool.h"
+#include "tfstream.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define ST_ROUND(_x_,_a_)   ( ( (_x_) + (_a_) - 1 ) / (_a_) * (_a_) )
+#define ST_PART             ( 64 * 1024 )   /* bytes per parallel job */
+
+typedef struct
+{
+    uint8_t*    data;
+    size_t      len;
+    bool        last;
+}streamBuffer;
+
+typedef struct
+{
+    uint8_t*                    mem;
+    size_t                      memsz;
+    size_t                      bufsz;
+    std::vector< streamBuffer > bufs;
+    /* one Run() */
+    std::mutex                  lock;
+    std::condition_variable     wake;
+    uint64_t                    filled;
+    uint64_t                    ciphered;
+    uint64_t                    written;
+    int                         error;
+    streamStats                 stats;
+    size_t                      threads;    /* SetParallel() */
+}libTwoFishStreamContext;
+
+// built-in cipher stage of one Run().
+typedef struct
+{
+    keyInstance*            key;
+    cipherInstance*         cipher;
+    uint8_t                 dir;
+    bool                    pad;
+    size_t                  threads;
+    /* buffer being ciphered in parts */
+    uint8_t*                buf;
+    size_t                  len;
+    std::vector< uint32_t > ivs;    /* CBC decryption : IV of each part */
+    int                     result;
+}streamBlock;
+
+#define L2FSTCTX        libTwoFishStreamContext
+#define TOSTCTX(_x_)    L2FSTCTX* _x_ = (L2FSTCTX*)context
+
+////////////////////////////////////////////////////////////////////////////////
+
+// lock held.  first error stops every stage.
+static void streamFail( L2FSTCTX* stctx, int error )
+{
+    if ( stctx->error == 0 )
+        stctx->error = error;
+
+    stctx->wake.notify_all();
+}
+
+static void streamReader( L2FSTCTX* stctx, streamRead reader, void* user )
+{
+    size_t bufcnt = stctx->bufs.size();
+
+    for ( uint64_t n=0; ; n++ )
+    {
+        {
+            std::unique_lock< std::mutex > guard( stctx->lock );
+
+            if ( n - stctx->written >= bufcnt )
+            {
+                stctx->stats.readWaits++;
+                stctx->wake.wait( guard, [stctx, n, bufcnt]()
+                                  {
+                                      return ( n - stctx->written < bufcnt ) ||
+                                             ( stctx->error != 0 );
+                                  } );
+            }
+
+            if ( stctx->error != 0 )
+                return;
+        }
+
+        streamBuffer* b    = &stctx->bufs[ n % bufcnt ];
+        size_t        len  = 0;
+        bool          fail = false;
+
+        // pipes give short reads, fill up to end of input.
+        while ( len < stctx->bufsz )
+        {
+            long r = reader( user, b->data + len, stctx->bufsz - len );
+
+            if ( r < 0 )
+                fail = true;
+            if ( r <= 0 )
+                break;
+
+            len += (size_t)r;
+        }
+
+        std::lock_guard< std::mutex > guard( stctx->lock );
+
+        if ( fail == true )
+        {
+            streamFail( stctx, STREAM_IO_FAIL );
+            return;
+        }
+
+        b->len  = len;
+        b->last = ( len < stctx->bufsz );
+
+        stctx->stats.bytesIn += len;
+        stctx->filled = n + 1;
+        stctx->wake.notify_all();
+
+        if ( b->last == true )
+            return;
+    }
+}
+
+static void streamWriter( L2FSTCTX* stctx, streamWrite writer, void* user )
+{
+    size_t bufcnt = stctx->bufs.size();
+
+    for ( uint64_t n=0; ; n++ )
+    {
+        {
+            std::unique_lock< std::mutex > guard( stctx->lock );
+
+            if ( stctx->ciphered <= n )
+            {
+                stctx->stats.writeWaits++;
+                stctx->wake.wait( guard, [stctx, n]()
+                                  {
+                                      return ( stctx->ciphered > n ) ||
+                                             ( stctx->error != 0 );
+                                  } );
+            }
+
+            if ( stctx->error != 0 )
+                return;
+        }
+
+        streamBuffer* b   = &stctx->bufs[ n % bufcnt ];
+        size_t        len = 0;
+
+        while ( len < b->len )
+        {
+            long r = writer( user, b->data + len, b->len - len );
+
+            if ( r <= 0 )
+            {
+                std::lock_guard< std::mutex > guard( stctx->lock );
+                streamFail( stctx, STREAM_IO_FAIL );
+                return;
+            }
+
+            len += (size_t)r;
+        }
+
+        std::lock_guard< std::mutex > guard( stctx->lock );
+
+        stctx->stats.bytesOut += len;
+        stctx->written = n + 1;
+        stctx->wake.notify_all();
+
+        if ( b->last == true )
+            return;
+    }
+}
+
+static bool streamParallel( const streamBlock* sb )
+{
+    uint8_t mode = sb->cipher->mode;
+
+    // CBC encryption chains every block, can't be split.
+    return ( sb->threads > 1 ) &&
+           ( ( mode == MODE_ECB ) || ( mode == MODE_CTR ) ||
+             ( ( mode == MODE_CBC ) && ( sb->dir == DIR_DECRYPT ) ) );
+}
+
+static void streamPart( void* arg, size_t job )
+{
+    streamBlock*   sb  = (streamBlock*)arg;
+    size_t         ofs = job * ST_PART;
+    size_t         len = ( sb->len - ofs < ST_PART ) ? sb->len - ofs : ST_PART;
+    cipherInstance ci  = *sb->cipher;
+    uint8_t*       p   = sb->buf + ofs;
+
+    if ( ci.mode == MODE_CTR )
+        CounterAdd( &ci, ofs / ( BLOCK_SIZE/8 ) );
+    else
+    if ( ( ci.mode == MODE_CBC ) && ( job > 0 ) )
+        memcpy( ci.iv32, &sb->ivs[ job * ( BLOCK_SIZE/32 ) ], BLOCK_SIZE/8 );
+
+    int reti;
+    if ( sb->dir == DIR_ENCRYPT )
+        reti = blockEncrypt( &ci, sb->key, p, len * 8, p );
+    else
+        reti = blockDecrypt( &ci, sb->key, p, len * 8, p );
+
+    if ( reti < 0 )
+        sb->result = reti;
+}
+
+// built-in cipher stage : blockEncrypt()/blockDecrypt() of whole buffer.
+static long streamBlockCipher( void* user, uint8_t* buf, size_t len, bool )
+{
+    streamBlock* sb = (streamBlock*)user;
+
+    // short buffer is the last one, padding fits in it.
+    if ( ( sb->pad == true ) && ( len % ( BLOCK_SIZE/8 ) != 0 ) )
+    {
+        size_t plen = ST_ROUND( len, BLOCK_SIZE/8 );
+        memset( buf + len, 0, plen - len );
+        len = plen;
+    }
+
+    if ( len == 0 )
+        return 0;
+
+    size_t parts = ( len + ST_PART - 1 ) / ST_PART;
+
+    if ( ( parts < 2 ) || ( streamParallel( sb ) == false ) ||
+         ( len % ( BLOCK_SIZE/8 ) != 0 ) )
+    {
+        int reti;
+        if ( sb->dir == DIR_ENCRYPT )
+            reti = blockEncrypt( sb->cipher, sb->key, buf, len * 8, buf );
+        else
+            reti = blockDecrypt( sb->cipher, sb->key, buf, len * 8, buf );
+
+        return ( reti < 0 ) ? reti : (long)len;
+    }
+
+    sb->buf    = buf;
+    sb->len    = len;
+    sb->result = TF_SUCCESS;
+
+    uint8_t mode = sb->cipher->mode;
+    uint8_t lastCt[ BLOCK_SIZE/8 ];
+
+    // part IVs are cipher text, taken before any part overwrites it.
+    if ( mode == MODE_CBC )
+    {
+        sb->ivs.resize( parts * ( BLOCK_SIZE/32 ) );
+        for ( size_t cnt=1; cnt<parts; cnt++ )
+        {
+            const uint32_t* prev = (const uint32_t*)( buf + cnt * ST_PART - BLOCK_SIZE/8 );
+            for ( size_t n=0; n<BLOCK_SIZE/32; n++ )
+                sb->ivs[ cnt * ( BLOCK_SIZE/32 ) + n ] = Bswap( prev[n] );
+        }
+        memcpy( lastCt, buf + len - BLOCK_SIZE/8, BLOCK_SIZE/8 );
+    }
+
+    TwoFishThreadPool::Shared().Run( parts, sb->threads, streamPart, sb );
+
+    if ( sb->result < 0 )
+        return sb->result;
+
+    // cipher state as after one call over the buffer.
+    if ( mode == MODE_CTR )
+        CounterAdd( sb->cipher, len / ( BLOCK_SIZE/8 ) );
+    else
+    if ( mode == MODE_CBC )
+    {
+        for ( size_t n=0; n<BLOCK_SIZE/32; n++ )
+            sb->cipher->iv32[ n ] = Bswap( ( (const uint32_t*)lastCt )[ n ] );
+    }
+
+    return (long)len;
+}
+
+static long streamFileRead( void* user, uint8_t* buf, size_t len )
+{
+    FILE*  fp = (FILE*)user;
+    size_t r  = fread( buf, 1, len, fp );
+
+    if ( ( r == 0 ) && ( ferror( fp ) != 0 ) )
+        return -1;
+
+    return (long)r;
+}
+
+static long streamFileWrite( void* user, const uint8_t* buf, size_t len )
+{
+    size_t r = fwrite( buf, 1, len, (FILE*)user );
+
+    if ( r == 0 )
+        return -1;
+
+    return (long)r;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+TwoFishStream::TwoFishStream( size_t bufferSize, size_t bufferCnt )
+ : context( NULL )
+{
+    L2FSTCTX* stctx = new L2FSTCTX;
+    if ( stctx == NULL )
+        return;
+
+    if ( bufferSize == 0 )
+        bufferSize = STREAM_BUFSZ;
+    if ( bufferSize > STREAM_MAXBUFSZ )     /* one blockEncrypt() a buffer */
+        bufferSize = STREAM_MAXBUFSZ;
+    if ( bufferCnt < 2 )
+        bufferCnt = 2;
+
+    stctx->bufsz = ST_ROUND( bufferSize, BLOCK_SIZE/8 );
+    stctx->memsz = ST_ROUND( stctx->bufsz, STREAM_ALIGN ) * bufferCnt;
+    stctx->mem   = (uint8_t*)malloc( stctx->memsz + STREAM_ALIGN );
+
+    if ( stctx->mem == NULL )
+    {
+        delete stctx;
+        return;
+    }
+
+    uint8_t* base = (uint8_t*)ST_ROUND( (uintptr_t)stctx->mem, STREAM_ALIGN );
+
+    stctx->bufs.resize( bufferCnt );
+
+    for ( size_t cnt=0; cnt<bufferCnt; cnt++ )
+    {
+        stctx->bufs[ cnt ].data = base + cnt * ST_ROUND( stctx->bufsz, STREAM_ALIGN );
+        stctx->bufs[ cnt ].len  = 0;
+        stctx->bufs[ cnt ].last = false;
+    }
+
+    memset( &stctx->stats, 0, sizeof( streamStats ) );
+    stctx->threads = 1;
+
+    context = (void*)stctx;
+}
+
+TwoFishStream::~TwoFishStream()
+{
+    TOSTCTX( stctx );
+
+    if ( stctx == NULL )
+        return;
+
+    /* plain text of the last buffers */
+    memset( stctx->mem, 0, stctx->memsz + STREAM_ALIGN );
+    free( stctx->mem );
+
+    context = NULL;
+    delete stctx;
+}
+
+int TwoFishStream::Run( keyInstance* key, cipherInstance* cipher, uint8_t dir,
+                        streamRead reader, void* rdUser,
+                        streamWrite writer, void* wrUser )
+{
+    TOSTCTX( stctx );
+
+    if ( ( stctx == NULL ) || ( key == NULL ) || ( cipher == NULL ) )
+        return BAD_PARAMS;
+
+    if ( ( dir != DIR_ENCRYPT ) && ( dir != DIR_DECRYPT ) )
+        return BAD_KEY_DIR;
+
+    streamBlock sb;
+
+    sb.key     = key;
+    sb.cipher  = cipher;
+    sb.dir     = dir;
+    sb.pad     = ( dir == DIR_ENCRYPT ) &&
+                 ( ( cipher->mode == MODE_ECB ) || ( cipher->mode == MODE_CBC ) );
+    sb.threads = stctx->threads;
+
+    // parallel buffers share the key : its S-boxes and subkey order final.
+    if ( streamParallel( &sb ) == true )
+    {
+        uint8_t keyDir = ( cipher->mode == MODE_CTR ) ? (uint8_t)DIR_ENCRYPT : dir;
+
+        expandKey( key );
+        if ( key->direction != keyDir )
+            ReverseRoundSubkeys( key, keyDir );
+    }
+
+    return Run( streamBlockCipher, &sb, reader, rdUser, writer, wrUser );
+}
+
+int TwoFishStream::Run( streamCipher cipherFn, void* cipherUser,
+                        streamRead reader, void* rdUser,
+                        streamWrite writer, void* wrUser )
+{
+    TOSTCTX( stctx );
+
+    if ( ( stctx == NULL ) || ( cipherFn == NULL ) ||
+         ( reader == NULL ) || ( writer == NULL ) )
+        return BAD_PARAMS;
+
+    stctx->filled   = 0;
+    stctx->ciphered = 0;
+    stctx->written  = 0;
+    stctx->error    = 0;
+    memset( &stctx->stats, 0, sizeof( streamStats ) );
+
+    size_t bufcnt = stctx->bufs.size();
+
+    std::thread rdThread( streamReader, stctx, reader, rdUser );
+    std::thread wrThread( streamWriter, stctx, writer, wrUser );
+
+    for ( uint64_t n=0; ; n++ )
+    {
+        {
+            std::unique_lock< std::mutex > guard( stctx->lock );
+
+            if ( stctx->filled <= n )
+            {
+                stctx->stats.cipherWaits++;
+                stctx->wake.wait( guard, [stctx, n]()
+                                  {
+                                      return ( stctx->filled > n ) ||
+                                             ( stctx->error != 0 );
+                                  } );
+            }
+
+            if ( stctx->error != 0 )
+                break;
+        }
+
+        streamBuffer* b   = &stctx->bufs[ n % bufcnt ];
+        long          ret = cipherFn( cipherUser, b->data, b->len, b->last );
+
+        std::lock_guard< std::mutex > guard( stctx->lock );
+
+        // a short buffer is the last, at most padded to a whole block.
+        if ( ( ret >= 0 ) &&
+             ( ( (size_t)ret > ST_ROUND( b->len, BLOCK_SIZE/8 ) ) ||
+               ( (size_t)ret > stctx->bufsz ) ) )
+            ret = BAD_PARAMS;
+
+        if ( ret < 0 )
+        {
+            streamFail( stctx, (int)ret );
+            break;
+        }
+
+        b->len = (size_t)ret;
+
+        stctx->stats.buffers++;
+        stctx->ciphered = n + 1;
+        stctx->wake.notify_all();
+
+        if ( b->last == true )
+            break;
+    }
+
+    rdThread.join();
+    wrThread.join();
+
+    return ( stctx->error != 0 ) ? stctx->error : TF_SUCCESS;
+}
+
+int TwoFishStream::RunFile( keyInstance* key, cipherInstance* cipher, uint8_t dir,
+                            FILE* in, FILE* out )
+{
+    if ( ( in == NULL ) || ( out == NULL ) )
+        return BAD_PARAMS;
+
+    int reti = Run( key, cipher, dir, streamFileRead, (void*)in,
+                    streamFileWrite, (void*)out );
+
+    if ( ( reti == TF_SUCCESS ) && ( fflush( out ) != 0 ) )
+        reti = STREAM_IO_FAIL;
+
+    return reti;
+}
+
+void TwoFishStream::GetStats( streamStats* stats )
+{
+    TOSTCTX( stctx );
+
+    if ( ( stctx == NULL ) || ( stats == NULL ) )
+        return;
+
+    std::lock_guard< std::mutex > guard( stctx->lock );
+
+    *stats = stctx->stats;
+}
+
+size_t TwoFishStream::GetBufferSize()
+{
+    TOSTCTX( stctx );
+
+    if ( stctx == NULL )
+        return 0;
+
+    return stctx->bufsz;
+}
+
+size_t TwoFishStream::GetBufferCount()
+{
+    TOSTCTX( stctx );
+
+    if ( stctx == NULL )
+        return 0;
+
+    return stctx->bufs.size();
+}
+
+void TwoFishStream::SetParallel( size_t threadCnt )
+{
+    TOSTCTX( stctx );
+
+    if ( stctx == NULL )
+        return;
+
+    if ( threadCnt == 0 )
+        threadCnt = std::thread::hardware_concurrency();
+
+    stctx->threads = ( threadCnt > 0 ) ? threadCnt : 1;
+}
@@ -0,0 +1,92 @@
+#ifndef __TFSTREAM_H__
+#define __TFSTREAM_H__
+
+/**
+* libtwofish stream pipeline
+* ========================================================
+* Ciphers a stream of any length through a ring of aligned buffers : one
+* is read into while another is ciphered and a third is written, so a
+* file or pipe goes at the speed of the slowest of disk and CPU instead
+* of their sum.  Reading stops while every buffer waits to be ciphered
+* or written (back-pressure), so memory stays at bufferSize x bufferCnt.
+*
+* (C)2021, Raphael Kim
+**/
+
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+
+#include "tfish.h"
+
+#define STREAM_BUFSZ        ( 1024 * 1024 )     /* default bufferSize */
+#define STREAM_BUFCNT       3                   /* default bufferCnt */
+#define STREAM_MAXBUFSZ     ( 64 * 1024 * 1024 ) /* bits of it fit in int */
+#define STREAM_ALIGN        4096                /* buffers start on a page */
+
+#define STREAM_IO_FAIL      -15     /* reader or writer failed */
+
+/* reader : fills up to len bytes, returns # bytes, 0 at end, <0 failed.
+   writer : takes len bytes, returns # bytes taken, <0 failed.
+*/
+typedef long (*streamRead)( void* user, uint8_t* buf, size_t len );
+typedef long (*streamWrite)( void* user, const uint8_t* buf, size_t len );
+/* cipher : in place over len bytes read, last true on the final buffer.
+   Returns # bytes to write, up to len rounded to a block and never past
+   bufferSize, <0 failed.
+*/
+typedef long (*streamCipher)( void* user, uint8_t* buf, size_t len, bool last );
+
+typedef struct
+{
+    uint64_t bytesIn;
+    uint64_t bytesOut;
+    uint64_t buffers;       /* ciphered */
+    uint64_t readWaits;     /* reader found no free buffer */
+    uint64_t cipherWaits;   /* cipher found no read buffer */
+    uint64_t writeWaits;    /* writer found no ciphered buffer */
+} streamStats;
+
+class TwoFishStream
+{
+    public:
+        /* bufferSize is rounded up to a block, at most STREAM_MAXBUFSZ,
+           bufferCnt at least 2.
+        */
+        TwoFishStream( size_t bufferSize = STREAM_BUFSZ,
+                       size_t bufferCnt = STREAM_BUFCNT );
+        ~TwoFishStream();
+
+    public:
+        /* reads to end, ciphers with blockEncrypt()/blockDecrypt() on
+           this thread, writes on.  cipher is carried over buffers as one
+           call would, ECB and CBC encryption pad the tail block with
+           zeros like TwoFish::Encode().  TF_SUCCESS or error code, output
+           written so far stays written.
+        */
+        int  Run( keyInstance* key, cipherInstance* cipher, uint8_t dir,
+                  streamRead reader, void* rdUser,
+                  streamWrite writer, void* wrUser );
+        /* same pipeline, cipher stage is the caller's. */
+        int  Run( streamCipher cipher, void* cipherUser,
+                  streamRead reader, void* rdUser,
+                  streamWrite writer, void* wrUser );
+        /* Run() over stdio files. */
+        int  RunFile( keyInstance* key, cipherInstance* cipher, uint8_t dir,
+                      FILE* in, FILE* out );
+        /* of last Run(). */
+        void GetStats( streamStats* stats );
+        size_t GetBufferSize();
+        size_t GetBufferCount();
+        /* built-in cipher stage splits a buffer over threadCnt threads of
+           the shared pool, 0 for every CPU, 1 (default) for none.  CBC
+           encryption stays serial.  Key gets expanded and its subkeys
+           turned for the run, so don't share it with a running cipher.
+        */
+        void SetParallel( size_t threadCnt );
+
+    public:
+        void* context;
+};
+
+#endif /// of __TFSTREAM_H__
@@ -0,0 +1,201 @@
+/***************************************************************************
+    tfthreadpool.cpp
+
+  ------------------------------------------------------------------------
+
+    Persistent worker threads for fork-join loops.
+
+    (C)2021, Raphael Kim
+
+    Notes:
+        *   One loop runs at a time.  Workers take job indices from an
+            atomic counter, the calling thread takes them too, so a loop
+            never waits for a worker to wake up before it makes progress.
+        *   Tab size is set to 4 characters in this file
+
+***************************************************************************/
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include "tfthreadpool.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+/* sanity bound of workers, whatever is asked for */
+#define TP_MAX_THREADS      256
+
+typedef struct
+{
+    std::mutex                  runlock;    /* one Run() at a time */
+    std::mutex                  lock;
+    std::condition_variable     wake;
+    std::condition_variable     done;
+    std::vector< std::thread >  workers;
+    uint64_t                    generation; /* bumped per loop */
+    size_t                      wanted;     /* workers taking part in loop */
+    size_t                      joined;
+    size_t                      running;
+    bool                        quit;
+    tfPoolJob                   fn;
+    void*                       arg;
+    size_t                      jobcnt;
+    std::atomic< size_t >       next;
+}libTwoFishThreadPoolContext;
+
+#define L2FTPCTX        libTwoFishThreadPoolContext
+#define TOTPCTX(_x_)    L2FTPCTX* _x_ = (L2FTPCTX*)context
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void poolJobs( L2FTPCTX* tpctx )
+{
+    for (;;)
+    {
+        size_t job = tpctx->next.fetch_add( 1 );
+        if ( job >= tpctx->jobcnt )
+            break;
+        tpctx->fn( tpctx->arg, job );
+    }
+}
+
+static void poolWorker( L2FTPCTX* tpctx )
+{
+    uint64_t seen = 0;
+
+    std::unique_lock< std::mutex > guard( tpctx->lock );
+
+    for (;;)
+    {
+        tpctx->wake.wait( guard, [&]{ return ( tpctx->quit == true ) ||
+                                             ( ( tpctx->generation != seen ) &&
+                                               ( tpctx->joined < tpctx->wanted ) ); } );
+        if ( tpctx->quit == true )
+            return;
+
+        seen = tpctx->generation;
+        tpctx->joined++;
+        tpctx->running++;
+        guard.unlock();
+
+        poolJobs( tpctx );
+
+        guard.lock();
+        if ( --tpctx->running == 0 )
+            tpctx->done.notify_all();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+TwoFishThreadPool& TwoFishThreadPool::Shared()
+{
+    static TwoFishThreadPool pool;
+
+    return pool;
+}
+
+TwoFishThreadPool::TwoFishThreadPool()
+ : context( NULL )
+{
+    L2FTPCTX* tpctx = new L2FTPCTX;
+    if ( tpctx != NULL )
+    {
+        tpctx->generation = 0;
+        tpctx->wanted     = 0;
+        tpctx->joined     = 0;
+        tpctx->running    = 0;
+        tpctx->quit       = false;
+        tpctx->fn         = NULL;
+        tpctx->arg        = NULL;
+        tpctx->jobcnt     = 0;
+        tpctx->next       = 0;
+
+        context = (void*)tpctx;
+    }
+}
+
+TwoFishThreadPool::~TwoFishThreadPool()
+{
+    TOTPCTX( tpctx );
+
+    if ( tpctx != NULL )
+    {
+        {
+            std::lock_guard< std::mutex > guard( tpctx->lock );
+            tpctx->quit = true;
+        }
+        tpctx->wake.notify_all();
+
+        for ( size_t cnt=0; cnt<tpctx->workers.size(); cnt++ )
+            tpctx->workers[cnt].join();
+
+        context = NULL;
+        delete tpctx;
+    }
+}
+
+void TwoFishThreadPool::Run( size_t jobCnt, size_t threadCnt, tfPoolJob fn, void* arg )
+{
+    TOTPCTX( tpctx );
+
+    if ( ( fn == NULL ) || ( jobCnt == 0 ) )
+        return;
+
+    if ( threadCnt > jobCnt )
+        threadCnt = jobCnt;
+    if ( threadCnt > TP_MAX_THREADS )
+        threadCnt = TP_MAX_THREADS;
+
+    std::unique_lock< std::mutex > runguard;
+
+    if ( ( tpctx != NULL ) && ( threadCnt >= 2 ) )
+        runguard = std::unique_lock< std::mutex >( tpctx->runlock, std::try_to_lock );
+
+    if ( runguard.owns_lock() == false )
+    {
+        for ( size_t cnt=0; cnt<jobCnt; cnt++ )
+            fn( arg, cnt );
+        return;
+    }
+
+    std::unique_lock< std::mutex > guard( tpctx->lock );
+
+    while ( tpctx->workers.size() < threadCnt - 1 )
+        tpctx->workers.push_back( std::thread( poolWorker, tpctx ) );
+
+    tpctx->fn      = fn;
+    tpctx->arg     = arg;
+    tpctx->jobcnt  = jobCnt;
+    tpctx->next    = 0;
+    tpctx->wanted  = threadCnt - 1;
+    tpctx->joined  = 0;
+    tpctx->generation++;
+    guard.unlock();
+    tpctx->wake.notify_all();
+
+    poolJobs( tpctx );
+
+    /* no late joiners after this, then wait for the ones that joined */
+    guard.lock();
+    tpctx->wanted = tpctx->joined;
+    tpctx->done.wait( guard, [&]{ return tpctx->running == 0; } );
+}
+
+size_t TwoFishThreadPool::GetThreadCount()
+{
+    TOTPCTX( tpctx );
+
+    if ( tpctx == NULL )
+        return 0;
+
+    std::lock_guard< std::mutex > guard( tpctx->lock );
+
+    return tpctx->workers.size() + 1;
+}
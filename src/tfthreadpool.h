@@ -0,0 +1,41 @@
+#ifndef __TFTHREADPOOL_H__
+#define __TFTHREADPOOL_H__
+
+/**
+* libtwofish thread pool
+* ========================================================
+* Persistent worker threads for fork-join loops inside the library.
+* Not a public header.
+*
+* (C)2021, Raphael Kim
+**/
+
+#include <cstdint>
+#include <cstddef>
+
+/* job function, called once per job index */
+typedef void (*tfPoolJob)( void* arg, size_t job );
+
+class TwoFishThreadPool
+{
+    public:
+        /* pool shared by the library, workers start on first use. */
+        static TwoFishThreadPool& Shared();
+
+    public:
+        TwoFishThreadPool();
+        ~TwoFishThreadPool();
+
+    public:
+        /* fn( arg, 0 .. jobCnt-1 ) on up to threadCnt threads, calling
+           thread included, returns when all jobs are done.  While the
+           pool serves another Run(), jobs run on the calling thread.
+        */
+        void   Run( size_t jobCnt, size_t threadCnt, tfPoolJob fn, void* arg );
+        size_t GetThreadCount();
+
+    public:
+        void* context;
+};
+
+#endif /// of __TFTHREADPOOL_H__
@@ -0,0 +1,903 @@
+/***************************************************************************
+    tfuring.cpp
+
+  ------------------------------------------------------------------------
+
+    Bulk file encryption over io_uring, without liburing.
+
+    (C)2021, Raphael Kim
+
+    Notes:
+        *   The ring is set up with io_uring_setup(), mapped, and driven
+            with io_uring_enter() directly.  All chunk buffers are one
+            registered buffer for READ_FIXED/WRITE_FIXED, the two files
+            are registered per call; either one refused, plain READ/WRITE
+            on them.  A kernel without io_uring (or a sandbox refusing it)
+            gets pread()/pwrite() instead.
+        *   A chunk slot goes FREE -> READING -> READ -> WRITING -> FREE.
+            One loop on the calling thread fills free slots with reads,
+            ciphers the READ ones as a batch on TwoFishThreadPool, queues
+            their writes, then submits everything and waits for at least
+            one completion.
+        *   A wait cut by a signal, or refused for want of kernel room,
+            is tried again.  A ring that fails for good has its I/O
+            cancelled and drained before it goes ; I/O that can't be
+            drained keeps the ring and the buffers it may write, for the
+            life of the object, which then refuses further work.
+        *   Chunks are block aligned, so CTR jobs just skip the counter
+            ahead.  CBC decryption reads the block before a chunk too, its
+            IV.  CBC encryption ciphers chunks in file order only.
+        *   Tab size is set to 4 characters in this file
+
+***************************************************************************/
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cerrno>
+
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+    #include <io.h>
+    #include <fcntl.h>
+    #include <sys/stat.h>
+#else
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <sys/stat.h>
+    #include <sys/uio.h>
+#endif
+
+#if defined(__linux__)
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+    #if defined(SYS_io_uring_setup) && __has_include(<linux/io_uring.h>)
+        #include <linux/io_uring.h>
+        #undef  BLOCK_SIZE  /* of linux/fs.h, not the cipher's */
+        #define UR_URING    1
+    #endif
+#endif
+
+#include "tfish.h"
+#include "tfthreadpool.h"
+#include "tfuring.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define UR_PRE          ( BLOCK_SIZE/8 )    /* room for CBC IV before chunk */
+#define UR_ROUND(x,a)   ( ( (x) + (a) - 1 ) / (a) * (a) )
+#define UR_ALIGN        4096
+#define UR_CANCEL       (~(uint64_t)0)      /* user_data of cancel SQEs */
+#define UR_DRAINTRY     1000
+
+enum
+{
+    UR_FREE = 0,
+    UR_READING,
+    UR_READ,
+    UR_WRITING
+};
+
+typedef struct
+{
+    uint8_t*        buf;        /* UR_PRE bytes, then chunk */
+    int             state;
+    uint64_t        chunk;
+    size_t          len;        /* input bytes of chunk */
+    size_t          need;       /* bytes to read, IV included */
+    size_t          got;
+    size_t          outLen;     /* padded */
+    size_t          put;
+    cipherInstance  ci;         /* after ciphering this chunk */
+    int             result;
+}uringSlot;
+
+#if defined(UR_URING)
+typedef struct
+{
+    int                 fd;
+    void*               sqmem;
+    size_t              sqsz;
+    io_uring_sqe*       sqes;
+    size_t              sqesz;
+    unsigned*           sqTail;
+    unsigned*           sqMask;
+    unsigned*           cqHead;
+    unsigned*           cqTail;
+    unsigned*           cqMask;
+    io_uring_cqe*       cqes;
+    unsigned            tail;       /* local SQ tail */
+    unsigned            toSubmit;
+    bool                fixedBufs;
+    bool                fixedFiles;
+}uringRing;
+#endif
+
+typedef struct
+{
+    uint8_t*                mem;
+    size_t                  memsz;
+    size_t                  chunksz;
+    size_t                  slotsz;
+    size_t                  threads;
+    std::vector< uringSlot > slots;
+    bool                    uring;
+    bool                    stuck;      /* I/O lost in flight, buffers kept */
+#if defined(UR_URING)
+    uringRing               ring;
+#endif
+    uringStats              stats;
+}libTwoFishUringContext;
+
+#define L2FURCTX        libTwoFishUringContext
+#define TOURCTX(_x_)    L2FURCTX* _x_ = (L2FURCTX*)context
+
+// one CryptFd().
+typedef struct
+{
+    L2FURCTX*               urctx;
+    keyInstance*            key;
+    cipherInstance          start;      /* cipher as given */
+    uint8_t                 dir;
+    bool                    pad;        /* ECB/CBC encryption */
+    int                     inFd;
+    int                     outFd;
+    uint64_t                inLen;
+    uint64_t                chunks;
+    uint64_t                nextRead;
+    uint64_t                nextCipher; /* CBC encryption order */
+    uint64_t                written;
+    size_t                  inflight;
+    int                     error;
+    std::vector< uringSlot* > batch;
+}uringRun;
+
+////////////////////////////////////////////////////////////////////////////////
+
+#if defined(UR_URING)
+
+static bool ringSetup( uringRing* r, unsigned entries )
+{
+    io_uring_params p;
+
+    memset( r, 0, sizeof( uringRing ) );
+    memset( &p, 0, sizeof( p ) );
+
+    r->fd = (int)syscall( SYS_io_uring_setup, entries, &p );
+    if ( r->fd < 0 )
+        return false;
+
+    // one mapping for both rings, kernels since 5.4.
+    if ( ( p.features & IORING_FEAT_SINGLE_MMAP ) == 0 )
+    {
+        close( r->fd );
+        return false;
+    }
+
+    size_t sqsz = p.sq_off.array + p.sq_entries * sizeof( unsigned );
+    size_t cqsz = p.cq_off.cqes + p.cq_entries * sizeof( io_uring_cqe );
+
+    r->sqsz  = ( sqsz > cqsz ) ? sqsz : cqsz;
+    r->sqmem = mmap( NULL, r->sqsz, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING );
+    if ( r->sqmem == MAP_FAILED )
+    {
+        close( r->fd );
+        return false;
+    }
+
+    r->sqesz = p.sq_entries * sizeof( io_uring_sqe );
+    r->sqes  = (io_uring_sqe*)mmap( NULL, r->sqesz, PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_POPULATE, r->fd,
+                                    IORING_OFF_SQES );
+    if ( r->sqes == MAP_FAILED )
+    {
+        munmap( r->sqmem, r->sqsz );
+        close( r->fd );
+        return false;
+    }
+
+    uint8_t* sq = (uint8_t*)r->sqmem;
+
+    r->sqTail = (unsigned*)( sq + p.sq_off.tail );
+    r->sqMask = (unsigned*)( sq + p.sq_off.ring_mask );
+    r->cqHead = (unsigned*)( sq + p.cq_off.head );
+    r->cqTail = (unsigned*)( sq + p.cq_off.tail );
+    r->cqMask = (unsigned*)( sq + p.cq_off.ring_mask );
+    r->cqes   = (io_uring_cqe*)( sq + p.cq_off.cqes );
+    r->tail   = *r->sqTail;
+
+    // SQ array maps ring entry i to SQE i, for good.
+    unsigned* array = (unsigned*)( sq + p.sq_off.array );
+    for ( unsigned cnt=0; cnt<p.sq_entries; cnt++ )
+        array[ cnt ] = cnt;
+
+    return true;
+}
+
+static void ringFree( uringRing* r )
+{
+    munmap( r->sqes, r->sqesz );
+    munmap( r->sqmem, r->sqsz );
+    close( r->fd );
+}
+
+static io_uring_sqe* ringSqe( uringRing* r )
+{
+    io_uring_sqe* sqe = &r->sqes[ r->tail & *r->sqMask ];
+
+    memset( sqe, 0, sizeof( io_uring_sqe ) );
+    r->tail++;
+    r->toSubmit++;
+
+    return sqe;
+}
+
+// submits queued SQEs, waits for waitCnt completions.
+static int ringEnter( uringRing* r, unsigned waitCnt )
+{
+    __atomic_store_n( r->sqTail, r->tail, __ATOMIC_RELEASE );
+
+    unsigned flags = ( waitCnt > 0 ) ? IORING_ENTER_GETEVENTS : 0;
+    int      reti  = (int)syscall( SYS_io_uring_enter, r->fd, r->toSubmit,
+                                   waitCnt, flags, NULL, 0 );
+    if ( reti >= 0 )
+        r->toSubmit -= ( (unsigned)reti < r->toSubmit ) ? (unsigned)reti : r->toSubmit;
+
+    return reti;
+}
+
+static void ringRw( uringRing* r, bool write, int fd, uint8_t* buf,
+                    size_t len, uint64_t ofs, uint64_t user )
+{
+    io_uring_sqe* sqe = ringSqe( r );
+
+    if ( r->fixedBufs == true )
+        sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+    else
+        sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd        = fd;
+    sqe->addr      = (uint64_t)(uintptr_t)buf;
+    sqe->len       = (uint32_t)len;
+    sqe->off       = ofs;
+    sqe->buf_index = 0;
+    sqe->user_data = user;
+
+    if ( r->fixedFiles == true )
+        sqe->flags |= IOSQE_FIXED_FILE;
+}
+
+#endif /// of UR_URING
+
+static long filePread( int fd, uint8_t* buf, size_t len, uint64_t ofs )
+{
+#if defined(_WIN32)
+    if ( _lseeki64( fd, (__int64)ofs, SEEK_SET ) < 0 )
+        return -1;
+    return _read( fd, buf, (unsigned)len );
+#else
+    return (long)pread( fd, buf, len, (off_t)ofs );
+#endif
+}
+
+static long filePwrite( int fd, const uint8_t* buf, size_t len, uint64_t ofs )
+{
+#if defined(_WIN32)
+    if ( _lseeki64( fd, (__int64)ofs, SEEK_SET ) < 0 )
+        return -1;
+    return _write( fd, buf, (unsigned)len );
+#else
+    return (long)pwrite( fd, buf, len, (off_t)ofs );
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// next read of slot, the rest of it after a short one.
+static void runRead( uringRun* run, size_t idx )
+{
+    L2FURCTX*  urctx = run->urctx;
+    uringSlot* s     = &urctx->slots[ idx ];
+    uint8_t    pre   = ( s->need > s->len ) ? UR_PRE : 0;
+    uint8_t*   dst   = s->buf + UR_PRE - pre + s->got;
+    uint64_t   ofs   = s->chunk * urctx->chunksz - pre + s->got;
+
+    urctx->stats.reads++;
+
+#if defined(UR_URING)
+    if ( urctx->uring == true )
+    {
+        uringRing* r = &urctx->ring;
+        ringRw( r, false, r->fixedFiles ? 0 : run->inFd,
+                dst, s->need - s->got, ofs, idx );
+        run->inflight++;
+        return;
+    }
+#endif
+
+    while ( s->got < s->need )
+    {
+        long n = filePread( run->inFd, dst, s->need - s->got, ofs );
+        if ( n <= 0 )
+        {
+            run->error = STREAM_IO_FAIL;
+            return;
+        }
+        s->got += (size_t)n;
+        dst    += n;
+        ofs    += n;
+    }
+
+    s->state = UR_READ;
+}
+
+static void runWrite( uringRun* run, size_t idx )
+{
+    L2FURCTX*  urctx = run->urctx;
+    uringSlot* s     = &urctx->slots[ idx ];
+    uint8_t*   src   = s->buf + UR_PRE + s->put;
+    uint64_t   ofs   = s->chunk * urctx->chunksz + s->put;
+
+    urctx->stats.writes++;
+
+#if defined(UR_URING)
+    if ( urctx->uring == true )
+    {
+        uringRing* r = &urctx->ring;
+        ringRw( r, true, r->fixedFiles ? 1 : run->outFd,
+                src, s->outLen - s->put, ofs, idx );
+        run->inflight++;
+        return;
+    }
+#endif
+
+    while ( s->put < s->outLen )
+    {
+        long n = filePwrite( run->outFd, src, s->outLen - s->put, ofs );
+        if ( n <= 0 )
+        {
+            run->error = STREAM_IO_FAIL;
+            return;
+        }
+        s->put += (size_t)n;
+        src    += n;
+        ofs    += n;
+    }
+
+    urctx->stats.bytesOut += s->outLen;
+    s->state = UR_FREE;
+    run->written++;
+}
+
+static void runCipherSlot( uringRun* run, uringSlot* s, cipherInstance* ci )
+{
+    uint8_t* data = s->buf + UR_PRE;
+
+    if ( ( run->pad == true ) && ( s->outLen > s->len ) )
+        memset( data + s->len, 0, s->outLen - s->len );
+
+    if ( s->outLen == 0 )
+        s->result = 0;
+    else
+    if ( run->dir == DIR_ENCRYPT )
+        s->result = blockEncrypt( ci, run->key, data, s->outLen * 8, data );
+    else
+        s->result = blockDecrypt( ci, run->key, data, s->outLen * 8, data );
+
+    s->ci = *ci;
+}
+
+static void runCipherJob( void* arg, size_t job )
+{
+    uringRun*      run = (uringRun*)arg;
+    uringSlot*     s   = run->batch[ job ];
+    cipherInstance ci  = run->start;
+
+    if ( ci.mode == MODE_CTR )
+        CounterAdd( &ci, s->chunk * run->urctx->chunksz / ( BLOCK_SIZE/8 ) );
+    else
+    if ( ( ci.mode == MODE_CBC ) && ( s->chunk > 0 ) )
+    {
+        // decryption only, IV is the block read before chunk.
+        const uint32_t* prev = (const uint32_t*)s->buf;
+        for ( size_t n=0; n<BLOCK_SIZE/32; n++ )
+            ci.iv32[ n ] = Bswap( prev[ n ] );
+    }
+
+    runCipherSlot( run, s, &ci );
+}
+
+// ciphers READ slots and queues their writes.
+static void runCipher( uringRun* run, cipherInstance* cipher )
+{
+    L2FURCTX* urctx  = run->urctx;
+    bool      serial = ( run->start.mode == MODE_CBC ) && ( run->dir == DIR_ENCRYPT );
+
+    run->batch.clear();
+
+    for ( bool more = true; more == true; )
+    {
+        more = false;
+
+        for ( size_t cnt=0; cnt<urctx->slots.size(); cnt++ )
+        {
+            uringSlot* s = &urctx->slots[ cnt ];
+
+            if ( s->state != UR_READ )
+                continue;
+
+            if ( serial == false )
+                run->batch.push_back( s );
+            else
+            if ( s->chunk == run->nextCipher )
+            {
+                run->batch.push_back( s );
+                runCipherSlot( run, s, cipher );
+                run->nextCipher++;
+                s->state = UR_WRITING;  /* taken, not found again */
+                more = true;
+            }
+        }
+    }
+
+    if ( run->batch.empty() == true )
+        return;
+
+    urctx->stats.batches++;
+
+    if ( serial == false )
+        TwoFishThreadPool::Shared().Run( run->batch.size(), urctx->threads,
+                                         runCipherJob, run );
+
+    for ( size_t cnt=0; ( cnt<run->batch.size() ) && ( run->error == 0 ); cnt++ )
+    {
+        uringSlot* s = run->batch[ cnt ];
+
+        if ( s->result < 0 )
+        {
+            run->error = s->result;
+            break;
+        }
+
+        if ( ( s->chunk + 1 == run->chunks ) && ( serial == false ) )
+            *cipher = s->ci;    /* state after last chunk */
+
+        s->state = UR_WRITING;
+        s->put   = 0;
+        runWrite( run, s - &urctx->slots[0] );
+    }
+}
+
+#if defined(UR_URING)
+// takes completions, resubmits short reads and writes.
+static void runReap( uringRun* run )
+{
+    L2FURCTX*  urctx = run->urctx;
+    uringRing* r     = &urctx->ring;
+    unsigned   head  = *r->cqHead;
+    unsigned   tail  = __atomic_load_n( r->cqTail, __ATOMIC_ACQUIRE );
+
+    for ( ; head != tail; head++ )
+    {
+        io_uring_cqe* cqe = &r->cqes[ head & *r->cqMask ];
+
+        // result of a cancel, the I/O it cancelled completes on its own.
+        if ( cqe->user_data == UR_CANCEL )
+            continue;
+
+        size_t        idx = (size_t)cqe->user_data;
+        uringSlot*    s   = &urctx->slots[ idx ];
+        int           res = cqe->res;
+
+        run->inflight--;
+
+        if ( res <= 0 )
+        {
+            // a read ending before the size fstat() gave, or failed I/O.
+            if ( run->error == 0 )
+                run->error = STREAM_IO_FAIL;
+            s->state = UR_FREE;
+            continue;
+        }
+
+        if ( run->error != 0 )
+        {
+            s->state = UR_FREE;
+            continue;
+        }
+
+        if ( s->state == UR_READING )
+        {
+            s->got += (size_t)res;
+            if ( s->got < s->need )
+                runRead( run, idx );
+            else
+                s->state = UR_READ;
+        }
+        else
+        {
+            s->put += (size_t)res;
+            if ( s->put < s->outLen )
+                runWrite( run, idx );
+            else
+            {
+                urctx->stats.bytesOut += s->outLen;
+                s->state = UR_FREE;
+                run->written++;
+            }
+        }
+    }
+
+    __atomic_store_n( r->cqHead, head, __ATOMIC_RELEASE );
+}
+
+// at least one completion reaped, or -errno of a ring failing for good.
+static int runWait( uringRun* run )
+{
+    uringRing* r = &run->urctx->ring;
+
+    while ( true )
+    {
+        if ( ringEnter( r, 1 ) >= 0 )
+            break;
+
+        int err = errno;
+
+        if ( err == EINTR )
+            continue;
+
+        // CQ full or no kernel memory now : make room, try again.
+        if ( ( err == EAGAIN ) || ( err == EBUSY ) )
+        {
+            runReap( run );
+            std::this_thread::yield();
+            continue;
+        }
+
+        return -err;
+    }
+
+    runReap( run );
+
+    return 0;
+}
+
+// in-flight I/O of a failing ring cancelled and waited for ; false if
+// some may still reach the buffers.
+static bool runDrain( uringRun* run )
+{
+    L2FURCTX*  urctx = run->urctx;
+    uringRing* r     = &urctx->ring;
+
+#if defined(IORING_FEAT_NODROP)     /* 5.5 headers, with ASYNC_CANCEL */
+    for ( size_t cnt=0; cnt<urctx->slots.size(); cnt++ )
+    {
+        int st = urctx->slots[ cnt ].state;
+
+        if ( ( st != UR_READING ) && ( st != UR_WRITING ) )
+            continue;
+
+        io_uring_sqe* sqe = ringSqe( r );
+
+        sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+        sqe->fd        = -1;
+        sqe->addr      = (uint64_t)cnt;
+        sqe->user_data = UR_CANCEL;
+    }
+#endif
+
+    for ( size_t cnt=0; ( cnt < UR_DRAINTRY ) && ( run->inflight > 0 ); cnt++ )
+    {
+        int reti = ringEnter( r, 1 );
+
+        if ( ( reti < 0 ) && ( errno != EINTR ) && ( errno != EAGAIN ) &&
+             ( errno != EBUSY ) )
+            std::this_thread::yield();
+
+        runReap( run );
+    }
+
+    return ( run->inflight == 0 );
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+
+TwoFishUring::TwoFishUring( size_t chunkSize, size_t depth, size_t threadCnt,
+                            unsigned flags )
+ : context( NULL )
+{
+    L2FURCTX* urctx = new L2FURCTX;
+    if ( urctx == NULL )
+        return;
+
+    if ( chunkSize == 0 )
+        chunkSize = URING_CHUNK;
+    if ( depth == 0 )
+        depth = URING_DEPTH;
+    if ( threadCnt == 0 )
+        threadCnt = std::thread::hardware_concurrency();
+
+    urctx->chunksz = UR_ROUND( chunkSize, BLOCK_SIZE/8 );
+    urctx->slotsz  = UR_ROUND( urctx->chunksz + UR_PRE, UR_ALIGN );
+    urctx->memsz   = urctx->slotsz * depth;
+    urctx->threads = ( threadCnt > 0 ) ? threadCnt : 1;
+    urctx->uring   = false;
+    urctx->stuck   = false;
+    urctx->mem     = (uint8_t*)malloc( urctx->memsz + UR_ALIGN );
+
+    if ( urctx->mem == NULL )
+    {
+        delete urctx;
+        return;
+    }
+
+    uint8_t* base = (uint8_t*)UR_ROUND( (uintptr_t)urctx->mem, UR_ALIGN );
+
+    urctx->slots.resize( depth );
+    for ( size_t cnt=0; cnt<depth; cnt++ )
+    {
+        memset( &urctx->slots[ cnt ], 0, sizeof( uringSlot ) );
+        urctx->slots[ cnt ].buf = base + cnt * urctx->slotsz;
+    }
+
+    memset( &urctx->stats, 0, sizeof( uringStats ) );
+
+#if defined(UR_URING)
+    if ( ( ( flags & URING_NONE ) == 0 ) &&
+         ( ringSetup( &urctx->ring, (unsigned)depth ) == true ) )
+    {
+        iovec iov;
+        iov.iov_base = base;
+        iov.iov_len  = urctx->memsz;
+
+        // no locked memory left for it : plain READ/WRITE.
+        urctx->ring.fixedBufs = ( syscall( SYS_io_uring_register, urctx->ring.fd,
+                                           IORING_REGISTER_BUFFERS, &iov, 1 ) == 0 );
+        urctx->uring = true;
+    }
+#endif
+
+    context = (void*)urctx;
+}
+
+TwoFishUring::~TwoFishUring()
+{
+    TOURCTX( urctx );
+
+    if ( urctx == NULL )
+        return;
+
+    // the kernel may still write to the buffers : both kept.
+    if ( urctx->stuck == true )
+    {
+        context = NULL;
+        delete urctx;
+        return;
+    }
+
+#if defined(UR_URING)
+    if ( urctx->uring == true )
+        ringFree( &urctx->ring );
+#endif
+
+    /* plain text of the last chunks */
+    memset( urctx->mem, 0, urctx->memsz + UR_ALIGN );
+    free( urctx->mem );
+
+    context = NULL;
+    delete urctx;
+}
+
+int TwoFishUring::CryptFd( keyInstance* key, cipherInstance* cipher, uint8_t dir,
+                           int inFd, int outFd )
+{
+    TOURCTX( urctx );
+
+    if ( ( urctx == NULL ) || ( key == NULL ) || ( cipher == NULL ) ||
+         ( inFd < 0 ) || ( outFd < 0 ) )
+        return BAD_PARAMS;
+
+    if ( key->keySig != VALID_SIG )
+        return BAD_KEY_INSTANCE;
+
+    if ( ( dir != DIR_ENCRYPT ) && ( dir != DIR_DECRYPT ) )
+        return BAD_KEY_DIR;
+
+    if ( urctx->stuck == true )
+        return STREAM_IO_FAIL;
+
+    uint8_t mode = cipher->mode;
+
+    if ( ( mode != MODE_ECB ) && ( mode != MODE_CBC ) && ( mode != MODE_CTR ) )
+        return BAD_CIPHER_MODE;
+
+    struct stat st;
+
+    if ( fstat( inFd, &st ) != 0 )
+        return STREAM_IO_FAIL;
+
+    uringRun run;
+
+    run.urctx      = urctx;
+    run.key        = key;
+    run.start      = *cipher;
+    run.dir        = dir;
+    run.pad        = ( dir == DIR_ENCRYPT ) && ( mode != MODE_CTR );
+    run.inFd       = inFd;
+    run.outFd      = outFd;
+    run.inLen      = (uint64_t)st.st_size;
+    run.chunks     = ( run.inLen + urctx->chunksz - 1 ) / urctx->chunksz;
+    run.nextRead   = 0;
+    run.nextCipher = 0;
+    run.written    = 0;
+    run.inflight   = 0;
+    run.error      = 0;
+
+    if ( ( dir == DIR_DECRYPT ) && ( mode != MODE_CTR ) &&
+         ( run.inLen % ( BLOCK_SIZE/8 ) != 0 ) )
+        return BAD_INPUT_LEN;
+
+    // chunks share the key : its S-boxes and subkey order must be final.
+    uint8_t keyDir = ( mode == MODE_CTR ) ? (uint8_t)DIR_ENCRYPT : dir;
+
+    expandKey( key );
+    if ( key->direction != keyDir )
+        ReverseRoundSubkeys( key, keyDir );
+
+    uint64_t outLen = ( run.pad == true ) ? UR_ROUND( run.inLen, BLOCK_SIZE/8 )
+                                          : run.inLen;
+#if !defined(_WIN32)
+    if ( ftruncate( outFd, (off_t)outLen ) != 0 )
+        return STREAM_IO_FAIL;
+#else
+    if ( _chsize_s( outFd, (__int64)outLen ) != 0 )
+        return STREAM_IO_FAIL;
+#endif
+
+    memset( &urctx->stats, 0, sizeof( uringStats ) );
+    for ( size_t cnt=0; cnt<urctx->slots.size(); cnt++ )
+        urctx->slots[ cnt ].state = UR_FREE;
+
+#if defined(UR_URING)
+    if ( urctx->uring == true )
+    {
+        int fds[2] = { inFd, outFd };
+
+        urctx->ring.fixedFiles = ( syscall( SYS_io_uring_register, urctx->ring.fd,
+                                            IORING_REGISTER_FILES, fds, 2 ) == 0 );
+    }
+#endif
+
+    while ( ( run.written < run.chunks ) && ( run.error == 0 ) )
+    {
+        for ( size_t cnt=0; ( cnt<urctx->slots.size() ) && ( run.error == 0 ); cnt++ )
+        {
+            uringSlot* s = &urctx->slots[ cnt ];
+
+            if ( ( s->state != UR_FREE ) || ( run.nextRead >= run.chunks ) )
+                continue;
+
+            uint64_t ofs = run.nextRead * urctx->chunksz;
+
+            s->chunk  = run.nextRead++;
+            s->len    = ( run.inLen - ofs < urctx->chunksz ) ? (size_t)( run.inLen - ofs )
+                                                             : urctx->chunksz;
+            s->outLen = ( run.pad == true ) ? UR_ROUND( s->len, BLOCK_SIZE/8 ) : s->len;
+            s->need   = s->len;
+            s->got    = 0;
+            s->put    = 0;
+            s->result = 0;
+            s->state  = UR_READING;
+
+            if ( ( mode == MODE_CBC ) && ( dir == DIR_DECRYPT ) && ( s->chunk > 0 ) )
+                s->need += UR_PRE;
+
+            urctx->stats.bytesIn += s->len;
+            runRead( &run, cnt );
+        }
+
+        if ( run.error == 0 )
+            runCipher( &run, cipher );
+
+#if defined(UR_URING)
+        if ( urctx->uring == true )
+        {
+            if ( run.inflight > urctx->stats.maxInFlight )
+                urctx->stats.maxInFlight = run.inflight;
+
+            // on error, still wait for I/O using buffers to finish.
+            while ( run.inflight > 0 )
+            {
+                if ( runWait( &run ) < 0 )
+                {
+                    // can't wait on the ring any more : give it up, once
+                    // nothing can write into the buffers.
+                    run.error = STREAM_IO_FAIL;
+                    if ( runDrain( &run ) == true )
+                        ringFree( &urctx->ring );
+                    else
+                        urctx->stuck = true;
+                    urctx->uring = false;
+                    break;
+                }
+                if ( run.error == 0 )
+                    break;
+            }
+        }
+#endif
+    }
+
+#if defined(UR_URING)
+    if ( ( urctx->uring == true ) && ( urctx->ring.fixedFiles == true ) )
+    {
+        syscall( SYS_io_uring_register, urctx->ring.fd,
+                 IORING_UNREGISTER_FILES, NULL, 0 );
+        urctx->ring.fixedFiles = false;
+    }
+#endif
+
+    // ECB has no state, serial CBC updated cipher as it went.
+    if ( ( run.error == 0 ) && ( run.chunks == 0 ) )
+        *cipher = run.start;
+
+    return ( run.error != 0 ) ? run.error : TF_SUCCESS;
+}
+
+int TwoFishUring::CryptFile( keyInstance* key, cipherInstance* cipher, uint8_t dir,
+                             const char* inPath, const char* outPath )
+{
+    if ( ( inPath == NULL ) || ( outPath == NULL ) )
+        return BAD_PARAMS;
+
+#if defined(_WIN32)
+    int inFd  = _open( inPath, _O_RDONLY | _O_BINARY );
+    int outFd = _open( outPath, _O_RDWR | _O_CREAT | _O_TRUNC | _O_BINARY,
+                       _S_IREAD | _S_IWRITE );
+#else
+    int inFd  = open( inPath, O_RDONLY );
+    int outFd = open( outPath, O_RDWR | O_CREAT | O_TRUNC, 0600 );
+#endif
+
+    int reti = STREAM_IO_FAIL;
+
+    if ( ( inFd >= 0 ) && ( outFd >= 0 ) )
+        reti = CryptFd( key, cipher, dir, inFd, outFd );
+
+#if defined(_WIN32)
+    if ( inFd >= 0 )
+        _close( inFd );
+    if ( ( outFd >= 0 ) && ( _close( outFd ) != 0 ) && ( reti == TF_SUCCESS ) )
+        reti = STREAM_IO_FAIL;
+#else
+    if ( inFd >= 0 )
+        close( inFd );
+    if ( ( outFd >= 0 ) && ( close( outFd ) != 0 ) && ( reti == TF_SUCCESS ) )
+        reti = STREAM_IO_FAIL;
+#endif
+
+    return reti;
+}
+
+bool TwoFishUring::IsUring()
+{
+    TOURCTX( urctx );
+
+    if ( urctx == NULL )
+        return false;
+
+    return urctx->uring;
+}
+
+void TwoFishUring::GetStats( uringStats* stats )
+{
+    TOURCTX( urctx );
+
+    if ( ( urctx == NULL ) || ( stats == NULL ) )
+        return;
+
+    *stats = urctx->stats;
+}
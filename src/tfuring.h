@@ -0,0 +1,72 @@
+#ifndef __TFURING_H__
+#define __TFURING_H__
+
+/**
+* libtwofish bulk file engine
+* ========================================================
+* Ciphers a whole file into another, with many chunk reads and writes in
+* flight at once through io_uring (Linux), on buffers and files
+* registered with the kernel once.  Chunks whose reads completed are
+* ciphered together on the library thread pool, then written, while the
+* next reads go on.  Without io_uring the same chunks go through
+* pread()/pwrite(), one batch at a time.
+*
+* (C)2021, Raphael Kim
+**/
+
+#include <cstdint>
+#include <cstddef>
+
+#include "tfish.h"
+#include "tfstream.h"
+
+#define URING_CHUNK         ( 1024 * 1024 )     /* default chunkSize */
+#define URING_DEPTH         16                  /* default depth */
+
+/* flags of TwoFishUring */
+#define URING_NONE          0x01    /* don't use io_uring, pread()/pwrite() */
+
+typedef struct
+{
+    uint64_t bytesIn;
+    uint64_t bytesOut;
+    uint64_t reads;         /* read calls, a short one is read again */
+    uint64_t writes;
+    uint64_t batches;       /* cipher passes over ready chunks */
+    uint64_t maxInFlight;   /* chunks reading or writing at once */
+} uringStats;
+
+class TwoFishUring
+{
+    public:
+        /* chunkSize is rounded up to a block.  depth : chunks in flight
+           and buffers held.  threadCnt 0 : ciphers on every CPU.
+        */
+        TwoFishUring( size_t chunkSize = URING_CHUNK, size_t depth = URING_DEPTH,
+                      size_t threadCnt = 0, unsigned flags = 0 );
+        ~TwoFishUring();
+
+    public:
+        /* whole of regular file inFd to outFd from offset 0, output is
+           truncated to what's written.  ECB, CBC or CTR, updating cipher
+           as one blockEncrypt() call would, and ECB/CBC encryption pads
+           the tail block with zeros like TwoFish::Encode().  key is
+           expanded and turned to the direction chunks need, as parallel
+           Encode() does.  CBC encryption chains chunks, so those are
+           ciphered one by one, in order.  TF_SUCCESS or error code.
+        */
+        int  CryptFd( keyInstance* key, cipherInstance* cipher, uint8_t dir,
+                      int inFd, int outFd );
+        /* CryptFd() on paths, output created or truncated. */
+        int  CryptFile( keyInstance* key, cipherInstance* cipher, uint8_t dir,
+                        const char* inPath, const char* outPath );
+        /* true while reads and writes go through io_uring. */
+        bool IsUring();
+        /* of last call. */
+        void GetStats( uringStats* stats );
+
+    public:
+        void* context;
+};
+
+#endif /// of __TFURING_H__
@@ -0,0 +1,134 @@
+/***************************************************************************
+    tfxts.cpp
+
+  ------------------------------------------------------------------------
+
+    XTS of a data unit, shared by in-place file and page ciphers.
+
+    (C)2021, Raphael Kim
+
+    Notes:
+        *   Tweaks of a run of blocks are made first, so the data goes
+            through one ECB call per run instead of a call per block.
+        *   Tab size is set to 4 characters in this file
+
+***************************************************************************/
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include "tfish.h"
+#include "tfxts.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define XTS_BLOCK       ( BLOCK_SIZE/8 )
+
+// multiply by x in GF(2^128), little endian as in P1619.
+static void xtsDouble( uint8_t* t )
+{
+    uint8_t carry = t[ XTS_BLOCK - 1 ] >> 7;
+
+    for ( size_t cnt=XTS_BLOCK-1; cnt>0; cnt-- )
+        t[ cnt ] = (uint8_t)( ( t[ cnt ] << 1 ) | ( t[ cnt-1 ] >> 7 ) );
+
+    t[0] = (uint8_t)( ( t[0] << 1 ) ^ ( carry ? 0x87 : 0 ) );
+}
+
+static void xtsXor( uint8_t* d, const uint8_t* s, size_t len )
+{
+    for ( size_t cnt=0; cnt<len; cnt++ )
+        d[ cnt ] ^= s[ cnt ];
+}
+
+// blocks of in place, ECB under tweaks t, then t steps past them.
+static int xtsBlocks( keyInstance* key, uint8_t dir, cipherInstance* ecb,
+                      uint8_t* p, size_t blocks, uint8_t* t )
+{
+    uint8_t tw[ XTS_RUN * XTS_BLOCK ];
+
+    while ( blocks > 0 )
+    {
+        size_t n = ( blocks < XTS_RUN ) ? blocks : XTS_RUN;
+
+        for ( size_t cnt=0; cnt<n; cnt++ )
+        {
+            memcpy( tw + cnt * XTS_BLOCK, t, XTS_BLOCK );
+            xtsDouble( t );
+        }
+
+        xtsXor( p, tw, n * XTS_BLOCK );
+
+        int reti;
+        if ( dir == DIR_ENCRYPT )
+            reti = blockEncrypt( ecb, key, p, n * BLOCK_SIZE, p );
+        else
+            reti = blockDecrypt( ecb, key, p, n * BLOCK_SIZE, p );
+        if ( reti < 0 )
+            return reti;
+
+        xtsXor( p, tw, n * XTS_BLOCK );
+
+        p      += n * XTS_BLOCK;
+        blocks -= n;
+    }
+
+    return TF_SUCCESS;
+}
+
+int xtsCrypt( keyInstance* key, keyInstance* tweakKey, uint8_t dir,
+              uint8_t* p, size_t len, const uint8_t* tweak )
+{
+    if ( len < XTS_BLOCK )
+        return BAD_INPUT_LEN;
+
+    cipherInstance ecb;
+    uint8_t        t[ XTS_BLOCK ];
+
+    cipherInit( &ecb, MODE_ECB, NULL );
+
+    int reti = blockEncrypt( &ecb, tweakKey, tweak, BLOCK_SIZE, t );
+    if ( reti < 0 )
+        return reti;
+
+    size_t m = len / XTS_BLOCK;
+    size_t r = len % XTS_BLOCK;
+
+    if ( r == 0 )
+        return xtsBlocks( key, dir, &ecb, p, m, t );
+
+    // ciphertext stealing over the last full block and the partial one.
+    reti = xtsBlocks( key, dir, &ecb, p, m - 1, t );
+    if ( reti < 0 )
+        return reti;
+
+    uint8_t* last = p + ( m - 1 ) * XTS_BLOCK;
+    uint8_t* tail = last + XTS_BLOCK;
+    uint8_t  t1[ XTS_BLOCK ];
+    uint8_t  t2[ XTS_BLOCK ];
+    uint8_t  b[ XTS_BLOCK ];
+
+    memcpy( t1, t, XTS_BLOCK );
+    memcpy( t2, t, XTS_BLOCK );
+    xtsDouble( t2 );
+
+    // encrypt steals with the first tweak, decrypt undoes the second first.
+    memcpy( b, last, XTS_BLOCK );
+    reti = xtsBlocks( key, dir, &ecb, b, 1, ( dir == DIR_ENCRYPT ) ? t1 : t2 );
+    if ( reti < 0 )
+        return reti;
+
+    uint8_t keep[ XTS_BLOCK ];
+    memcpy( keep, tail, r );
+    memcpy( tail, b, r );
+    memcpy( b, keep, r );
+
+    reti = xtsBlocks( key, dir, &ecb, b, 1, ( dir == DIR_ENCRYPT ) ? t2 : t1 );
+    if ( reti < 0 )
+        return reti;
+
+    memcpy( last, b, XTS_BLOCK );
+
+    return TF_SUCCESS;
+}
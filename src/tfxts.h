@@ -0,0 +1,29 @@
+#ifndef __TFXTS_H__
+#define __TFXTS_H__
+
+/**
+* libtwofish XTS
+* ========================================================
+* XTS-Twofish (IEEE P1619) of one data unit, ciphertext stealing for a
+* unit that isn't whole blocks.  For modules ciphering units in jobs.
+* Not a public header.
+*
+* (C)2021, Raphael Kim
+**/
+
+#include <cstdint>
+#include <cstddef>
+
+#include "tfish.h"
+
+#define XTS_RUN         64      /* blocks per ECB call */
+
+/* unit of len bytes in place, len a block or more.  tweak is the 16 byte
+   tweak value before encryption by tweakKey.  key must be expanded and
+   turned to dir, tweakKey expanded and turned to DIR_ENCRYPT : both are
+   only read, jobs may share them.  TF_SUCCESS or error code.
+*/
+int xtsCrypt( keyInstance* key, keyInstance* tweakKey, uint8_t dir,
+              uint8_t* p, size_t len, const uint8_t* tweak );
+
+#endif /// of __TFXTS_H__
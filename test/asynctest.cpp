@@ -0,0 +1,250 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+
+#include <mutex>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+
+#include "tfish.h"
+#include "tfengine.h"
+#include "tfasync.h"
+
+#if !defined( TWOFISH_ASYNC )
+int main( int argc, char** argv )
+{
+    printf( "libtwofish async API needs C++20 coroutines.\n" );
+    return 0;
+}
+#else
+
+/* coroutine that starts at once and tells when it ended */
+struct asyncTask
+{
+    struct promise_type
+    {
+        asyncTask get_return_object() { return asyncTask(); }
+        std::suspend_never initial_suspend() { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { abort(); }
+    };
+};
+
+/* one thread running posted tasks, as an event loop would */
+class taskLoop
+{
+    public:
+        taskLoop() : quit( false ), worker( [this](){ Run(); } ) {}
+        ~taskLoop()
+        {
+            {
+                std::lock_guard< std::mutex > guard( lock );
+                quit = true;
+            }
+            wake.notify_one();
+            worker.join();
+        }
+
+    public:
+        void Post( std::function< void() > task )
+        {
+            {
+                std::lock_guard< std::mutex > guard( lock );
+                tasks.push_back( task );
+            }
+            wake.notify_one();
+        }
+
+        bool IsOwner() { return std::this_thread::get_id() == worker.get_id(); }
+
+    private:
+        void Run()
+        {
+            for (;;)
+            {
+                std::function< void() > task;
+                {
+                    std::unique_lock< std::mutex > guard( lock );
+                    wake.wait( guard, [this](){ return quit || !tasks.empty(); } );
+                    if ( tasks.empty() )
+                        return;
+                    task = tasks.front();
+                    tasks.pop_front();
+                }
+                task();
+            }
+        }
+
+    private:
+        std::mutex                          lock;
+        std::condition_variable             wake;
+        std::deque< std::function< void() > > tasks;
+        bool                                quit;
+        std::thread                         worker;
+};
+
+static std::atomic< int > doneCnt( 0 );
+static std::atomic< int > failCnt( 0 );
+
+asyncTask roundTrip( uint8_t mode, const asyncOptions* opt, taskLoop* loop,
+                     const uint8_t* src, size_t len, uint8_t* enc, uint8_t* dec )
+{
+    keyInstance    ek;
+    keyInstance    dk;
+    cipherInstance ci;
+    cipherInstance sci;
+    const char     iv[] = "000102030405060708090A0B0C0D0E0F";
+
+    makeKey( &ek, DIR_ENCRYPT, 256,
+             "0123456789ABCDEFFEDCBA987654321000112233445566778899AABBCCDDEEFF" );
+    makeKey( &dk, ( mode == MODE_CTR ) ? DIR_ENCRYPT : DIR_DECRYPT, 256,
+             "0123456789ABCDEFFEDCBA987654321000112233445566778899AABBCCDDEEFF" );
+    cipherInit( &ci, mode, iv );
+
+    int64_t reti = co_await EncryptAsync( &ek, &ci, src, len * 8, enc, *opt );
+
+    if ( ( opt->resume ) && ( loop->IsOwner() == false ) )
+        failCnt++;
+
+    /* same as one blockEncrypt() over all of it */
+    uint8_t* ref = new uint8_t[ len ];
+    cipherInit( &sci, mode, iv );
+    blockEncrypt( &sci, &ek, src, len * 8, ref );
+
+    if ( ( reti != (int64_t)len ) || ( memcmp( ref, enc, len ) != 0 ) ||
+         ( memcmp( sci.iv32, ci.iv32, sizeof( ci.iv32 ) ) != 0 ) )
+        failCnt++;
+    delete[] ref;
+
+    cipherInit( &ci, mode, iv );
+    reti = co_await DecryptAsync( &dk, &ci, enc, len * 8, dec, *opt );
+
+    if ( ( reti != (int64_t)len ) || ( memcmp( dec, src, len ) != 0 ) )
+        failCnt++;
+
+    doneCnt++;
+}
+
+/* 256 MB and more in one op : 2^31 bits and up, zeros in place by ECB */
+asyncTask bigBuffer( const asyncOptions* opt, uint8_t* buf, size_t len )
+{
+    keyInstance    ek;
+    cipherInstance ci;
+    uint8_t        zero[ BLOCK_SIZE/8 ] = {0};
+    uint8_t        ref[ BLOCK_SIZE/8 ];
+
+    makeKey( &ek, DIR_ENCRYPT, 128, NULL );
+    cipherInit( &ci, MODE_ECB, NULL );
+    blockEncrypt( &ci, &ek, zero, BLOCK_SIZE, ref );
+
+    int64_t reti = co_await EncryptAsync( &ek, &ci, buf, len * 8, buf, *opt );
+
+    if ( reti != (int64_t)len )
+        failCnt++;
+
+    for ( size_t cnt=0; ( reti == (int64_t)len ) && ( cnt<len ); cnt+=sizeof( ref ) )
+        if ( memcmp( buf + cnt, ref, sizeof( ref ) ) != 0 )
+        {
+            failCnt++;
+            break;
+        }
+
+    doneCnt++;
+}
+
+int main( int argc, char** argv )
+{
+    const size_t len   = 1024 * 1024 + 16 * 5;
+    uint8_t*     src   = new uint8_t[ len ];
+    uint8_t*     enc   = new uint8_t[ len ];
+    uint8_t*     dec   = new uint8_t[ len ];
+    uint8_t      modes[] = { MODE_ECB, MODE_CBC, MODE_CTR };
+
+    printf( "libtwofish async testing, Rapahael Kim, (C)2021\n" );
+
+    for ( size_t cnt=0; cnt<len; cnt++ )
+        src[ cnt ] = (uint8_t)( cnt * 7 + 3 );
+
+    taskLoop      loop;
+    taskLoop      pool;
+    TwoFishEngine engine( 2 );
+
+    asyncOptions opts[ 3 ];
+    /* library engine, resume on engine worker */
+    opts[0].engine = NULL;
+    opts[0].chunk  = 0;
+    /* own engine, resume on loop */
+    opts[1].engine = &engine;
+    opts[1].queue  = engine.OpenQueue();
+    opts[1].resume = [&loop]( std::function< void() > t ){ loop.Post( t ); };
+    opts[1].chunk  = 4096;
+    /* executor only, resume on loop */
+    opts[2].engine   = NULL;
+    opts[2].executor = [&pool]( std::function< void() > t ){ pool.Post( t ); };
+    opts[2].resume   = [&loop]( std::function< void() > t ){ loop.Post( t ); };
+    opts[2].chunk    = 100000;
+
+    const char* names[] = { "library engine", "own engine", "executor" };
+    int         total   = 0;
+
+    for ( size_t o=0; o<3; o++ )
+    {
+        for ( size_t m=0; m<sizeof( modes ); m++ )
+        {
+            printf( "%s, mode %u ... ", names[o], modes[m] );
+            fflush( stdout );
+
+            int before = failCnt;
+            total++;
+
+            loop.Post( [&, o, m](){ roundTrip( modes[m], &opts[o], &loop,
+                                               src, len, enc, dec ); } );
+
+            while ( doneCnt < total )
+                std::this_thread::yield();
+
+            if ( failCnt != before )
+            {
+                printf( "Failed !\n" );
+                break;
+            }
+            printf( "Ok.\n" );
+        }
+    }
+
+    if ( failCnt == 0 )
+    {
+        const size_t bigLen = (size_t)256 * 1024 * 1024 + 16;
+        uint8_t*     big    = (uint8_t*)calloc( bigLen, 1 );
+
+        printf( "library engine, 256 MB ... " );
+        fflush( stdout );
+
+        if ( big == NULL )
+            failCnt++;
+        else
+        {
+            total++;
+            loop.Post( [&](){ bigBuffer( &opts[0], big, bigLen ); } );
+
+            while ( doneCnt < total )
+                std::this_thread::yield();
+        }
+
+        printf( ( failCnt == 0 ) ? "Ok.\n" : "Failed !\n" );
+        free( big );
+    }
+
+    delete[] src;
+    delete[] enc;
+    delete[] dec;
+
+    return ( failCnt == 0 ) ? 0 : -1;
+}
+
+#endif /// of TWOFISH_ASYNC
@@ -7,7 +7,11 @@
 #include <cstdint>
 #include <cctype>
 
+#include <vector>
+#include <utility>
+
 #include "twofish.h"
+#include "tfkeyhandle.h"
 
 void prtHex( const uint8_t* p, size_t len )
 {
@@ -108,6 +112,111 @@ int main( int argc, char** argv )
     }
     
     printf( "Decoded : %s\n", decbuff );
+
+    printf( "Moving into vector ... " );
+    std::vector< TwoFish > tfv;
+    tfv.push_back( std::move( *tf ) );
+    tfv.emplace_back();
+    tfv.emplace_back();     /* grows, moves tfv[0] once more */
+    size_t mvbuffsz = tfv[0].Decode( encbuff, decbuff, encbuffsz );
+    if ( ( mvbuffsz != decbuffsz ) || 
+         ( memcmp( decbuff, testsrc, sizeof( testsrc ) ) != 0 ) )
+    {
+        printf( "Failed to decoding by moved object !\n" );
+        delete tf;
+        delete[] encbuff;
+        delete[] decbuff;
+        return -1;
+    }
+    printf( "Ok.\n" );
+
+    printf( "Parallel coding ... " );
+    fflush( stdout );
+    const uint8_t pmodes[] = { TWOFISH_MODE_ECB, TWOFISH_MODE_CBC, TWOFISH_MODE_CTR };
+    const char    piv[]    = "parallel iv  16b";
+    size_t   bigsz  = 1024 * 1024 + 17;
+    uint8_t* bigsrc = new uint8_t[ bigsz ];
+    genRand( (char*)bigsrc, bigsz );
+    for( size_t cnt=0; cnt<sizeof( pmodes ); cnt++ )
+    {
+        TwoFish  tfs( testkey, testkeylen, piv, strlen( piv ) );
+        TwoFish  tfp( testkey, testkeylen, piv, strlen( piv ) );
+        uint8_t* sencbuff = NULL;
+        uint8_t* pencbuff = NULL;
+        uint8_t* pdecbuff = NULL;
+
+        tfs.SetMode( pmodes[cnt] );
+        tfp.SetMode( pmodes[cnt] );
+        tfp.SetParallel( 4, 0 );
+
+        size_t ssz = tfs.Encode( bigsrc, sencbuff, bigsz );
+        size_t psz = tfp.Encode( bigsrc, pencbuff, bigsz );
+        size_t dsz = tfp.Decode( pencbuff, pdecbuff, psz );
+        bool   ok  = ( ssz == psz ) && ( ssz > 0 ) && ( dsz == psz ) &&
+                     ( memcmp( sencbuff, pencbuff, ssz ) == 0 ) &&
+                     ( memcmp( pdecbuff, bigsrc, bigsz ) == 0 );
+
+        // not a whole block : both paths clear the tail alike.
+        uint8_t* sdecbuff = new uint8_t[ psz ];
+        memset( sdecbuff, 0xFF, psz );
+        memset( pdecbuff, 0xFF, psz );
+        size_t   sdsz = tfs.Decode( pencbuff, sdecbuff, psz - 7 );
+        size_t   pdsz = tfp.Decode( pencbuff, pdecbuff, psz - 7 );
+        ok = ok && ( sdsz == pdsz ) &&
+             ( memcmp( sdecbuff, pdecbuff, psz - 7 ) == 0 );
+
+        delete[] sencbuff;
+        delete[] pencbuff;
+        delete[] pdecbuff;
+        delete[] sdecbuff;
+
+        if ( ok == false )
+        {
+            printf( "Failed in mode %u !\n", pmodes[cnt] );
+            delete tf;
+            delete[] bigsrc;
+            delete[] encbuff;
+            delete[] decbuff;
+            return -1;
+        }
+    }
+    delete[] bigsrc;
+    printf( "Ok.\n" );
+
+    printf( "Rotating key handle ... " );
+    fflush( stdout );
+    {
+        TwoFishKeyHandle kh;
+        TwoFish          tfh( testkey, testkeylen, piv, strlen( piv ) );
+        uint8_t*         henc = NULL;
+        uint8_t*         hdec = NULL;
+
+        tfh.SetKeyHandle( &kh );
+        bool ok = ( tfh.Encode( testsrc, henc, sizeof( testsrc ) ) == 0 );   /* no key yet */
+
+        kh.Publish( 128, "00112233445566778899AABBCCDDEEFF" );
+        size_t hsz = tfh.Encode( testsrc, henc, sizeof( testsrc ) );
+        ok = ok && ( hsz > 0 ) && ( tfh.Decode( henc, hdec, hsz ) == hsz ) &&
+             ( memcmp( hdec, testsrc, sizeof( testsrc ) ) == 0 );
+
+        /* next key, old ciphertext no longer decodes to source */
+        kh.Publish( 128, "FFEEDDCCBBAA99887766554433221100" );
+        ok = ok && ( tfh.Decode( henc, hdec, hsz ) == hsz ) &&
+             ( memcmp( hdec, testsrc, sizeof( testsrc ) ) != 0 );
+
+        delete[] henc;
+        delete[] hdec;
+
+        if ( ok == false )
+        {
+            printf( "Failed !\n" );
+            delete tf;
+            delete[] encbuff;
+            delete[] decbuff;
+            return -1;
+        }
+    }
+    printf( "Ok.\n" );
     
     delete tf;
     delete[] encbuff;
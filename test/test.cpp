@@ -36,8 +36,34 @@
 #include <ctime>
 #include <cstdint>
 #include <cctype>
+#include <chrono>
+#include <atomic>
+#include <thread>
+
+#if defined(__linux__)
+    #include <unistd.h>
+    #include <sys/stat.h>
+    #include <sys/socket.h>
+    #include <netinet/in.h>
+    #include <arpa/inet.h>
+#endif
 
 #include "tfish.h"
+#include "tfkeycache.h"
+#include "tfkeyarena.h"
+#include "tfkeyblob.h"
+#include "tfengine.h"
+#include "tfbatcher.h"
+#include "tfkeyhandle.h"
+#include "tfstream.h"
+#include "tfuring.h"
+#include "tfmapfile.h"
+#include "tfgcm.h"
+#include "tfcontainer.h"
+#include "tfjournal.h"
+#include "tfpagecache.h"
+#include "tfchannel.h"
+#include "tfdatagram.h"
 
 /*
 +*****************************************************************************
@@ -68,6 +94,7 @@ int         debug       =   0;  /* debugging mode */
 int         verbose     =   0;  /* verbose output */
 int         quietVerify =   0;  /* quiet during verify */
 int         timeIterCnt =   0;  /* how many times to iterate for timing */
+int         bigTabIterCnt = 0;  /* how many reKeys for big table timing */
 uint32_t    randBits[64]= {1};  /* use Knuth's additive generator */
 int         randPtr;
 testData *  debugTD     = NULL; /* for use with debugIO */
@@ -368,198 +395,3430 @@ void TimeOps(int iterCnt)
             testTime[q][n]=minT;
             }
         }
-    /* now print all the results */
-#ifdef HI_RES_CLK
-    if (!FMT_LOG)
+    /* now print all the results */
+#ifdef HI_RES_CLK
+    if (!FMT_LOG)
+        {
+        printf("\nCalibrate GetTimer(): ",t1-t0);
+        for (i=0;i<sizeof(dt)/sizeof(dt[0]);i++)
+            printf("%6ld",dt[i]);
+        printf("\n\n");
+        }
+#else
+    printf("All times in clks, assuming %d MHz CPU (use -fmNN switch to set)\n",CLK_MHZ);
+    printf("CLOCKS_PER_SEC = %8.1f\n",(double)CLOCKS_PER_SEC);
+#endif
+
+    printf("%-13s","keySize=");
+    for (t.keySize=KEY_BITS_0;t.keySize<=MAX_KEY_BITS;t.keySize+=STEP_KEY_BITS)
+        printf("%10d bits  ",t.keySize);
+    printf("\n");
+        
+    for (n=0;n<TEST_CNT;n++)
+        {
+        printf("%-13s",testName[n]);
+        for (q=0;q<3;q++)
+            {
+            printf(format[n],TSCALE*testTime[q][n]/(ICNT*(double)denom[n]),atomName[n]);
+            }
+        printf("\n");
+        }
+    if (FMT_LOG)
+        printf(";;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;\n");
+    }
+
+
+/*
++*****************************************************************************
+*
+* Function Name:    TimeBigTab
+*
+* Function:         Time reKey() with and without the big keying table,
+*                   as other data between calls pushes tables out of cache
+*
+* Arguments:        iterCnt = how many reKey calls per measurement
+*
+* Return:           None.
+*
+* Notes:            Between two reKey calls, evictKB of other data is
+*                   read, the way a server touches session data between
+*                   rekeys.  Only the reKey calls are timed, best of 3.
+*                   Prints the largest evictKB where the big table
+*                   still beats the chained q lookups.
+*
+-****************************************************************************/
+void TimeBigTab(int iterCnt)
+    {
+    enum { EVICT_CNT = 9, KEY_CNT = 3, LINE = 64 };
+    static const size_t evictKB[EVICT_CNT] = { 0,16,64,128,256,512,1024,4096,16384 };
+    static keyInstance ki;
+    static uint8_t     *evict = NULL;
+    const char  *modeName[3] = { "chained q  ", "big table  ", "vector     " };
+    double  ns[EVICT_CNT][KEY_CNT][3];
+    size_t  e,n,j,k,m,r,keySize,payKB[KEY_CNT];
+    std::chrono::steady_clock::time_point t0;
+    double  tSum;
+    volatile uint8_t sink = 0;
+    int     hasVec;
+
+    SimdOp(SIMD_ENABLE);
+    hasVec = (SimdOp(SIMD_QUERY) == TF_SUCCESS);
+    evict  = (uint8_t *) malloc(evictKB[EVICT_CNT-1]*1024);
+    if (evict == NULL)
+        FatalError("No memory for big table timing","");
+    memset(evict,1,evictKB[EVICT_CNT-1]*1024);
+
+    for (j=0;j<MAX_KEY_SIZE;j++)
+        ki.keyMaterial[j]=hexTab[Rand() & 0xF];
+
+    for (e=0;e<EVICT_CNT;e++)
+    for (k=0,keySize=KEY_BITS_0;k<KEY_CNT;k++,keySize+=STEP_KEY_BITS)
+    for (m=0;m<3;m++)
+        {
+        size_t lines = evictKB[e]*1024/LINE;
+        size_t iters = iterCnt;
+
+        /* keep big evictions from taking forever */
+        if (evictKB[e] > 1024)
+            iters = iterCnt*1024/evictKB[e];
+        if (iters < 16)
+            iters = 16;
+
+        SimdOp((m == 2) ? SIMD_ENABLE : SIMD_DISABLE);
+        BigTabOp((m == 1) ? BIGTAB_ENABLE : BIGTAB_DISABLE);
+        makeKey(&ki,DIR_ENCRYPT,keySize,ki.keyMaterial);
+
+        for (r=0;r<3;r++)
+            {
+            for (n=0,tSum=0;n<iters;n++)
+                {
+                for (j=0;j<lines;j++)
+                    sink += evict[j*LINE];
+                ki.key32[0]+=0x87654321;
+                t0=std::chrono::steady_clock::now();
+                reKey(&ki);
+                tSum+=std::chrono::duration<double,std::nano>(
+                          std::chrono::steady_clock::now()-t0).count();
+                }
+            if ((r == 0) || (ns[e][k][m] > tSum/iters))
+                ns[e][k][m]=tSum/iters;
+            }
+        }
+    BigTabOp(BIGTAB_DISABLE);
+    SimdOp(SIMD_ENABLE);
+    free(evict);
+
+    printf("reKey ns/call, with evictKB of other data read between calls\n");
+    printf("%-9s %-11s","evictKB","keying");
+    for (k=0,keySize=KEY_BITS_0;k<KEY_CNT;k++,keySize+=STEP_KEY_BITS)
+        printf("%8d bits",(int)keySize);
+    printf("\n");
+    for (e=0;e<EVICT_CNT;e++)
+    for (m=0;m<3;m++)
+        {
+        if ((m == 2) && (!hasVec))
+            continue;
+        printf("%-9d %s",(int)evictKB[e],modeName[m]);
+        for (k=0;k<KEY_CNT;k++)
+            printf("%13.0f",ns[e][k][m]);
+        printf("\n");
+        }
+
+    for (k=0,keySize=KEY_BITS_0;k<KEY_CNT;k++,keySize+=STEP_KEY_BITS)
+        {
+        payKB[k]=0;
+        for (e=0;(e<EVICT_CNT) && (ns[e][k][1] < ns[e][k][0]);e++)
+            payKB[k]=evictKB[e]+1;
+        if (payKB[k] == evictKB[EVICT_CNT-1]+1)
+            printf("%d-bit keys: big table pays off at all sizes tested%s\n",(int)keySize,
+                   (hasVec && (ns[0][k][2] < ns[0][k][1])) ? " (vector keying is faster still)" : "");
+        else if (payKB[k])
+            printf("%d-bit keys: big table pays off up to %d KB between rekeys%s\n",
+                   (int)keySize,(int)payKB[k]-1,
+                   (hasVec && (ns[0][k][2] < ns[0][k][1])) ? " (vector keying is faster still)" : "");
+        else
+            printf("%d-bit keys: big table does not pay off\n",(int)keySize);
+        }
+    }
+
+
+/*
++*****************************************************************************
+*
+* Function Name:    AES_Sanity_Check
+*
+* Function:         Make sure things work to the interface spec and
+*                   that encryption and decryption are inverse functions
+*
+* Arguments:        None.
+*
+* Return:           None.
+*
+* Notes:            Will FatalError if any problems found
+*
+-****************************************************************************/
+void AES_Sanity_Check(int testCnt)
+    {
+    static uint32_t hexVal[] =
+            {0x67452301,0xEFCDAB89,0x98BADCFE,0x10325476,
+             0x33221100,0x77665544,0xBBAA9988,0xFFEEDDCC};
+    const char *modeNames[]={"(null)","MODE_ECB","MODE_CBC","MODE_CFB1"};
+
+    int i,j,q,n,testNum,lim,saveDebug=debug;
+    testData t;
+    keyInstance k2;
+    uint8_t pt[128];
+    uint8_t ct[128];
+    char ivString[BLOCK_SIZE/4];
+    const char *mName = NULL;
+    uint8_t mode;
+#if ALIGN32
+    uint8_t alignDummy[3]; /* keep dword alignment on stack after uint8_t mode */
+#endif
+
+    if (!quietVerify) 
+    {
+        printf("\nTwofish code sanity check...");
+        fflush( stdout );
+    }
+    
+#if (MODE_CFB1 != MODE_ECB  + 2)
+    #error Need to change mode loop constants
+#endif
+    
+    if (testCnt)
+    for (mode=MODE_ECB;mode<=MODE_CFB1;mode++)
+    {        
+        debug=(mode == saveDebug);
+        mName=modeNames[(size_t)mode];
+        if (cipherInit(&t.ci,mode,hexString) != TF_SUCCESS)
+            FatalError("cipherInit error during sanity check %s",mName);
+        if (t.ci.mode != mode)
+            FatalError("Cipher mode not set properly during sanity check %s",mName);
+        if (mode != MODE_ECB)
+            for (i=0;i<BLOCK_SIZE/32;i++)
+                if (t.ci.iv32[i] != hexVal[i])
+                    FatalError("Invalid IV parse during sanity check %s",mName);
+        lim = (mode == MODE_CFB1) ? (testCnt+31)/32 : testCnt;
+        for (t.keySize=KEY_BITS_0;t.keySize <= MAX_KEY_BITS;t.keySize+=STEP_KEY_BITS)
+            {
+            /* printf("Running %-9s sanity check on keySize = %3d.\n",mName,t.keySize); */
+            if (!quietVerify) printf(".");  /* show some progress */
+            ClearTestData(&t);
+            debug=0;            /* don't show debug info in this makeKey call */
+            if (makeKey(&t.ki,DIR_ENCRYPT,t.keySize,hexString) != TF_SUCCESS)
+                FatalError("Error parsing key during sanity check %s",mName);
+            debug=(mode == saveDebug);
+            for (i=0;i<t.keySize/32;i++)
+                if (t.ki.key32[i]!=hexVal[i])
+                    FatalError("Invalid key parse during sanity check %s",mName);
+            for (testNum=0;testNum<lim;testNum++)
+                {                       /* run a bunch of encode/decode tests */
+                if ((testNum&0x1F)==0)  /* periodic re-key time? */
+                    {
+                    for (j=0;j<t.keySize/4;j++)
+                        t.ki.keyMaterial[j]=hexTab[Rand() & 0xF];
+                    if (testNum==0)
+                        ClearTestData(&t);  /* give "easy" test data the first time */
+                    if (makeKey(&t.ki,DIR_ENCRYPT,t.keySize,t.ki.keyMaterial) != TF_SUCCESS)
+                        FatalError("Encrypt makeKey during sanity check %s",mName);
+                    debug=0;
+                    if (makeKey(&k2  ,DIR_DECRYPT,t.keySize,t.ki.keyMaterial) != TF_SUCCESS)
+                        FatalError("Decrypt makeKey during sanity check %s",mName);
+                    debug=(mode == saveDebug);
+                    }
+                if (mode != MODE_ECB)               /* set IV  if needed*/
+                    for (j=0;j<BLOCK_SIZE/4;j++)
+                        ivString[j]=hexTab[(testNum)? Rand() & 0xF : 0];
+                if ((debug) || (testNum == 0))
+                    n = (BLOCK_SIZE/8);             /* do only one block if debugging */
+                else
+                    n = (BLOCK_SIZE/8)*(1 + (Rand() % (sizeof(pt)/(BLOCK_SIZE/8))));
+
+                for (j=0;j<n;j++)                   /* set random plaintext */
+                    pt[j]=(testNum) ? (uint8_t) Rand() : 0;
+                if (mode == MODE_CBC)
+                    {   /* check that CBC works as advertised */
+                    cipherInit(&t.ci,mode,ivString);
+                    t.ci.mode=MODE_ECB;
+                    for (q=0;q<BLOCK_SIZE/8;q++)    /* copy over the iv */
+                        t.pt[q] = (uint8_t) (t.ci.iv32[q/4] >> (8*(q&3))); /* auto-Bswap! */
+                    for (j=0;j<n;j+=BLOCK_SIZE/8)
+                        {
+                        for (q=0;q<BLOCK_SIZE/8;q++)    /* xor in next block */
+                            t.pt[q] ^= pt[j+q];
+                        debug=0;
+                        if (BLOCK_SIZE != blockEncrypt(&t.ci,&t.ki,t.pt,BLOCK_SIZE,t.pt))
+                            FatalError("blockEncrypt return value during sanity check %s",mName);
+                        debug=(mode == saveDebug);
+                        }
+                    t.ci.mode=MODE_CBC;         /* restore mode */
+                    }
+                /* encrypt */
+                cipherInit(&t.ci,mode,ivString);
+                if ((testNum < 4) || (Rand() & 1))
+                    {
+                    if (n*8 != blockEncrypt(&t.ci,&t.ki,pt,n*8,ct))
+                        FatalError("blockEncrypt return value during sanity check %s",mName);
+                    }
+                else    /* do it in pieces */
+                    for (j=0;j<n;j+=BLOCK_SIZE/8)
+                        if (BLOCK_SIZE != blockEncrypt(&t.ci,&t.ki,pt+j,BLOCK_SIZE,ct+j))
+                        FatalError("blockEncrypt return value during sanity check %s",mName);
+                            
+                if (mode == MODE_CBC)           /* validate CBC "hash" */
+                    for (q=0;q<BLOCK_SIZE/8;q++)
+                        if (t.pt[q] != ct[n-BLOCK_SIZE/8+q])
+                            FatalError("CBC doesn't work during sanity check %s",mName);
+                /* decrypt */
+                cipherInit(&t.ci,mode,ivString);
+                if ((testNum < 4) || (Rand() & 1))
+                    {
+                    if (n*8 != blockDecrypt(&t.ci,&t.ki,ct,n*8,ct))
+                        FatalError("blockDecrypt return value during sanity check %s",mName);
+                    }
+                else    /* do it in pieces */
+                    for (j=0;j<n;j+=BLOCK_SIZE/8)
+                        if (BLOCK_SIZE != blockDecrypt(&t.ci,&t.ki,ct+j,BLOCK_SIZE,ct+j))
+                        FatalError("blockEncrypt return value during sanity check %s",mName);
+
+                /* compare */
+                for (j=0;j<n;j++)
+                    if (pt[j] != ct[j])
+                        {
+                        char s[128];
+                        sprintf(s,"Sanity check: encrypt/decrypt miscompare (mode=%s,keySize=%d)",
+                                mName,t.keySize);
+                        FatalError(s,"");
+                        }
+                if (debug)
+                    {
+                    if (testNum >= debug)
+                        exit(1);
+                    printf(";-------------------------------------------------\n");
+                    }
+                }
+            }
+    }
+    debug=saveDebug;
+    if (!quietVerify) printf("  OK\n");
+    }
+
+
+/*
++*****************************************************************************
+*
+* Function Name:    Lanes_Sanity_Check
+*
+* Function:         Make sure multi-key lanes give same result as
+*                   blockEncrypt/blockDecrypt on each lane
+*
+* Arguments:        testCnt =   # of lane sets to run per mode
+*
+* Return:           None.
+*
+* Notes:            Runs with vector kernels off, then on.
+*                   Will FatalError if any problems found
+*
+-****************************************************************************/
+void Lanes_Sanity_Check(int testCnt)
+    {
+    enum { KEY_CNT = 5, LANE_MAX = 21, BLK_MAX = 6 };
+    static keyInstance ki[KEY_CNT];
+    static keyInstance ksave[KEY_CNT];
+    static keyInstance kref;
+    cipherInstance ci[LANE_MAX];
+    cipherInstance cref;
+    laneInstance   ln[LANE_MAX];
+    uint32_t ivSave[LANE_MAX][BLOCK_SIZE/32];
+    uint8_t  pt[LANE_MAX][BLK_MAX*BLOCK_SIZE/8];
+    uint8_t  ct[LANE_MAX][BLK_MAX*BLOCK_SIZE/8];
+    uint8_t  rt[BLK_MAX*BLOCK_SIZE/8];
+    char     keyMaterial[MAX_KEY_SIZE+4];
+    char     ivString[BLOCK_SIZE/4+1];
+    int      i,j,n,testNum,simd,laneCnt,keySize;
+    int      keyIdx[LANE_MAX];
+    uint8_t  mode;
+
+    if (!quietVerify)
+        {
+        printf("Twofish lanes sanity check...");
+        fflush( stdout );
+        }
+
+    for (simd=SIMD_DISABLE;simd<=SIMD_ENABLE;simd++)
+    for (mode=MODE_ECB;mode<=MODE_CBC;mode++)
+    for (testNum=0;testNum<testCnt;testNum++)
+        {
+        SimdOp(simd);
+        for (i=0;i<KEY_CNT;i++)
+            {
+            keySize = KEY_BITS_0 + STEP_KEY_BITS*(Rand() % 3);
+            for (j=0;j<keySize/4;j++)
+                keyMaterial[j]=hexTab[Rand() & 0xF];
+            keyMaterial[j]=0;
+            if (makeKey(&ki[i],(Rand() & 1) ? DIR_ENCRYPT : DIR_DECRYPT,
+                        keySize,keyMaterial) != TF_SUCCESS)
+                FatalError("makeKey during lanes sanity check","");
+            }
+        memcpy(ksave,ki,sizeof(ki));
+
+        laneCnt = 1 + (Rand() % LANE_MAX);
+        for (i=0;i<laneCnt;i++)
+            {
+            for (j=0;j<BLOCK_SIZE/4;j++)
+                ivString[j]=hexTab[Rand() & 0xF];
+            ivString[j]=0;
+            cipherInit(&ci[i],mode,ivString);
+            BlockCopy(ivSave[i],ci[i].iv32);
+            keyIdx[i] = Rand() % KEY_CNT;
+            n         = Rand() % (BLK_MAX+1);
+            for (j=0;j<n*BLOCK_SIZE/8;j++)
+                pt[i][j]=(uint8_t) Rand();
+            ln[i].key       = &ki[keyIdx[i]];
+            ln[i].cipher    = ((mode == MODE_ECB) && (Rand() & 1)) ? NULL : &ci[i];
+            ln[i].input     = pt[i];
+            ln[i].inputLen  = n*BLOCK_SIZE;
+            ln[i].outBuffer = ct[i];
+            ln[i].result    = BAD_PARAMS;
+            }
+
+        if (blockEncryptLanes(ln,laneCnt) != TF_SUCCESS)
+            FatalError("blockEncryptLanes return value during lanes sanity check","");
+        if (memcmp(ksave,ki,sizeof(ki)))
+            FatalError("blockEncryptLanes modified a key during lanes sanity check","");
+
+        for (i=0;i<laneCnt;i++)
+            {   /* compare with a single key call */
+            if (ln[i].result != (int)ln[i].inputLen)
+                FatalError("blockEncryptLanes lane result during lanes sanity check","");
+            kref = ksave[keyIdx[i]];
+            cref = ci[i];
+            BlockCopy(cref.iv32,ivSave[i]);
+            if (blockEncrypt(&cref,&kref,pt[i],ln[i].inputLen,rt) != (int)ln[i].inputLen)
+                FatalError("blockEncrypt return value during lanes sanity check","");
+            if (memcmp(rt,ct[i],ln[i].inputLen/8))
+                FatalError("Lanes sanity check: encrypt miscompare (simd=%s)",
+                           (SimdOp(SIMD_QUERY) == TF_SUCCESS) ? "on" : "off");
+            if ((ln[i].cipher != NULL) && memcmp(cref.iv32,ci[i].iv32,BLOCK_SIZE/8))
+                FatalError("Lanes sanity check: CBC iv miscompare","");
+            BlockCopy(ci[i].iv32,ivSave[i]);
+            ln[i].input     = ct[i];
+            ln[i].outBuffer = ct[i];    /* decrypt in place */
+            }
+
+        if (blockDecryptLanes(ln,laneCnt) != TF_SUCCESS)
+            FatalError("blockDecryptLanes return value during lanes sanity check","");
+        for (i=0;i<laneCnt;i++)
+            if (memcmp(pt[i],ct[i],ln[i].inputLen/8))
+                FatalError("Lanes sanity check: decrypt miscompare (simd=%s)",
+                           (SimdOp(SIMD_QUERY) == TF_SUCCESS) ? "on" : "off");
+        }
+    if (!quietVerify) printf("  OK\n");
+    }
+
+
+/* compare the parts of two keys made by makeKey() */
+int SameKeySchedule(const keyInstance *a,const keyInstance *b)
+    {
+    /* sboxKeys past keyLen are left as they were by reKey() */
+    return (a->direction == b->direction) && (a->keyLen == b->keyLen) &&
+           (a->numRounds == b->numRounds) &&
+           !memcmp(a->key32,b->key32,sizeof(a->key32)) &&
+           !memcmp(a->sboxKeys,b->sboxKeys,a->keyLen/64*sizeof(uint32_t)) &&
+           !memcmp(a->subKeys,b->subKeys,sizeof(a->subKeys)) &&
+           !memcmp(a->sBox8x32,b->sBox8x32,sizeof(a->sBox8x32));
+    }
+
+
+/*
++*****************************************************************************
+*
+* Function Name:    ReKey_Sanity_Check
+*
+* Function:         Make sure vector and big table key schedules are
+*                   same as portable one
+*
+* Arguments:        testCnt =   # of random keys per key size
+*
+* Return:           None.
+*
+* Notes:            Also checks the published zero plaintext vectors,
+*                   with vector kernels and big table off and on.
+*                   Will FatalError if any problems found
+*
+-****************************************************************************/
+void ReKey_Sanity_Check(int testCnt)
+    {
+    static const char *katKey[3] =
+        {
+        "00000000000000000000000000000000",
+        "0123456789ABCDEFFEDCBA98765432100011223344556677",
+        "0123456789ABCDEFFEDCBA987654321000112233445566778899AABBCCDDEEFF"
+        };
+    static const uint8_t katCT[3][BLOCK_SIZE/8] =
+        {
+        { 0x9F,0x58,0x9F,0x5C,0xF6,0x12,0x2C,0x32,0xB6,0xBF,0xEC,0x2F,0x2A,0xE8,0xC3,0x5A },
+        { 0xCF,0xD1,0xD2,0xE5,0xA9,0xBE,0x9C,0xDF,0x50,0x1F,0x13,0xB8,0x92,0xBD,0x22,0x48 },
+        { 0x37,0x52,0x7B,0xE0,0x05,0x23,0x34,0xB8,0x9F,0x0C,0xFC,0xCA,0xE8,0x7C,0xFA,0x20 }
+        };
+    static keyInstance kv;
+    static keyInstance kp;
+    static keyInstance kb;
+    cipherInstance ci;
+    uint8_t  pt[BLOCK_SIZE/8];
+    uint8_t  ct[BLOCK_SIZE/8];
+    char     keyMaterial[MAX_KEY_SIZE+4];
+    int      i,j,testNum,simd,big,keySize;
+
+    if (!quietVerify)
+        {
+        printf("Twofish key schedule sanity check...");
+        fflush( stdout );
+        }
+
+    memset(pt,0,sizeof(pt));
+    if (cipherInit(&ci,MODE_ECB,NULL) != TF_SUCCESS)
+        FatalError("cipherInit during key schedule sanity check","");
+
+    for (big=BIGTAB_DISABLE;big<=BIGTAB_ENABLE;big++)
+    for (simd=SIMD_DISABLE;simd<=SIMD_ENABLE;simd++)
+        {
+        BigTabOp(big);
+        SimdOp(simd);
+        for (i=0;i<3;i++)
+            {
+            keySize = KEY_BITS_0 + STEP_KEY_BITS*i;
+            if (makeKey(&kv,DIR_ENCRYPT,keySize,katKey[i]) != TF_SUCCESS)
+                FatalError("makeKey during key schedule sanity check","");
+            if ((blockEncrypt(&ci,&kv,pt,BLOCK_SIZE,ct) != BLOCK_SIZE) ||
+                memcmp(ct,katCT[i],sizeof(ct)))
+                FatalError("Key schedule sanity check: KAT miscompare (simd/big table=%s)",
+                           (SimdOp(SIMD_QUERY) == TF_SUCCESS) ? "on" : "off");
+            }
+        }
+    BigTabOp(BIGTAB_DISABLE);
+
+    for (testNum=0;testNum<testCnt;testNum++)
+        {
+        keySize = KEY_BITS_0 + STEP_KEY_BITS*(testNum % 3);
+        for (j=0;j<keySize/4;j++)
+            keyMaterial[j]=hexTab[Rand() & 0xF];
+        keyMaterial[j]=0;
+
+        SimdOp(SIMD_DISABLE);
+        if (makeKey(&kp,DIR_ENCRYPT,keySize,keyMaterial) != TF_SUCCESS)
+            FatalError("makeKey during key schedule sanity check","");
+        BigTabOp(BIGTAB_ENABLE);
+        if (makeKey(&kb,DIR_ENCRYPT,keySize,keyMaterial) != TF_SUCCESS)
+            FatalError("makeKey during key schedule sanity check","");
+        BigTabOp(BIGTAB_DISABLE);
+        SimdOp(SIMD_ENABLE);
+        if (makeKey(&kv,DIR_ENCRYPT,keySize,keyMaterial) != TF_SUCCESS)
+            FatalError("makeKey during key schedule sanity check","");
+        if (!SameKeySchedule(&kv,&kp))
+            FatalError("Key schedule sanity check: vector/portable miscompare","");
+        if (!SameKeySchedule(&kb,&kp))
+            FatalError("Key schedule sanity check: big table/portable miscompare","");
+        }
+
+    if (!quietVerify) printf("  OK\n");
+    }
+
+
+/*
++*****************************************************************************
+*
+* Function Name:    SBox_Sanity_Check
+*
+* Function:         Make sure key schedules fill every S-box entry
+*
+* Arguments:        None.
+*
+* Return:           None.
+*
+* Notes:            Runs the chains of the published tables test (ecb_tbl),
+*                   where every key is the last plaintext and the key
+*                   before it, on key instances filled with junk first :
+*                   an S-box entry reKey() leaves alone shows up as a
+*                   wrong last ciphertext.
+*                   Will FatalError if any problems found
+*
+-****************************************************************************/
+void SBox_Sanity_Check(void)
+    {
+    static const uint8_t tblCT[3][BLOCK_SIZE/8] =    /* I=49 */
+        {
+        { 0x5D,0x9D,0x4E,0xEF,0xFA,0x91,0x51,0x57,0x55,0x24,0xF1,0x15,0x81,0x5A,0x12,0xE0 },
+        { 0xE7,0x54,0x49,0x21,0x2B,0xEE,0xF9,0xF4,0xA3,0x90,0xBD,0x86,0x0A,0x64,0x09,0x41 },
+        { 0x37,0xFE,0x26,0xFF,0x1C,0xF6,0x61,0x75,0xF5,0xDD,0xF4,0xC3,0x3B,0x97,0xA2,0x05 }
+        };
+    static keyInstance ki;
+    cipherInstance ci;
+    uint8_t  kb[MAX_KEY_BITS/8];
+    uint8_t  pt[BLOCK_SIZE/8];
+    uint8_t  ct[BLOCK_SIZE/8];
+    char     keyMaterial[MAX_KEY_SIZE+4];
+    int      i,j,n,big,keySize;
+
+    if (!quietVerify)
+        {
+        printf("Twofish S-box sanity check...");
+        fflush( stdout );
+        }
+
+    if (cipherInit(&ci,MODE_ECB,NULL) != TF_SUCCESS)
+        FatalError("cipherInit during S-box sanity check","");
+
+    for (big=BIGTAB_DISABLE;big<=BIGTAB_ENABLE;big++)
+        {
+        BigTabOp(big);
+        for (n=0;n<3;n++)
+            {
+            keySize = KEY_BITS_0 + STEP_KEY_BITS*n;
+            memset(kb,0,sizeof(kb));
+            memset(pt,0,sizeof(pt));
+            for (i=1;i<=49;i++)
+                {
+                for (j=0;j<keySize/8;j++)
+                    {
+                    keyMaterial[2*j  ]=hexTab[kb[j] >> 4];
+                    keyMaterial[2*j+1]=hexTab[kb[j] & 0xF];
+                    }
+                keyMaterial[2*j]=0;
+                memset(&ki,(i & 1) ? 0xA5 : 0x5A,sizeof(ki));
+                if (makeKey(&ki,DIR_ENCRYPT,keySize,keyMaterial) != TF_SUCCESS)
+                    FatalError("makeKey during S-box sanity check","");
+                if (blockEncrypt(&ci,&ki,pt,BLOCK_SIZE,ct) != BLOCK_SIZE)
+                    FatalError("blockEncrypt during S-box sanity check","");
+                memmove(kb+BLOCK_SIZE/8,kb,sizeof(kb)-BLOCK_SIZE/8);
+                memcpy(kb,pt,BLOCK_SIZE/8);
+                memcpy(pt,ct,BLOCK_SIZE/8);
+                }
+            if (memcmp(ct,tblCT[n],sizeof(ct)))
+                FatalError("S-box sanity check: tables KAT miscompare (big table=%s)",
+                           (big == BIGTAB_ENABLE) ? "on" : "off");
+            }
+        }
+    BigTabOp(BIGTAB_DISABLE);
+
+    if (!quietVerify) printf("  OK\n");
+    }
+
+
+/*
++*****************************************************************************
+*
+* Function Name:    Lazy_Sanity_Check
+*
+* Function:         Make sure lazy keys cipher same as fully expanded ones
+*
+* Arguments:        testCnt =   # of keys per key size
+*
+* Return:           None.
+*
+* Notes:            Small calls must leave the key lazy, the first call
+*                   above LAZY_BLOCKS must expand it to same S-boxes.
+*                   Will FatalError if any problems found
+*
+-****************************************************************************/
+void Lazy_Sanity_Check(int testCnt)
+    {
+    enum { BLK_MAX = LAZY_BLOCKS+3 };
+    static keyInstance kl;
+    static keyInstance ke;
+    cipherInstance cl,ce;
+    uint8_t  pt[BLK_MAX*BLOCK_SIZE/8];
+    uint8_t  ct[BLK_MAX*BLOCK_SIZE/8];
+    uint8_t  rt[BLK_MAX*BLOCK_SIZE/8];
+    char     keyMaterial[MAX_KEY_SIZE+4];
+    char     ivString[BLOCK_SIZE/4+1];
+    int      i,j,n,testNum,keySize,bits;
+    uint8_t  mode,dir;
+
+    if (!quietVerify)
+        {
+        printf("Twofish lazy S-box sanity check...");
+        fflush( stdout );
+        }
+
+    for (testNum=0;testNum<testCnt*3;testNum++)
+        {
+        keySize = KEY_BITS_0 + STEP_KEY_BITS*(testNum % 3);
+        mode    = MODE_ECB + (Rand() % 3);
+        dir     = (Rand() & 1) ? DIR_ENCRYPT : DIR_DECRYPT;
+        for (j=0;j<keySize/4;j++)
+            keyMaterial[j]=hexTab[Rand() & 0xF];
+        keyMaterial[j]=0;
+        for (j=0;j<BLOCK_SIZE/4;j++)
+            ivString[j]=hexTab[Rand() & 0xF];
+        ivString[j]=0;
+
+        LazyOp(LAZY_DISABLE);
+        if (makeKey(&ke,dir,keySize,keyMaterial) != TF_SUCCESS)
+            FatalError("makeKey during lazy sanity check","");
+        LazyOp(LAZY_ENABLE);
+        if (makeKey(&kl,dir,keySize,keyMaterial) != TF_SUCCESS)
+            FatalError("makeKey during lazy sanity check","");
+        if (kl.sboxReady)
+            FatalError("Lazy sanity check: key expanded by makeKey","");
+
+        /* small calls, then one bulk call, each way */
+        for (i=0;i<4;i++)
+            {
+            n    = (i < 3) ? 1 + (Rand() % LAZY_BLOCKS) : BLK_MAX;
+            bits = (mode == MODE_CFB1) ? ((i < 3) ? n : n*8) : n*BLOCK_SIZE;
+            for (j=0;j<n*BLOCK_SIZE/8;j++)
+                pt[j]=(uint8_t) Rand();
+            if (bits & 7)   /* CFB1 leaves bits past the end as they were */
+                pt[bits/8] &= (uint8_t)(0xFF00 >> (bits & 7));
+            memset(ct,0,sizeof(ct));
+            memset(rt,0,sizeof(rt));
+            cipherInit(&cl,mode,ivString);
+            cipherInit(&ce,mode,ivString);
+            if ((blockEncrypt(&cl,&kl,pt,bits,ct) != bits) ||
+                (blockEncrypt(&ce,&ke,pt,bits,rt) != bits) ||
+                memcmp(ct,rt,(bits+7)/8))
+                FatalError("Lazy sanity check: encrypt miscompare","");
+            if (kl.sboxReady != (uint32_t)(i == 3))
+                FatalError("Lazy sanity check: expanded at wrong time","");
+            memset(rt,0,sizeof(rt));
+            cipherInit(&cl,mode,ivString);
+            cipherInit(&ce,mode,ivString);
+            if ((blockDecrypt(&cl,&kl,ct,bits,rt) != bits) ||
+                memcmp(pt,rt,(bits+7)/8) ||
+                (memset(rt,0,sizeof(rt)) == NULL) ||
+                (blockDecrypt(&ce,&ke,ct,bits,rt) != bits) ||
+                memcmp(pt,rt,(bits+7)/8))
+                FatalError("Lazy sanity check: decrypt miscompare","");
+            }
+        if (!SameKeySchedule(&kl,&ke))
+            FatalError("Lazy sanity check: expanded key miscompare","");
+        }
+    LazyOp(LAZY_DISABLE);
+
+    if (!quietVerify) printf("  OK\n");
+    }
+
+
+/*
++*****************************************************************************
+*
+* Function Name:    Compact_Sanity_Check
+*
+* Function:         Make sure compact keys cipher same as full keys
+*
+* Arguments:        testCnt =   # of keys per key size
+*
+* Return:           None.
+*
+* Notes:            Also checks promoteKey() gives the makeKey() schedule,
+*                   and demoteKey() gives back the compact key.
+*                   Will FatalError if any problems found
+*
+-****************************************************************************/
+void Compact_Sanity_Check(int testCnt)
+    {
+    enum { BLK_MAX = 2*LAZY_BLOCKS+1 };
+    static keyInstance ke;
+    static keyInstance kp;
+    compactKey  kc,kd;
+    cipherInstance cc,ce;
+    uint8_t  pt[BLK_MAX*BLOCK_SIZE/8];
+    uint8_t  ct[BLK_MAX*BLOCK_SIZE/8];
+    uint8_t  rt[BLK_MAX*BLOCK_SIZE/8];
+    char     keyMaterial[MAX_KEY_SIZE+4];
+    char     ivString[BLOCK_SIZE/4+1];
+    int      j,n,testNum,keySize,bits;
+    uint8_t  mode,dir;
+
+    if (!quietVerify)
+        {
+        printf("Twofish compact key sanity check...");
+        fflush( stdout );
+        }
+
+    if (sizeof(compactKey) > 256)
+        FatalError("Compact sanity check: compactKey too big","");
+
+    for (testNum=0;testNum<testCnt*3;testNum++)
+        {
+        keySize = KEY_BITS_0 + STEP_KEY_BITS*(testNum % 3);
+        mode    = MODE_ECB + (Rand() % 3);
+        dir     = (Rand() & 1) ? DIR_ENCRYPT : DIR_DECRYPT;
+        n       = 1 + (Rand() % BLK_MAX);
+        bits    = (mode == MODE_CFB1) ? n : n*BLOCK_SIZE;
+        for (j=0;j<keySize/4;j++)
+            keyMaterial[j]=hexTab[Rand() & 0xF];
+        keyMaterial[j]=0;
+        for (j=0;j<BLOCK_SIZE/4;j++)
+            ivString[j]=hexTab[Rand() & 0xF];
+        ivString[j]=0;
+        for (j=0;j<n*BLOCK_SIZE/8;j++)
+            pt[j]=(uint8_t) Rand();
+        if (bits & 7)   /* CFB1 leaves bits past the end as they were */
+            pt[bits/8] &= (uint8_t)(0xFF00 >> (bits & 7));
+
+        if ((makeKey(&ke,dir,keySize,keyMaterial) != TF_SUCCESS) ||
+            (makeCompactKey(&kc,dir,keySize,keyMaterial) != TF_SUCCESS))
+            FatalError("makeKey during compact sanity check","");
+
+        if ((promoteKey(&kp,&kc) != TF_SUCCESS) || !SameKeySchedule(&kp,&ke) ||
+            memcmp(kp.keyMaterial,keyMaterial,keySize/4))
+            FatalError("Compact sanity check: promoted key miscompare","");
+
+        memset(ct,0,sizeof(ct));
+        memset(rt,0,sizeof(rt));
+        cipherInit(&cc,mode,ivString);
+        cipherInit(&ce,mode,ivString);
+        if ((blockEncryptCompact(&cc,&kc,pt,bits,ct) != bits) ||
+            (blockEncrypt(&ce,&ke,pt,bits,rt) != bits) ||
+            memcmp(ct,rt,(bits+7)/8))
+            FatalError("Compact sanity check: encrypt miscompare","");
+
+        memset(rt,0,sizeof(rt));
+        cipherInit(&cc,mode,ivString);
+        if ((blockDecryptCompact(&cc,&kc,ct,bits,rt) != bits) ||
+            memcmp(pt,rt,(bits+7)/8))
+            FatalError("Compact sanity check: decrypt miscompare","");
+
+        /* compact key is read only, full key was reversed by blockEncrypt */
+        if (ke.direction != dir)
+            ReverseRoundSubkeys(&ke,dir);
+        if ((demoteKey(&kd,&ke) != TF_SUCCESS) ||
+            (kd.direction != kc.direction) || (kd.keyLen != kc.keyLen) ||
+            (kd.numRounds != kc.numRounds) ||
+            memcmp(kd.key32,kc.key32,sizeof(kd.key32)) ||
+            memcmp(kd.sboxKeys,kc.sboxKeys,kc.keyLen/64*sizeof(uint32_t)) ||
+            memcmp(kd.subKeys,kc.subKeys,sizeof(kd.subKeys)))
+            FatalError("Compact sanity check: demoted key miscompare","");
+        }
+
+    if (!quietVerify) printf("  OK\n");
+    }
+
+
+/*
++*****************************************************************************
+*
+* Function Name:    MakeKeys_Sanity_Check
+*
+* Function:         Make sure batch key setup is same as makeKey() per key
+*
+* Arguments:        testCnt =   # of batches per key size
+*
+* Return:           None.
+*
+* Notes:            Runs with vector kernels off, then on, on one thread
+*                   and on several.  Some keys are bad, to check they
+*                   are reported and don't spoil the others.
+*                   Will FatalError if any problems found
+*
+-****************************************************************************/
+void MakeKeys_Sanity_Check(int testCnt)
+    {
+    enum { KEY_MAX = 45 };
+    static keyInstance kb[KEY_MAX];
+    static keyInstance kref;
+    static char keyMaterial[KEY_MAX][MAX_KEY_SIZE+4];
+    const char *km[KEY_MAX];
+    int   i,j,testNum,simd,keyCnt,keySize,threadCnt,bad,reti;
+    uint8_t dir;
+
+    if (!quietVerify)
+        {
+        printf("Twofish batch key setup sanity check...");
+        fflush( stdout );
+        }
+
+    for (simd=SIMD_DISABLE;simd<=SIMD_ENABLE;simd++)
+    for (testNum=0;testNum<testCnt*3;testNum++)
+        {
+        SimdOp(simd);
+        keySize   = KEY_BITS_0 + STEP_KEY_BITS*(testNum % 3);
+        keyCnt    = 1 + (Rand() % KEY_MAX);
+        threadCnt = Rand() % 4;
+        dir       = (Rand() & 1) ? DIR_ENCRYPT : DIR_DECRYPT;
+        bad       = ((Rand() & 3) == 0) ? (int)(Rand() % keyCnt) : -1;
+        for (i=0;i<keyCnt;i++)
+            {
+            for (j=0;j<keySize/4;j++)
+                keyMaterial[i][j]=hexTab[Rand() & 0xF];
+            keyMaterial[i][j]=0;
+            km[i]=keyMaterial[i];
+            }
+        if (bad >= 0)
+            keyMaterial[bad][0]='x';
+
+        reti = makeKeys(kb,keyCnt,dir,keySize,km,threadCnt);
+        if (reti != ((bad >= 0) ? BAD_KEY_MAT : TF_SUCCESS))
+            FatalError("makeKeys return value during batch key setup sanity check","");
+
+        for (i=0;i<keyCnt;i++)
+            {
+            if (i == bad)
+                continue;
+            if (makeKey(&kref,dir,keySize,km[i]) != TF_SUCCESS)
+                FatalError("makeKey during batch key setup sanity check","");
+            if (!SameKeySchedule(&kb[i],&kref))
+                FatalError("Batch key setup sanity check: key schedule miscompare (simd=%s)",
+                           (SimdOp(SIMD_QUERY) == TF_SUCCESS) ? "on" : "off");
+            }
+        }
+
+    if (makeKeys(NULL,1,DIR_ENCRYPT,KEY_BITS_0,km,0) != BAD_PARAMS)
+        FatalError("Batch key setup sanity check: NULL keys accepted","");
+
+    if (!quietVerify) printf("  OK\n");
+    }
+
+
+/*
++*****************************************************************************
+*
+* Function Name:    KeyCache_Sanity_Check
+*
+* Function:         Make sure cached key schedules are same as makeKey()
+*
+* Arguments:        testCnt =   # of keys to look up
+*
+* Return:           None.
+*
+* Notes:            Will FatalError if any problems found
+*
+-****************************************************************************/
+void KeyCache_Sanity_Check(int testCnt)
+    {
+    enum { KEY_CNT = 6 };
+    static keyInstance kc;
+    static keyInstance kref;
+    char  keyMaterial[KEY_CNT][MAX_KEY_SIZE+4];
+    int   keySize[KEY_CNT];
+    int   i,j,testNum,lookupCnt;
+    uint8_t dir;
+
+    if (!quietVerify)
+        {
+        printf("Twofish key cache sanity check...");
+        fflush( stdout );
+        }
+
+    /* room for 3 of 6 keys, so there are hits, misses and evictions */
+    TwoFishKeyCache cache(3*(sizeof(keyInstance)+256));
+    if (cache.GetCapacity() != 3)
+        FatalError("Key cache capacity during key cache sanity check","");
+
+    for (i=0;i<KEY_CNT;i++)
+        {
+        keySize[i] = KEY_BITS_0 + STEP_KEY_BITS*(i % 3);
+        for (j=0;j<keySize[i]/4;j++)
+            keyMaterial[i][j]=hexTab[Rand() & 0xF];
+        keyMaterial[i][j]=0;
+        }
+
+    /* enough lookups for hits even with a small -l count */
+    lookupCnt = (testCnt*4 > 4*KEY_CNT) ? testCnt*4 : 4*KEY_CNT;
+    for (testNum=0;testNum<lookupCnt;testNum++)
+        {
+        i   = (testNum < KEY_CNT) ? testNum : (int)(Rand() % KEY_CNT);
+        dir = (Rand() & 1) ? DIR_ENCRYPT : DIR_DECRYPT;
+        if (cache.MakeKey(&kc,dir,keySize[i],keyMaterial[i]) != TF_SUCCESS)
+            FatalError("MakeKey during key cache sanity check","");
+        if (makeKey(&kref,dir,keySize[i],keyMaterial[i]) != TF_SUCCESS)
+            FatalError("makeKey during key cache sanity check","");
+        if (!SameKeySchedule(&kc,&kref))
+            FatalError("Key cache sanity check: key schedule miscompare","");
+        }
+
+    if ((cache.GetHits() + cache.GetMisses() != (uint64_t)lookupCnt) ||
+        (cache.GetHits() == 0) || (cache.GetEvictions() == 0) ||
+        (cache.GetCount() != 3))
+        FatalError("Key cache sanity check: bad counters","");
+
+    if (cache.MakeKey(&kc,DIR_ENCRYPT,KEY_BITS_0,"not a hex key !!") != BAD_KEY_MAT)
+        FatalError("Key cache sanity check: bad key material accepted","");
+
+    cache.Clear();
+    if (cache.GetCount() != 0)
+        FatalError("Key cache sanity check: Clear()","");
+
+    if (!quietVerify) printf("  OK\n");
+    }
+
+
+/*
++*****************************************************************************
+*
+* Function Name:    KeyArena_Sanity_Check
+*
+* Function:         Make sure arena keys are aligned, recycled and usable
+*
+* Arguments:        testCnt =   # of keys to allocate, per slab flag set
+*
+* Return:           None.
+*
+* Notes:            Huge pages and mlock may be refused by the system, the
+*                   arena must work without them.
+*                   Will FatalError if any problems found
+*
+-****************************************************************************/
+void KeyArena_Sanity_Check(int testCnt)
+    {
+    static keyInstance kref;
+    keyInstance* keys[64];
+    char     keyMaterial[MAX_KEY_SIZE+4];
+    int      i,j,keyCnt,keySize;
+    unsigned flags;
+
+    if (!quietVerify)
+        {
+        printf("Twofish key arena sanity check...");
+        fflush( stdout );
+        }
+
+    keyCnt = (testCnt < 64) ? testCnt : 64;
+    if (keyCnt < 4)
+        keyCnt = 4;
+
+    for (flags=0;flags<=(KEYARENA_HUGEPAGE|KEYARENA_MLOCK);flags++)
+        {
+        /* small slabs, so keys span a few of them */
+        TwoFishKeyArena arena(3*sizeof(keyInstance),flags);
+        if ((arena.GetCapacity() == 0) || (arena.GetFlags() & ~flags))
+            FatalError("Key arena sanity check: bad arena","");
+
+        for (i=0;i<keyCnt;i++)
+            {
+            keys[i] = arena.Alloc();
+            if ((keys[i] == NULL) || ((uintptr_t)keys[i]->sBox8x32 % 64) ||
+                (keys[i]->keySig != 0))
+                FatalError("Key arena sanity check: bad key from Alloc","");
+            for (j=0;j<i;j++)
+                if ((uint8_t*)keys[j] + sizeof(keyInstance) > (uint8_t*)keys[i] &&
+                    (uint8_t*)keys[i] + sizeof(keyInstance) > (uint8_t*)keys[j])
+                    FatalError("Key arena sanity check: keys overlap","");
+
+            keySize = KEY_BITS_0 + STEP_KEY_BITS*(i % 3);
+            for (j=0;j<keySize/4;j++)
+                keyMaterial[j]=hexTab[Rand() & 0xF];
+            keyMaterial[j]=0;
+            if ((makeKey(keys[i],DIR_ENCRYPT,keySize,keyMaterial) != TF_SUCCESS) ||
+                (makeKey(&kref,DIR_ENCRYPT,keySize,keyMaterial) != TF_SUCCESS) ||
+                !SameKeySchedule(keys[i],&kref))
+                FatalError("Key arena sanity check: key schedule miscompare","");
+            }
+        if ((arena.GetCount() != (size_t)keyCnt) ||
+            (arena.GetCapacity() < (size_t)keyCnt))
+            FatalError("Key arena sanity check: bad counters","");
+
+        /* freed slot comes back first, wiped */
+        arena.Free(keys[keyCnt/2]);
+        if ((arena.Alloc() != keys[keyCnt/2]) || (keys[keyCnt/2]->keySig != 0))
+            FatalError("Key arena sanity check: slot not recycled","");
+
+        for (i=0;i<keyCnt;i++)
+            arena.Free(keys[i]);
+        if (arena.GetCount() != 0)
+            FatalError("Key arena sanity check: bad counters","");
+        }
+
+    if (!quietVerify) printf("  OK\n");
+    }
+
+
+/*
++*****************************************************************************
+*
+* Function Name:    KeyBlob_Sanity_Check
+*
+* Function:         Make sure saved key blobs give back the same keys
+*
+* Arguments:        testCnt =   # of keys in blob
+*
+* Return:           None.
+*
+* Notes:            Goes through a file in the current directory, and
+*                   makes sure damaged blobs are refused.  Blob keys are
+*                   used in their direction in place, the other one on
+*                   a copy, and must stay as they were.  The file must be
+*                   the owner's only, even over a stale temporary file.
+*                   Will FatalError if any problems found
+*
+-****************************************************************************/
+void KeyBlob_Sanity_Check(int testCnt)
+    {
+    static const char blobPath[] = "tfkeyblob.bin";
+    static keyInstance kref[16],kc,ks;
+    const keyInstance* kp[16];
+    const keyInstance* kb;
+    cipherInstance cb,ce;
+    uint8_t  pt[4*BLOCK_SIZE/8];
+    uint8_t  ct[4*BLOCK_SIZE/8];
+    uint8_t  rt[4*BLOCK_SIZE/8];
+    char     keyMaterial[MAX_KEY_SIZE+4];
+    int      i,j,keyCnt,keySize;
+    uint8_t* mem;
+    size_t   memsz;
+    FILE*    fp;
+
+    if (!quietVerify)
+        {
+        printf("Twofish key blob sanity check...");
+        fflush( stdout );
+        }
+
+    keyCnt = (testCnt < 16) ? testCnt : 16;
+    if (keyCnt < 1)
+        keyCnt = 1;
+
+    for (i=0;i<keyCnt;i++)
+        {
+        keySize = KEY_BITS_0 + STEP_KEY_BITS*(i % 3);
+        for (j=0;j<keySize/4;j++)
+            keyMaterial[j]=hexTab[Rand() & 0xF];
+        keyMaterial[j]=0;
+        if (makeKey(&kref[i],(i & 1) ? DIR_DECRYPT : DIR_ENCRYPT,keySize,keyMaterial) != TF_SUCCESS)
+            FatalError("makeKey during key blob sanity check","");
+        kp[i] = &kref[i];
+        }
+
+    fp = fopen("tfkeyblob.bin.tmp","wb");     /* as left by a crash */
+    if (fp != NULL)
+        fclose(fp);
+    if (TwoFishKeyBlob::Save(blobPath,kp,keyCnt) != TF_SUCCESS)
+        FatalError("Key blob sanity check: Save","");
+#if defined(__linux__)
+        {
+        struct stat sb;
+        if ((stat(blobPath,&sb) != 0) || ((sb.st_mode & 0077) != 0))
+            FatalError("Key blob sanity check: blob file readable by others","");
+        }
+#endif
+
+        {
+        TwoFishKeyBlob blob;
+        if ((blob.Open(blobPath) != TF_SUCCESS) || (blob.GetCount() != (size_t)keyCnt) ||
+            (blob.GetKey(keyCnt) != NULL))
+            FatalError("Key blob sanity check: Open","");
+
+        for (i=0;i<keyCnt;i++)
+            {
+            kb = blob.GetKey(i);
+            if ((kb == NULL) || ((uintptr_t)kb->sBox8x32 % 64) || !SameKeySchedule(kb,&kref[i]))
+                FatalError("Key blob sanity check: key miscompare","");
+
+            for (j=0;j<(int)sizeof(pt);j++)
+                pt[j]=(uint8_t) Rand();
+            memcpy(&ks,kb,sizeof(ks));
+            if (blob.CopyKey(i,&kc) != TF_SUCCESS)
+                FatalError("Key blob sanity check: CopyKey","");
+            cipherInit(&cb,MODE_ECB,NULL);
+            cipherInit(&ce,MODE_ECB,NULL);
+            /* blob key in its direction, the copy the other way */
+            if (kb->direction == DIR_ENCRYPT)
+                j = (blockEncrypt(&cb,(keyInstance*)kb,pt,sizeof(pt)*8,ct) != (int)sizeof(pt)*8) ||
+                    (blockDecrypt(&ce,&kc,ct,sizeof(ct)*8,rt) != (int)sizeof(ct)*8);
+            else
+                j = (blockEncrypt(&cb,&kc,pt,sizeof(pt)*8,ct) != (int)sizeof(pt)*8) ||
+                    (blockDecrypt(&ce,(keyInstance*)kb,ct,sizeof(ct)*8,rt) != (int)sizeof(ct)*8);
+            if (j || memcmp(pt,rt,sizeof(pt)))
+                FatalError("Key blob sanity check: round trip miscompare","");
+            cipherInit(&ce,MODE_ECB,NULL);
+            if ((blockEncrypt(&ce,&kref[i],pt,sizeof(pt)*8,rt) != (int)sizeof(pt)*8) ||
+                memcmp(ct,rt,sizeof(ct)))
+                FatalError("Key blob sanity check: encrypt miscompare","");
+            if (memcmp(&ks,kb,sizeof(ks)) || (blob.CopyKey(keyCnt,&kc) != BAD_PARAMS))
+                FatalError("Key blob sanity check: blob key changed","");
+            }
+        }
+    remove(blobPath);
+
+    /* in memory, and damaged */
+    memsz = TwoFishKeyBlob::Size(keyCnt);
+    mem   = new uint8_t[memsz];
+    kref[0].sboxReady = 0;
+    if (TwoFishKeyBlob::Write(mem,memsz,kp,keyCnt) != BAD_KEY_INSTANCE)
+        FatalError("Key blob sanity check: lazy key saved","");
+    kref[0].sboxReady = 1;
+    if (TwoFishKeyBlob::Write(mem,memsz,kp,keyCnt) != TF_SUCCESS)
+        FatalError("Key blob sanity check: Write","");
+
+        {
+        TwoFishKeyBlob blob;
+        if (blob.Attach(mem,memsz) != TF_SUCCESS)
+            FatalError("Key blob sanity check: Attach","");
+        blob.Close();
+
+        mem[memsz-1-(Rand() % 4096)] ^= 1;
+        if ((blob.Attach(mem,memsz) != BAD_KEY_BLOB) ||
+            (blob.Attach(mem,memsz,false) != TF_SUCCESS))
+            FatalError("Key blob sanity check: damaged key accepted","");
+        blob.Close();
+
+        mem[Rand() % KEYBLOB_HEADSZ] ^= 0x10;
+        if ((blob.Attach(mem,memsz,false) != BAD_KEY_BLOB) ||
+            (blob.Attach(mem,memsz-1) != BAD_KEY_BLOB))
+            FatalError("Key blob sanity check: damaged header accepted","");
+        }
+    delete[] mem;
+
+    if (!quietVerify) printf("  OK\n");
+    }
+
+
+/*
++*****************************************************************************
+*
+* Function Name:    CTR_Sanity_Check
+*
+* Function:         Make sure MODE_CTR is ECB of counter blocks, xored
+*
+* Arguments:        testCnt =   # of keys to test
+*
+* Return:           None.
+*
+* Notes:            Also splits the stream with CounterAdd() and checks
+*                   the carry over bytes of the counter.
+*                   Will FatalError if any problems found
+*
+-****************************************************************************/
+void CTR_Sanity_Check(int testCnt)
+    {
+    static keyInstance ke,kd;
+    cipherInstance ci,ce;
+    uint8_t  ctr[37*BLOCK_SIZE/8];
+    uint8_t  pt[37*BLOCK_SIZE/8];
+    uint8_t  ct[37*BLOCK_SIZE/8];
+    uint8_t  rt[37*BLOCK_SIZE/8];
+    char     keyMaterial[MAX_KEY_SIZE+4];
+    char     ivString[BLOCK_SIZE/4+4];
+    int      i,j,n,byteCnt,keySize;
+
+    if (!quietVerify)
+        {
+        printf("Twofish CTR sanity check...");
+        fflush( stdout );
+        }
+
+    for (i=0;i<testCnt;i++)
+        {
+        keySize = KEY_BITS_0 + STEP_KEY_BITS*(i % 3);
+        for (j=0;j<keySize/4;j++)
+            keyMaterial[j]=hexTab[Rand() & 0xF];
+        keyMaterial[j]=0;
+        for (j=0;j<BLOCK_SIZE/4;j++)
+            ivString[j]=hexTab[Rand() & 0xF];
+        /* low bytes all ones on some keys, so counter carries */
+        if (i & 1)
+            for (j=BLOCK_SIZE/4-6;j<BLOCK_SIZE/4;j++)
+                ivString[j]='F';
+        ivString[j]=0;
+        if ((makeKey(&ke,DIR_ENCRYPT,keySize,keyMaterial) != TF_SUCCESS) ||
+            (makeKey(&kd,DIR_DECRYPT,keySize,keyMaterial) != TF_SUCCESS))
+            FatalError("makeKey during CTR sanity check","");
+
+        /* any byte count, not only whole blocks */
+        byteCnt = 1 + Rand() % sizeof(pt);
+        for (j=0;j<(int)sizeof(pt);j++)
+            pt[j]=(uint8_t) Rand();
+
+        /* counter blocks by hand, big-endian increment of IV */
+        if (cipherInit(&ci,MODE_CTR,ivString) != TF_SUCCESS)
+            FatalError("cipherInit during CTR sanity check","");
+        memcpy(ctr,ci.IV,BLOCK_SIZE/8);
+        for (n=1;n<(int)(sizeof(ctr)/(BLOCK_SIZE/8));n++)
+            {
+            memcpy(ctr+n*BLOCK_SIZE/8,ctr+(n-1)*BLOCK_SIZE/8,BLOCK_SIZE/8);
+            for (j=BLOCK_SIZE/8-1;j>=0;j--)
+                if (++ctr[n*BLOCK_SIZE/8+j] != 0)
+                    break;
+            }
+        cipherInit(&ce,MODE_ECB,NULL);
+        if (blockEncrypt(&ce,&ke,ctr,sizeof(ctr)*8,rt) != (int)sizeof(ctr)*8)
+            FatalError("blockEncrypt during CTR sanity check","");
+        for (j=0;j<byteCnt;j++)
+            rt[j]^=pt[j];
+
+        if ((blockEncrypt(&ci,&ke,pt,byteCnt*8,ct) != byteCnt*8) || memcmp(ct,rt,byteCnt))
+            FatalError("CTR sanity check: keystream miscompare","");
+
+        /* second half first, by stepping a fresh counter */
+        n = (byteCnt / (BLOCK_SIZE/8) / 2) * (BLOCK_SIZE/8);
+        cipherInit(&ci,MODE_CTR,ivString);
+        CounterAdd(&ci,n/(BLOCK_SIZE/8));
+        if (blockEncrypt(&ci,&ke,pt+n,(byteCnt-n)*8,rt+n) != (byteCnt-n)*8)
+            FatalError("blockEncrypt during CTR sanity check","");
+        cipherInit(&ci,MODE_CTR,ivString);
+        if ((n > 0) && (blockEncrypt(&ci,&ke,pt,n*8,rt) != n*8))
+            FatalError("blockEncrypt during CTR sanity check","");
+        if (memcmp(ct,rt,byteCnt))
+            FatalError("CTR sanity check: split stream miscompare","");
+
+        /* decrypt is the same, whatever direction the key was made for */
+        cipherInit(&ci,MODE_CTR,ivString);
+        if ((blockDecrypt(&ci,&kd,ct,byteCnt*8,rt) != byteCnt*8) || memcmp(pt,rt,byteCnt))
+            FatalError("CTR sanity check: decrypt miscompare","");
+        }
+
+    if (!quietVerify) printf("  OK\n");
+    }
+
+
+/*
++*****************************************************************************
+*
+* Function Name:    Engine_Sanity_Check
+*
+* Function:         Make sure engine jobs give the same output as direct calls
+*
+* Arguments:        testCnt =   # of jobs
+*
+* Return:           None.
+*
+* Notes:            Mixes modes, directions and keys in flight, polls most
+*                   jobs and takes some by callback.  Then more keys than
+*                   a worker keeps copies of, and releases them.
+*                   Will FatalError if any problems found
+*
+-****************************************************************************/
+static void EngineDone(engineJob* job)
+    {
+    ((std::atomic<int>*)job->user)->fetch_add(1);
+    }
+
+void Engine_Sanity_Check(int testCnt)
+    {
+    static keyInstance keys[4];
+    static keyInstance many[48];
+    static engineJob   jobs[64];
+    static engineJob   kjob;
+    static uint8_t     pt[64][8*BLOCK_SIZE/8];
+    static uint8_t     ct[64][8*BLOCK_SIZE/8];
+    static cipherInstance ciphers[64];
+    uint8_t  rt[8*BLOCK_SIZE/8];
+    static const uint8_t modes[3] = { MODE_ECB, MODE_CBC, MODE_CTR };
+    char     keyMaterial[MAX_KEY_SIZE+4];
+    char     ivString[BLOCK_SIZE/4+4];
+    cipherInstance ci;
+    engineJob* done[8];
+    std::atomic<int> called(0);
+    int      i,j,q,jobCnt,keySize,polled,calls;
+    unsigned flags;
+
+    if (!quietVerify)
+        {
+        printf("Twofish engine sanity check...");
+        fflush( stdout );
+        }
+
+    jobCnt = (testCnt < 64) ? testCnt : 64;
+    if (jobCnt < 8)
+        jobCnt = 8;
+
+    /* plain, then pinned workers with node local key copies */
+    for (flags=0;flags<=ENGINE_NUMA;flags++)
+        {
+        /* even keys encrypt, odd keys decrypt ECB/CBC */
+        for (i=0;i<4;i++)
+            {
+            keySize = KEY_BITS_0 + STEP_KEY_BITS*(i % 3);
+            for (j=0;j<keySize/4;j++)
+                keyMaterial[j]=hexTab[Rand() & 0xF];
+            keyMaterial[j]=0;
+            if (makeKey(&keys[i],(i & 1) ? DIR_DECRYPT : DIR_ENCRYPT,keySize,keyMaterial) != TF_SUCCESS)
+                FatalError("makeKey during engine sanity check","");
+            }
+
+            {
+            TwoFishEngine engine(2,4,flags);
+            if ((engine.GetThreadCount() != 2) || (engine.GetNodeCount() < 1) ||
+                ((q = engine.OpenQueue(jobCnt)) < 0))
+                FatalError("Engine sanity check: bad engine","");
+
+            calls  = 0;
+            called = 0;
+            for (i=0;i<jobCnt;i++)
+                {
+                engineJob* job = &jobs[i];
+                for (j=0;j<(int)sizeof(pt[i]);j++)
+                    pt[i][j]=(uint8_t) Rand();
+                for (j=0;j<BLOCK_SIZE/4;j++)
+                    ivString[j]=hexTab[Rand() & 0xF];
+                ivString[j]=0;
+
+                memset(job,0,sizeof(*job));
+                cipherInit(&job->cipher,modes[i % 3],ivString);
+                job->dir       = (modes[i % 3] == MODE_CTR) ? DIR_ENCRYPT : (uint8_t)(Rand() & 1);
+                job->key       = &keys[(modes[i % 3] == MODE_CTR) ? 0 : (Rand() & 3)];
+                job->input     = pt[i];
+                job->inputLen  = (1 + Rand() % 8) * BLOCK_SIZE;
+                job->outBuffer = ct[i];
+                ciphers[i]     = job->cipher;
+                if ((i % 5) == 4)
+                    {
+                    job->done = EngineDone;
+                    job->user = &called;
+                    calls++;
+                    }
+                /* rings are tiny : retry after draining, like a producer would */
+                while ((j = engine.Submit(q,job)) == ENGINE_BUSY)
+                    std::this_thread::yield();
+                if (j != TF_SUCCESS)
+                    FatalError("Engine sanity check: Submit","");
+                }
+
+            polled = 0;
+            while (engine.GetPending(q) > 0)
+                {
+                size_t n = engine.Poll(q,done,8);
+                for (j=0;j<(int)n;j++)
+                    if (done[j]->done != NULL)
+                        FatalError("Engine sanity check: callback job polled","");
+                polled += (int)n;
+                if (n == 0)
+                    std::this_thread::yield();
+                }
+            if ((polled + calls != jobCnt) || (called != calls))
+                FatalError("Engine sanity check: jobs lost","");
+
+            /* decrypting key can't run a CTR job */
+            jobs[0].key         = &keys[1];
+            jobs[0].cipher.mode = MODE_CTR;
+            if (engine.Submit(q,&jobs[0]) != BAD_KEY_DIR)
+                FatalError("Engine sanity check: CTR job with decrypt key","");
+
+            /* lazy key is refused until expanded */
+            LazyOp(LAZY_ENABLE);
+            if (makeKey(&many[0],DIR_ENCRYPT,KEY_BITS_0,keyMaterial) != TF_SUCCESS)
+                FatalError("makeKey during engine sanity check","");
+            LazyOp(LAZY_DISABLE);
+            jobs[0].key         = &many[0];
+            jobs[0].cipher.mode = MODE_ECB;
+            if ((many[0].sboxReady == 0) &&
+                (engine.Submit(q,&jobs[0]) != BAD_KEY_INSTANCE))
+                FatalError("Engine sanity check: lazy key submitted","");
+
+            /* key copies evicted and made again, then released */
+            for (i=0;i<48;i++)
+                {
+                for (j=0;j<KEY_BITS_0/4;j++)
+                    keyMaterial[j]=hexTab[Rand() & 0xF];
+                keyMaterial[j]=0;
+                if (makeKey(&many[i],DIR_ENCRYPT,KEY_BITS_0,keyMaterial) != TF_SUCCESS)
+                    FatalError("makeKey during engine sanity check","");
+                }
+            for (i=0;i<96;i++)
+                {
+                engineJob* job = &kjob;
+                memset(job,0,sizeof(*job));
+                cipherInit(&job->cipher,MODE_ECB,NULL);
+                job->dir       = DIR_ENCRYPT;
+                job->key       = &many[(i * 7) % 48];
+                job->input     = pt[i % 48];
+                job->inputLen  = BLOCK_SIZE;
+                job->outBuffer = ct[0] + BLOCK_SIZE/8 * (i & 1);
+                while ((j = engine.Submit(q,job)) == ENGINE_BUSY)
+                    std::this_thread::yield();
+                if (j != TF_SUCCESS)
+                    FatalError("Engine sanity check: Submit","");
+                while (engine.GetPending(q) > 0)
+                    if (engine.Poll(q,done,8) == 0)
+                        std::this_thread::yield();
+                blockEncrypt(&job->cipher,job->key,job->input,BLOCK_SIZE,rt);
+                if ((job->result != BLOCK_SIZE) || memcmp(rt,job->outBuffer,BLOCK_SIZE/8))
+                    FatalError("Engine sanity check: evicted key miscompare","");
+                }
+            for (i=0;i<48;i++)
+                if (engine.ReleaseKey(&many[i]) != TF_SUCCESS)
+                    FatalError("Engine sanity check: ReleaseKey","");
+            if (engine.ReleaseKey(NULL) != BAD_PARAMS)
+                FatalError("Engine sanity check: ReleaseKey(NULL)","");
+            }
+
+        /* each job again by a direct call, from its cipher as submitted */
+        for (i=1;i<jobCnt;i++)
+            {
+            engineJob* job = &jobs[i];
+            if (job->result != (int)job->inputLen)
+                FatalError("Engine sanity check: job failed","");
+
+            ci = ciphers[i];
+            if (job->dir == DIR_ENCRYPT)
+                j = blockEncrypt(&ci,job->key,job->input,job->inputLen,rt);
+            else
+                j = blockDecrypt(&ci,job->key,job->input,job->inputLen,rt);
+            if ((j != (int)job->inputLen) || memcmp(rt,job->outBuffer,job->inputLen/8) ||
+                ((ci.mode == MODE_CBC) && memcmp(ci.iv32,job->cipher.iv32,sizeof(ci.iv32))))
+                FatalError("Engine sanity check: job miscompare","");
+            }
+        }
+
+    if (!quietVerify) printf("  OK\n");
+    }
+
+
+/*
++*****************************************************************************
+*
+* Function Name:    Batcher_Sanity_Check
+*
+* Function:         Make sure batched jobs are flushed by size and deadline
+*
+* Arguments:        testCnt =   # of one block jobs
+*
+* Return:           None.
+*
+* Notes:            Output is checked against direct ECB calls.
+*                   Will FatalError if any problems found
+*
+-****************************************************************************/
+void Batcher_Sanity_Check(int testCnt)
+    {
+    static keyInstance ke;
+    static keyInstance kl;
+    static engineJob   jobs[64];
+    static engineJob   lazyJob;
+    static uint8_t     pt[64][BLOCK_SIZE/8];
+    static uint8_t     ct[64][BLOCK_SIZE/8];
+    uint8_t  rt[BLOCK_SIZE/8];
+    char     keyMaterial[MAX_KEY_SIZE+4];
+    cipherInstance ci;
+    batcherStats   st;
+    std::atomic<int> called(0);
+    int      i,j,jobCnt,waitMs;
+
+    if (!quietVerify)
+        {
+        printf("Twofish micro-batcher sanity check...");
+        fflush( stdout );
+        }
+
+    jobCnt = (testCnt < 64) ? testCnt : 64;
+    if (jobCnt < 12)
+        jobCnt = 12;
+
+    for (j=0;j<KEY_BITS_0/4;j++)
+        keyMaterial[j]=hexTab[Rand() & 0xF];
+    keyMaterial[j]=0;
+    if (makeKey(&ke,DIR_ENCRYPT,KEY_BITS_0,keyMaterial) != TF_SUCCESS)
+        FatalError("makeKey during micro-batcher sanity check","");
+
+        {
+        /* long deadline first : only full batches of 4 */
+        TwoFishBatcher batcher(4,1000000);
+        for (i=0;i<jobCnt;i++)
+            {
+            for (j=0;j<BLOCK_SIZE/8;j++)
+                pt[i][j]=(uint8_t) Rand();
+            memset(&jobs[i],0,sizeof(engineJob));
+            cipherInit(&jobs[i].cipher,MODE_ECB,NULL);
+            jobs[i].key       = &ke;
+            jobs[i].dir       = DIR_ENCRYPT;
+            jobs[i].input     = pt[i];
+            jobs[i].inputLen  = BLOCK_SIZE;
+            jobs[i].outBuffer = ct[i];
+            jobs[i].done      = EngineDone;
+            jobs[i].user      = &called;
+            if (batcher.Add(&jobs[i]) != TF_SUCCESS)
+                FatalError("Micro-batcher sanity check: Add","");
+            if (called != (i+1)/4*4)
+                FatalError("Micro-batcher sanity check: not flushed by size","");
+            }
+        batcher.GetStats(&st);
+        if ((st.fullBatches != (uint64_t)jobCnt/4) || (st.lateBatches != 0) ||
+            (st.blocks != (uint64_t)jobCnt/4*4) || (batcher.GetWaiting() != (size_t)jobCnt%4))
+            FatalError("Micro-batcher sanity check: bad stats","");
+        batcher.Flush();
+        if ((called != jobCnt) || (batcher.GetWaiting() != 0))
+            FatalError("Micro-batcher sanity check: Flush","");
+        }
+
+        {
+        /* short deadline : a lone job goes out by itself */
+        TwoFishBatcher batcher(1000,200);
+        called = 0;
+        if (batcher.Add(&jobs[0]) != TF_SUCCESS)
+            FatalError("Micro-batcher sanity check: Add","");
+        for (waitMs=0;(called == 0) && (waitMs < 5000);waitMs++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        batcher.GetStats(&st);
+        if ((called != 1) || (st.lateBatches != 1) || (st.delayUsMax < 200))
+            FatalError("Micro-batcher sanity check: not flushed by deadline","");
+
+        /* lazy key is refused until expanded */
+        LazyOp(LAZY_ENABLE);
+        if (makeKey(&kl,DIR_ENCRYPT,KEY_BITS_0,keyMaterial) != TF_SUCCESS)
+            FatalError("makeKey during micro-batcher sanity check","");
+        LazyOp(LAZY_DISABLE);
+        lazyJob     = jobs[0];
+        lazyJob.key = &kl;
+        if ((kl.sboxReady == 0) && (batcher.Add(&lazyJob) != BAD_KEY_INSTANCE))
+            FatalError("Micro-batcher sanity check: lazy key added","");
+        }
+
+    for (i=0;i<jobCnt;i++)
+        {
+        cipherInit(&ci,MODE_ECB,NULL);
+        if ((jobs[i].result != BLOCK_SIZE) ||
+            (blockEncrypt(&ci,&ke,pt[i],BLOCK_SIZE,rt) != BLOCK_SIZE) ||
+            memcmp(rt,ct[i],sizeof(rt)))
+            FatalError("Micro-batcher sanity check: job miscompare","");
+        }
+
+    if (!quietVerify) printf("  OK\n");
+    }
+
+
+/*
++*****************************************************************************
+*
+* Function Name:    KeyHandle_Sanity_Check
+*
+* Function:         Make sure key rotation keeps readers on a whole key
+*
+* Arguments:        testCnt =   # of rotations under running readers
+*
+* Return:           None.
+*
+* Notes:            Readers check every block against the key version
+*                   they acquired, while the main thread rotates.
+*                   Will FatalError if any problems found
+*
+-****************************************************************************/
+static char     handleMaterial[32][MAX_KEY_SIZE+4];
+static uint8_t  handleCt[32][BLOCK_SIZE/8];
+static uint8_t  handlePt[BLOCK_SIZE/8];
+
+static void KeyHandleReader(TwoFishKeyHandle* handle,std::atomic<bool>* stop,
+                            std::atomic<int>* errors)
+    {
+    keyReader rd;
+    cipherInstance ci;
+    uint8_t  ct[BLOCK_SIZE/8];
+
+    while (*stop == false)
+        {
+        if (handle->Acquire(&rd) != TF_SUCCESS)
+            continue;
+        cipherInit(&ci,MODE_ECB,NULL);
+        if ((rd.version == 0) || (rd.version > 32) ||
+            (blockEncrypt(&ci,rd.enc,handlePt,BLOCK_SIZE,ct) != BLOCK_SIZE) ||
+            memcmp(ct,handleCt[rd.version-1],sizeof(ct)) ||
+            (blockDecrypt(&ci,rd.dec,ct,BLOCK_SIZE,ct) != BLOCK_SIZE) ||
+            memcmp(ct,handlePt,sizeof(ct)))
+            (*errors)++;
+        handle->Release(&rd);
+        }
+    }
+
+void KeyHandle_Sanity_Check(int testCnt)
+    {
+    static keyInstance kref;
+    cipherInstance ci;
+    keyReader rd1,rd2;
+    std::atomic<bool> stop(false);
+    std::atomic<int>  errors(0);
+    int      i,j,rotCnt;
+
+    if (!quietVerify)
+        {
+        printf("Twofish key handle sanity check...");
+        fflush( stdout );
+        }
+
+    rotCnt = (testCnt < 32) ? testCnt : 32;
+    if (rotCnt < 3)
+        rotCnt = 3;
+
+    for (j=0;j<BLOCK_SIZE/8;j++)
+        handlePt[j]=(uint8_t) Rand();
+    for (i=0;i<rotCnt;i++)
+        {
+        for (j=0;j<KEY_BITS_0/4;j++)
+            handleMaterial[i][j]=hexTab[Rand() & 0xF];
+        handleMaterial[i][j]=0;
+        cipherInit(&ci,MODE_ECB,NULL);
+        if ((makeKey(&kref,DIR_ENCRYPT,KEY_BITS_0,handleMaterial[i]) != TF_SUCCESS) ||
+            (blockEncrypt(&ci,&kref,handlePt,BLOCK_SIZE,handleCt[i]) != BLOCK_SIZE))
+            FatalError("makeKey during key handle sanity check","");
+        }
+
+        {
+        TwoFishKeyHandle handle;
+        if ((handle.Acquire(&rd1) != KEY_NOT_READY) || (handle.Rotate() != KEY_NOT_READY))
+            FatalError("Key handle sanity check: key before publish","");
+
+        /* old key stays with its reader past a rotation */
+        if ((handle.Publish(KEY_BITS_0,handleMaterial[0]) != TF_SUCCESS) ||
+            (handle.Acquire(&rd1) != TF_SUCCESS) || (rd1.version != 1))
+            FatalError("Key handle sanity check: Publish","");
+        if (handle.Prepare(KEY_BITS_0,handleMaterial[1]) != TF_SUCCESS)
+            FatalError("Key handle sanity check: Prepare","");
+        for (j=0;(handle.IsPrepared() == false) && (j < 5000);j++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if ((handle.IsPrepared() == false) || (handle.Rotate() != TF_SUCCESS) ||
+            (handle.GetVersion() != 2) || (handle.Reclaim() != 1))
+            FatalError("Key handle sanity check: Rotate","");
+        if ((handle.Acquire(&rd2) != TF_SUCCESS) || (rd2.version != 2))
+            FatalError("Key handle sanity check: new key not taken","");
+        for (i=0;i<2;i++)
+            {
+            uint8_t ct[BLOCK_SIZE/8];
+            cipherInit(&ci,MODE_ECB,NULL);
+            if ((blockEncrypt(&ci,i ? rd2.enc : rd1.enc,handlePt,BLOCK_SIZE,ct) != BLOCK_SIZE) ||
+                memcmp(ct,handleCt[i],sizeof(ct)))
+                FatalError("Key handle sanity check: key miscompare","");
+            }
+        handle.Release(&rd1);
+        handle.Release(&rd2);
+        if (handle.Reclaim() != 0)
+            FatalError("Key handle sanity check: old key not freed","");
+
+        /* rotations under readers */
+        std::thread r1(KeyHandleReader,&handle,&stop,&errors);
+        std::thread r2(KeyHandleReader,&handle,&stop,&errors);
+        for (i=2;i<rotCnt;i++)
+            {
+            if (handle.Publish(KEY_BITS_0,handleMaterial[i]) != TF_SUCCESS)
+                FatalError("Key handle sanity check: Publish","");
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+        stop = true;
+        r1.join();
+        r2.join();
+        if ((errors != 0) || (handle.GetVersion() != (uint64_t)rotCnt) ||
+            (handle.Reclaim() != 0))
+            FatalError("Key handle sanity check: reader saw a broken key","");
+        }
+
+    if (!quietVerify) printf("  OK\n");
+    }
+
+
+/*
++*****************************************************************************
+*
+* Function Name:    Stream_Sanity_Check
+*
+* Function:         Make sure the stream pipeline matches one cipher call
+*
+* Arguments:        testCnt =   # of random lengths to try
+*
+* Return:           None.
+*
+* Notes:            Reader hands out short pieces, like a pipe, so buffers
+*                   fill in several reads.  Lengths on and around buffer
+*                   ends are always tried.
+*                   Will FatalError if any problems found
+*
+-****************************************************************************/
+typedef struct
+{
+    const uint8_t* data;
+    size_t   len;
+    size_t   pos;
+    uint8_t* out;
+    size_t   outLen;
+    size_t   outMax;
+} streamMem;
+
+static long StreamMemRead(void* user,uint8_t* buf,size_t len)
+    {
+    streamMem* m = (streamMem*)user;
+    size_t   n = m->len - m->pos;
+
+    if (n > len)
+        n = len;
+    if (n > 1000)
+        n = 1000;
+    memcpy(buf,m->data+m->pos,n);
+    m->pos += n;
+    return (long)n;
+    }
+
+static long StreamMemWrite(void* user,const uint8_t* buf,size_t len)
+    {
+    streamMem* m = (streamMem*)user;
+
+    if (m->outLen + len > m->outMax)
+        return -1;
+    memcpy(m->out+m->outLen,buf,len);
+    m->outLen += len;
+    return (long)len;
+    }
+
+/* own cipher stage : zero pad to a block, XOR; user set asks too much */
+static long StreamXorCipher(void* user,uint8_t* buf,size_t len,bool last)
+    {
+    size_t   plen = (len+15)/16*16,i;
+
+    if (user != NULL)
+        return (long)(plen+BLOCK_SIZE/8);
+    memset(buf+len,0,plen-len);
+    for (i=0;i<plen;i++)
+        buf[i] ^= 0x5A;
+    return (long)plen;
+    }
+
+void Stream_Sanity_Check(int testCnt)
+    {
+    static keyInstance ke,kd;
+    static uint8_t src[5*4096+64],ref[5*4096+64],enc[5*4096+64],dec[5*4096+64];
+    static uint8_t big[700*1024],bigRef[700*1024],bigOut[700*1024];
+    cipherInstance ci;
+    streamMem m;
+    streamStats st;
+    char     iv[] = "00112233445566778899AABBCCDDEEFF";
+    uint8_t  modes[] = { MODE_ECB, MODE_CBC, MODE_CTR };
+    size_t   lens[] = { 0, 1, 16, 4095, 4096, 4097, 3*4096, 5*4096+17 };
+    size_t   i,j,len,plen;
+    int      n,mode;
+
+    if (!quietVerify)
+        {
+        printf("Twofish stream sanity check...");
+        fflush( stdout );
+        }
+
+    for (i=0;i<sizeof(src);i++)
+        src[i]=(uint8_t) Rand();
+
+    TwoFishStream stream(4096,3);
+    if ((stream.GetBufferSize() != 4096) || (stream.GetBufferCount() != 3))
+        FatalError("Stream sanity check: buffers","");
+        {
+        /* buffer of a blockEncrypt() call, bits fit in int */
+        TwoFishStream huge((size_t)1 << 30,2);
+        if (huge.GetBufferSize() != STREAM_MAXBUFSZ)
+            FatalError("Stream sanity check: buffer size not capped","");
+        }
+
+    for (mode=0;mode<3;mode++)
+    for (n=0;n<testCnt+8;n++)
+        {
+        len  = (n < 8) ? lens[n] : Rand() % (5*4096+17);
+        plen = (modes[mode] == MODE_CTR) ? len : (len+15)/16*16;
+
+        if ((makeKey(&ke,DIR_ENCRYPT,KEY_BITS_0,NULL) != TF_SUCCESS) ||
+            (makeKey(&kd,(modes[mode] == MODE_CTR) ? DIR_ENCRYPT : DIR_DECRYPT,
+                     KEY_BITS_0,NULL) != TF_SUCCESS))
+            FatalError("makeKey during stream sanity check","");
+
+        memset(ref,0,sizeof(ref));
+        memcpy(ref,src,len);
+        cipherInit(&ci,modes[mode],iv);
+        if ((plen > 0) && (blockEncrypt(&ci,&ke,ref,plen*8,ref) < 0))
+            FatalError("Stream sanity check: blockEncrypt","");
+
+        m.data = src; m.len = len; m.pos = 0;
+        m.out = enc; m.outLen = 0; m.outMax = sizeof(enc);
+        cipherInit(&ci,modes[mode],iv);
+        if ((stream.Run(&ke,&ci,DIR_ENCRYPT,StreamMemRead,&m,StreamMemWrite,&m) != TF_SUCCESS) ||
+            (m.outLen != plen) || memcmp(enc,ref,plen))
+            FatalError("Stream sanity check: encrypt miscompare","");
+
+        stream.GetStats(&st);
+        if ((st.bytesIn != len) || (st.bytesOut != plen) ||
+            (st.buffers != len/4096+1))
+            FatalError("Stream sanity check: stats","");
+
+        m.data = enc; m.len = plen; m.pos = 0;
+        m.out = dec; m.outLen = 0; m.outMax = sizeof(dec);
+        cipherInit(&ci,modes[mode],iv);
+        if ((stream.Run(&kd,&ci,DIR_DECRYPT,StreamMemRead,&m,StreamMemWrite,&m) != TF_SUCCESS) ||
+            (m.outLen != plen) || memcmp(dec,src,len))
+            FatalError("Stream sanity check: decrypt miscompare","");
+        for (j=len;j<plen;j++)
+            if (dec[j] != 0)
+                FatalError("Stream sanity check: padding not zero","");
+        }
+
+    /* writer running out of room stops the pipeline */
+    m.data = src; m.len = 5*4096; m.pos = 0;
+    m.out = enc; m.outLen = 0; m.outMax = 4096+100;
+    cipherInit(&ci,MODE_CTR,iv);
+    if (stream.Run(&ke,&ci,DIR_ENCRYPT,StreamMemRead,&m,StreamMemWrite,&m) != STREAM_IO_FAIL)
+        FatalError("Stream sanity check: writer failure not reported","");
+
+    /* ECB/CBC cipher text must be whole blocks */
+    m.data = src; m.len = 4096+5; m.pos = 0;
+    m.out = dec; m.outLen = 0; m.outMax = sizeof(dec);
+    cipherInit(&ci,MODE_CBC,iv);
+    if (stream.Run(&kd,&ci,DIR_DECRYPT,StreamMemRead,&m,StreamMemWrite,&m) != BAD_INPUT_LEN)
+        FatalError("Stream sanity check: partial block decrypted","");
+
+    /* buffers split over threads, cipher state carried as by one call */
+    TwoFishStream pstream(256*1024,2);
+    pstream.SetParallel(3);
+    for (mode=0;mode<3;mode++)
+        {
+        len  = sizeof(big) - 16*(Rand() % 4096);
+        len -= (modes[mode] == MODE_CTR) ? Rand() % 16 : 0;
+        for (i=0;i<len;i++)
+            big[i]=(uint8_t) Rand();
+        if ((makeKey(&ke,DIR_ENCRYPT,KEY_BITS_0,NULL) != TF_SUCCESS) ||
+            (makeKey(&kd,(modes[mode] == MODE_CTR) ? DIR_ENCRYPT : DIR_DECRYPT,
+                     KEY_BITS_0,NULL) != TF_SUCCESS))
+            FatalError("makeKey during stream sanity check","");
+        memcpy(bigRef,big,len);
+        cipherInit(&ci,modes[mode],iv);
+        if (blockEncrypt(&ci,&ke,bigRef,len*8,bigRef) < 0)
+            FatalError("Stream sanity check: blockEncrypt","");
+        m.data = big; m.len = len; m.pos = 0;
+        m.out = bigOut; m.outLen = 0; m.outMax = sizeof(bigOut);
+        cipherInit(&ci,modes[mode],iv);
+        if ((pstream.Run(&ke,&ci,DIR_ENCRYPT,StreamMemRead,&m,StreamMemWrite,&m) != TF_SUCCESS) ||
+            (m.outLen != len) || memcmp(bigOut,bigRef,len))
+            FatalError("Stream sanity check: parallel encrypt miscompare","");
+        m.data = bigRef; m.len = len; m.pos = 0;
+        m.out = bigOut; m.outLen = 0; m.outMax = sizeof(bigOut);
+        cipherInit(&ci,modes[mode],iv);
+        if ((pstream.Run(&kd,&ci,DIR_DECRYPT,StreamMemRead,&m,StreamMemWrite,&m) != TF_SUCCESS) ||
+            (m.outLen != len) || memcmp(bigOut,big,len))
+            FatalError("Stream sanity check: parallel decrypt miscompare","");
+        }
+
+    /* own cipher stage, growing the last buffer to a block */
+    m.data = src; m.len = 3*4096+5; m.pos = 0;
+    m.out = enc; m.outLen = 0; m.outMax = sizeof(enc);
+    if ((stream.Run(StreamXorCipher,NULL,StreamMemRead,&m,StreamMemWrite,&m) != TF_SUCCESS) ||
+        (m.outLen != 3*4096+16))
+        FatalError("Stream sanity check: own cipher stage","");
+    for (i=0;i<3*4096+16;i++)
+        if (enc[i] != (uint8_t)(((i < 3*4096+5) ? src[i] : 0) ^ 0x5A))
+            FatalError("Stream sanity check: own cipher stage miscompare","");
+    m.data = src; m.len = 4096; m.pos = 0;
+    m.out = enc; m.outLen = 0; m.outMax = sizeof(enc);
+    if (stream.Run(StreamXorCipher,(void*)1,StreamMemRead,&m,StreamMemWrite,&m) != BAD_PARAMS)
+        FatalError("Stream sanity check: own cipher stage failure not reported","");
+
+    if (!quietVerify) printf("  OK\n");
+    }
+
+
+/*
++*****************************************************************************
+*
+* Function Name:    Uring_Sanity_Check
+*
+* Function:         Make sure bulk file ciphering matches one cipher call
+*
+* Arguments:        testCnt =   # of random file lengths to try
+*
+* Return:           None.
+*
+* Notes:            Runs with io_uring where the system has it and with
+*                   pread()/pwrite(), small chunks and few slots so reads
+*                   and writes of many chunks overlap.
+*                   Will FatalError if any problems found
+*
+-****************************************************************************/
+static void UringFile(const char* path,const uint8_t* p,size_t len)
+    {
+    FILE* fp = fopen(path,"wb");
+
+    if ((fp == NULL) || (fwrite(p,1,len,fp) != len) || fclose(fp))
+        FatalError("Uring sanity check: can't write ",path);
+    }
+
+static size_t UringRead(const char* path,uint8_t* p,size_t max)
+    {
+    FILE* fp = fopen(path,"rb");
+    size_t len;
+
+    if (fp == NULL)
+        FatalError("Uring sanity check: can't read ",path);
+    len = fread(p,1,max,fp);
+    fclose(fp);
+    return len;
+    }
+
+void Uring_Sanity_Check(int testCnt)
+    {
+    static keyInstance ke,kd;
+    static uint8_t src[9*4096+64],ref[9*4096+64],out[9*4096+64];
+    cipherInstance ci,rci;
+    uringStats st;
+    char     iv[] = "0F1E2D3C4B5A69788796A5B4C3D2E1F0";
+    uint8_t  modes[] = { MODE_ECB, MODE_CBC, MODE_CTR };
+    size_t   lens[] = { 0, 5, 4096, 4096+16, 9*4096+11 };
+    size_t   i,len,plen;
+    int      n,mode,way;
+
+    if (!quietVerify)
+        {
+        printf("Twofish bulk file sanity check...");
+        fflush( stdout );
+        }
+
+    for (i=0;i<sizeof(src);i++)
+        src[i]=(uint8_t) Rand();
+
+    for (way=0;way<2;way++)
+        {
+        TwoFishUring ur(4096,3,2,way ? URING_NONE : 0);
+        if (way && ur.IsUring())
+            FatalError("Uring sanity check: io_uring not turned off","");
+
+        for (mode=0;mode<3;mode++)
+        for (n=0;n<testCnt/4+5;n++)
+            {
+            len  = (n < 5) ? lens[n] : Rand() % (9*4096+17);
+            plen = (modes[mode] == MODE_CTR) ? len : (len+15)/16*16;
+
+            if ((makeKey(&ke,DIR_ENCRYPT,KEY_BITS_0,NULL) != TF_SUCCESS) ||
+                (makeKey(&kd,DIR_DECRYPT,KEY_BITS_0,NULL) != TF_SUCCESS))
+                FatalError("makeKey during uring sanity check","");
+
+            memset(ref,0,sizeof(ref));
+            memcpy(ref,src,len);
+            cipherInit(&rci,modes[mode],iv);
+            if ((plen > 0) && (blockEncrypt(&rci,&ke,ref,plen*8,ref) < 0))
+                FatalError("Uring sanity check: blockEncrypt","");
+
+            UringFile("uring_in.bin",src,len);
+            cipherInit(&ci,modes[mode],iv);
+            if ((ur.CryptFile(&ke,&ci,DIR_ENCRYPT,"uring_in.bin","uring_enc.bin") != TF_SUCCESS) ||
+                (UringRead("uring_enc.bin",out,sizeof(out)) != plen) ||
+                memcmp(out,ref,plen))
+                FatalError("Uring sanity check: encrypt miscompare","");
+            if ((modes[mode] != MODE_ECB) &&
+                (memcmp(ci.IV,rci.IV,sizeof(ci.IV)) || memcmp(ci.iv32,rci.iv32,sizeof(ci.iv32))))
+                FatalError("Uring sanity check: cipher state miscompare","");
+
+            ur.GetStats(&st);
+            if ((st.bytesIn != len) || (st.bytesOut != plen))
+                FatalError("Uring sanity check: stats","");
+
+            /* decrypting key turned around for CTR, as parallel Decode */
+            cipherInit(&ci,modes[mode],iv);
+            if ((ur.CryptFile(&kd,&ci,DIR_DECRYPT,"uring_enc.bin","uring_dec.bin") != TF_SUCCESS) ||
+                (UringRead("uring_dec.bin",out,sizeof(out)) != plen) ||
+                memcmp(out,src,len))
+                FatalError("Uring sanity check: decrypt miscompare","");
+            }
+
+        /* ECB/CBC cipher text must be whole blocks */
+        UringFile("uring_in.bin",src,4096+5);
+        cipherInit(&ci,MODE_CBC,iv);
+        if (ur.CryptFile(&kd,&ci,DIR_DECRYPT,"uring_in.bin","uring_dec.bin") != BAD_INPUT_LEN)
+            FatalError("Uring sanity check: partial block decrypted","");
+        if (ur.CryptFile(&kd,&ci,DIR_DECRYPT,"uring_none.bin","uring_dec.bin") != STREAM_IO_FAIL)
+            FatalError("Uring sanity check: missing file not reported","");
+        }
+
+    remove("uring_in.bin");
+    remove("uring_enc.bin");
+    remove("uring_dec.bin");
+
+    if (!quietVerify) printf("  OK\n");
+    }
+
+
+/*
++*****************************************************************************
+*
+* Function Name:    MapFile_Sanity_Check
+*
+* Function:         Make sure in-place file CTR / XTS match plain calls
+*
+* Arguments:        testCnt =   # of random file lengths to try
+*
+* Return:           None.
+*
+* Notes:            CTR is checked against one blockEncrypt() call, XTS
+*                   against a block at a time P1619 done here, stealing
+*                   included.  Small chunks and windows, so a file takes
+*                   many of both.
+*                   Will FatalError if any problems found
+*
+-****************************************************************************/
+static void XtsRefBlock(keyInstance* k,uint8_t dir,uint8_t* b,const uint8_t* t)
+    {
+    cipherInstance ci;
+    int      i;
+
+    cipherInit(&ci,MODE_ECB,NULL);
+    for (i=0;i<BLOCK_SIZE/8;i++)
+        b[i] ^= t[i];
+    if (dir == DIR_ENCRYPT)
+        blockEncrypt(&ci,k,b,BLOCK_SIZE,b);
+    else
+        blockDecrypt(&ci,k,b,BLOCK_SIZE,b);
+    for (i=0;i<BLOCK_SIZE/8;i++)
+        b[i] ^= t[i];
+    }
+
+static void XtsRefDouble(uint8_t* t)
+    {
+    int      i,c = t[15] >> 7;
+
+    for (i=15;i>0;i--)
+        t[i] = (uint8_t)((t[i] << 1) | (t[i-1] >> 7));
+    t[0] = (uint8_t)((t[0] << 1) ^ (c ? 0x87 : 0));
+    }
+
+static void XtsRef(keyInstance* k,keyInstance* kt,uint8_t dir,uint8_t* p,
+                   size_t len,size_t unit,uint64_t firstUnit)
+    {
+    cipherInstance ci;
+    uint8_t  t[16],t2[16],b[16];
+    size_t   u,ulen,m,r,i;
+
+    for (u=0;u*unit<len;u++)
+        {
+        uint8_t* q = p + u*unit;
+        ulen = (len-u*unit < unit) ? len-u*unit : unit;
+        memset(t,0,sizeof(t));
+        for (i=0;i<8;i++)
+            t[i] = (uint8_t)((firstUnit+u) >> (i*8));
+        cipherInit(&ci,MODE_ECB,NULL);
+        blockEncrypt(&ci,kt,t,BLOCK_SIZE,t);
+        m = ulen/16; r = ulen%16;
+        for (i=0;i<((r) ? m-1 : m);i++)
+            {
+            XtsRefBlock(k,dir,q+i*16,t);
+            XtsRefDouble(t);
+            }
+        if (r == 0)
+            continue;
+        memcpy(t2,t,16);
+        XtsRefDouble(t2);
+        memcpy(b,q+(m-1)*16,16);
+        XtsRefBlock(k,dir,b,(dir == DIR_ENCRYPT) ? t : t2);
+        for (i=0;i<r;i++)
+            {
+            uint8_t x = q[m*16+i];
+            q[m*16+i] = b[i];
+            b[i] = x;
+            }
+        XtsRefBlock(k,dir,b,(dir == DIR_ENCRYPT) ? t2 : t);
+        memcpy(q+(m-1)*16,b,16);
+        }
+    }
+
+void MapFile_Sanity_Check(int testCnt)
+    {
+    static keyInstance ke,kd,kt;
+    static uint8_t src[7*4096+64],ref[7*4096+64],out[7*4096+64];
+    cipherInstance ci,rci;
+    mapFileStats st;
+    char     iv[] = "FFEEDDCCBBAA99887766554433221100";
+    size_t   lens[] = { 0, 16, 17, 4096, 4096+31, 7*4096+5 };
+    size_t   units[] = { 512, 4096 };
+    size_t   i,len,unit;
+    uint64_t first;
+    int      n;
+
+    if (!quietVerify)
+        {
+        printf("Twofish in-place file sanity check...");
+        fflush( stdout );
+        }
+
+    for (i=0;i<sizeof(src);i++)
+        src[i]=(uint8_t) Rand();
+
+    TwoFishMapFile mf(2,4096,3*4096);
+
+    for (n=0;n<testCnt/4+6;n++)
+        {
+        if ((makeKey(&ke,DIR_ENCRYPT,KEY_BITS_0,NULL) != TF_SUCCESS) ||
+            (makeKey(&kd,DIR_DECRYPT,KEY_BITS_0,NULL) != TF_SUCCESS) ||
+            (makeKey(&kt,DIR_ENCRYPT,KEY_BITS_0+64,NULL) != TF_SUCCESS))
+            FatalError("makeKey during in-place file sanity check","");
+
+        len = (n < 6) ? lens[n] : Rand() % (7*4096+17);
+
+        /* CTR, and back */
+        memcpy(ref,src,len);
+        cipherInit(&rci,MODE_CTR,iv);
+        if ((len > 0) && (blockEncrypt(&rci,&ke,ref,len*8,ref) < 0))
+            FatalError("In-place file sanity check: blockEncrypt","");
+        UringFile("map_file.bin",src,len);
+        cipherInit(&ci,MODE_CTR,iv);
+        if ((mf.CryptCTR("map_file.bin",&ke,&ci) != TF_SUCCESS) ||
+            (UringRead("map_file.bin",out,sizeof(out)) != len) ||
+            memcmp(out,ref,len) || memcmp(ci.IV,rci.IV,sizeof(ci.IV)))
+            FatalError("In-place file sanity check: CTR miscompare","");
+        mf.GetStats(&st);
+        if ((st.bytes != len) || (st.windows != (len+3*4096-1)/(3*4096)))
+            FatalError("In-place file sanity check: stats","");
+        cipherInit(&ci,MODE_CTR,iv);
+        if ((mf.CryptCTR("map_file.bin",&kd,&ci) != TF_SUCCESS) ||
+            (UringRead("map_file.bin",out,sizeof(out)) != len) ||
+            memcmp(out,src,len))
+            FatalError("In-place file sanity check: CTR not undone","");
+
+        /* XTS, and back; a last unit short of a block is refused */
+        unit  = units[n & 1];
+        first = ((uint64_t)Rand() << 32) | Rand();
+        memcpy(ref,src,len);
+        UringFile("map_file.bin",src,len);
+        if ((len % unit != 0) && (len % unit < 16))
+            {
+            if ((mf.CryptXTS("map_file.bin",DIR_ENCRYPT,&ke,&kt,unit,first) != BAD_INPUT_LEN) ||
+                (UringRead("map_file.bin",out,sizeof(out)) != len) ||
+                memcmp(out,src,len))
+                FatalError("In-place file sanity check: XTS short unit","");
+            continue;
+            }
+        XtsRef(&ke,&kt,DIR_ENCRYPT,ref,len,unit,first);
+        if ((mf.CryptXTS("map_file.bin",DIR_ENCRYPT,&ke,&kt,unit,first) != TF_SUCCESS) ||
+            (UringRead("map_file.bin",out,sizeof(out)) != len) ||
+            memcmp(out,ref,len))
+            FatalError("In-place file sanity check: XTS miscompare","");
+        if ((mf.CryptXTS("map_file.bin",DIR_DECRYPT,&kd,&kt,unit,first) != TF_SUCCESS) ||
+            (UringRead("map_file.bin",out,sizeof(out)) != len) ||
+            memcmp(out,src,len))
+            FatalError("In-place file sanity check: XTS not undone","");
+        }
+
+    if (mf.CryptXTS("map_file.bin",DIR_ENCRYPT,&ke,&ke,4096,0) != BAD_PARAMS)
+        FatalError("In-place file sanity check: same XTS keys taken","");
+
+    remove("map_file.bin");
+
+    if (!quietVerify) printf("  OK\n");
+    }
+
+
+/*
++*****************************************************************************
+*
+* Function Name:    GCM_Sanity_Check
+*
+* Function:         Make sure GCM matches the spec's bit at a time form
+*
+* Arguments:        testCnt =   # of random messages to try
+*
+* Return:           None.
+*
+* Notes:            Reference is SP 800-38D as written : GHASH a bit at a
+*                   time (Algorithm 1), counter blocks through ECB with
+*                   inc32.  Streamed Update()s must give the same tag, a
+*                   flipped bit anywhere must be refused.  A 256 MB
+*                   message, 2^31 bits, goes through in one call.
+*                   Will FatalError if any problems found
+*
+-****************************************************************************/
+static void GcmRefMult(uint8_t* x,const uint8_t* h)
+    {
+    uint8_t  z[16],v[16];
+    int      i,j,lsb;
+
+    memset(z,0,16);
+    memcpy(v,h,16);
+    for (i=0;i<128;i++)
+        {
+        if (x[i/8] & (0x80 >> (i%8)))
+            for (j=0;j<16;j++)
+                z[j] ^= v[j];
+        lsb = v[15] & 1;
+        for (j=15;j>0;j--)
+            v[j] = (uint8_t)((v[j] >> 1) | (v[j-1] << 7));
+        v[0] >>= 1;
+        if (lsb)
+            v[0] ^= 0xE1;
+        }
+    memcpy(x,z,16);
+    }
+
+static void GcmRefHash(uint8_t* x,const uint8_t* h,const uint8_t* p,size_t len)
+    {
+    size_t   i,n;
+
+    for (;len>0;p+=n,len-=n)
+        {
+        n = (len < 16) ? len : 16;
+        for (i=0;i<n;i++)
+            x[i] ^= p[i];
+        GcmRefMult(x,h);
+        }
+    }
+
+static void GcmRefLengths(uint8_t* x,const uint8_t* h,uint64_t a,uint64_t c)
+    {
+    uint8_t  b[16];
+    int      i;
+
+    for (i=0;i<8;i++)
+        {
+        b[i]   = (uint8_t)(a >> (56-i*8));
+        b[i+8] = (uint8_t)(c >> (56-i*8));
+        }
+    GcmRefHash(x,h,b,16);
+    }
+
+static void GcmRef(keyInstance* k,const uint8_t* iv,size_t ivLen,
+                   const uint8_t* aad,size_t aadLen,
+                   const uint8_t* in,size_t len,uint8_t* out,uint8_t* tag)
+    {
+    cipherInstance ci;
+    uint8_t  h[16],j0[16],cb[16],ks[16],x[16];
+    size_t   i,n;
+    uint32_t c32;
+
+    cipherInit(&ci,MODE_ECB,NULL);
+    memset(h,0,16);
+    blockEncrypt(&ci,k,h,BLOCK_SIZE,h);
+    memset(j0,0,16);
+    if (ivLen == 12)
+        {
+        memcpy(j0,iv,12);
+        j0[15] = 1;
+        }
+    else
+        {
+        GcmRefHash(j0,h,iv,ivLen);
+        GcmRefLengths(j0,h,0,(uint64_t)ivLen*8);
+        }
+    memcpy(cb,j0,16);
+    for (i=0;i<len;i+=16)
+        {
+        c32 = ((uint32_t)cb[12] << 24) | ((uint32_t)cb[13] << 16) |
+              ((uint32_t)cb[14] << 8) | cb[15];
+        c32++;
+        cb[12] = (uint8_t)(c32 >> 24); cb[13] = (uint8_t)(c32 >> 16);
+        cb[14] = (uint8_t)(c32 >> 8);  cb[15] = (uint8_t)c32;
+        blockEncrypt(&ci,k,cb,BLOCK_SIZE,ks);
+        for (n=0;(n<16) && (i+n<len);n++)
+            out[i+n] = in[i+n] ^ ks[n];
+        }
+    memset(x,0,16);
+    GcmRefHash(x,h,aad,aadLen);
+    GcmRefHash(x,h,out,len);
+    GcmRefLengths(x,h,(uint64_t)aadLen*8,(uint64_t)len*8);
+    blockEncrypt(&ci,k,j0,BLOCK_SIZE,ks);
+    for (i=0;i<16;i++)
+        tag[i] = x[i] ^ ks[i];
+    }
+
+void GCM_Sanity_Check(int testCnt)
+    {
+    static keyInstance k;
+    static uint8_t src[3000],ref[3000],out[3000],aad[100];
+    uint8_t  iv[64],tag[16],rtag[16];
+    uint8_t  *big;
+    const size_t bigLen = (size_t)256*1024*1024;
+    size_t   ivLens[] = { 12, 1, 16, 60 };
+    size_t   i,len,aadLen,ivLen,cut;
+    int      n;
+
+    if (!quietVerify)
+        {
+        printf("Twofish GCM sanity check...");
+        fflush( stdout );
+        }
+
+    for (i=0;i<sizeof(src);i++)
+        src[i]=(uint8_t) Rand();
+    for (i=0;i<sizeof(aad);i++)
+        aad[i]=(uint8_t) Rand();
+
+    for (n=0;n<testCnt/4+8;n++)
+        {
+        /* decrypt direction key gets turned for CTR */
+        if (makeKey(&k,(n & 1) ? DIR_DECRYPT : DIR_ENCRYPT,
+                    KEY_BITS_0 + 64*(n % 3),NULL) != TF_SUCCESS)
+            FatalError("makeKey during GCM sanity check","");
+        TwoFishGCM gcm(&k);
+
+        len    = (n < 4) ? n*16 : Rand() % sizeof(src);
+        aadLen = (n & 2) ? Rand() % sizeof(aad) : 0;
+        ivLen  = ivLens[n % 4];
+        for (i=0;i<ivLen;i++)
+            iv[i]=(uint8_t) Rand();
+
+        GcmRef(&k,iv,ivLen,aad,aadLen,src,len,ref,rtag);
+
+        if ((gcm.Encrypt(iv,ivLen,aad,aadLen,src,len,out,tag) != TF_SUCCESS) ||
+            memcmp(out,ref,len) || memcmp(tag,rtag,16))
+            FatalError("GCM sanity check: encrypt miscompare","");
+
+        /* streamed in whole blocks, then the tail */
+        cut = (len/16) ? (Rand() % (len/16 + 1))*16 : 0;
+        memset(out,0,sizeof(out));
+        if ((gcm.Start(iv,ivLen,aad,aadLen) != TF_SUCCESS) ||
+            (gcm.Update(DIR_ENCRYPT,src,cut,out) != TF_SUCCESS) ||
+            (gcm.Update(DIR_ENCRYPT,src+cut,len-cut,out+cut) != TF_SUCCESS) ||
+            (gcm.Finish(tag) != TF_SUCCESS) ||
+            memcmp(out,ref,len) || memcmp(tag,rtag,16))
+            FatalError("GCM sanity check: streamed encrypt miscompare","");
+
+        if ((gcm.Decrypt(iv,ivLen,aad,aadLen,ref,len,out,rtag) != TF_SUCCESS) ||
+            memcmp(out,src,len))
+            FatalError("GCM sanity check: decrypt miscompare","");
+
+        /* in place, truncated tag */
+        memcpy(out,ref,len);
+        if ((gcm.Decrypt(iv,ivLen,aad,aadLen,out,len,out,rtag,12) != TF_SUCCESS) ||
+            memcmp(out,src,len))
+            FatalError("GCM sanity check: in place decrypt miscompare","");
+
+        /* tags shorter than GCM_MIN_TAG_SIZE are refused */
+        memcpy(out,ref,len);
+        if ((gcm.Decrypt(iv,ivLen,aad,aadLen,ref,len,out,rtag,8) != BAD_PARAMS) ||
+            (gcm.Decrypt(iv,ivLen,aad,aadLen,ref,len,out,rtag,4) != BAD_PARAMS) ||
+            (gcm.Decrypt(iv,ivLen,aad,aadLen,ref,len,out,rtag,17) != BAD_PARAMS))
+            FatalError("GCM sanity check: short tag taken","");
+        for (i=0;i<len;i++)
+            if (out[i] != 0)
+                FatalError("GCM sanity check: text of short tag not wiped","");
+
+        /* forgeries */
+        if (len > 0)
+            {
+            ref[Rand() % len] ^= (uint8_t)(1 << (Rand() % 8));
+            if ((gcm.Decrypt(iv,ivLen,aad,aadLen,ref,len,out,rtag) != BAD_GCM_TAG))
+                FatalError("GCM sanity check: changed text taken","");
+            for (i=0;i<len;i++)
+                if (out[i] != 0)
+                    FatalError("GCM sanity check: forged text not wiped","");
+            }
+        rtag[Rand() % 16] ^= 0x80;
+        if (gcm.Decrypt(iv,ivLen,aad,aadLen,ref,len,out,rtag) != BAD_GCM_TAG)
+            FatalError("GCM sanity check: changed tag taken","");
+        }
+
+    /* partial block ends the message */
+    TwoFishGCM gcm(&k);
+    if ((gcm.Start(iv,GCM_IV_SIZE) != TF_SUCCESS) ||
+        (gcm.Update(DIR_ENCRYPT,src,15,out) != TF_SUCCESS) ||
+        (gcm.Update(DIR_ENCRYPT,src,16,out) != BAD_PARAMS))
+        FatalError("GCM sanity check: update after partial block","");
+
+    /* 256 MB in one call, more bits than an int holds, vs. streamed */
+    big = (uint8_t *) malloc(bigLen);
+    if (big == NULL)
+        FatalError("No memory for GCM sanity check","");
+    for (i=0;i<bigLen;i++)
+        big[i]=(uint8_t)(i*7 + (i >> 12));
+    if (gcm.Encrypt(iv,GCM_IV_SIZE,NULL,0,big,bigLen,big,tag) != TF_SUCCESS)
+        FatalError("GCM sanity check: 256 MB encrypt failed","");
+    if (gcm.Start(iv,GCM_IV_SIZE) != TF_SUCCESS)
+        FatalError("GCM sanity check: Start","");
+    for (len=0;len<bigLen;len+=2048)
+        {
+        for (i=0;i<2048;i++)
+            src[i]=(uint8_t)((len+i)*7 + ((len+i) >> 12));
+        if ((gcm.Update(DIR_ENCRYPT,src,2048,out) != TF_SUCCESS) ||
+            memcmp(out,big+len,2048))
+            FatalError("GCM sanity check: 256 MB encrypt miscompare","");
+        }
+    if ((gcm.Finish(rtag) != TF_SUCCESS) || memcmp(tag,rtag,16))
+        FatalError("GCM sanity check: 256 MB tag miscompare","");
+    if (gcm.Decrypt(iv,GCM_IV_SIZE,NULL,0,big,bigLen,big,tag) != TF_SUCCESS)
+        FatalError("GCM sanity check: 256 MB decrypt failed","");
+    for (i=0;i<bigLen;i++)
+        if (big[i] != (uint8_t)(i*7 + (i >> 12)))
+            FatalError("GCM sanity check: 256 MB decrypt miscompare","");
+    free(big);
+
+    if (!quietVerify) printf("  OK\n");
+    }
+
+
+/*
++*****************************************************************************
+*
+* Function Name:    Container_Sanity_Check
+*
+* Function:         Make sure container ranges read back, and forgeries don't
+*
+* Arguments:        testCnt =   # of random containers to try
+*
+* Return:           None.
+*
+* Notes:            Containers start a few bytes into their file, chunk
+*                   sizes aren't whole blocks, tags go inline and in an
+*                   index.  A changed byte must fail its own chunk only, a
+*                   changed length or key every read.
+*                   Will FatalError if any problems found
+*
+-****************************************************************************/
+static void ContainerPoke(FILE* fp,long ofs,uint8_t x)
+    {
+    int      c;
+
+    fseek(fp,ofs,SEEK_SET);
+    c = fgetc(fp);
+    fseek(fp,ofs,SEEK_SET);
+    fputc(c ^ x,fp);
+    fflush(fp);
+    }
+
+void Container_Sanity_Check(int testCnt)
+    {
+    static keyInstance k,k2;
+    static uint8_t src[20*4096+100],out[20*4096+100];
+    containerInfo info;
+    containerStats st;
+    size_t   lens[] = { 0, 1, 999, 1000, 1001, 5*1000, 4096, 20*4096+99 };
+    size_t   i,len,cs,stride,rlen;
+    uint64_t ofs,cnt,first,last;
+    uint32_t flags;
+    long     pos;
+    int      n,r;
+
+    if (!quietVerify)
+        {
+        printf("Twofish container sanity check...");
+        fflush( stdout );
+        }
+
+    for (i=0;i<sizeof(src);i++)
+        src[i]=(uint8_t) Rand();
+
+    TwoFishContainer ct(3);
+
+    for (n=0;n<testCnt/4+8;n++)
+        {
+        if ((makeKey(&k,(n & 1) ? DIR_DECRYPT : DIR_ENCRYPT,KEY_BITS_0,NULL) != TF_SUCCESS) ||
+            (makeKey(&k2,DIR_ENCRYPT,KEY_BITS_0,NULL) != TF_SUCCESS))
+            FatalError("makeKey during container sanity check","");
+        for (i=0;i<KEY_BITS_0/32;i++)
+            {
+            k.key32[i]  = Rand();
+            k2.key32[i] = k.key32[i] ^ ((i == 0) ? 1 : 0);
+            }
+        if ((reKey(&k) != TF_SUCCESS) || (reKey(&k2) != TF_SUCCESS))
+            FatalError("reKey during container sanity check","");
+
+        len    = (n < 8) ? lens[n] : Rand() % sizeof(src);
+        cs     = (n & 2) ? 4096 : 1000;
+        flags  = (n & 4) ? CONTAINER_INDEX : 0;
+        stride = cs + ((flags & CONTAINER_INDEX) ? 0 : 16);
+        cnt    = (len == 0) ? 1 : (len+cs-1)/cs;
+
+        FILE* in  = tmpfile();
+        FILE* fp  = tmpfile();
+        if ((in == NULL) || (fp == NULL))
+            FatalError("Container sanity check: tmpfile","");
+        fwrite(src,1,len,in);
+        rewind(in);
+        fwrite("junk!",1,5,fp);
+
+        if (ct.Seal(&k,in,fp,cs,flags) != TF_SUCCESS)
+            FatalError("Container sanity check: seal","");
+        ct.GetStats(&st);
+        if ((st.bytes != len) || (st.chunks != cnt))
+            FatalError("Container sanity check: seal stats","");
+        pos = ftell(fp);
+        if (pos != (long)(5+CONTAINER_HDRSZ+len+16*cnt))
+            FatalError("Container sanity check: container size","");
+
+        fseek(fp,5,SEEK_SET);
+        if ((ct.Open(&k,fp) != TF_SUCCESS) || (ct.GetInfo(&info) != TF_SUCCESS) ||
+            (info.dataLength != len) || (info.chunkCount != cnt) ||
+            (info.chunkSize != cs) || (info.flags != flags))
+            FatalError("Container sanity check: open","");
+        if ((ct.Verify() != TF_SUCCESS) || (ct.GetStats(&st),st.chunks != cnt))
+            FatalError("Container sanity check: verify","");
+        if ((ct.Read(len,out,10) != 0) || (ct.Read(0,out,0) != 0))
+            FatalError("Container sanity check: read past end","");
+
+        /* ranges touch only their chunks */
+        for (r=0;(len > 0) && (r<8);r++)
+            {
+            ofs  = Rand() % len;
+            rlen = (r == 0) ? len+10 : Rand() % (3*cs+1) + 1;
+            memset(out,0,sizeof(out));
+            if (ct.Read(ofs,out,rlen) != (long)((rlen < len-ofs) ? rlen : len-ofs))
+                FatalError("Container sanity check: read length","");
+            if (rlen > len-ofs)
+                rlen = len-ofs;
+            ct.GetStats(&st);
+            if (memcmp(out,src+ofs,rlen) ||
+                (st.chunks != (ofs+rlen-1)/cs - ofs/cs + 1))
+                FatalError("Container sanity check: read miscompare","");
+            }
+
+        /* changed byte fails its chunk, not the others */
+        if (len > 0)
+            {
+            last = Rand() % cnt;
+            ContainerPoke(fp,(long)(5+CONTAINER_HDRSZ+last*stride+Rand()%((last+1 < cnt) ? cs : len-last*cs)),0x10);
+            if ((ct.Read(last*cs,out,1) != BAD_GCM_TAG) || (out[0] != 0) ||
+                (ct.Verify() != BAD_GCM_TAG))
+                FatalError("Container sanity check: changed chunk read","");
+            first = (last + 1) % cnt;
+            if ((first != last) && (ct.Read(first*cs,out,1) != 1))
+                FatalError("Container sanity check: good chunk not read","");
+            }
+
+        /* cut at a chunk end, per header */
+        if (cnt > 1)
+            {
+            ct.Close();
+            rewind(in);
+            fseek(fp,5,SEEK_SET);
+            if ((ct.Seal(&k,in,fp,cs,flags) != TF_SUCCESS))
+                FatalError("Container sanity check: reseal","");
+            fseek(fp,5+16,SEEK_SET);
+            for (i=0;i<8;i++)
+                fputc((int)((((cnt-1)*cs) >> (i*8)) & 0xFF),fp);
+            fflush(fp);
+            fseek(fp,5,SEEK_SET);
+            r = ct.Open(&k,fp);
+            if ((r == TF_SUCCESS) && (ct.GetInfo(&info),info.dataLength != (cnt-1)*cs))
+                FatalError("Container sanity check: cut length","");
+            if ((r == TF_SUCCESS) && (ct.Verify() != BAD_GCM_TAG))
+                FatalError("Container sanity check: cut container taken","");
+            }
+
+        /* other key */
+        ct.Close();
+        rewind(in);
+        fseek(fp,5,SEEK_SET);
+        if (ct.Seal(&k,in,fp,cs,flags) != TF_SUCCESS)
+            FatalError("Container sanity check: reseal","");
+        fseek(fp,5,SEEK_SET);
+        if ((ct.Open(&k2,fp) != TF_SUCCESS) || (ct.Verify() != BAD_GCM_TAG))
+            FatalError("Container sanity check: other key taken","");
+
+        /* header asking for more than the file has */
+        fseek(fp,5+8,SEEK_SET);
+        fputc(1,fp); fputc(0,fp); fputc(0,fp); fputc(0,fp);
+        fseek(fp,5+16,SEEK_SET);
+        for (i=0;i<8;i++)
+            fputc((i == 7) ? 0x40 : 0,fp);
+        fflush(fp);
+        fseek(fp,5,SEEK_SET);
+        if (ct.Open(&k,fp) != BAD_CONTAINER)
+            FatalError("Container sanity check: oversized header taken","");
+
+        /* not a container */
+        ContainerPoke(fp,5,0x01);
+        fseek(fp,5,SEEK_SET);
+        if (ct.Open(&k,fp) != BAD_CONTAINER)
+            FatalError("Container sanity check: bad magic taken","");
+
+        ct.Close();
+        fclose(in);
+        fclose(fp);
+        }
+
+    if (!quietVerify) printf("  OK\n");
+    }
+
+
+/*
++*****************************************************************************
+*
+* Function Name:    Journal_Sanity_Check
+*
+* Function:         Make sure journal records replay, and survive crashes
+*
+* Arguments:        testCnt =   # of extra records to append
+*
+* Return:           None.
+*
+* Notes:            The journal file is checked against one CTR call over
+*                   the framed records, so no padding and one counter
+*                   stream.  Crashes are played by removing the index,
+*                   adding a torn tail and cutting the last record ; the
+*                   IV must change when a tail is cut, and a record must
+*                   fill what the index gives it.
+*                   Will FatalError if any problems found
+*
+-****************************************************************************/
+#define JRN_MAX     600
+
+typedef struct
+{
+    const uint8_t* src;
+    size_t   ofs[JRN_MAX];
+    size_t   len[JRN_MAX];
+    uint64_t next;
+    uint64_t stopAt;
+} journalCheck;
+
+static bool JournalRecordCheck(void* user,uint64_t recNo,const uint8_t* data,size_t len)
+    {
+    journalCheck* jc = (journalCheck*)user;
+
+    if ((recNo != jc->next) || (len != jc->len[recNo]) ||
+        memcmp(data,jc->src+jc->ofs[recNo],len))
+        FatalError("Journal sanity check: replay miscompare","");
+    jc->next++;
+    return (jc->next != jc->stopAt);
+    }
+
+typedef struct
+{
+    TwoFishJournal* jr;
+    size_t   appended;
+} journalEcho;
+
+static bool JournalRecordEcho(void* user,uint64_t recNo,const uint8_t* data,size_t len)
+    {
+    journalEcho* je = (journalEcho*)user;
+
+    if (je->jr->Append(data,len) == TF_SUCCESS)
+        je->appended++;
+    return true;
+    }
+
+static void JournalThread(TwoFishJournal* jr,journalCheck* jc,size_t first,size_t cnt)
+    {
+    size_t   i;
+
+    for (i=first;i<first+cnt;i++)
+        if ((jr->Append(jc->src+jc->ofs[i],jc->len[i]) != TF_SUCCESS) ||
+            ((i % 7 == 0) && (jr->Commit() != TF_SUCCESS)))
+            FatalError("Journal sanity check: threaded append","");
+    }
+
+static long JournalFileSize(const char* path)
+    {
+    FILE*    fp = fopen(path,"rb");
+    long     sz;
+
+    if (fp == NULL)
+        return -1;
+    fseek(fp,0,SEEK_END);
+    sz = ftell(fp);
+    fclose(fp);
+    return sz;
+    }
+
+void Journal_Sanity_Check(int testCnt)
+    {
+    static keyInstance k;
+    static uint8_t src[8192],raw[JRN_MAX*(4+2000)+JOURNAL_HDRSZ],ref[JRN_MAX*(4+2000)];
+    static journalCheck jc;
+    cipherInstance ci;
+    journalStats st;
+    char     iv[33];
+    size_t   i,n,cnt,total,pos;
+    uint64_t recNo,first;
+    FILE*    fp;
+    long     sz;
+
+    if (!quietVerify)
+        {
+        printf("Twofish journal sanity check...");
+        fflush( stdout );
+        }
+
+    for (i=0;i<sizeof(src);i++)
+        src[i]=(uint8_t) Rand();
+    if (makeKey(&k,DIR_DECRYPT,KEY_BITS_0,NULL) != TF_SUCCESS)
+        FatalError("makeKey during journal sanity check","");
+    for (i=0;i<KEY_BITS_0/32;i++)
+        k.key32[i] = Rand();
+    if (reKey(&k) != TF_SUCCESS)
+        FatalError("reKey during journal sanity check","");
+
+    cnt = 300 + ((size_t)testCnt % 200);
+    jc.src = src;
+    for (i=0;i<cnt;i++)
+        {
+        jc.len[i] = (i < 3) ? i : Rand() % 2001;
+        jc.ofs[i] = Rand() % (sizeof(src)-2000);
+        }
+
+    remove("journal.bin");
+    remove("journal.bin.idx");
+
+    /* one thread, then two at once; commits batch many records */
+    {
+    TwoFishJournal jr(4096);
+    if (jr.Open("journal.bin",&k) != TF_SUCCESS)
+        FatalError("Journal sanity check: create","");
+    for (i=0;i<cnt/2;i++)
+        if ((jr.Append(src+jc.ofs[i],jc.len[i],&recNo) != TF_SUCCESS) || (recNo != i) ||
+            ((i % 17 == 0) && (jr.Commit() != TF_SUCCESS)))
+            FatalError("Journal sanity check: append","");
+    if (jr.Append(NULL,JOURNAL_MAXREC+1) != BAD_PARAMS)
+        FatalError("Journal sanity check: bad append taken","");
+    if (jr.Commit() != TF_SUCCESS)
+        FatalError("Journal sanity check: commit","");
+    std::thread t1(JournalThread,&jr,&jc,cnt/2,(cnt-cnt/2)/2);
+    std::thread t2(JournalThread,&jr,&jc,cnt/2+(cnt-cnt/2)/2,cnt-cnt/2-(cnt-cnt/2)/2);
+    t1.join();
+    t2.join();
+    jr.GetStats(&st);
+    if ((st.records != cnt) || (st.commits >= cnt) || (jr.Close() != TF_SUCCESS) ||
+        (jr.GetRecordCount() != 0))
+        FatalError("Journal sanity check: group commit","");
+    }
+
+    /* file is the framed records under one CTR stream : order of the
+       threaded half is taken from a replay */
+    fp = fopen("journal.bin","rb");
+    sz = (long)fread(raw,1,sizeof(raw),fp);
+    fclose(fp);
+    for (i=0;i<16;i++)
+        snprintf(&iv[i*2],3,"%02X",raw[16+i]);
+    cipherInit(&ci,MODE_CTR,iv);
+    total = (size_t)sz - JOURNAL_HDRSZ;
+    memcpy(ref,raw+JOURNAL_HDRSZ,total);
+    if (blockEncrypt(&ci,&k,ref,total*8,ref) < 0)
+        FatalError("Journal sanity check: blockEncrypt","");
+    for (i=0,pos=0;i<cnt;i++)
+        {
+        n = ref[pos] | (ref[pos+1] << 8) | (ref[pos+2] << 16) | ((size_t)ref[pos+3] << 24);
+        if ((pos+4+n > total) || ((i < cnt/2) &&
+            ((n != jc.len[i]) || memcmp(ref+pos+4,src+jc.ofs[i],n))))
+            FatalError("Journal sanity check: file miscompare","");
+        /* threaded records : find which, keep replay order */
+        if (i >= cnt/2)
+            {
+            for (recNo=cnt/2;recNo<cnt;recNo++)
+                if ((jc.len[recNo] == n) && !memcmp(ref+pos+4,src+jc.ofs[recNo],n))
+                    break;
+            if (recNo == cnt)
+                FatalError("Journal sanity check: threaded record lost","");
+            first = jc.ofs[recNo]; jc.ofs[recNo] = jc.ofs[i]; jc.ofs[i] = (size_t)first;
+            first = jc.len[recNo]; jc.len[recNo] = jc.len[i]; jc.len[i] = (size_t)first;
+            }
+        pos += 4+n;
+        }
+    if (pos != total)
+        FatalError("Journal sanity check: padding in file","");
+
+    /* reopened : ranges, and a replay stopped early */
+    {
+    TwoFishJournal jr;
+    if ((jr.Open("journal.bin",&k) != TF_SUCCESS) || (jr.GetRecordCount() != cnt))
+        FatalError("Journal sanity check: reopen","");
+    jc.next = 0; jc.stopAt = cnt+1;
+    if ((jr.Replay(0,cnt+5,JournalRecordCheck,&jc) != TF_SUCCESS) || (jc.next != cnt))
+        FatalError("Journal sanity check: replay all","");
+    for (n=0;n<20;n++)
+        {
+        first   = Rand() % cnt;
+        jc.next = first; jc.stopAt = (n & 1) ? first + 1 + Rand() % 5 : cnt+1;
+        recNo   = Rand() % 50;
+        if ((jr.Replay(first,recNo,JournalRecordCheck,&jc) != TF_SUCCESS) ||
+            ((n & 1) == 0) && (jc.next != ((first+recNo < cnt) ? first+recNo : cnt)))
+            FatalError("Journal sanity check: replay range","");
+        }
+    }
+
+    /* index lost */
+    remove("journal.bin.idx");
+    {
+    TwoFishJournal jr;
+    if ((jr.Open("journal.bin",&k) != TF_SUCCESS) || (jr.GetRecordCount() != cnt) ||
+        (jr.GetStats(&st),st.recovered != cnt))
+        FatalError("Journal sanity check: index rebuild","");
+    jc.len[cnt] = 100; jc.ofs[cnt] = 5;
+    if ((jr.Append(src+5,100) != TF_SUCCESS) || (jr.Close() != TF_SUCCESS))
+        FatalError("Journal sanity check: append after rebuild","");
+    }
+
+    /* torn tail, then last record cut */
+    sz = JournalFileSize("journal.bin");
+    fp = fopen("journal.bin","ab");
+    fwrite(src,1,7,fp);
+    fclose(fp);
+    {
+    TwoFishJournal jr;
+    if ((jr.Open("journal.bin",&k) != TF_SUCCESS) || (jr.GetRecordCount() != cnt+1) ||
+        (jr.GetStats(&st),st.dropped != 7) || (JournalFileSize("journal.bin") != sz))
+        FatalError("Journal sanity check: torn tail","");
+    jc.next = cnt; jc.stopAt = cnt+2;
+    if ((jr.Replay(cnt,1,JournalRecordCheck,&jc) != TF_SUCCESS) || (jc.next != cnt+1))
+        FatalError("Journal sanity check: replay after torn tail","");
+    }
+    fp = fopen("journal.bin","rb");
+    total = fread(ref,1,JOURNAL_HDRSZ,fp);
+    fclose(fp);
+    if (!memcmp(ref+16,raw+16,16))
+        FatalError("Journal sanity check: IV kept over torn tail","");
+    fp = fopen("journal.bin","rb");
+    total = fread(raw,1,sizeof(raw),fp);
+    fclose(fp);
+    fp = fopen("journal.bin","wb");
+    fwrite(raw,1,(size_t)sz-3,fp);
+    fclose(fp);
+    {
+    TwoFishJournal jr;
+    if ((jr.Open("journal.bin",&k) != TF_SUCCESS) || (jr.GetRecordCount() != cnt) ||
+        (jr.GetStats(&st),st.dropped != 104-3) ||
+        (JournalFileSize("journal.bin") != sz-104))
+        FatalError("Journal sanity check: cut record","");
+    }
+
+    /* index entry moved a byte : record 0 no longer fills its place */
+    fp = fopen("journal.bin.idx","r+b");
+    fseek(fp,8,SEEK_SET);
+    pos = (size_t)fgetc(fp);
+    fseek(fp,8,SEEK_SET);
+    fputc((int)pos+1,fp);
+    fclose(fp);
+    {
+    TwoFishJournal jr;
+    jc.next = 0; jc.stopAt = cnt+1;
+    if ((jr.Open("journal.bin",&k) != TF_SUCCESS) ||
+        (jr.Replay(0,2,JournalRecordCheck,&jc) != BAD_JOURNAL) || (jc.next != 0))
+        FatalError("Journal sanity check: record length not checked","");
+    }
+
+    fp = fopen("journal.bin","r+b");
+    fputc('X',fp);
+    fclose(fp);
+    {
+    TwoFishJournal jr;
+    if (jr.Open("journal.bin",&k) != BAD_JOURNAL)
+        FatalError("Journal sanity check: bad header taken","");
+    }
+
+    remove("journal.bin");
+    remove("journal.bin.idx");
+
+    /* callback appends : replay doesn't hold the journal lock */
+    {
+    TwoFishJournal jr;
+    journalEcho    je = { &jr, 0 };
+    if (jr.Open("journal.bin",&k) != TF_SUCCESS)
+        FatalError("Journal sanity check: create","");
+    for (i=0;i<3;i++)
+        if (jr.Append(src+jc.ofs[i],jc.len[i]) != TF_SUCCESS)
+            FatalError("Journal sanity check: append","");
+    if ((jr.Commit() != TF_SUCCESS) ||
+        (jr.Replay(0,3,JournalRecordEcho,&je) != TF_SUCCESS) || (je.appended != 3) ||
+        (jr.Commit() != TF_SUCCESS) || (jr.GetRecordCount() != 6))
+        FatalError("Journal sanity check: append from replay","");
+    jc.next = 0; jc.stopAt = 4;
+    if (jr.Replay(0,3,JournalRecordCheck,&jc) != TF_SUCCESS)
+        FatalError("Journal sanity check: replay after append from replay","");
+    }
+
+    remove("journal.bin");
+    remove("journal.bin.idx");
+
+    if (!quietVerify) printf("  OK\n");
+    }
+
+
+/*
++*****************************************************************************
+*
+* Function Name:    Page_Sanity_Check
+*
+* Function:         Make sure cached pages read back, and are XTS on disk
+*
+* Arguments:        testCnt =   # of extra random page operations
+*
+* Return:           None.
+*
+* Notes:            A small cache against a plain model of the file, so
+*                   most operations miss or evict.  Slots on disk are
+*                   checked against P1619 done here under a tweak of page
+*                   number and version.
+*                   Will FatalError if any problems found
+*
+-****************************************************************************/
+#define PAGE_SZ     4096
+#define PAGE_CNT    48
+
+static uint64_t PageSlotVersion(const uint8_t* raw,size_t page)
+    {
+    const uint8_t* s = raw + page*(PAGECACHE_HDRSZ+PAGE_SZ);
+    uint64_t v = 0;
+    int      i;
+
+    for (i=7;i>=0;i--)
+        v = (v << 8) | s[i];
+    return v;
+    }
+
+static void PageSlotCheck(keyInstance* k,keyInstance* kt,const uint8_t* raw,
+                          const uint8_t* model,size_t page)
+    {
+    static uint8_t ref[PAGE_SZ];
+    cipherInstance ci;
+    uint8_t  t[16];
+    uint64_t v = PageSlotVersion(raw,page);
+    size_t   i;
+
+    for (i=0;i<8;i++)
+        {
+        t[i]   = (uint8_t)(page >> (i*8));
+        t[i+8] = (uint8_t)(v >> (i*8));
+        }
+    cipherInit(&ci,MODE_ECB,NULL);
+    blockEncrypt(&ci,kt,t,BLOCK_SIZE,t);
+    memcpy(ref,model+page*PAGE_SZ,PAGE_SZ);
+    for (i=0;i<PAGE_SZ/16;i++)
+        {
+        XtsRefBlock(k,DIR_ENCRYPT,ref+i*16,t);
+        XtsRefDouble(t);
+        }
+    if (memcmp(ref,raw+page*(PAGECACHE_HDRSZ+PAGE_SZ)+PAGECACHE_HDRSZ,PAGE_SZ))
+        FatalError("Page sanity check: slot not XTS of page","");
+    }
+
+static size_t PageFileRead(const char* path,uint8_t* raw,size_t len)
+    {
+    FILE*    fp = fopen(path,"rb");
+    size_t   n;
+
+    if (fp == NULL)
+        return 0;
+    n = fread(raw,1,len,fp);
+    fclose(fp);
+    return n;
+    }
+
+void Page_Sanity_Check(int testCnt)
+    {
+    static keyInstance k,kt;
+    static uint8_t model[PAGE_CNT*PAGE_SZ],page[PAGE_SZ];
+    static uint8_t raw[PAGE_CNT*(PAGECACHE_HDRSZ+PAGE_SZ)],raw2[PAGE_CNT*(PAGECACHE_HDRSZ+PAGE_SZ)];
+    static bool    written[PAGE_CNT];
+    pageCacheStats st,st2;
+    size_t   i,n,p,ops;
+    uint64_t v;
+
+    if (!quietVerify)
+        {
+        printf("Twofish page cache sanity check...");
+        fflush( stdout );
+        }
+
+    if ((makeKey(&k,DIR_ENCRYPT,KEY_BITS_0,NULL) != TF_SUCCESS) ||
+        (makeKey(&kt,DIR_ENCRYPT,KEY_BITS_0,NULL) != TF_SUCCESS))
+        FatalError("makeKey during page sanity check","");
+    for (i=0;i<KEY_BITS_0/32;i++)
+        {
+        k.key32[i]  = Rand();
+        kt.key32[i] = Rand();
+        }
+    if ((reKey(&k) != TF_SUCCESS) || (reKey(&kt) != TF_SUCCESS))
+        FatalError("reKey during page sanity check","");
+
+    memset(model,0,sizeof(model));
+    memset(written,0,sizeof(written));
+    remove("pages.bin");
+
+    {
+    TwoFishPageCache bad(1000);
+    TwoFishPageCache pc(PAGE_SZ,16,2);
+    if ((bad.Open("pages.bin",&k,&kt) != BAD_PARAMS) ||
+        (pc.Open("pages.bin",&k,&k) != BAD_PARAMS))
+        FatalError("Page sanity check: bad parameters taken","");
+    if ((pc.Open("pages.bin",&k,&kt) != TF_SUCCESS) || (pc.GetPageCount() != 0) ||
+        (pc.GetPageSize() != PAGE_SZ))
+        FatalError("Page sanity check: create","");
+
+    /* random reads and writes, three times the cache in pages */
+    ops = 1500 + ((size_t)testCnt % 500);
+    for (n=0;n<ops;n++)
+        {
+        p = Rand() % PAGE_CNT;
+        if (Rand() % 3 == 0)
+            {
+            for (i=0;i<PAGE_SZ;i++)
+                model[p*PAGE_SZ+i] = (uint8_t)Rand();
+            written[p] = true;
+            if (pc.Write(p,model+p*PAGE_SZ) != TF_SUCCESS)
+                FatalError("Page sanity check: write","");
+            }
+        else if ((pc.Read(p,page) != TF_SUCCESS) || memcmp(page,model+p*PAGE_SZ,PAGE_SZ))
+            FatalError("Page sanity check: read miscompare","");
+        }
+    pc.GetStats(&st);
+    if ((st.hits == 0) || (st.misses == 0) || (st.evictions == 0) ||
+        (st.writebacks == 0) || (st.batches == 0) || (st.batches > st.writebacks))
+        FatalError("Page sanity check: stats","");
+
+    /* a run of pages written back in one write */
+    if (pc.Flush() != TF_SUCCESS)
+        FatalError("Page sanity check: flush","");
+    pc.GetStats(&st);
+    for (p=0;p<12;p++)
         {
-        printf("\nCalibrate GetTimer(): ",t1-t0);
-        for (i=0;i<sizeof(dt)/sizeof(dt[0]);i++)
-            printf("%6ld",dt[i]);
-        printf("\n\n");
+        memset(model+p*PAGE_SZ,(int)p+1,PAGE_SZ);
+        written[p] = true;
+        if (pc.Write(p,model+p*PAGE_SZ) != TF_SUCCESS)
+            FatalError("Page sanity check: write run","");
         }
-#else
-    printf("All times in clks, assuming %d MHz CPU (use -fmNN switch to set)\n",CLK_MHZ);
-    printf("CLOCKS_PER_SEC = %8.1f\n",(double)CLOCKS_PER_SEC);
-#endif
+    if (pc.Flush(true) != TF_SUCCESS)
+        FatalError("Page sanity check: durable flush","");
+    pc.GetStats(&st2);
+    if ((st2.writebacks-st.writebacks != 12) || (st2.writes-st.writes != 1) ||
+        (st2.batches-st.batches != 1))
+        FatalError("Page sanity check: run not coalesced","");
+    }
 
-    printf("%-13s","keySize=");
-    for (t.keySize=KEY_BITS_0;t.keySize<=MAX_KEY_BITS;t.keySize+=STEP_KEY_BITS)
-        printf("%10d bits  ",t.keySize);
-    printf("\n");
-        
-    for (n=0;n<TEST_CNT;n++)
+    /* slots are XTS under page and version, zeros never written */
+    n = PageFileRead("pages.bin",raw,sizeof(raw));
+    if (n % (PAGECACHE_HDRSZ+PAGE_SZ))
+        FatalError("Page sanity check: file size","");
+    for (p=0;p<PAGE_CNT;p++)
         {
-        printf("%-13s",testName[n]);
-        for (q=0;q<3;q++)
+        if ((p+1)*(PAGECACHE_HDRSZ+PAGE_SZ) > n)
             {
-            printf(format[n],TSCALE*testTime[q][n]/(ICNT*(double)denom[n]),atomName[n]);
+            if (written[p])
+                FatalError("Page sanity check: written page missing","");
+            continue;
             }
-        printf("\n");
+        v = PageSlotVersion(raw,p);
+        if ((v == 0) != !written[p])
+            FatalError("Page sanity check: slot version","");
+        if (v)
+            PageSlotCheck(&k,&kt,raw,model,p);
         }
-    if (FMT_LOG)
-        printf(";;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;\n");
+
+    /* same page again : new version, other cipher text; prefetch */
+    {
+    TwoFishPageCache pc(PAGE_SZ,16,2);
+    if ((pc.Open("pages.bin",&k,&kt) != TF_SUCCESS) ||
+        (pc.GetPageCount() != n/(PAGECACHE_HDRSZ+PAGE_SZ)))
+        FatalError("Page sanity check: reopen","");
+    if ((pc.Write(3,model+3*PAGE_SZ) != TF_SUCCESS) || (pc.Flush() != TF_SUCCESS))
+        FatalError("Page sanity check: rewrite","");
+    PageFileRead("pages.bin",raw2,sizeof(raw2));
+    i = 3*(PAGECACHE_HDRSZ+PAGE_SZ);
+    if ((PageSlotVersion(raw2,3) != PageSlotVersion(raw,3)+1) ||
+        !memcmp(raw+i+PAGECACHE_HDRSZ,raw2+i+PAGECACHE_HDRSZ,PAGE_SZ))
+        FatalError("Page sanity check: rewrite kept cipher text","");
+    PageSlotCheck(&k,&kt,raw2,model,3);
+
+    pc.GetStats(&st);
+    if ((pc.Prefetch(20,100) != TF_SUCCESS) || (pc.GetStats(&st2),st2.misses-st.misses != 8))
+        FatalError("Page sanity check: prefetch","");
+    for (p=20;p<28;p++)
+        if ((pc.Read(p,page) != TF_SUCCESS) || memcmp(page,model+p*PAGE_SZ,PAGE_SZ))
+            FatalError("Page sanity check: prefetch miscompare","");
+    pc.GetStats(&st);
+    if ((st.misses != st2.misses) || (st.hits-st2.hits != 8))
+        FatalError("Page sanity check: prefetched pages missed","");
+    for (p=0;p<PAGE_CNT;p++)
+        if ((pc.Read(p,page) != TF_SUCCESS) || memcmp(page,model+p*PAGE_SZ,PAGE_SZ))
+            FatalError("Page sanity check: reopen miscompare","");
+    if (pc.Close() != TF_SUCCESS)
+        FatalError("Page sanity check: close","");
+    }
+
+    remove("pages.bin");
+
+    if (!quietVerify) printf("  OK\n");
     }
 
 
 /*
 +*****************************************************************************
 *
-* Function Name:    AES_Sanity_Check
+* Function Name:    Channel_Sanity_Check
 *
-* Function:         Make sure things work to the interface spec and
-*                   that encryption and decryption are inverse functions
+* Function:         Make sure frames cross a shared memory channel intact
 *
-* Arguments:        None.
+* Arguments:        testCnt =   # of extra frames to send
 *
 * Return:           None.
 *
-* Notes:            Will FatalError if any problems found
+* Notes:            Producer and consumer in threads of this process, on
+*                   a ring of a few slots, so both sides wait on the
+*                   other.  Frames go by Send() and by Acquire() and
+*                   Publish() in turns.
+*                   Will FatalError if any problems found
 *
 -****************************************************************************/
-void AES_Sanity_Check(int testCnt)
+#define CHN_SLOTSZ  3000
+
+typedef struct
+{
+    const uint8_t* src;
+    size_t   ofs;
+    size_t   len;
+} channelFrame;
+
+static void ChannelConsumer(TwoFishChannel* ch,const channelFrame* fr,size_t cnt)
     {
-    static uint32_t hexVal[] =
-            {0x67452301,0xEFCDAB89,0x98BADCFE,0x10325476,
-             0x33221100,0x77665544,0xBBAA9988,0xFFEEDDCC};
-    const char *modeNames[]={"(null)","MODE_ECB","MODE_CBC","MODE_CFB1"};
+    const uint8_t* p;
+    size_t   i,len;
 
-    int i,j,q,n,testNum,lim,saveDebug=debug;
-    testData t;
-    keyInstance k2;
-    uint8_t pt[128];
-    uint8_t ct[128];
-    char ivString[BLOCK_SIZE/4];
-    const char *mName = NULL;
-    uint8_t mode;
-#if ALIGN32
-    uint8_t alignDummy[3]; /* keep dword alignment on stack after uint8_t mode */
-#endif
+    for (i=0;i<cnt;i++)
+        {
+        if ((ch->Receive(&p,&len) != TF_SUCCESS) || (len != fr[i].len) ||
+            memcmp(p,fr[i].src+fr[i].ofs,len))
+            FatalError("Channel sanity check: frame miscompare","");
+        if (ch->Release() != TF_SUCCESS)
+            FatalError("Channel sanity check: release","");
+        }
+    if (ch->Receive(&p,&len) != CHANNEL_CLOSED)
+        FatalError("Channel sanity check: producer close not seen","");
+    }
 
-    if (!quietVerify) 
+void Channel_Sanity_Check(int testCnt)
     {
-        printf("\nTwofish code sanity check...");
+    static keyInstance k,k2;
+    static uint8_t src[8192];
+    static channelFrame fr[1200];
+    channelStats st,st2;
+    const uint8_t* p;
+    uint8_t* buf;
+    uint8_t  first[32];
+    char     name[64];
+    size_t   i,cnt,len;
+
+    if (!quietVerify)
+        {
+        printf("Twofish shared memory channel sanity check...");
         fflush( stdout );
+        }
+
+    for (i=0;i<sizeof(src);i++)
+        src[i]=(uint8_t) Rand();
+    if ((makeKey(&k,DIR_ENCRYPT,KEY_BITS_0,NULL) != TF_SUCCESS) ||
+        (makeKey(&k2,DIR_DECRYPT,KEY_BITS_0,NULL) != TF_SUCCESS))
+        FatalError("makeKey during channel sanity check","");
+    for (i=0;i<KEY_BITS_0/32;i++)
+        k.key32[i] = Rand();
+    if (reKey(&k) != TF_SUCCESS)
+        FatalError("reKey during channel sanity check","");
+    snprintf(name,sizeof(name),"/tfchannel-test-%08X",(unsigned)Rand());
+
+    /* setup : bad parameters, no channel, wrong key, name taken */
+    {
+    TwoFishChannel prod,cons,other;
+    if ((prod.Create(name,&k,1,100) != BAD_PARAMS) ||
+        (prod.Create(name,&k,4,CHANNEL_MAXSLOTSZ+1) != BAD_PARAMS) ||
+        (cons.Attach(name,&k) != STREAM_IO_FAIL))
+        FatalError("Channel sanity check: bad setup taken","");
+    if ((prod.Create(name,&k,4,CHN_SLOTSZ) != TF_SUCCESS) ||
+        (other.Create(name,&k,4,CHN_SLOTSZ) != STREAM_IO_FAIL))
+        FatalError("Channel sanity check: create","");
+    if ((cons.Attach(name,&k2) != BAD_KEY_MAT) || (cons.Attach(name,&k) != TF_SUCCESS) ||
+        (cons.GetSlotSize() != CHN_SLOTSZ))
+        FatalError("Channel sanity check: attach","");
+
+    /* empty and full rings time out; a frame sits ciphered in its slot */
+    if ((cons.Receive(&p,&len,0) != CHANNEL_TIMEOUT) ||
+        (cons.Receive(&p,&len,20) != CHANNEL_TIMEOUT))
+        FatalError("Channel sanity check: empty ring","");
+    if ((prod.Send(src,CHN_SLOTSZ+1) != BAD_INPUT_LEN) || (prod.Publish(5) != BAD_PARAMS))
+        FatalError("Channel sanity check: bad send taken","");
+    for (i=0;i<4;i++)
+        {
+        if (prod.Acquire(&buf,0) != TF_SUCCESS)
+            FatalError("Channel sanity check: acquire","");
+        memcpy(buf,src,32);
+        if ((prod.Publish(32) != TF_SUCCESS) || !memcmp(buf,src,32))
+            FatalError("Channel sanity check: frame not ciphered","");
+        if (i == 0)
+            memcpy(first,buf,32);
+        else if (!memcmp(first,buf,32))
+            FatalError("Channel sanity check: counters of frames meet","");
+        }
+    if ((prod.Send(src,10,0) != CHANNEL_TIMEOUT) || (prod.Acquire(&buf,20) != CHANNEL_TIMEOUT))
+        FatalError("Channel sanity check: full ring","");
+    for (i=0;i<4;i++)
+        if ((cons.Receive(&p,&len,0) != TF_SUCCESS) || (len != 32) || memcmp(p,src,32) ||
+            (cons.Receive(&p,&len,0) != BAD_PARAMS) || (cons.Release() != TF_SUCCESS))
+            FatalError("Channel sanity check: receive","");
+    if ((cons.Close() != TF_SUCCESS) || (prod.Send(src,10) != CHANNEL_CLOSED))
+        FatalError("Channel sanity check: consumer close not seen","");
     }
-    
-#if (MODE_CFB1 != MODE_ECB  + 2)
-    #error Need to change mode loop constants
-#endif
-    
-    if (testCnt)
-    for (mode=MODE_ECB;mode<=MODE_CFB1;mode++)
-    {        
-        debug=(mode == saveDebug);
-        mName=modeNames[(size_t)mode];
-        if (cipherInit(&t.ci,mode,hexString) != TF_SUCCESS)
-            FatalError("cipherInit error during sanity check %s",mName);
-        if (t.ci.mode != mode)
-            FatalError("Cipher mode not set properly during sanity check %s",mName);
-        if (mode != MODE_ECB)
-            for (i=0;i<BLOCK_SIZE/32;i++)
-                if (t.ci.iv32[i] != hexVal[i])
-                    FatalError("Invalid IV parse during sanity check %s",mName);
-        lim = (mode == MODE_CFB1) ? (testCnt+31)/32 : testCnt;
-        for (t.keySize=KEY_BITS_0;t.keySize <= MAX_KEY_BITS;t.keySize+=STEP_KEY_BITS)
+
+    /* threads : producer far ahead of or behind the consumer */
+    cnt = 800 + ((size_t)testCnt % 400);
+    for (i=0;i<cnt;i++)
+        {
+        fr[i].src = src;
+        fr[i].len = (i < 3) ? i : Rand() % (CHN_SLOTSZ+1);
+        fr[i].ofs = Rand() % (sizeof(src)-CHN_SLOTSZ);
+        }
+    {
+    TwoFishChannel prod,cons;
+    if ((prod.Create(name,&k,4,CHN_SLOTSZ) != TF_SUCCESS) ||
+        (cons.Attach(name,&k) != TF_SUCCESS))
+        FatalError("Channel sanity check: create again","");
+    std::thread t(ChannelConsumer,&cons,fr,cnt);
+    for (i=0;i<cnt;i++)
+        {
+        if (i & 1)
             {
-            /* printf("Running %-9s sanity check on keySize = %3d.\n",mName,t.keySize); */
-            if (!quietVerify) printf(".");  /* show some progress */
-            ClearTestData(&t);
-            debug=0;            /* don't show debug info in this makeKey call */
-            if (makeKey(&t.ki,DIR_ENCRYPT,t.keySize,hexString) != TF_SUCCESS)
-                FatalError("Error parsing key during sanity check %s",mName);
-            debug=(mode == saveDebug);
-            for (i=0;i<t.keySize/32;i++)
-                if (t.ki.key32[i]!=hexVal[i])
-                    FatalError("Invalid key parse during sanity check %s",mName);
-            for (testNum=0;testNum<lim;testNum++)
-                {                       /* run a bunch of encode/decode tests */
-                if ((testNum&0x1F)==0)  /* periodic re-key time? */
-                    {
-                    for (j=0;j<t.keySize/4;j++)
-                        t.ki.keyMaterial[j]=hexTab[Rand() & 0xF];
-                    if (testNum==0)
-                        ClearTestData(&t);  /* give "easy" test data the first time */
-                    if (makeKey(&t.ki,DIR_ENCRYPT,t.keySize,t.ki.keyMaterial) != TF_SUCCESS)
-                        FatalError("Encrypt makeKey during sanity check %s",mName);
-                    debug=0;
-                    if (makeKey(&k2  ,DIR_DECRYPT,t.keySize,t.ki.keyMaterial) != TF_SUCCESS)
-                        FatalError("Decrypt makeKey during sanity check %s",mName);
-                    debug=(mode == saveDebug);
-                    }
-                if (mode != MODE_ECB)               /* set IV  if needed*/
-                    for (j=0;j<BLOCK_SIZE/4;j++)
-                        ivString[j]=hexTab[(testNum)? Rand() & 0xF : 0];
-                if ((debug) || (testNum == 0))
-                    n = (BLOCK_SIZE/8);             /* do only one block if debugging */
-                else
-                    n = (BLOCK_SIZE/8)*(1 + (Rand() % (sizeof(pt)/(BLOCK_SIZE/8))));
+            if (prod.Send(src+fr[i].ofs,fr[i].len) != TF_SUCCESS)
+                FatalError("Channel sanity check: threaded send","");
+            }
+        else if ((prod.Acquire(&buf) != TF_SUCCESS) ||
+                 (memcpy(buf,src+fr[i].ofs,fr[i].len),prod.Publish(fr[i].len) != TF_SUCCESS))
+            FatalError("Channel sanity check: threaded publish","");
+        if (i % 97 == 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    prod.Close();
+    t.join();
+    prod.GetStats(&st);
+    cons.GetStats(&st2);
+    for (i=0,len=0;i<cnt;i++)
+        len += fr[i].len;
+    if ((st.frames != cnt) || (st2.frames != cnt) || (st.bytes != len) || (st2.bytes != len))
+        FatalError("Channel sanity check: stats","");
+    }
 
-                for (j=0;j<n;j++)                   /* set random plaintext */
-                    pt[j]=(testNum) ? (uint8_t) Rand() : 0;
-                if (mode == MODE_CBC)
-                    {   /* check that CBC works as advertised */
-                    cipherInit(&t.ci,mode,ivString);
-                    t.ci.mode=MODE_ECB;
-                    for (q=0;q<BLOCK_SIZE/8;q++)    /* copy over the iv */
-                        t.pt[q] = (uint8_t) (t.ci.iv32[q/4] >> (8*(q&3))); /* auto-Bswap! */
-                    for (j=0;j<n;j+=BLOCK_SIZE/8)
-                        {
-                        for (q=0;q<BLOCK_SIZE/8;q++)    /* xor in next block */
-                            t.pt[q] ^= pt[j+q];
-                        debug=0;
-                        if (BLOCK_SIZE != blockEncrypt(&t.ci,&t.ki,t.pt,BLOCK_SIZE,t.pt))
-                            FatalError("blockEncrypt return value during sanity check %s",mName);
-                        debug=(mode == saveDebug);
-                        }
-                    t.ci.mode=MODE_CBC;         /* restore mode */
-                    }
-                /* encrypt */
-                cipherInit(&t.ci,mode,ivString);
-                if ((testNum < 4) || (Rand() & 1))
-                    {
-                    if (n*8 != blockEncrypt(&t.ci,&t.ki,pt,n*8,ct))
-                        FatalError("blockEncrypt return value during sanity check %s",mName);
-                    }
-                else    /* do it in pieces */
-                    for (j=0;j<n;j+=BLOCK_SIZE/8)
-                        if (BLOCK_SIZE != blockEncrypt(&t.ci,&t.ki,pt+j,BLOCK_SIZE,ct+j))
-                        FatalError("blockEncrypt return value during sanity check %s",mName);
-                            
-                if (mode == MODE_CBC)           /* validate CBC "hash" */
-                    for (q=0;q<BLOCK_SIZE/8;q++)
-                        if (t.pt[q] != ct[n-BLOCK_SIZE/8+q])
-                            FatalError("CBC doesn't work during sanity check %s",mName);
-                /* decrypt */
-                cipherInit(&t.ci,mode,ivString);
-                if ((testNum < 4) || (Rand() & 1))
-                    {
-                    if (n*8 != blockDecrypt(&t.ci,&t.ki,ct,n*8,ct))
-                        FatalError("blockDecrypt return value during sanity check %s",mName);
-                    }
-                else    /* do it in pieces */
-                    for (j=0;j<n;j+=BLOCK_SIZE/8)
-                        if (BLOCK_SIZE != blockDecrypt(&t.ci,&t.ki,ct+j,BLOCK_SIZE,ct+j))
-                        FatalError("blockEncrypt return value during sanity check %s",mName);
+    if (!quietVerify) printf("  OK\n");
+    }
 
-                /* compare */
-                for (j=0;j<n;j++)
-                    if (pt[j] != ct[j])
-                        {
-                        char s[128];
-                        sprintf(s,"Sanity check: encrypt/decrypt miscompare (mode=%s,keySize=%d)",
-                                mName,t.keySize);
-                        FatalError(s,"");
-                        }
-                if (debug)
-                    {
-                    if (testNum >= debug)
-                        exit(1);
-                    printf(";-------------------------------------------------\n");
-                    }
-                }
+
+/*
++*****************************************************************************
+*
+* Function Name:    Datagram_Sanity_Check
+*
+* Function:         Make sure mmsghdr batches cipher right, over loopback
+*
+* Arguments:        testCnt =   # of extra datagrams per batch
+*
+* Return:           None.
+*
+* Notes:            Payloads are checked against one CTR call from the
+*                   header nonce, then a batch goes by sendmmsg() and
+*                   comes back by recvmmsg() to 127.0.0.1.  Some datagrams
+*                   have header and payload in iovecs of their own, one
+*                   is cut short by its receive buffer.
+*                   Will FatalError if any problems found
+*
+-****************************************************************************/
+#define DGR_CNT     40
+#define DGR_HDR     16
+#define DGR_MAX     1400
+
+void Datagram_Sanity_Check(int testCnt)
+    {
+#if defined(__linux__)
+    static keyInstance k;
+    static uint8_t plain[DGR_CNT][DGR_HDR+DGR_MAX],pkt[DGR_CNT][DGR_HDR+DGR_MAX];
+    static uint8_t rx[DGR_CNT][DGR_HDR+DGR_MAX],ref[DGR_MAX];
+    struct mmsghdr msgs[DGR_CNT],rmsgs[DGR_CNT];
+    struct iovec iov[DGR_CNT][2],riov[DGR_CNT];
+    struct sockaddr_in addr;
+    socklen_t alen = sizeof(addr);
+    cipherInstance ci;
+    dgramStats st;
+    int      results[DGR_CNT];
+    char     iv[33];
+    size_t   i,j,cnt,len[DGR_CNT];
+    int      tx,rs;
+
+    if (!quietVerify)
+        {
+        printf("Twofish datagram batch sanity check...");
+        fflush( stdout );
+        }
+
+    if (makeKey(&k,DIR_DECRYPT,KEY_BITS_0,NULL) != TF_SUCCESS)
+        FatalError("makeKey during datagram sanity check","");
+    for (i=0;i<KEY_BITS_0/32;i++)
+        k.key32[i] = Rand();
+    if (reKey(&k) != TF_SUCCESS)
+        FatalError("reKey during datagram sanity check","");
+
+    TwoFishDatagram bad(&k,8,4);
+    TwoFishDatagram dg(&k,DGR_HDR,4);
+    if ((bad.Encrypt(msgs,1) != BAD_PARAMS) || (dg.Encrypt(NULL,1) != BAD_PARAMS))
+        FatalError("Datagram sanity check: bad parameters taken","");
+
+    /* batch of small and big datagrams, one short of a header */
+    cnt = DGR_CNT - ((size_t)testCnt % 8);
+    memset(msgs,0,sizeof(msgs));
+    for (i=0;i<cnt;i++)
+        {
+        len[i] = (i == 5) ? DGR_HDR-1 : (i < 3) ? DGR_HDR+i*16 : DGR_HDR + Rand() % DGR_MAX;
+        for (j=0;j<len[i];j++)
+            plain[i][j] = (uint8_t)Rand();
+        memcpy(plain[i]+4,&i,4);        /* nonce : datagram # and random */
+        memcpy(pkt[i],plain[i],len[i]);
+        iov[i][0].iov_base = pkt[i];
+        if (i & 1)
+            {
+            /* header split over two iovecs, nonce across them */
+            iov[i][0].iov_len  = 7;
+            iov[i][1].iov_base = pkt[i]+7;
+            iov[i][1].iov_len  = len[i]-7;
+            msgs[i].msg_hdr.msg_iovlen = 2;
             }
-    }
-    debug=saveDebug;
+        else
+            {
+            iov[i][0].iov_len = len[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+        msgs[i].msg_hdr.msg_iov = iov[i];
+        }
+    if (dg.Encrypt(msgs,cnt,results) != BAD_INPUT_LEN)
+        FatalError("Datagram sanity check: short datagram taken","");
+    for (i=0;i<cnt;i++)
+        {
+        if (i == 5)
+            {
+            if ((results[i] != BAD_INPUT_LEN) || memcmp(pkt[i],plain[i],len[i]))
+                FatalError("Datagram sanity check: short datagram changed","");
+            continue;
+            }
+        if ((results[i] != TF_SUCCESS) || memcmp(pkt[i],plain[i],DGR_HDR))
+            FatalError("Datagram sanity check: header changed","");
+        for (j=0;j<8;j++)
+            snprintf(&iv[j*2],3,"%02X",plain[i][4+j]);
+        memset(iv+16,'0',16);
+        iv[32] = 0;
+        cipherInit(&ci,MODE_CTR,iv);
+        memcpy(ref,plain[i]+DGR_HDR,len[i]-DGR_HDR);
+        if ((blockEncrypt(&ci,&k,ref,(len[i]-DGR_HDR)*8,ref) < 0) ||
+            memcmp(ref,pkt[i]+DGR_HDR,len[i]-DGR_HDR))
+            FatalError("Datagram sanity check: payload not CTR from nonce","");
+        }
+    dg.GetStats(&st);
+    if ((st.datagrams != cnt-1) || (st.rejected != 1) || (st.batches != 1))
+        FatalError("Datagram sanity check: not one ECB call","");
+
+    /* over loopback : sendmmsg(), recvmmsg(), Decrypt() */
+    tx = socket(AF_INET,SOCK_DGRAM,0);
+    rs = socket(AF_INET,SOCK_DGRAM,0);
+    memset(&addr,0,sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((tx < 0) || (rs < 0) || bind(rs,(struct sockaddr*)&addr,sizeof(addr)) ||
+        getsockname(rs,(struct sockaddr*)&addr,&alen))
+        FatalError("Datagram sanity check: loopback socket","");
+    for (i=0;i<cnt;i++)
+        {
+        msgs[i].msg_hdr.msg_name    = &addr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(addr);
+        }
+    if (sendmmsg(tx,msgs,(unsigned)cnt,0) != (int)cnt)
+        FatalError("Datagram sanity check: sendmmsg","");
+    memset(rmsgs,0,sizeof(rmsgs));
+    for (i=0;i<cnt;i++)
+        {
+        riov[i].iov_base = rx[i];
+        riov[i].iov_len  = (i == 9) ? DGR_HDR+1 : sizeof(rx[i]);
+        rmsgs[i].msg_hdr.msg_iov    = &riov[i];
+        rmsgs[i].msg_hdr.msg_iovlen = 1;
+        }
+    for (i=0;i<cnt;i+=j)
+        {
+        int r = recvmmsg(rs,rmsgs+i,(unsigned)(cnt-i),0,NULL);
+        if (r <= 0)
+            FatalError("Datagram sanity check: recvmmsg","");
+        j = (size_t)r;
+        }
+    if (dg.Decrypt(rmsgs,cnt,results) != BAD_INPUT_LEN)
+        FatalError("Datagram sanity check: cut datagram taken","");
+    for (i=0;i<cnt;i++)
+        {
+        if ((i == 5) || ((i == 9) && (len[9] > DGR_HDR+1)))
+            {
+            if (results[i] != BAD_INPUT_LEN)
+                FatalError("Datagram sanity check: bad datagram deciphered","");
+            continue;
+            }
+        if ((results[i] != TF_SUCCESS) || (rmsgs[i].msg_len != len[i]) ||
+            memcmp(rx[i],plain[i],len[i]))
+            FatalError("Datagram sanity check: loopback miscompare","");
+        }
+    close(tx);
+    close(rs);
+#else
+    (void)testCnt;
+#endif /// of __linux__
+
     if (!quietVerify) printf("  OK\n");
     }
 
@@ -1442,6 +4701,7 @@ void GiveHelp(void)
            "          -s      ==> set initial random seed based on time\n"
            "          -sNN    ==> set initial random seed to NN\n"
            "          -tNN    ==> time performance using NN iterations\n"
+           "          -bNN    ==> time big keying table vs. cache pressure\n"
            "          -v      ==> validate files, don't generate them\n"
            // MAX_ROUNDS
           );
@@ -1551,6 +4811,12 @@ int main(int argc,char *argv[])
                         }
                     break;
                 case '?':
+                case 'B':
+                    if (argList[i][2])
+                        bigTabIterCnt = atoi(argList[i]+2);
+                    else
+                        bigTabIterCnt = 256;
+                    break;
                 case 'H':
                     GiveHelp();
                     break;  
@@ -1611,6 +4877,28 @@ int main(int argc,char *argv[])
     {
         printf( "test count = %u, initializing ... ", testCnt );
         AES_Sanity_Check(testCnt);      /* test API compliance, self-consistency */
+        Lanes_Sanity_Check(testCnt);    /* multi-key lanes vs. single key calls */
+        ReKey_Sanity_Check(testCnt);    /* vector, big table key schedule vs. portable */
+        SBox_Sanity_Check();            /* tables KAT, S-boxes over junk */
+        Lazy_Sanity_Check(testCnt);     /* lazy S-boxes vs. expanded keys */
+        Compact_Sanity_Check(testCnt);  /* compact keys vs. full keys */
+        MakeKeys_Sanity_Check(testCnt); /* batch key setup vs. makeKey */
+        KeyCache_Sanity_Check(testCnt); /* cached key schedules vs. makeKey */
+        KeyArena_Sanity_Check(testCnt); /* arena keys vs. makeKey */
+        KeyBlob_Sanity_Check(testCnt);  /* saved key blobs vs. makeKey */
+        CTR_Sanity_Check(testCnt);      /* counter mode vs. ECB of counters */
+        Engine_Sanity_Check(testCnt);   /* engine jobs vs. direct calls */
+        Batcher_Sanity_Check(testCnt);  /* micro-batches vs. direct calls */
+        KeyHandle_Sanity_Check(testCnt);/* key rotation under readers */
+        Stream_Sanity_Check(testCnt);   /* stream pipeline vs. one call */
+        Uring_Sanity_Check(testCnt);    /* bulk file I/O vs. one call */
+        MapFile_Sanity_Check(testCnt);  /* in-place CTR / XTS vs. plain calls */
+        GCM_Sanity_Check(testCnt);      /* GCM vs. bitwise GHASH reference */
+        Container_Sanity_Check(testCnt);/* chunked container ranges, forgeries */
+        Journal_Sanity_Check(testCnt);  /* journal vs. one CTR call, recovery */
+        Page_Sanity_Check(testCnt);     /* page cache vs. model, XTS slots */
+        Channel_Sanity_Check(testCnt);  /* shared memory ring, two threads */
+        Datagram_Sanity_Check(testCnt); /* mmsghdr batches over loopback */
         printf( "Ok.\n" );
         fflush( stdout );
     }
@@ -1620,6 +4908,12 @@ int main(int argc,char *argv[])
         TimeOps(timeIterCnt);
         exit(0);
     }
+
+    if (bigTabIterCnt)
+    {
+        TimeBigTab(bigTabIterCnt);
+        exit(0);
+    }
         
 
     AES_Test_VK("ecb_vk.txt");          /* Variable key  KAT */
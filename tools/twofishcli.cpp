@@ -0,0 +1,593 @@
+/***************************************************************************
+    twofishcli.cpp
+
+  ------------------------------------------------------------------------
+
+    twofish-cli : streaming file / pipe encryptor on libtwofish.
+
+    (C)2021, Raphael Kim
+
+    Notes:
+        *   Data goes through TwoFishStream, never all in memory : a few
+            chunks are read, ciphered and written at once.  CTR and CBC
+            decryption split chunks over threads, CBC encryption and GCM
+            are serial by nature and only overlap with the I/O.
+        *   Output starts with a header of magic, mode and random IV.  CBC
+            pads PKCS#7 style, GCM takes the header as additional data and
+            ends with its tag.
+        *   GCM decryption writes plain text before the tag is checked, it
+            can't be held back while streaming.  A bad tag removes the
+            output file and fails, stdout can only be told on stderr.
+        *   Tab size is set to 4 characters in this file
+
+***************************************************************************/
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include <chrono>
+#include <random>
+#include <thread>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+#include "tfish.h"
+#include "tfgcm.h"
+#include "tfstream.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define CLI_MAGIC       "TFC1"
+#define CLI_HDRSZ       24              /* magic, mode, 3 zeros, IV */
+#define CLI_MODE_CTR    MODE_CTR
+#define CLI_MODE_CBC    MODE_CBC
+#define CLI_MODE_GCM    0x10
+#define CLI_BENCHSZ     ( 256 * 1024 * 1024 )   /* --bench without input */
+
+#define BLK             ( BLOCK_SIZE/8 )
+
+typedef struct
+{
+    uint8_t     dir;
+    uint8_t     mode;
+    const char* keyFile;
+    const char* inFile;
+    const char* outFile;
+    size_t      threads;
+    size_t      chunk;
+    bool        bench;
+}cliOptions;
+
+// reader over a FILE : PKCS#7 pad appended, or last bytes held back.
+typedef struct
+{
+    FILE*       fp;
+    uint64_t    total;
+    size_t      padLeft;        /* encryption : pad bytes still to give */
+    uint8_t     padByte;
+    bool        pad;
+    bool        eof;
+    size_t      hold;           /* decryption : bytes kept from the end */
+    uint8_t     tail[ BLK ];
+    size_t      tailLen;
+    uint64_t    benchLeft;      /* fp NULL : zeros for --bench */
+}cliReader;
+
+// writer over a FILE, last block held back for its padding.
+typedef struct
+{
+    FILE*       fp;
+    size_t      hold;
+    uint8_t     tail[ BLK ];
+    size_t      tailLen;
+}cliWriter;
+
+typedef struct
+{
+    TwoFishGCM* gcm;
+    uint8_t     dir;
+}cliGCM;
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void usage()
+{
+    fprintf( stderr,
+             "usage : twofish-cli -e|-d -k keyfile [options]\n"
+             "  -e, -d           encrypt, decrypt\n"
+             "  -m ctr|cbc|gcm   mode, default gcm\n"
+             "  -k file          binary key of 16, 24 or 32 bytes\n"
+             "  -i file          input, default stdin\n"
+             "  -o file          output, default stdout\n"
+             "  -t threads       0 for every CPU (default), 1 for none\n"
+             "  -c KB            chunk size, default %u\n"
+             "  --bench          MB/s on stderr, encrypts unless -d ; with no -i,\n"
+             "                   ciphers %u MB of zeros, to -o or nowhere\n",
+             (unsigned)( STREAM_BUFSZ / 1024 ),
+             (unsigned)( CLI_BENCHSZ / ( 1024 * 1024 ) ) );
+}
+
+static bool parseArgs( int argc, char** argv, cliOptions* opt )
+{
+    memset( opt, 0, sizeof( cliOptions ) );
+    opt->dir   = 0xFF;
+    opt->mode  = CLI_MODE_GCM;
+    opt->chunk = STREAM_BUFSZ;
+
+    for ( int cnt=1; cnt<argc; cnt++ )
+    {
+        const char* a   = argv[cnt];
+        const char* val = ( cnt + 1 < argc ) ? argv[cnt+1] : NULL;
+
+        if ( strcmp( a, "-e" ) == 0 )
+            opt->dir = DIR_ENCRYPT;
+        else
+        if ( strcmp( a, "-d" ) == 0 )
+            opt->dir = DIR_DECRYPT;
+        else
+        if ( strcmp( a, "--bench" ) == 0 )
+            opt->bench = true;
+        else
+        if ( ( a[0] == '-' ) && ( a[1] != 0 ) && ( a[2] == 0 ) &&
+             ( strchr( "mkiotc", a[1] ) != NULL ) )
+        {
+            if ( val == NULL )
+                return false;
+            cnt++;
+
+            switch( a[1] )
+            {
+                case 'm':
+                    if ( strcmp( val, "ctr" ) == 0 )
+                        opt->mode = CLI_MODE_CTR;
+                    else
+                    if ( strcmp( val, "cbc" ) == 0 )
+                        opt->mode = CLI_MODE_CBC;
+                    else
+                    if ( strcmp( val, "gcm" ) == 0 )
+                        opt->mode = CLI_MODE_GCM;
+                    else
+                        return false;
+                    break;
+
+                case 'k': opt->keyFile = val; break;
+                case 'i': opt->inFile  = val; break;
+                case 'o': opt->outFile = val; break;
+                case 't': opt->threads = strtoul( val, NULL, 10 ); break;
+                case 'c': opt->chunk   = strtoul( val, NULL, 10 ) * 1024; break;
+            }
+        }
+        else
+            return false;
+    }
+
+    // --bench needs no direction, it encrypts unless told.
+    if ( ( opt->bench == true ) && ( opt->dir == 0xFF ) )
+        opt->dir = DIR_ENCRYPT;
+
+    return ( opt->dir != 0xFF ) && ( opt->keyFile != NULL ) && ( opt->chunk > 0 );
+}
+
+static int loadKey( const char* path, keyInstance* key, uint8_t dir )
+{
+    FILE* fp = fopen( path, "rb" );
+    if ( fp == NULL )
+        return BAD_KEY_MAT;
+
+    uint8_t raw[ MAX_KEY_BITS/8 + 1 ];
+    size_t  len = fread( raw, 1, sizeof( raw ), fp );
+    fclose( fp );
+
+    if ( ( len != 16 ) && ( len != 24 ) && ( len != 32 ) )
+    {
+        memset( raw, 0, sizeof( raw ) );
+        return BAD_KEY_MAT;
+    }
+
+    char hex[ MAX_KEY_SIZE + 1 ] = {0};
+    for ( size_t cnt=0; cnt<len; cnt++ )
+        snprintf( &hex[cnt*2], 3, "%02X", raw[cnt] );
+
+    int reti = makeKey( key, dir, len * 8, hex );
+
+    memset( raw, 0, sizeof( raw ) );
+    memset( hex, 0, sizeof( hex ) );
+
+    return reti;
+}
+
+static void ivHex( const uint8_t* iv, char* hex )
+{
+    for ( size_t cnt=0; cnt<BLK; cnt++ )
+        snprintf( &hex[cnt*2], 3, "%02X", iv[cnt] );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static long cliRead( void* user, uint8_t* buf, size_t len )
+{
+    cliReader* rd = (cliReader*)user;
+    size_t     r  = 0;
+
+    if ( rd->eof == false )
+    {
+        if ( rd->fp == NULL )
+        {
+            r = ( rd->benchLeft < len ) ? (size_t)rd->benchLeft : len;
+            memset( buf, 0, r );
+            rd->benchLeft -= r;
+        }
+        else
+        {
+            r = fread( buf, 1, len, rd->fp );
+            if ( ( r == 0 ) && ( ferror( rd->fp ) != 0 ) )
+                return -1;
+        }
+
+        if ( r == 0 )
+        {
+            rd->eof = true;
+
+            if ( rd->pad == true )
+            {
+                rd->padByte = (uint8_t)( BLK - rd->total % BLK );
+                rd->padLeft = rd->padByte;
+            }
+        }
+    }
+
+    if ( rd->eof == true )
+    {
+        if ( rd->padLeft == 0 )
+            return 0;
+
+        r = ( rd->padLeft < len ) ? rd->padLeft : len;
+        memset( buf, rd->padByte, r );
+        rd->padLeft -= r;
+
+        return (long)r;
+    }
+
+    rd->total += r;
+
+    if ( rd->hold == 0 )
+        return (long)r;
+
+    // stream so far is tail + buf, the last hold bytes of it stay.
+    uint8_t tmp[ BLK * 2 ];
+
+    if ( rd->tailLen + r <= rd->hold )
+    {
+        memcpy( rd->tail + rd->tailLen, buf, r );
+        rd->tailLen += r;
+        return cliRead( user, buf, len );
+    }
+
+    size_t give = rd->tailLen + r - rd->hold;
+
+    if ( r >= rd->hold )
+    {
+        memcpy( tmp, buf + r - rd->hold, rd->hold );
+        memmove( buf + rd->tailLen, buf, r - rd->hold );
+        memcpy( buf, rd->tail, rd->tailLen );
+        memcpy( rd->tail, tmp, rd->hold );
+    }
+    else
+    {
+        memcpy( tmp, rd->tail, rd->tailLen );
+        memcpy( tmp + rd->tailLen, buf, r );
+        memcpy( buf, tmp, give );
+        memcpy( rd->tail, tmp + give, rd->hold );
+    }
+
+    rd->tailLen = rd->hold;
+
+    return (long)give;
+}
+
+static long cliWrite( void* user, const uint8_t* buf, size_t len )
+{
+    cliWriter* wr = (cliWriter*)user;
+
+    if ( wr->fp == NULL )
+        return (long)len;
+
+    if ( wr->hold == 0 )
+        return (long)fwrite( buf, 1, len, wr->fp );
+
+    if ( wr->tailLen + len <= wr->hold )
+    {
+        memcpy( wr->tail + wr->tailLen, buf, len );
+        wr->tailLen += len;
+        return (long)len;
+    }
+
+    // write all but the last hold bytes of tail + buf.
+    size_t out   = wr->tailLen + len - wr->hold;
+    size_t fromT = ( out < wr->tailLen ) ? out : wr->tailLen;
+
+    if ( fwrite( wr->tail, 1, fromT, wr->fp ) != fromT )
+        return -1;
+    if ( ( out > fromT ) &&
+         ( fwrite( buf, 1, out - fromT, wr->fp ) != out - fromT ) )
+        return -1;
+
+    uint8_t tmp[ BLK * 2 ];
+    size_t  keep = wr->tailLen - fromT;
+
+    memcpy( tmp, wr->tail + fromT, keep );
+    memcpy( tmp + keep, buf + ( out - fromT ), wr->hold - keep );
+    memcpy( wr->tail, tmp, wr->hold );
+    wr->tailLen = wr->hold;
+
+    return (long)len;
+}
+
+static long cliGCMCipher( void* user, uint8_t* buf, size_t len, bool )
+{
+    cliGCM* g = (cliGCM*)user;
+
+    int reti = g->gcm->Update( g->dir, buf, len, buf );
+
+    return ( reti == TF_SUCCESS ) ? (long)len : reti;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int cliRun( const cliOptions* opt, FILE* in, FILE* out )
+{
+    bool    gcmMode = ( opt->mode == CLI_MODE_GCM );
+    bool    zeros   = ( in == NULL );   /* --bench input, not our data */
+    uint8_t keyDir  = ( ( opt->mode == CLI_MODE_CBC ) && ( opt->dir == DIR_DECRYPT ) )
+                      ? (uint8_t)DIR_DECRYPT : (uint8_t)DIR_ENCRYPT;
+
+    static keyInstance key;
+
+    int reti = loadKey( opt->keyFile, &key, keyDir );
+    if ( reti != TF_SUCCESS )
+    {
+        fprintf( stderr, "twofish-cli : key file %s not a 16, 24 or 32 byte key\n",
+                 opt->keyFile );
+        return reti;
+    }
+
+    uint8_t hdr[ CLI_HDRSZ ] = {0};
+
+    if ( zeros == true )
+    {
+        memcpy( hdr, CLI_MAGIC, 4 );
+        hdr[4] = opt->mode;
+
+        if ( ( opt->dir == DIR_ENCRYPT ) && ( out != NULL ) &&
+             ( fwrite( hdr, 1, CLI_HDRSZ, out ) != CLI_HDRSZ ) )
+            return STREAM_IO_FAIL;
+    }
+    else
+    if ( opt->dir == DIR_ENCRYPT )
+    {
+        std::random_device rnd;
+
+        memcpy( hdr, CLI_MAGIC, 4 );
+        hdr[4] = opt->mode;
+        for ( size_t cnt=8; cnt<CLI_HDRSZ; cnt+=4 )
+        {
+            uint32_t r = rnd();
+            memcpy( hdr + cnt, &r, 4 );
+        }
+        if ( gcmMode == true )
+            memset( hdr + 8 + GCM_IV_SIZE, 0, BLK - GCM_IV_SIZE );
+
+        if ( ( out != NULL ) && ( fwrite( hdr, 1, CLI_HDRSZ, out ) != CLI_HDRSZ ) )
+            return STREAM_IO_FAIL;
+    }
+    else
+    {
+        if ( ( fread( hdr, 1, CLI_HDRSZ, in ) != CLI_HDRSZ ) ||
+             ( memcmp( hdr, CLI_MAGIC, 4 ) != 0 ) || ( hdr[4] != opt->mode ) )
+        {
+            fprintf( stderr, "twofish-cli : input is not %s data of twofish-cli\n",
+                     ( opt->mode == CLI_MODE_GCM ) ? "gcm" :
+                     ( opt->mode == CLI_MODE_CBC ) ? "cbc" : "ctr" );
+            return BAD_PARAMS;
+        }
+    }
+
+    cliReader rd;
+    cliWriter wr;
+
+    memset( &rd, 0, sizeof( rd ) );
+    memset( &wr, 0, sizeof( wr ) );
+
+    rd.fp        = in;
+    rd.benchLeft = CLI_BENCHSZ;
+    rd.pad       = ( opt->mode == CLI_MODE_CBC ) && ( opt->dir == DIR_ENCRYPT );
+    rd.hold      = ( gcmMode && ( opt->dir == DIR_DECRYPT ) ) ? GCM_TAG_SIZE : 0;
+    wr.fp        = out;
+    wr.hold      = ( ( opt->mode == CLI_MODE_CBC ) && ( opt->dir == DIR_DECRYPT ) ) ? BLK : 0;
+
+    // zeros deciphered have no tag or pad to check.
+    if ( zeros == true )
+    {
+        rd.hold = 0;
+        wr.hold = 0;
+    }
+
+    TwoFishStream stream( opt->chunk );
+    stream.SetParallel( opt->threads );
+
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+
+    if ( gcmMode == true )
+    {
+        TwoFishGCM gcm( &key );
+        cliGCM     g  = { &gcm, opt->dir };
+
+        reti = gcm.Start( hdr + 8, GCM_IV_SIZE, hdr, 8 );
+        if ( reti == TF_SUCCESS )
+            reti = stream.Run( cliGCMCipher, &g, cliRead, &rd, cliWrite, &wr );
+
+        if ( reti == TF_SUCCESS )
+        {
+            if ( opt->dir == DIR_ENCRYPT )
+            {
+                uint8_t tag[ GCM_TAG_SIZE ];
+
+                reti = gcm.Finish( tag );
+                if ( ( reti == TF_SUCCESS ) && ( out != NULL ) &&
+                     ( fwrite( tag, 1, GCM_TAG_SIZE, out ) != GCM_TAG_SIZE ) )
+                    reti = STREAM_IO_FAIL;
+            }
+            else
+            if ( zeros == true )
+                reti = TF_SUCCESS;
+            else
+            if ( rd.tailLen != GCM_TAG_SIZE )
+                reti = BAD_INPUT_LEN;
+            else
+                reti = gcm.Verify( rd.tail );
+        }
+    }
+    else
+    {
+        cipherInstance ci;
+        char           iv[ BLK*2 + 1 ] = {0};
+
+        ivHex( hdr + 8, iv );
+        cipherInit( &ci, opt->mode, iv );
+
+        reti = stream.Run( &key, &ci, opt->dir, cliRead, &rd, cliWrite, &wr );
+
+        // last block of CBC plain text carries the pad length.
+        if ( ( reti == TF_SUCCESS ) && ( wr.hold > 0 ) )
+        {
+            uint8_t p = wr.tail[ BLK - 1 ];
+
+            if ( ( wr.tailLen != BLK ) || ( p == 0 ) || ( p > BLK ) )
+                reti = BAD_INPUT_LEN;
+
+            for ( size_t cnt=BLK-p; ( reti == TF_SUCCESS ) && ( cnt<BLK ); cnt++ )
+                if ( wr.tail[cnt] != p )
+                    reti = BAD_INPUT_LEN;
+
+            if ( ( reti == TF_SUCCESS ) &&
+                 ( fwrite( wr.tail, 1, BLK - p, out ) != (size_t)( BLK - p ) ) )
+                reti = STREAM_IO_FAIL;
+        }
+    }
+
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now() - t0;
+
+    memset( &key, 0, sizeof( key ) );
+
+    if ( ( reti == TF_SUCCESS ) && ( opt->bench == true ) )
+    {
+        streamStats st;
+        stream.GetStats( &st );
+
+        double mb = (double)st.bytesIn / ( 1024.0 * 1024.0 );
+        size_t tc = ( opt->threads > 0 ) ? opt->threads
+                                         : std::thread::hardware_concurrency();
+        fprintf( stderr, "twofish-cli : %.1f MB in %.3f s, %.1f MB/s "
+                         "(%u threads, %u KB chunks)\n",
+                 mb, secs.count(),
+                 ( secs.count() > 0 ) ? mb / secs.count() : 0.0,
+                 (unsigned)tc, (unsigned)( stream.GetBufferSize() / 1024 ) );
+    }
+
+    switch( reti )
+    {
+        case TF_SUCCESS:
+            break;
+
+        case BAD_GCM_TAG:
+            fprintf( stderr, "twofish-cli : authentication failed, "
+                             "data was changed or key is wrong\n" );
+            break;
+
+        case BAD_INPUT_LEN:
+            fprintf( stderr, "twofish-cli : input truncated or key is wrong\n" );
+            break;
+
+        default:
+            fprintf( stderr, "twofish-cli : failed, error %d\n", reti );
+            break;
+    }
+
+    return reti;
+}
+
+int main( int argc, char** argv )
+{
+    cliOptions opt;
+
+    if ( parseArgs( argc, argv, &opt ) == false )
+    {
+        usage();
+        return 1;
+    }
+
+#ifdef _WIN32
+    _setmode( _fileno( stdin ), _O_BINARY );
+    _setmode( _fileno( stdout ), _O_BINARY );
+#endif
+
+    // --bench with no -i reads zeros, and with no -o writes nowhere.
+    FILE* in  = stdin;
+    FILE* out = stdout;
+
+    if ( ( opt.bench == true ) && ( opt.inFile == NULL ) )
+    {
+        in = NULL;
+        if ( opt.outFile == NULL )
+            out = NULL;
+    }
+
+    if ( opt.inFile != NULL )
+    {
+        in = fopen( opt.inFile, "rb" );
+        if ( in == NULL )
+        {
+            fprintf( stderr, "twofish-cli : can't open %s\n", opt.inFile );
+            return 2;
+        }
+    }
+
+    if ( opt.outFile != NULL )
+    {
+        out = fopen( opt.outFile, "wb" );
+        if ( out == NULL )
+        {
+            fprintf( stderr, "twofish-cli : can't create %s\n", opt.outFile );
+            if ( opt.inFile != NULL )
+                fclose( in );
+            return 2;
+        }
+    }
+
+    int reti = cliRun( &opt, in, out );
+
+    if ( ( out != NULL ) && ( fflush( out ) != 0 ) && ( reti == TF_SUCCESS ) )
+    {
+        fprintf( stderr, "twofish-cli : write failed\n" );
+        reti = STREAM_IO_FAIL;
+    }
+
+    if ( opt.inFile != NULL )
+        fclose( in );
+
+    if ( opt.outFile != NULL )
+    {
+        fclose( out );
+
+        // partial or forged plain text isn't left behind.
+        if ( reti != TF_SUCCESS )
+            remove( opt.outFile );
+    }
+
+    return ( reti == TF_SUCCESS ) ? 0 : 2;
+}